@@ -79,6 +79,9 @@
 		
 	userDefaults = [NSUserDefaults standardUserDefaults];
 	
+	// 0 decodes bitmap updates on one thread per CPU, 1 keeps decoding on each session's connection thread
+	workpool_init([userDefaults integerForKey:CRDBitmapDecodeThreads]);
+	
 	connectedServers = [[NSMutableArray alloc] init];
 	savedServers = [[NSMutableArray alloc] init];
 	filteredServers = [[NSMutableArray alloc] init];
@@ -28,6 +28,7 @@
 }
 
 - (id)initWithBitmapData:(const unsigned char *)d size:(NSSize)s view:(CRDSessionView *)v;
+- (id)initWithARGBData:(unsigned char *)argb size:(NSSize)s;
 - (id)initWithGlyphData:(const unsigned char *)d size:(NSSize)s view:(CRDSessionView *)v;
 - (id)initWithCursorData:(const unsigned char *)d alpha:(const unsigned char *)a size:(NSSize)s hotspot:(NSPoint)hotspot view:(CRDSessionView *)v bpp:(int)bpp;
 - (id)initWithImage:(NSImage *)img;
@@ -38,6 +39,7 @@
 - (void)overlayColor:(NSColor *)c;
 
 - (NSImage *)image;
+- (const unsigned char *)argbData;
 - (void)setColor:(NSColor *)color;
 - (NSColor *)color;
 - (NSCursor *)cursor;
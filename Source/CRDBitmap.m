@@ -33,84 +33,24 @@
 // Currently is adequately optimized: only somewhat critical
 - (id)initWithBitmapData:(const unsigned char *)sourceBitmap size:(NSSize)s view:(CRDSessionView *)v
 {
-	if (![super init])
-		return nil;
-
-	int bitsPerPixel = [v bitsPerPixel],  bytesPerPixel = (bitsPerPixel + 7) / 8;
-	
-	uint8 *outputBitmap, *nc;
-	const uint8 *p, *end;
-	unsigned realLength, newLength;
-	unsigned int *colorMap;
+	int bitsPerPixel = [v bitsPerPixel], bytesPerPixel = (bitsPerPixel + 7) / 8;
 	int width = (int)s.width, height = (int)s.height;
 	
-	realLength = width * height * bytesPerPixel;
-	newLength = width * height * 4;
-	
-	p = sourceBitmap;
-	end = p + realLength;
+	uint8 *outputBitmap = malloc(width * height * 4);
+	bitmap_convert_argb(outputBitmap, 0, sourceBitmap, width * bytesPerPixel, width, height, bitsPerPixel, [v colorMap]);
 	
-	nc = outputBitmap = malloc(newLength);
-	
-	if (bitsPerPixel == 8)
-	{
-		colorMap = [v colorMap];
-		while (p < end)
-		{
-			nc[0] = 255;
-			nc[1] = colorMap[*p] & 0xff;
-			nc[2] = (colorMap[*p] >> 8) & 0xff;
-			nc[3] = (colorMap[*p] >> 16) & 0xff;
-			
-			p++;
-			nc += 4;
-		}
-	}
-	else if (bitsPerPixel == 16)
-	{
-		while (p < end)
-		{
-			unsigned short c = p[0] | (p[1] << 8);
+	return [self initWithARGBData:outputBitmap size:s];
+}
 
-			nc[0] = 255;
-			nc[1] = (( (c >> 11) & 0x1f) * 255 + 15) / 31;
-			nc[2] = (( (c >> 5) & 0x3f) * 255 + 31) / 63;
-			nc[3] = ((c & 0x1f) * 255 + 15) / 31;
-			
-			p += bytesPerPixel;
-			nc += 4;
-		}
-	}
-	else if (bitsPerPixel == 15)
-	{
-		while (p < end)
-		{
-			unsigned short c = p[0] | (p[1] << 8);
+// Takes ownership of a malloc'd ARGB8888 buffer, such as one filled by bitmap_decompress_argb
+- (id)initWithARGBData:(unsigned char *)argb size:(NSSize)s
+{
+	if (![super init])
+		return nil;
 
-			nc[0] = 255;
-			nc[1] = (( (c >> 10) & 0x1f) * 255 + 15) / 31;
-			nc[2] = (( (c >> 5) & 0x1f) * 255 + 15) / 31;
-			nc[3] = ((c & 0x1f) * 255 + 15) / 31;
-			
-			p += bytesPerPixel;
-			nc += 4;
-		}
-	}
-	else if (bitsPerPixel == 24 || bitsPerPixel == 32)
-	{
-		while (p < end)
-		{
-			nc[0] = 255;
-			nc[1] = p[2];
-			nc[2] = p[1];
-			nc[3] = p[0];
-			
-			p += bytesPerPixel;
-			nc += 4;
-		}
-	}
+	int width = (int)s.width, height = (int)s.height;
 	
-	data = [[NSData alloc] initWithBytesNoCopy:(void *)outputBitmap length:newLength];
+	data = [[NSData alloc] initWithBytesNoCopy:(void *)argb length:width * height * 4];
 	
 	unsigned char *planes[2] = {(unsigned char *)[data bytes], NULL};
 	
@@ -382,6 +322,14 @@
 	return image;
 }
 
+// The ARGB8888 pixels of a bitmap, top row first; NULL for glyphs, cursors and images
+-(const unsigned char *)argbData
+{
+	if (data == nil || [data length] != [image size].width * [image size].height * 4)
+		return NULL;
+	return [data bytes];
+}
+
 -(void)dealloc
 {
 	[cursor release];
@@ -88,6 +88,12 @@ void ui_set_colourmap(RDConnectionRef conn, RDColorMapRef map)
 	[v setColorMap:(unsigned int *)map];
 }
 
+RDColorMapRef ui_get_colourmap(RDConnectionRef conn)
+{
+	LOCALS_FROM_CONN;
+	return [v colorMap];
+}
+
 
 #pragma mark -
 #pragma mark Bitmap
@@ -100,53 +106,74 @@ RDBitmapRef ui_create_bitmap(RDConnectionRef conn, int width, int height, uint8
 void ui_paint_bitmap(RDConnectionRef conn, int x, int y, int cx, int cy, int width, int height, uint8 * data)
 {
 	CRDBitmap *bitmap = [[CRDBitmap alloc] initWithBitmapData:data size:NSMakeSize(width, height) view:conn->ui];
-	ui_memblt(conn, 0, x, y, cx, cy, bitmap, 0, 0);
+	ui_memblt(conn, 12, x, y, cx, cy, bitmap, 0, 0);
+	[bitmap release];
+}
+
+// The _argb variants take ownership of an already converted (malloc'd) ARGB8888 buffer
+RDBitmapRef ui_create_bitmap_argb(RDConnectionRef conn, int width, int height, uint8 *argb)
+{
+	return [[CRDBitmap alloc] initWithARGBData:argb size:NSMakeSize(width, height)];
+}
+
+void ui_paint_bitmap_argb(RDConnectionRef conn, int x, int y, int cx, int cy, int width, int height, uint8 *argb)
+{
+	CRDBitmap *bitmap = [[CRDBitmap alloc] initWithARGBData:argb size:NSMakeSize(width, height)];
+	ui_memblt(conn, 12, x, y, cx, cy, bitmap, 0, 0);
 	[bitmap release];
 }
 
+// Clips a blit to the surface and the bitmap and converts only the pixels it reads, cx a row, into native endian ARGB words as the backing store holds them, in a buffer the connection reuses; NULL if nothing is read
+static uint32 *native_bitmap_pixels(RDConnectionRef conn, CRDBitmap *bmp, const RDRopSurface *surface,
+									int *x, int *y, int *cx, int *cy, int srcx, int srcy)
+{
+	const uint8 *argb = [bmp argbData], *p;
+	uint32 *pixels;
+	int width, height, row, i;
+	
+	if (argb == NULL)
+		return NULL;
+	
+	width = [[bmp image] size].width;
+	height = [[bmp image] size].height;
+	if (!rop_clip_blit(surface, x, y, cx, cy, &srcx, &srcy, width, height))
+		return NULL;
+	
+	if (*cx * *cy > conn->ropSourceSize)
+	{
+		conn->ropSource = (uint32 *)xrealloc(conn->ropSource, *cx * *cy * 4);
+		conn->ropSourceSize = *cx * *cy;
+	}
+	
+	pixels = conn->ropSource;
+	for (row = 0; row < *cy; row++)
+	{
+		p = argb + ((srcy + row) * width + srcx) * 4;
+		for (i = 0; i < *cx; i++, p += 4)
+			*pixels++ = ((uint32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	}
+	return conn->ropSource;
+}
+
 void ui_memblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBitmapRef src, int srcx, int srcy)
 {
 	LOCALS_FROM_CONN;
 	
 	CRDBitmap *bmp = (CRDBitmap *)src;
 	NSRect r = NSMakeRect(x, y, cx, cy);
-	NSPoint p = NSMakePoint(srcx, srcy);
-	NSCompositingOperation compositingOp;
-	switch (opcode)
+	RDRopSurface surface;
+	uint32 *pixels;
+	
+	if (opcode == 12)
 	{
-		case 0:
-		case 12:
-			compositingOp = NSCompositeCopy;
-			break;
-
-		case 6:
-			compositingOp = NSCompositePlusLighter;
-			break;
-
-		case 8: // AND
-			compositingOp = NSCompositePlusDarker;
-			break;
-
-		case 14: // OR
-			compositingOp = NSCompositePlusLighter;
-			break;
-
-		case 2: //Inverted AND
-			bmp = [bmp invert];
-			compositingOp = NSCompositePlusDarker;
-			break;
-
-		case 11: // Inverted OR
-			bmp = [bmp invert];
-			compositingOp = NSCompositePlusLighter;
-			break;
-
-		default:
-			CHECKOPCODE(opcode);
-			compositingOp = NSCompositeCopy;
+		[v drawBitmap:bmp inRect:r from:NSMakePoint(srcx, srcy) operation:NSCompositeCopy];
+	}
+	else
+	{
+		[v getRopSurface:&surface];
+		if ((pixels = native_bitmap_pixels(conn, bmp, &surface, &x, &y, &cx, &cy, srcx, srcy)) != NULL)
+			rop_blit(&surface, opcode, x, y, cx, cy, (uint8 *)pixels, cx * 4, cx, cy, 0, 0);
 	}
-	
-	[v drawBitmap:bmp inRect:r from:p operation:compositingOp];
 
 	schedule_display_in_rect(conn, r);
 }
@@ -157,6 +184,28 @@ void ui_destroy_bitmap(RDBitmapRef bmp)
 	[image release];
 }
 
+// Roughly what a bitmap, glyph or cursor holds in memory, for the cache budget
+int ui_bitmap_bytes(RDBitmapRef bmp)
+{
+	if (bmp == nil)
+		return 0;
+	
+	NSSize size = [[(CRDBitmap *)bmp image] size];
+	return (int)(size.width * size.height * 4);
+}
+
+// Expands an 8x8 colour brush into native endian ARGB words, as the backing store holds them
+void ui_convert_brush(RDConnectionRef conn, RDBrushData *bd, uint32 *pixels)
+{
+	LOCALS_FROM_CONN;
+	uint8 argb[8 * 8 * 4], *p;
+	int i;
+	
+	bitmap_convert_argb(argb, 0, bd->data, 8 * (bd->colour_code - 2), 8, 8, conn->serverBpp, [v colorMap]);
+	for (i = 0, p = argb; i < 64; i++, p += 4)
+		pixels[i] = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
 
 #pragma mark -
 #pragma mark Desktop Cache
@@ -401,36 +450,22 @@ void ui_line(RDConnectionRef conn, uint8 opcode, int startx, int starty, int end
 void ui_screenblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, int srcx, int srcy)
 {
 	LOCALS_FROM_CONN;
-	NSRect src = NSMakeRect(srcx, srcy, cx, cy);
-	NSPoint dest = NSMakePoint(x, y);
+	RDRopSurface surface;
 	
-	CHECKOPCODE(opcode);
-	[v screenBlit:src to:dest];
+	[v getRopSurface:&surface];
+	rop_screenblt(&surface, opcode, x, y, cx, cy, srcx, srcy);
 	schedule_display_in_rect(conn, NSMakeRect(x, y, cx, cy));
 }
 
 void ui_destblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy)
 {
 	LOCALS_FROM_CONN;
-	NSRect r = NSMakeRect(x, y, cx, cy);
-	/* XXX */
-	switch (opcode)
-	{
-		case 0:
-			[v fillRect:r withColor:[NSColor blackColor]];
-			break;
-		case 5:
-			[v swapRect:r];
-			break;
-		case 15:
-			[v fillRect:r withColor:[NSColor whiteColor]];
-			break;
-		default:
-			CHECKOPCODE(opcode);
-			break;
-	}
+	RDRopSurface surface;
 	
-	schedule_display_in_rect(conn, r);
+	// destination-only opcodes ignore the source
+	[v getRopSurface:&surface];
+	rop_fill(&surface, opcode, x, y, cx, cy, 0);
+	schedule_display_in_rect(conn, NSMakeRect(x, y, cx, cy));
 }
 
 void ui_polyline(RDConnectionRef conn, uint8 opcode, RDPoint* points, int npoints, RDPen *pen)
@@ -564,110 +599,30 @@ void ui_polygon(RDConnectionRef conn, uint8 opcode, uint8 fillmode, RDPoint* poi
 	schedule_display(conn);
 }
 
-/* XXX Still needs origins */
 void ui_patblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBrush * brush, int bgcolor, int fgcolor)
 {
 	LOCALS_FROM_CONN;
 	NSRect dest = NSMakeRect(x, y, cx, cy);
-	NSRect glyphSize;
-	CRDBitmap *bitmap;
-	NSImage *fill;
-	NSColor *fillColor;
-	uint8 i, ipattern[8];
-	
-	if (opcode == 6)
-	{
-		[v swapRect:dest];
-		schedule_display_in_rect(conn, dest);
-		return;
-	}
-	
-	CHECKOPCODE(opcode);
+	RDRopSurface surface;
+	const uint32 *tile;
 	
 	switch (brush->style)
 	{
 		case 0: /* Solid */
-			[v fillRect:dest withColor:[v nscolorForRDCColor:fgcolor]];
-			schedule_display_in_rect(conn, dest);
+			if (opcode == 12)
+			{
+				[v fillRect:dest withColor:[v nscolorForRDCColor:fgcolor]];
+				break;
+			}
+			[v getRopSurface:&surface];
+			rop_fill(&surface, opcode, x, y, cx, cy, [v pixelForRDCColor:fgcolor]);
 			break;
 			
 		case 2: /* Hatch */
-
-			glyphSize = NSMakeRect(0, 0, 8, 8);
-            bitmap = ui_create_glyph(conn, 8, 8, hatch_patterns + brush->pattern[0] * 8);
-			fill = [bitmap image];
-			[fill lockFocus];
-			
-			[[NSGraphicsContext currentContext] setCompositingOperation:NSCompositeSourceAtop];
-			[[v nscolorForRDCColor:fgcolor] set];
-			[NSBezierPath fillRect:glyphSize];
-			
-			[[NSGraphicsContext currentContext] setCompositingOperation:NSCompositeDestinationAtop];
-			[[v nscolorForRDCColor:bgcolor] set];
-			[NSBezierPath fillRect:glyphSize];
-			
-			[fill unlockFocus];
-			
-			fillColor = [NSColor colorWithPatternImage:fill];
-			[v fillRect:dest withColor:fillColor patternOrigin:NSMakePoint(brush->xorigin, brush->yorigin)];
-            ui_destroy_glyph(bitmap);
-            break;
-			
 		case 3: /* Pattern */
-			if (brush->bd == 0)	/* rdp4 brush */
-			{
-				for (i = 0; i != 8; i++)
-					ipattern[7 - i] = brush->pattern[i];
-				
-				glyphSize = NSMakeRect(0, 0, 8, 8);
-				bitmap = ui_create_glyph(conn, 8, 8, ipattern);
-				fill = [bitmap image];
-				[fill lockFocus];
-				
-				[[NSGraphicsContext currentContext] setCompositingOperation:NSCompositeSourceAtop];
-				[[v nscolorForRDCColor:bgcolor] set];
-				[NSBezierPath fillRect:glyphSize];
-				
-				[[NSGraphicsContext currentContext] setCompositingOperation:NSCompositeDestinationAtop];
-				[[v nscolorForRDCColor:fgcolor] set];
-				[NSBezierPath fillRect:glyphSize];
-				
-				[fill unlockFocus];
-				
-				fillColor = [NSColor colorWithPatternImage:fill];
-				[v fillRect:dest withColor:fillColor patternOrigin:NSMakePoint(brush->xorigin, brush->yorigin)];
-				ui_destroy_glyph(bitmap);
-			}
-			else if (brush->bd->colour_code > 1)	/* > 1 bpp */
-			{
-				bitmap = ui_create_glyph(conn, 8, 8, brush->bd->data);
-				fill = [bitmap image];
-				
-				fillColor = [NSColor colorWithPatternImage:fill];
-				[v fillRect:dest withColor:fillColor patternOrigin:NSMakePoint(brush->xorigin, brush->yorigin)];
-				ui_destroy_glyph(bitmap);
-			}
-			else
-			{
-				glyphSize = NSMakeRect(0, 0, 8, 8);
-				bitmap = ui_create_glyph(conn, 8, 8, brush->bd->data);
-				fill = [bitmap image];
-				[fill lockFocus];
-				
-				[[NSGraphicsContext currentContext] setCompositingOperation:NSCompositeSourceAtop];
-				[[v nscolorForRDCColor:bgcolor] set];
-				[NSBezierPath fillRect:glyphSize];
-				
-				[[NSGraphicsContext currentContext] setCompositingOperation:NSCompositeDestinationAtop];
-				[[v nscolorForRDCColor:fgcolor] set];
-				[NSBezierPath fillRect:glyphSize];
-				
-				[fill unlockFocus];
-				
-				fillColor = [NSColor colorWithPatternImage:fill];
-				[v fillRect:dest withColor:fillColor patternOrigin:NSMakePoint(brush->xorigin, brush->yorigin)];
-				ui_destroy_glyph(bitmap);
-			}
+			tile = brush_tile_get(conn, brush, [v pixelForRDCColor:fgcolor], [v pixelForRDCColor:bgcolor]);
+			[v getRopSurface:&surface];
+			rop_pattern(&surface, opcode, x, y, cx, cy, tile, brush->xorigin, brush->yorigin);
 			break;
 			
 		default:
@@ -677,13 +632,35 @@ void ui_patblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy,
 	schedule_display_in_rect(conn, dest);
 }
 
-void ui_triblt(uint8 opcode, 
-			   int x, int y, int cx, int cy,
-			   RDBitmapRef src, int srcx, int srcy,
+// opcode is a full ROP3 here, over the brush, the bitmap and the screen
+void ui_triblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBitmapRef src, int srcx, int srcy,
 			   RDBrush *brush, int bgcolour, int fgcolour)
 {
-	CHECKOPCODE(opcode);
-	UNIMPL;
+	LOCALS_FROM_CONN;
+	RDRopSurface surface;
+	const uint32 *tile = NULL;
+	uint32 solid[64], *pixels;
+	int i, style = (brush != NULL) ? brush->style : 0;
+	
+	if (style == 0)
+	{
+		for (i = 0; i < 64; i++)
+			solid[i] = [v pixelForRDCColor:fgcolour];
+		tile = solid;
+	}
+	else if ((tile = brush_tile_get(conn, brush, [v pixelForRDCColor:fgcolour], [v pixelForRDCColor:bgcolour])) == NULL)
+	{
+		unimpl("brush %d\n", style);
+		return;
+	}
+	
+	[v getRopSurface:&surface];
+	if ((pixels = native_bitmap_pixels(conn, (CRDBitmap *)src, &surface, &x, &y, &cx, &cy, srcx, srcy)) == NULL)
+		return;
+	
+	rop_triblt(&surface, opcode, x, y, cx, cy, (uint8 *)pixels, cx * 4, cx, cy, 0, 0, tile,
+			   (brush != NULL) ? brush->xorigin : 0, (brush != NULL) ? brush->yorigin : 0);
+	schedule_display_in_rect(conn, NSMakeRect(x, y, cx, cy));
 }
 
 void ui_ellipse(RDConnectionRef conn, uint8 opcode, uint8 fillmode, int x, int y, int cx, int cy,
@@ -808,56 +785,13 @@ void ui_destroy_glyph(RDGlyphRef glyph)
 	[glyph release];
 }
 
-void ui_drawglyph(RDConnectionRef conn, int x, int y, int w, int h, CRDBitmap *glyph, NSColor *fgcolor, NSColor *bgcolor);
-
-void ui_drawglyph(RDConnectionRef conn, int x, int y, int w, int h, CRDBitmap *glyph, NSColor *fgcolor, NSColor *bgcolor)
-{
-	LOCALS_FROM_CONN;
-	[v drawGlyph:glyph at:NSMakeRect(x, y, w, h) foregroundColor:fgcolor];
-}
-
-#define DO_GLYPH(ttext,idx) \
-{\
-	glyph = cache_get_font (conn, font, ttext[idx]);\
-	if (!(flags & TEXT2_IMPLICIT_X))\
-	{\
-		xyoffset = ttext[++idx];\
-		if ((xyoffset & 0x80))\
-		{\
-			if (flags & TEXT2_VERTICAL)\
-				y += ttext[idx+1] | (ttext[idx+2] << 8);\
-			else\
-				x += ttext[idx+1] | (ttext[idx+2] << 8);\
-			idx += 2;\
-		}\
-		else\
-		{\
-			if (flags & TEXT2_VERTICAL)\
-				y += xyoffset;\
-			else\
-				x += xyoffset;\
-		}\
-	}\
-	if (glyph != NULL)\
-	{\
-		x1 = x + glyph->offset;\
-		y1 = y + glyph->baseline;\
-		ui_drawglyph(conn, x1, y1, glyph->width, glyph->height, glyph->pixmap, foregroundColor, backgroundColor); \
-		if (flags & TEXT2_IMPLICIT_X)\
-			x += glyph->width;\
-	}\
-}
-
 void ui_draw_text(RDConnectionRef conn, uint8 font, uint8 flags, uint8 opcode, int mixmode, int x, int y, int clipx, int clipy,
 				  int clipcx, int clipcy, int boxx, int boxy, int boxcx, int boxcy, RDBrush * brush, int bgcolour,
 				  int fgcolour, uint8 * text, uint8 length)
 {
 	LOCALS_FROM_CONN;
-	int i = 0, j, xyoffset, x1, y1;
-	RDFontGlyph *glyph;
-	RDDataBlob *entry;
+	RDGlyphMask mask;
 	NSRect box;
-	NSColor *foregroundColor = [v nscolorForRDCColor:fgcolour], *backgroundColor = [v nscolorForRDCColor:bgcolour];
 	
 	CHECKOPCODE(opcode);
 	
@@ -868,64 +802,11 @@ void ui_draw_text(RDConnectionRef conn, uint8 font, uint8 flags, uint8 opcode, i
 	box = (boxcx > 1) ? NSMakeRect(boxx, boxy, boxcx, boxcy) : NSMakeRect(clipx, clipy, clipcx, clipcy);
 	
 	if (boxcx > 1 || mixmode == MIX_OPAQUE)
-		[v fillRect:box withColor:backgroundColor];
-	
-	[v startUpdate];
-	
-	// Paint text character by character
-	for (i = 0; i < length;)
-	{                       
-		switch (text[i])
-		{           
-			case 0xff:  
-				if (i + 2 < length)
-				{
-					cache_put_text(conn, text[i + 1], text, text[i + 2]);
-				} 
-				else
-				{
-					error("this shouldn't be happening\n");
-					exit(1);
-				} 
-				
-				// After FF command, move pointer to first character 
-
-				length -= i + 3;
-				text = &(text[i + 3]);
-				i = 0;
-				break;
-
-			case 0xfe:
-				entry = cache_get_text(conn, text[i + 1]);
-				if (entry != NULL)
-				{
-					if ((((uint8 *) (entry->data))[1] == 0) && (!(flags & TEXT2_IMPLICIT_X)))
-					{
-						if (flags & TEXT2_VERTICAL)
-							y += text[i + 2];
-						else
-							x += text[i + 2]; 
-					}
-					
-					for (j = 0; j < entry->size; j++)
-						DO_GLYPH(((uint8 *) (entry->data)), j);
-				} 
-
-				i += (i + 2 < length) ? 3 : 2;
-				length -= i;
-				// After FE command, move pointer to first character
-				text = &(text[i]);
-				i = 0;
-				break;
-
-			default:
-				DO_GLYPH(text, i);
-				i++;
-				break;
-		}
-	}  
+		[v fillRect:box withColor:[v nscolorForRDCColor:bgcolour]];
 	
-	[v stopUpdate];
+	// Resolve, clip and rasterize the whole run, then paint it at once
+	if (text_run_rasterize(conn, font, flags, x, y, clipx, clipy, clipcx, clipcy, boxx, boxy, boxcx, boxcy, text, length, &mask))
+		[v drawGlyphMask:mask.pixels inRect:NSMakeRect(mask.x, mask.y, mask.width, mask.height) withRDColor:fgcolour];
 	schedule_display_in_rect(conn, box);
 }
 
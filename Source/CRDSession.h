@@ -24,7 +24,7 @@
 @class CRDServerCell;
 @class CRDSessionView;
 
-@interface CRDSession : NSObject <NSMachPortDelegate, NSStreamDelegate, NSWindowDelegate>
+@interface CRDSession : NSObject <NSWindowDelegate>
 {
 	// Represented rdesktop object
 	RDConnectionRef conn;
@@ -38,10 +38,10 @@
 	
 	// Working between main thread and connection thread
 	volatile BOOL connectionRunLoopFinished;
-	NSRunLoop *connectionRunLoop;
+	RDEventLoop *eventLoop;
+	int inputFlushTimer;
 	NSThread *connectionThread;
-	NSMachPort *inputEventPort;
-	NSMutableArray *inputEventStack;
+	RDInputRing *inputRing;
 
 	// General information about instance
 	BOOL isTemporary, modified, temporarilyFullscreen, _usesScrollers;
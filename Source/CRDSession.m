@@ -33,8 +33,37 @@
 - (void)createViewWithFrameValue:(NSValue *)frameRect;
 - (void)setUpConnectionThread;
 - (void)discardConnectionThread;
+- (void)receivePackets;
+- (BOOL)hasBufferedPackets;
+- (void)processInputEvents;
+- (void)flushInput;
 @end
 
+// The connection thread's event loop calls back into the session through these
+static void
+CRDSessionSocketReadable(void *context)
+{
+	[(CRDSession *)context receivePackets];
+}
+
+static RD_BOOL
+CRDSessionPacketsBuffered(void *context)
+{
+	return [(CRDSession *)context hasBufferedPackets];
+}
+
+static void
+CRDSessionInputQueued(void *context)
+{
+	[(CRDSession *)context processInputEvents];
+}
+
+static void
+CRDSessionFlushInput(void *context)
+{
+	[(CRDSession *)context flushInput];
+}
+
 #pragma mark -
 
 @implementation CRDSession
@@ -56,7 +85,8 @@
 	otherAttributes = [[NSMutableDictionary alloc] init];
 	
 	cellRepresentation = [[CRDServerCell alloc] init];
-	inputEventStack = [[NSMutableArray alloc] init];
+	inputRing = malloc(sizeof(RDInputRing));
+	input_ring_init(inputRing, True);
 	
 	[self setStatus:CRDConnectionClosed];
 	
@@ -115,9 +145,7 @@
 	while (connectionStatus != CRDConnectionClosed)
 		usleep(1000);
 	
-	[inputEventPort invalidate];
-	[inputEventPort release];
-	[inputEventStack release];
+	free(inputRing);
 	
 	[label release];
 	[hostName release];
@@ -183,15 +211,9 @@
 #pragma mark -
 #pragma mark Working with rdesktop
 
-// Invoked on incoming data arrival, starts the processing of incoming packets
-- (void)stream:(NSStream *)stream handleEvent:(NSStreamEvent)streamEvent
+// Invoked by the event loop on incoming data arrival, starts the processing of incoming packets
+- (void)receivePackets
 {
-	if (streamEvent == NSStreamEventErrorOccurred)
-	{
-		[g_appController performSelectorOnMainThread:@selector(disconnectInstance:) withObject:self waitUntilDone:NO];
-		return;
-	}
-
 	uint8 type;
 	RDStreamRef s;
 	uint32 ext_disc_reason;
@@ -232,7 +254,19 @@
 				unimpl("PDU %d\n", type);
 		}
 		
-	} while ( (conn->nextPacket < s->end) && (connectionStatus == CRDConnectionConnected) );
+	// Stop before waiting on the socket for the rest of a packet, or when input is queued; the event loop
+	//	calls back straight away for packets already read, after sending the input
+	} while ([self hasBufferedPackets] && !event_loop_wake_pending(eventLoop));
+}
+
+// Whether the rest of the last packet, or a whole packet read along with it, can be handled without waiting on the socket
+- (BOOL)hasBufferedPackets
+{
+	if (connectionStatus != CRDConnectionConnected)
+		return NO;
+	
+	return ((conn->rdpStream != NULL) && (conn->nextPacket != NULL) && (conn->nextPacket < conn->rdpStream->end))
+		|| transport_has_pdu(&conn->transport);
 }
 
 // Using the current properties, attempt to connect to a server. Blocks until timeout or failure.
@@ -369,6 +403,35 @@
 	
 	rdpdr_init(conn);
 	cliprdr_init(conn);
+	
+	// Record the session for offline replay (see capture.c) when a capture folder is set
+	NSString *capturePath = [[[NSUserDefaults standardUserDefaults] stringForKey:CRDCaptureSessionsPath] stringByExpandingTildeInPath];
+	if ([capturePath length])
+	{
+		NSString *captureName = [NSString stringWithFormat:@"%@-%d.cordcap", hostName, (int)time(NULL)];
+		capture_open(conn, [[capturePath stringByAppendingPathComponent:captureName] fileSystemRepresentation]);
+	}
+	
+	// Dump drawing order statistics to the console every so many seconds (see orderstats.c)
+	NSInteger statisticsInterval = [[NSUserDefaults standardUserDefaults] integerForKey:CRDOrderStatisticsInterval];
+	if (statisticsInterval > 0)
+		order_stats_enable(conn, statisticsInterval);
+
+	// Pick the persistent bitmap cache replacement policy by name (see cachepolicy.c), and record the cache accesses for cachesim when a trace folder is set
+	NSString *cachePolicy = [[NSUserDefaults standardUserDefaults] stringForKey:CRDBitmapCachePolicy];
+	if ([cachePolicy length])
+		conn->bmpcachePolicy = cache_policy_find([cachePolicy UTF8String]);
+	
+	NSString *tracePath = [[[NSUserDefaults standardUserDefaults] stringForKey:CRDBitmapCacheTracePath] stringByExpandingTildeInPath];
+	if ([tracePath length])
+	{
+		NSString *traceName = [NSString stringWithFormat:@"%@-%d.cachetrace", hostName, (int)time(NULL)];
+		cache_trace_open(conn, [[tracePath stringByAppendingPathComponent:traceName] fileSystemRepresentation]);
+	}
+	
+	// Cap the memory held by this session's caches, and by all sessions' together, in megabytes (see cachebudget.c)
+	cache_budget_set(conn, (uint64)MAX([[NSUserDefaults standardUserDefaults] integerForKey:CRDCacheMemoryBudget], 0) << 20);
+	cache_budget_set_process((uint64)MAX([[NSUserDefaults standardUserDefaults] integerForKey:CRDCacheMemoryProcessBudget], 0) << 20);
 
 	// Make the connection
 	BOOL connected = rdp_connect(conn,
@@ -388,14 +451,13 @@
 		[self setStatus:CRDConnectionConnected];
 		[self setUpConnectionThread];
 
-		NSStream *is = conn->inputStream;
-		[is setDelegate:self];
-		[is scheduleInRunLoop:connectionRunLoop forMode:NSDefaultRunLoopMode];
-
 		[self performSelectorOnMainThread:@selector(createViewWithFrameValue:) withObject:[NSValue valueWithRect:NSMakeRect(0.0, 0.0, conn->screenWidth, conn->screenHeight)] waitUntilDone:YES];
 	}
 	else if (connectionStatus == CRDConnectionConnecting)
 	{
+		capture_close(conn);
+		cache_trace_close(conn);
+		order_stats_disable(conn);
 		[self setStatus:CRDConnectionClosed];
 		[self performSelectorOnMainThread:@selector(setStatusAsNumber:) withObject:[NSNumber numberWithInt:CRDConnectionClosed] waitUntilDone:NO];
 	}
@@ -421,7 +483,8 @@
 		// Try to forcefully break the connection thread out of its run loop
 		@synchronized(self)
 		{
-			[inputEventPort sendBeforeDate:[NSDate dateWithTimeIntervalSinceNow:TIMEOUT_LENGTH] components:nil from:nil reserved:0];
+			if (eventLoop != NULL)
+				event_loop_wake(eventLoop);
 		}
 		
 		time_t start = time(NULL);
@@ -432,22 +495,13 @@
 		[self performSelectorOnMainThread:@selector(destroyUIElements) withObject:nil waitUntilDone:YES];
 
 		
-		// Clear out the bitmap cache
-		int i, k;
-		for (i = 0; i < BITMAP_CACHE_SIZE; i++)
-		{
-			for (k = 0; k < BITMAP_CACHE_ENTRIES; k++)
-			{	
-				ui_destroy_bitmap(conn->bmpcache[i][k].bitmap);
-				conn->bmpcache[i][k].bitmap = NULL;
-			}
-		}
-		
-		for (i = 0; i < CURSOR_CACHE_SIZE; i++)
-			ui_destroy_cursor(conn->cursorCache[i]);
-		
+		// Clear out the caches, handing their memory back to the process budget
+		cache_destroy(conn);
 		
 		free(conn->rdpdrClientname);
+		capture_close(conn);
+		cache_trace_close(conn);
+		order_stats_disable(conn);
 		
 		
 		memset(conn, 0, sizeof(RDConnection));
@@ -473,13 +527,14 @@
 	
 	connectionRunLoopFinished = NO;
 	
-	BOOL gotInput;
-	do
+	// Sleeps until the server sends something, input is queued or the connection is being closed
+	int handled = 0;
+	while ( (connectionStatus == CRDConnectionConnected) && (eventLoop != NULL) && (handled >= 0) )
 	{
 		pool = [[NSAutoreleasePool alloc] init];
-		gotInput = [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.25]];
+		handled = event_loop_run_once(eventLoop, -1);
 		[pool release];
-	} while (connectionStatus == CRDConnectionConnected && gotInput);
+	}
 	
 	pool = [[NSAutoreleasePool alloc] init];
 	
@@ -833,39 +888,59 @@
 	}
 	else
 	{	
-		// Push this event onto the event stack and handle it in the connection thread
-		CRDInputEvent queuedEvent = CRDMakeInputEvent(time, type, flags, param1, param2), *ie;
-		
-		ie = malloc(sizeof(CRDInputEvent));
-		memcpy(ie, &queuedEvent, sizeof(CRDInputEvent));
+		// Queue this event for the connection thread; only the main thread sends from here, so the ring has one producer
+		CRDInputEvent queuedEvent = CRDMakeInputEvent(time, type, flags, param1, param2);
 		
-		@synchronized(inputEventStack)
+		while (!input_ring_push(inputRing, &queuedEvent))
 		{
-			[inputEventStack addObject:[NSValue valueWithPointer:ie]];
+			// The connection thread is a whole ring behind: a move can be dropped, anything else waits for room
+			if ( ((type == RDP_INPUT_MOUSE) && (flags == MOUSE_FLAG_MOVE)) || (connectionStatus != CRDConnectionConnected) )
+				return;
+			usleep(1000);
 		}
 		
 		// Inform the connection thread it has unprocessed events
-		[inputEventPort sendBeforeDate:[NSDate date] components:nil from:nil reserved:0];
+		@synchronized(self)
+		{
+			if (eventLoop != NULL)
+				event_loop_wake(eventLoop);
+		}
 	}
 }
 
-// Called by the connection thread in the run loop when new user input needs to be sent
-- (void)handleMachMessage:(void *)msg
+// Called by the connection thread in the event loop when new user input needs to be sent
+- (void)processInputEvents
 {
-    @synchronized(inputEventStack)
+	CRDInputEvent ie;
+	BOOL sendNow = NO;
+	
+	while ( (connectionStatus == CRDConnectionConnected) && input_ring_pop(inputRing, &ie) )
+		sendNow |= rdp_queue_input(conn, ie.time, ie.type, ie.deviceFlags, ie.param1, ie.param2);
+	
+	if (connectionStatus != CRDConnectionConnected)
+		return;
+	
+	// Keys and clicks go at once; pointer moves alone wait for the flush timer, so a drag sends a packet per interval
+	if (sendNow)
+		[self flushInput];
+	else if ( (conn->inputBatchCount != 0) && (inputFlushTimer < 0) )
 	{
-		while ([inputEventStack count] != 0)
-		{
-			CRDInputEvent *ie = [[inputEventStack objectAtIndex:0] pointerValue];
-			[inputEventStack removeObjectAtIndex:0];
-			if (ie != NULL)
-				[self sendInputOnConnectionThread:ie->time type:ie->type flags:ie->deviceFlags param1:ie->param1 param2:ie->param2];
-			
-			free(ie);
-		}
+		inputFlushTimer = event_loop_add_timer(eventLoop, INPUT_FLUSH_INTERVAL, 0, CRDSessionFlushInput, self);
+		if (inputFlushTimer < 0)
+			[self flushInput];
 	}
 }
 
+// Called by the connection thread to send the input batched so far
+- (void)flushInput
+{
+	event_loop_cancel_timer(eventLoop, inputFlushTimer);
+	inputFlushTimer = -1;
+	
+	if (connectionStatus == CRDConnectionConnected)
+		rdp_flush_input(conn);
+}
+
 
 #pragma mark -
 #pragma mark Working With CoRD
@@ -1193,11 +1268,18 @@
 	@synchronized(self)
 	{
 		connectionThread = [NSThread currentThread];
-		connectionRunLoop  = [NSRunLoop currentRunLoop];
+		inputFlushTimer = -1;
 
-		inputEventPort = [[NSMachPort alloc] init];
-		[inputEventPort setDelegate:self];
-		[connectionRunLoop addPort:inputEventPort forMode:(NSString *)kCFRunLoopCommonModes];
+		eventLoop = malloc(sizeof(RDEventLoop));
+		if (!event_loop_init(eventLoop))
+		{
+			free(eventLoop);
+			eventLoop = NULL;
+			return;
+		}
+		event_loop_watch(eventLoop, conn->transport.fd, CRDSessionSocketReadable, self);
+		event_loop_on_buffered(eventLoop, CRDSessionPacketsBuffered);
+		event_loop_on_wake(eventLoop, CRDSessionInputQueued, self);
 	}
 }
 
@@ -1205,22 +1287,16 @@
 {
 	@synchronized(self)
 	{
-		[connectionRunLoop removePort:inputEventPort forMode:(NSString *)kCFRunLoopCommonModes];
-		[inputEventPort invalidate];
-		[inputEventPort release];
-		inputEventPort = nil;
-	
-		@synchronized(inputEventStack)
+		if (eventLoop != NULL)
 		{
-			while ([inputEventStack count] != 0)
-			{
-				free([[inputEventStack objectAtIndex:0] pointerValue]);
-				[inputEventStack removeObjectAtIndex:0];
-			}
+			event_loop_destroy(eventLoop);
+			free(eventLoop);
+			eventLoop = NULL;
 		}
+	
+		input_ring_clear(inputRing);
 		
 		connectionThread = nil;
-		connectionRunLoop = nil;
 	}
 }
 
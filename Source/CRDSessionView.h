@@ -61,10 +61,8 @@
 - (void)fillRect:(NSRect)rect withColor:(NSColor *)color patternOrigin:(NSPoint)origin;
 - (void)fillRect:(NSRect)rect withRDColor:(int)color;
 - (void)drawBitmap:(CRDBitmap *)image inRect:(NSRect)r from:(NSPoint)origin operation:(NSCompositingOperation)op;
-- (void)screenBlit:(NSRect)from to:(NSPoint)to;
 - (void)drawLineFrom:(NSPoint)start to:(NSPoint)end color:(NSColor *)color width:(int)width;
-- (void)drawGlyph:(CRDBitmap *)glyph at:(NSRect)r foregroundColor:(NSColor *)c;
-- (void)swapRect:(NSRect)r;
+- (void)drawGlyphMask:(const uint8 *)mask inRect:(NSRect)r withRDColor:(int)color;
 
 // Other rdesktop handlers
 - (void)setClip:(NSRect)r;
@@ -75,12 +73,14 @@
 - (void)stopUpdate;
 - (void)focusBackingStore;
 - (void)releaseBackingStore;
+- (void)getRopSurface:(RDRopSurface *)surface;
 
 - (BOOL)checkMouseInBounds:(id)ev;
 - (void)sendMouseInput:(unsigned short)flags;
 
 // Converting colors
 - (void)rgbForRDCColor:(int)col r:(unsigned char *)r g:(unsigned char *)g b:(unsigned char *)b;
+- (uint32)pixelForRDCColor:(int)col;
 - (NSColor *)nscolorForRDCColor:(int)col;
 
 // Other
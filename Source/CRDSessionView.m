@@ -505,16 +505,6 @@
 	[self releaseBackingStore];
 }
 
-- (void)screenBlit:(NSRect)from to:(NSPoint)to
-{
-	[self focusBackingStore];
-	NSRectClip(NSMakeRect(to.x, to.y, NSWidth(from), NSHeight(from)));
-	CGImageRef rdBufferImage = CGBitmapContextCreateImage(rdBufferContext);
-	CGContextDrawImage([[NSGraphicsContext currentContext] graphicsPort], CGRectMake(to.x - from.origin.x, to.y - from.origin.y,  screenSize.width, screenSize.height), rdBufferImage);
-	CGImageRelease(rdBufferImage);
-	[self releaseBackingStore];
-}
-
 - (void)drawLineFrom:(NSPoint)start to:(NSPoint)end color:(NSColor *)color width:(int)width
 {
 	[NSBezierPath setDefaultLineWidth:0.0];
@@ -525,33 +515,56 @@
 	[self releaseBackingStore];
 }
 
-- (void)drawGlyph:(CRDBitmap *)glyph at:(NSRect)r foregroundColor:(NSColor *)foregroundColor;
+// Describes the backing store's pixels to the raster operations, which write them directly
+- (void)getRopSurface:(RDRopSurface *)surface
 {
-	// Assumes that focusBackingStore has already been called (for efficiency)
+	NSRect area = NSIntersectionRect(clipRect, NSMakeRect(0, 0, rdBufferWidth, rdBufferHeight));
+	int rowBytes = rdBufferWidth * 4;
 	
-	if (![[glyph color] isEqual:foregroundColor])
-	{
-		[glyph overlayColor:foregroundColor];
-		[glyph setColor:foregroundColor];
-	}
-	
-	[glyph drawInRect:r fromRect:NSMakeRect(0, 0, NSWidth(r), NSHeight(r)) operation:NSCompositeSourceOver];
+	// RDP rows run down the screen, the buffer's rows up it
+	CGContextFlush(rdBufferContext);
+	surface->pixels = rdBufferBitmapData + (rdBufferHeight - 1) * rowBytes;
+	surface->stride = -rowBytes;
+	surface->width = rdBufferWidth;
+	surface->height = rdBufferHeight;
+	surface->clip_left = NSMinX(area);
+	surface->clip_top = NSMinY(area);
+	surface->clip_right = NSMaxX(area);
+	surface->clip_bottom = NSMaxY(area);
+	surface->opaque = 0xffu << 24;
 }
 
-- (void)swapRect:(NSRect)r
+// Fills the pixels of r set in a one byte per pixel coverage mask, whose first row is at the top of r
+- (void)drawGlyphMask:(const uint8 *)mask inRect:(NSRect)r withRDColor:(int)color
 {
+	size_t width = NSWidth(r), height = NSHeight(r);
+	unsigned char red, green, blue;
+	
+	if (!width || !height)
+		return;
+	
+	CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, mask, width * height, NULL);
+	CGColorSpaceRef gray = CGColorSpaceCreateDeviceGray();
+	CGImageRef maskImage = CGImageCreate(width, height, 8, 8, width, gray, kCGImageAlphaNone, provider, NULL, false, kCGRenderingIntentDefault);
+	
 	[self focusBackingStore];
-	CGContextRef context = (CGContextRef)[[NSGraphicsContext currentContext] graphicsPort];
+	CGContextRef context = [[NSGraphicsContext currentContext] graphicsPort];
 	CGContextSaveGState(context);
-	CGContextSetBlendMode(context, kCGBlendModeDifference);
-	CGContextSetRGBFillColor(context, 1.0, 1.0, 1.0, 1.0);
-	CGContextFillRect(context, CGRectMake(r.origin.x, r.origin.y, r.size.width, r.size.height));
-	CGContextFlush(context);
+	CGContextTranslateCTM(context, NSMinX(r), NSMaxY(r));
+	CGContextScaleCTM(context, 1.0, -1.0);
+	CGContextClipToMask(context, CGRectMake(0, 0, width, height), maskImage);
+	
+	[self rgbForRDCColor:color r:&red g:&green b:&blue];
+	CGContextSetRGBFillColor(context, red/255.0f, green/255.0f, blue/255.0f, 1.0);
+	CGContextFillRect(context, CGRectMake(0, 0, width, height));
 	CGContextRestoreGState(context);
 	[self releaseBackingStore];
+	
+	CGImageRelease(maskImage);
+	CGColorSpaceRelease(gray);
+	CGDataProviderRelease(provider);
 }
 
-
 #pragma mark -
 #pragma mark Clipping backing store drawing
 
@@ -672,6 +685,14 @@
 	*r = t & 0xff;
 }
 
+- (uint32)pixelForRDCColor:(int)col
+{
+	unsigned char r, g, b;
+	[self rgbForRDCColor:col r:&r g:&g b:&b];
+	
+	return (0xffu << 24) | (r << 16) | (g << 8) | b;
+}
+
 - (NSColor *)nscolorForRDCColor:(int)col
 {
 	unsigned char r, g, b;
@@ -45,11 +45,7 @@ typedef enum _CRDDisplayMode
 	CRDDisplayFullscreen = 2
 } CRDDisplayMode;
 
-typedef struct _CRDInputEvent
-{
-	unsigned int time; 
-	unsigned short type, deviceFlags, param1, param2;
-} CRDInputEvent;
+typedef RDInputEvent CRDInputEvent;
 
 typedef enum _CRDLogLevel
 {
@@ -173,6 +169,13 @@ extern NSString * const CRDForwardOnlyDefinedPaths;
 extern NSString * const CRDUseSocksProxy;
 extern NSString * const CRDDisableCrashReporter;
 extern NSString * const CRDSavedServersPath;
+extern NSString * const CRDBitmapDecodeThreads;
+extern NSString * const CRDCaptureSessionsPath;
+extern NSString * const CRDOrderStatisticsInterval;
+extern NSString * const CRDBitmapCachePolicy;
+extern NSString * const CRDBitmapCacheTracePath;
+extern NSString * const CRDCacheMemoryBudget;
+extern NSString * const CRDCacheMemoryProcessBudget;
 
 // Notifications
 extern NSString * const CRDMinimalViewDidChangeNotification;
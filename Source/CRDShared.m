@@ -68,6 +68,13 @@ NSString * const CRDForwardOnlyDefinedPaths = @"CRDForwardOnlyDefinedPaths";
 NSString * const CRDUseSocksProxy = @"CRDUseSocksProxy";
 NSString * const CRDDisableCrashReporter = @"disableCrashReporter";
 NSString * const CRDSavedServersPath = @"savedServersPath";
+NSString * const CRDBitmapDecodeThreads = @"CRDBitmapDecodeThreads";
+NSString * const CRDCaptureSessionsPath = @"CRDCaptureSessionsPath";
+NSString * const CRDOrderStatisticsInterval = @"CRDOrderStatisticsInterval";
+NSString * const CRDBitmapCachePolicy = @"CRDBitmapCachePolicy";
+NSString * const CRDBitmapCacheTracePath = @"CRDBitmapCacheTracePath";
+NSString * const CRDCacheMemoryBudget = @"CRDCacheMemoryBudget";
+NSString * const CRDCacheMemoryProcessBudget = @"CRDCacheMemoryProcessBudget";
 
 #pragma mark -
 #pragma mark General purpose routines
@@ -381,6 +388,7 @@ void CRDFillDefaultConnection(RDConnectionRef conn)
 	conn->bitmapCache = 1;
 	conn->bitmapCachePersist = 0;
 	conn->bitmapCachePrecache = 1;
+	conn->bitmapCacheCompress = 1;
 	conn->polygonEllipseOrders = 1;
 	conn->desktopSave = 1;
 	conn->serverRdpVersion = 1;
@@ -391,8 +399,6 @@ void CRDFillDefaultConnection(RDConnectionRef conn)
 	conn->licenseIssued	= 0;
 	conn->pstcacheEnumerated = 0;
 	conn->ioRequest	= NULL;
-	conn->bmpcacheLru[0] = conn->bmpcacheLru[1] = conn->bmpcacheLru[2] = NOT_SET;
-	conn->bmpcacheMru[0] = conn->bmpcacheMru[1] = conn->bmpcacheMru[2] = NOT_SET;
 	conn->errorCode = ConnectionErrorNone;
 	conn->numDevices = 0;
 	conn->numChannels = 0;
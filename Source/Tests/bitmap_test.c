@@ -0,0 +1,450 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Tests for the interleaved RLE and planar bitmap decoders
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Known answers for every RLE opcode and for a planar bitmap, then random
+   streams decoded by bitmap.c, with its span kernels, and by a decoder
+   here that does one pixel at a time as bitmap.c did before them. */
+
+#import "test.h"
+#import "bitmap_simd.h"
+
+#define MAX_WIDTH	80
+#define MAX_HEIGHT	24
+
+/* The pixel at a time decoder for any Bpp, pixels being Bpp bytes as
+   they arrive: dst = (above ? above : 0) ^ (xor ? xor : 0) */
+static void
+ref_put(uint8 * dst, const uint8 * above, const uint8 * xor, int Bpp)
+{
+	int i;
+
+	for (i = 0; i < Bpp; i++)
+		dst[i] = (above ? above[i] : 0) ^ (xor ? xor[i] : 0);
+}
+
+static RD_BOOL
+ref_decompress(uint8 * output, int width, int height, const uint8 * input, int size, int Bpp)
+{
+	const uint8 *end = input + size;
+	uint8 *prevline = NULL, *line = NULL, *dst;
+	const uint8 *above;
+	uint8 mix[4] = { 0xff, 0xff, 0xff, 0xff }, colour1[4] = { 0 }, colour2[4] = { 0 };
+	int opcode, count, offset, x = width, lastopcode = -1, insertmix = False, bicolour = False;
+	int fom_mask;
+	uint8 code, mask = 0, mixmask;
+
+	while (input < end)
+	{
+		fom_mask = 0;
+		code = *(input++);
+		opcode = code >> 4;
+		switch (opcode)
+		{
+			case 0xc:
+			case 0xd:
+			case 0xe:
+				opcode -= 6;
+				count = code & 0xf;
+				offset = 16;
+				break;
+			case 0xf:
+				opcode = code & 0xf;
+				if (opcode < 9)
+				{
+					count = input[0] | (input[1] << 8);
+					input += 2;
+				}
+				else
+				{
+					count = (opcode < 0xb) ? 8 : 1;
+				}
+				offset = 0;
+				break;
+			default:
+				opcode >>= 1;
+				count = code & 0x1f;
+				offset = 32;
+				break;
+		}
+		if (offset != 0)
+		{
+			if (count == 0)
+				count = *(input++) + (((opcode == 2) || (opcode == 7)) ? 1 : offset);
+			else if ((opcode == 2) || (opcode == 7))
+				count <<= 3;
+		}
+		switch (opcode)
+		{
+			case 0:
+				if ((lastopcode == opcode) && !((x == width) && (prevline == NULL)))
+					insertmix = True;
+				break;
+			case 8:
+				memcpy(colour1, input, Bpp);
+				input += Bpp;
+			case 3:
+				memcpy(colour2, input, Bpp);
+				input += Bpp;
+				break;
+			case 6:
+			case 7:
+				memcpy(mix, input, Bpp);
+				input += Bpp;
+				opcode -= 5;
+				break;
+			case 9:
+			case 0xa:
+				fom_mask = mask = (opcode == 9) ? 3 : 5;
+				opcode = 2;
+				break;
+		}
+		lastopcode = opcode;
+		mixmask = 0;
+		while (count > 0)
+		{
+			if (x >= width)
+			{
+				if (height <= 0)
+					return False;
+				x = 0;
+				height--;
+				prevline = line;
+				line = output + height * width * Bpp;
+			}
+			dst = line + x * Bpp;
+			above = (prevline != NULL) ? prevline + x * Bpp : NULL;
+			switch (opcode)
+			{
+				case 0:
+					ref_put(dst, above, insertmix ? mix : NULL, Bpp);
+					insertmix = False;
+					break;
+				case 1:
+					ref_put(dst, above, mix, Bpp);
+					break;
+				case 2:
+					mixmask <<= 1;
+					if (mixmask == 0)
+					{
+						mask = fom_mask ? fom_mask : *(input++);
+						mixmask = 1;
+					}
+					ref_put(dst, above, (mask & mixmask) ? mix : NULL, Bpp);
+					break;
+				case 3:
+					memcpy(dst, colour2, Bpp);
+					break;
+				case 4:
+					memcpy(dst, input, Bpp);
+					input += Bpp;
+					break;
+				case 8:
+					memcpy(dst, bicolour ? colour2 : colour1, Bpp);
+					if (!bicolour)
+						count++;
+					bicolour = !bicolour;
+					break;
+				case 0xd:
+					memset(dst, 0xff, Bpp);
+					break;
+				case 0xe:
+					memset(dst, 0, Bpp);
+					break;
+				default:
+					return False;
+			}
+			count--;
+			x++;
+		}
+	}
+	return True;
+}
+
+/* Append a random run in any of the code forms to out, and add the
+   pixels it covers to pixels; returns the bytes written */
+static int
+rle_random_run(uint8 * out, int Bpp, int *pixels)
+{
+	static const int regular[] = { 0, 1, 2, 3, 4 }, lite[] = { 6, 7, 8 }, special[] = { 9, 0xa, 0xd, 0xe };
+	uint8 *p = out;
+	int opcode, count, extra;
+
+	switch (test_random() % 4)
+	{
+		case 0:
+			opcode = regular[test_random() % 5];
+			count = test_random() % 32;
+			*(p++) = (opcode << 5) | count;
+			extra = (opcode == 2) ? 1 : 32;
+			break;
+		case 1:
+			opcode = lite[test_random() % 3];
+			count = test_random() % 16;
+			*(p++) = 0xc0 | ((opcode - 6) << 4) | count;
+			extra = (opcode == 7) ? 1 : 16;
+			break;
+		case 2:
+			opcode = test_random() % 8;
+			opcode += (opcode >= 5);	/* 5 is not an opcode */
+			count = test_random() % 300;
+			*(p++) = 0xf0 | opcode;
+			*(p++) = count & 0xff;
+			*(p++) = count >> 8;
+			extra = -1;
+			break;
+		default:
+			opcode = special[test_random() % 4];
+			*(p++) = 0xf0 | opcode;
+			count = (opcode < 0xb) ? 8 : 1;
+			extra = -1;
+			break;
+	}
+
+	if (extra > 0)
+	{
+		if (count == 0)
+		{
+			*p = test_random();
+			count = *(p++) + extra;
+		}
+		else if ((opcode == 2) || (opcode == 7))
+		{
+			count <<= 3;
+		}
+	}
+
+	if ((opcode == 3) || (opcode == 6) || (opcode == 7) || (opcode == 8))
+	{
+		test_random_bytes(p, (opcode == 8) ? 2 * Bpp : Bpp);
+		p += (opcode == 8) ? 2 * Bpp : Bpp;
+	}
+	if (opcode == 4)
+	{
+		test_random_bytes(p, count * Bpp);
+		p += count * Bpp;
+	}
+	if ((opcode == 2) || (opcode == 7))
+	{
+		test_random_bytes(p, (count + 7) / 8);
+		p += (count + 7) / 8;
+	}
+
+	*pixels += (opcode == 8) ? 2 * count : count;
+	return p - out;
+}
+
+static void
+test_rle_vectors(void)
+{
+	/* 1 Bpp, 4x2: a colour line, then a mix over it */
+	uint8 colour_mix[] = { 0x64, 0x11, 0x24 };
+	uint8 colour_mix_out[] = { 0xee, 0xee, 0xee, 0xee, 0x11, 0x11, 0x11, 0x11 };
+	/* 1 Bpp, 4x2: a fill straight after a fill starts with a mix pixel */
+	uint8 fill_fill[] = { 0x64, 0x20, 0x02, 0x02 };
+	uint8 fill_fill_out[] = { 0x20, 0x20, 0xdf, 0x20, 0x20, 0x20, 0x20, 0x20 };
+	/* 1 Bpp, 6x1: white, black, bicolour, copy */
+	uint8 single[] = { 0xfd, 0xfe, 0xe1, 0x07, 0x08, 0x82, 0x33, 0x44 };
+	uint8 single_out[] = { 0xff, 0x00, 0x07, 0x08, 0x33, 0x44 };
+	/* 2 Bpp, 8x2: set mix and fill or mix with a mask byte, then fill or
+	   mix with the fixed mask 3 */
+	uint8 fom[] = { 0xd1, 0x34, 0x12, 0xa5, 0xf9 };
+	uint8 fom_out[] = {
+		0x00, 0x00, 0x34, 0x12, 0x34, 0x12, 0x00, 0x00, 0x00, 0x00, 0x34, 0x12, 0x00, 0x00, 0x34, 0x12,
+		0x34, 0x12, 0x00, 0x00, 0x34, 0x12, 0x00, 0x00, 0x00, 0x00, 0x34, 0x12, 0x00, 0x00, 0x34, 0x12
+	};
+	/* 3 Bpp, 2x1: a 16 bit count colour run */
+	uint8 mega[] = { 0xf3, 0x02, 0x00, 0x01, 0x02, 0x03 };
+	uint8 mega_out[] = { 0x01, 0x02, 0x03, 0x01, 0x02, 0x03 };
+	uint8 out[64];
+
+	CHECK(bitmap_decompress(out, 4, 2, colour_mix, sizeof(colour_mix), 1));
+	CHECK(memcmp(out, colour_mix_out, sizeof(colour_mix_out)) == 0);
+	CHECK(bitmap_decompress(out, 4, 2, fill_fill, sizeof(fill_fill), 1));
+	CHECK(memcmp(out, fill_fill_out, sizeof(fill_fill_out)) == 0);
+	CHECK(bitmap_decompress(out, 6, 1, single, sizeof(single), 1));
+	CHECK(memcmp(out, single_out, sizeof(single_out)) == 0);
+	CHECK(bitmap_decompress(out, 8, 2, fom, sizeof(fom), 2));
+	CHECK(memcmp(out, fom_out, sizeof(fom_out)) == 0);
+	CHECK(bitmap_decompress(out, 2, 1, mega, sizeof(mega), 3));
+	CHECK(memcmp(out, mega_out, sizeof(mega_out)) == 0);
+
+	/* more pixels than the bitmap holds */
+	CHECK(!bitmap_decompress(out, 4, 1, colour_mix, sizeof(colour_mix), 1));
+}
+
+static void
+test_rle_random(void)
+{
+	static uint8 input[MAX_WIDTH * MAX_HEIGHT * 8 + 64], expected[MAX_WIDTH * MAX_HEIGHT * 3],
+		output[MAX_WIDTH * MAX_HEIGHT * 3];
+	int i, Bpp, width, height, size, pixels;
+	RD_BOOL rv;
+
+	for (i = 0; i < 3000; i++)
+	{
+		Bpp = 1 + i % 3;
+		width = 1 + test_random() % MAX_WIDTH;
+		height = 1 + test_random() % MAX_HEIGHT;
+
+		/* the last run often overruns the bitmap, which both must refuse */
+		for (size = pixels = 0; pixels < width * height;)
+			size += rle_random_run(input + size, Bpp, &pixels);
+
+		memset(expected, 0x5a, sizeof(expected));
+		memset(output, 0x5a, sizeof(output));
+		rv = ref_decompress(expected, width, height, input, size, Bpp);
+		CHECK(bitmap_decompress(output, width, height, input, size, Bpp) == rv);
+		CHECK(memcmp(output, expected, sizeof(output)) == 0);
+	}
+}
+
+/* the span kernels against a byte at a time */
+static void
+test_spans(void)
+{
+	uint8 pattern[RLE_PATTERN_SIZE], pixel[3], src[300], dst[320], expected[320];
+	int i, j, Bpp, offset, length;
+
+	for (i = 0; i < 2000; i++)
+	{
+		Bpp = 1 + i % 3;
+		test_random_bytes(pixel, Bpp);
+		rle_make_pattern(pattern, pixel, Bpp);
+		offset = test_random() % 16;
+		length = test_random() % 300;
+		test_random_bytes(src, sizeof(src));
+
+		memset(dst, 0, sizeof(dst));
+		memset(expected, 0, sizeof(expected));
+		for (j = 0; j < length; j++)
+			expected[offset + j] = pixel[j % Bpp];
+		rle_span_fill(dst + offset, pattern, length);
+		CHECK(memcmp(dst, expected, sizeof(dst)) == 0);
+
+		for (j = 0; j < length; j++)
+			expected[offset + j] = src[j] ^ pixel[j % Bpp];
+		rle_span_xor(dst + offset, src, pattern, length);
+		CHECK(memcmp(dst, expected, sizeof(dst)) == 0);
+	}
+}
+
+static void
+test_planar_vectors(void)
+{
+	/* 2x2: alpha 0xff; red, green and blue raw on the first line and as
+	   deltas (2n is +n, 2n + 1 is -(n + 1)) on the second */
+	uint8 input[] = {
+		0x10,
+		0x20, 0xff, 0xff, 0x20, 0x00, 0x00,
+		0x20, 0x01, 0x02, 0x20, 0x02, 0x01,
+		0x20, 0x03, 0x04, 0x20, 0x00, 0x00,
+		0x20, 0x05, 0x06, 0x20, 0x02, 0x02
+	};
+	/* bottom-up BGRA */
+	uint8 expected[] = {
+		0x06, 0x03, 0x02, 0xff, 0x07, 0x04, 0x01, 0xff,
+		0x05, 0x03, 0x01, 0xff, 0x06, 0x04, 0x02, 0xff
+	};
+	uint8 longer[sizeof(input) + 1], out[16];
+
+	CHECK(bitmap_decompress(out, 2, 2, input, sizeof(input), 4));
+	CHECK(memcmp(out, expected, sizeof(expected)) == 0);
+
+	/* a plane cut short, and a byte left over */
+	CHECK(!bitmap_decompress(out, 2, 2, input, sizeof(input) - 1, 4));
+	memcpy(longer, input, sizeof(input));
+	longer[sizeof(input)] = 0;
+	CHECK(!bitmap_decompress(out, 2, 2, longer, sizeof(longer), 4));
+}
+
+/* a random plane line of raw colours and runs */
+static int
+planar_random_line(uint8 * out, int width)
+{
+	uint8 *p = out;
+	int x = 0, collen, replen;
+
+	while (x < width)
+	{
+		collen = test_random() % MIN(16, width - x + 1);
+		replen = (test_random() % 2) ? 3 + test_random() % 13 : 0;
+		if (x + collen + replen > width)
+			replen = 0;
+		if (collen + replen == 0)
+			collen = 1;
+		*(p++) = (collen << 4) | replen;
+		test_random_bytes(p, collen);
+		p += collen;
+		x += collen + replen;
+	}
+	return p - out;
+}
+
+/* bitmap_decompress interleaves the planes from bitmap_decompress_planes */
+static void
+test_planar_random(void)
+{
+	static uint8 input[4 * MAX_WIDTH * MAX_HEIGHT * 2 + 1], planes[4 * MAX_WIDTH * MAX_HEIGHT],
+		output[4 * MAX_WIDTH * MAX_HEIGHT];
+	uint8 *a, *r, *g, *b, *px;
+	int i, width, height, size, plane, y, x;
+	RD_BOOL ok;
+
+	for (i = 0; i < 500; i++)
+	{
+		width = 1 + test_random() % MAX_WIDTH;
+		height = 1 + test_random() % MAX_HEIGHT;
+		size = 0;
+		input[size++] = 0x10;
+		for (plane = 0; plane < 4; plane++)
+			for (y = 0; y < height; y++)
+				size += planar_random_line(input + size, width);
+
+		CHECK(bitmap_decompress_planes(planes, width, height, input, size));
+		CHECK(bitmap_decompress(output, width, height, input, size, 4));
+
+		a = planes;
+		r = a + width * height;
+		g = r + width * height;
+		b = g + width * height;
+		ok = True;
+		for (y = 0; y < height; y++)
+		{
+			for (x = 0; x < width; x++)
+			{
+				px = output + ((height - 1 - y) * width + x) * 4;
+				if ((px[0] != b[y * width + x]) || (px[1] != g[y * width + x])
+				    || (px[2] != r[y * width + x]) || (px[3] != a[y * width + x]))
+					ok = False;
+			}
+		}
+		CHECK(ok);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	test_rle_vectors();
+	test_rle_random();
+	test_spans();
+	test_planar_vectors();
+	test_planar_random();
+	return test_result("bitmap_test");
+}
@@ -0,0 +1,194 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Tests for the glyph atlases
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Glyphs placed in an atlas must hold their own bits and not overlap,
+   across the atlas growing and starting new generations, and a run's
+   mask must come out the same whether its glyphs are copied from the
+   atlas or drawn from their bits. */
+
+#import "test.h"
+
+#define ATLAS_WIDTH	512	/* as in glyphatlas.c */
+#define GLYPHS		800
+
+static RDFontGlyph glyphs[GLYPHS];
+
+static void
+make_glyph(RDFontGlyph * glyph, int width, int height)
+{
+	int size = height * ((width + 7) / 8);
+
+	memset(glyph, 0, sizeof(*glyph));
+	glyph->width = width;
+	glyph->height = height;
+	glyph->data = (uint8 *) xmalloc(MAX(size, 1));
+	test_random_bytes(glyph->data, size);
+}
+
+static RD_BOOL
+glyph_bit(const RDFontGlyph * glyph, int x, int y)
+{
+	return (glyph->data[y * ((glyph->width + 7) / 8) + (x >> 3)] & (0x80 >> (x & 7))) != 0;
+}
+
+/* whether a placed glyph is inside the atlas and holds its bits */
+static RD_BOOL
+glyph_in_atlas(RDConnectionRef conn, uint8 font, const RDFontGlyph * glyph)
+{
+	RDGlyphAtlas *atlas = &conn->glyphAtlas[font];
+	int x, y;
+
+	if ((glyph->atlas_x + glyph->width > ATLAS_WIDTH) || (glyph->atlas_y + glyph->height > atlas->height))
+		return False;
+	for (y = 0; y < glyph->height; y++)
+		for (x = 0; x < glyph->width; x++)
+			if (atlas->pixels[(glyph->atlas_y + y) * ATLAS_WIDTH + glyph->atlas_x + x]
+			    != (glyph_bit(glyph, x, y) ? 0xff : 0))
+				return False;
+	return True;
+}
+
+static RD_BOOL
+glyphs_overlap(const RDFontGlyph * a, const RDFontGlyph * b)
+{
+	return (a->atlas_x < b->atlas_x + b->width) && (b->atlas_x < a->atlas_x + a->width)
+		&& (a->atlas_y < b->atlas_y + b->height) && (b->atlas_y < a->atlas_y + a->height);
+}
+
+static void
+test_placing(RDConnectionRef conn)
+{
+	RDGlyphAtlas *atlas = &conn->glyphAtlas[0];
+	RDFontGlyph big;
+	int i, j, placed, wrong = 0, overlaps = 0, pass;
+
+	for (i = 0; i < GLYPHS; i++)
+		make_glyph(&glyphs[i], 1 + test_random() % 48, 1 + test_random() % 48);
+
+	/* the second pass places the glyphs of older generations again */
+	for (pass = 0; pass < 2; pass++)
+	{
+		for (i = 0; i < GLYPHS; i++)
+		{
+			CHECK(glyphatlas_place(conn, 0, &glyphs[i]));
+			CHECK(glyphatlas_placed(conn, 0, &glyphs[i]));
+			if (!glyph_in_atlas(conn, 0, &glyphs[i]))
+				wrong++;
+		}
+
+		for (i = 0, placed = 0; i < GLYPHS; i++)
+		{
+			if (!glyphatlas_placed(conn, 0, &glyphs[i]))
+				continue;
+			placed++;
+			if (!glyph_in_atlas(conn, 0, &glyphs[i]))
+				wrong++;
+			for (j = i + 1; j < GLYPHS; j++)
+				if (glyphatlas_placed(conn, 0, &glyphs[j]) && glyphs_overlap(&glyphs[i], &glyphs[j]))
+					overlaps++;
+		}
+		CHECK((placed > 0) && (placed < GLYPHS));
+	}
+	CHECK(wrong == 0);
+	CHECK(overlaps == 0);
+	CHECK(atlas->generation > 2);
+	CHECK(conn->cacheUsage.rebuilt[CACHE_KIND_GLYPH] > 0);
+	CHECK(conn->cacheUsage.bytes[CACHE_KIND_GLYPH] == (uint64) ATLAS_WIDTH * atlas->height);
+
+	/* glyphs that fit no atlas are left out of it */
+	make_glyph(&big, ATLAS_WIDTH + 1, 8);
+	CHECK(!glyphatlas_place(conn, 0, &big));
+	CHECK(!glyphatlas_placed(conn, 0, &big));
+	xfree(big.data);
+
+	/* freeing the atlas gives its bytes back and unplaces its glyphs */
+	glyphatlas_free(conn, 0);
+	CHECK(conn->cacheUsage.bytes[CACHE_KIND_GLYPH] == 0);
+	for (i = 0, placed = 0; i < GLYPHS; i++)
+		placed += glyphatlas_placed(conn, 0, &glyphs[i]) ? 1 : 0;
+	CHECK(placed == 0);
+}
+
+static void
+test_blit(RDConnectionRef conn)
+{
+	static uint8 expected[96 * 64];
+	RDGlyphMask mask;
+	RDFontGlyph *glyph;
+	int run, i, n, x, y, gx, gy, mx, my, width, height, wrong = 0;
+	RD_BOOL inked;
+
+	for (run = 0; run < 200; run++)
+	{
+		mx = test_random() % 1000;
+		my = test_random() % 1000;
+		width = 1 + test_random() % 96;
+		height = 1 + test_random() % 64;
+		glyphatlas_begin_run(conn, &mask, mx, my, width, height);
+		memset(expected, 0, sizeof(expected));
+		inked = False;
+
+		/* glyphs in and out of the atlas, some hanging over each edge */
+		for (n = 0; n < 8; n++)
+		{
+			glyph = &glyphs[test_random() % GLYPHS];
+			if (test_random() % 2)
+				glyphatlas_place(conn, 0, glyph);
+			x = mx - 50 + (int) (test_random() % (width + 100));
+			y = my - 50 + (int) (test_random() % (height + 100));
+			glyphatlas_blit(conn, 0, glyph, x, y, &mask);
+
+			for (gy = 0; gy < glyph->height; gy++)
+				for (gx = 0; gx < glyph->width; gx++)
+				{
+					if ((x + gx < mx) || (x + gx >= mx + width) || (y + gy < my)
+					    || (y + gy >= my + height))
+						continue;
+					inked = True;
+					if (glyph_bit(glyph, gx, gy))
+						expected[(y + gy - my) * width + x + gx - mx] = 0xff;
+				}
+		}
+
+		for (i = 0; i < width * height; i++)
+			if (mask.pixels[i] != expected[i])
+				wrong++;
+		CHECK(mask.inked == inked);
+	}
+	CHECK(wrong == 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	RDConnectionRef conn = (RDConnectionRef) xmalloc(sizeof(RDConnection));
+	int i;
+
+	memset(conn, 0, sizeof(RDConnection));
+	test_placing(conn);
+	test_blit(conn);
+
+	glyphatlas_destroy(conn);
+	CHECK(conn->cacheUsage.bytes[CACHE_KIND_GLYPH] == 0);
+	CHECK(conn->glyphMask == NULL);
+	for (i = 0; i < GLYPHS; i++)
+		xfree(glyphs[i].data);
+	xfree(conn);
+	return test_result("glyphatlas_test");
+}
@@ -0,0 +1,310 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Tests for the MPPC bulk decompressor
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Known answers for each kind of code, streams mppc_expand must refuse,
+   and sessions of packets compressed here, with 8k and 64k histories,
+   that must come back as they went in. */
+
+#import "test.h"
+
+#define MPPC_8K		(RDP_MPPC_COMPRESSED)
+#define MPPC_64K	(RDP_MPPC_COMPRESSED | RDP_MPPC_BIG)
+
+#define HASH_SIZE	4096
+#define HASH_CHAIN	32
+
+typedef struct
+{
+	uint8 *data;
+	int bits;
+} BitWriter;
+
+static void
+put_bits(BitWriter * w, uint32 value, int count)
+{
+	while (count-- > 0)
+	{
+		if ((w->bits & 7) == 0)
+			w->data[w->bits >> 3] = 0;
+		if ((value >> count) & 1)
+			w->data[w->bits >> 3] |= 0x80 >> (w->bits & 7);
+		w->bits++;
+	}
+}
+
+static void
+put_literal(BitWriter * w, uint8 c)
+{
+	if (c < 0x80)
+		put_bits(w, c, 8);
+	else
+		put_bits(w, 0x100 | (c - 0x80), 9);
+}
+
+static void
+put_copy(BitWriter * w, int offset, int length, RD_BOOL big)
+{
+	int n;
+
+	if (big)
+	{
+		if (offset < 64)
+			put_bits(w, (0x1f << 6) | offset, 11);
+		else if (offset < 320)
+			put_bits(w, (0x1e << 8) | (offset - 64), 13);
+		else if (offset < 2368)
+			put_bits(w, (0xe << 11) | (offset - 320), 15);
+		else
+			put_bits(w, (0x6 << 16) | (offset - 2368), 19);
+	}
+	else
+	{
+		if (offset < 64)
+			put_bits(w, (0xf << 6) | offset, 10);
+		else if (offset < 320)
+			put_bits(w, (0xe << 8) | (offset - 64), 12);
+		else
+			put_bits(w, (0x6 << 13) | (offset - 320), 16);
+	}
+
+	/* 3 is 0; otherwise n - 1 ones, a zero and the n bits below the top
+	   one of a length of n + 1 bits */
+	if (length == 3)
+	{
+		put_bits(w, 0, 1);
+		return;
+	}
+	for (n = 2; (length >> (n + 1)) != 0; n++)
+		;
+	put_bits(w, (1 << n) - 2, n);
+	put_bits(w, length & ((1 << n) - 1), n);
+}
+
+/* A greedy compressor keeping the same history as the decompressor */
+typedef struct
+{
+	RD_BOOL big;
+	uint8 hist[RDP_MPPC_DICT_SIZE];
+	int pos;
+	int head[HASH_SIZE], prev[RDP_MPPC_DICT_SIZE];
+} Compressor;
+
+static int
+hash3(const uint8 * p)
+{
+	return ((p[0] << 8) ^ (p[1] << 4) ^ p[2]) % HASH_SIZE;
+}
+
+static void
+compressor_reset(Compressor * c)
+{
+	c->pos = 0;
+	memset(c->head, 0xff, sizeof(c->head));
+}
+
+static void
+compressor_insert(Compressor * c, int at, int end)
+{
+	if (at + 3 > end)
+		return;
+	c->prev[at] = c->head[hash3(c->hist + at)];
+	c->head[hash3(c->hist + at)] = at;
+}
+
+/* compress length bytes into out; returns the bytes written and the
+   packet's ctype */
+static int
+compress_packet(Compressor * c, const uint8 * data, int length, uint8 * out, uint8 * ctype)
+{
+	int window = c->big ? 65535 : 8191, max_length = c->big ? 65535 : 8191;
+	int history = c->big ? RDP_MPPC_DICT_SIZE : 8192;
+	int at, end, cand, chain, best, best_offset, n;
+	BitWriter w = { out, 0 };
+
+	*ctype = c->big ? MPPC_64K : MPPC_8K;
+	if (c->pos + length >= history)
+	{
+		compressor_reset(c);
+		*ctype |= RDP_MPPC_FLUSH;
+	}
+
+	memcpy(c->hist + c->pos, data, length);
+	at = c->pos;
+	end = c->pos + length;
+	while (at < end)
+	{
+		best = 0;
+		best_offset = 0;
+		if (at + 3 <= end)
+		{
+			for (cand = c->head[hash3(c->hist + at)], chain = 0; (cand >= 0) && (chain < HASH_CHAIN);
+			     cand = c->prev[cand], chain++)
+			{
+				if (at - cand > window)
+					break;
+				for (n = 0; (at + n < end) && (n < max_length) && (c->hist[cand + n] == c->hist[at + n]); n++)
+					;
+				if (n > best)
+				{
+					best = n;
+					best_offset = at - cand;
+				}
+			}
+		}
+
+		if (best >= 3)
+		{
+			put_copy(&w, best_offset, best, c->big);
+			for (n = 0; n < best; n++)
+				compressor_insert(c, at + n, end);
+			at += best;
+		}
+		else
+		{
+			put_literal(&w, c->hist[at]);
+			compressor_insert(c, at, end);
+			at++;
+		}
+	}
+	c->pos = end;
+	return (w.bits + 7) / 8;
+}
+
+static RD_BOOL
+expands_to(RDConnectionRef conn, uint8 * data, int length, uint8 ctype, const uint8 * expected, int expected_length)
+{
+	uint32 roff, rlen;
+
+	if (mppc_expand(conn, data, length, ctype, &roff, &rlen) != 0)
+		return False;
+	return (rlen == expected_length) && (memcmp(conn->mppcDict.hist + roff, expected, rlen) == 0);
+}
+
+static void
+test_vectors(RDConnectionRef conn)
+{
+	/* 7 bit literals are their own bytes */
+	uint8 low[] = { 0x61, 0x62, 0x63 };
+	/* 10 + 0x69, padded with zeros */
+	uint8 high[] = { 0xb4, 0x80 };
+	uint8 high_out[] = { 0xe9 };
+	/* abc, then 1111 000011 (offset 3) 10 10 (length 6) */
+	uint8 copy_8k[] = { 0x61, 0x62, 0x63, 0xf0, 0xe8 };
+	/* abc, then 11111 000011 (offset 3) 0 (length 3) */
+	uint8 copy_64k[] = { 0x61, 0x62, 0x63, 0xf8, 0x60 };
+	/* 10 + 0x69, padded with bits that are not zero */
+	uint8 bad_padding[] = { 0xb4, 0x81 };
+	/* a, then 11111 000011 (offset 3) 10 10 (length 6), from before the
+	   start of the history */
+	uint8 before_start[] = { 0x61, 0xf8, 0x74 };
+	uint32 roff, rlen;
+
+	CHECK(expands_to(conn, low, sizeof(low), MPPC_8K | RDP_MPPC_FLUSH, (uint8 *) "abc", 3));
+	CHECK(expands_to(conn, high, sizeof(high), MPPC_8K | RDP_MPPC_FLUSH, high_out, 1));
+	CHECK(expands_to(conn, copy_8k, sizeof(copy_8k), MPPC_8K | RDP_MPPC_FLUSH, (uint8 *) "abcabcabc", 9));
+	CHECK(expands_to(conn, copy_64k, sizeof(copy_64k), MPPC_64K | RDP_MPPC_FLUSH, (uint8 *) "abcabc", 6));
+
+	/* the next packet continues the history */
+	CHECK(expands_to(conn, low, sizeof(low), MPPC_64K, (uint8 *) "abc", 3));
+	CHECK(conn->mppcDict.roff == 9);
+
+	CHECK(mppc_expand(conn, bad_padding, sizeof(bad_padding), MPPC_8K | RDP_MPPC_FLUSH, &roff, &rlen) == -1);
+	CHECK(mppc_expand(conn, before_start, sizeof(before_start), MPPC_64K | RDP_MPPC_FLUSH, &roff, &rlen)
+	      == -1);
+
+	/* uncompressed data is used where it is */
+	CHECK(mppc_expand(conn, low, sizeof(low), 0, &roff, &rlen) == 0);
+	CHECK((roff == 0) && (rlen == sizeof(low)));
+}
+
+/* a random packet of one of a few kinds of data */
+static int
+random_packet(uint8 * data, int max)
+{
+	static const char *words[] = { "the ", "bitmap ", "cache ", "order ", "glyph ", "window ", "\r\n", "0000" };
+	int length = 1 + test_random() % max, i, run;
+
+	switch (test_random() % 4)
+	{
+		case 0:	/* noise */
+			test_random_bytes(data, length);
+			break;
+		case 1:	/* text */
+			for (i = 0; i < length; i++)
+				data[i] = words[test_random() % 8][0];
+			for (i = 0; i < length; i += run)
+			{
+				const char *word = words[test_random() % 8];
+				run = MIN((int) strlen(word), length - i);
+				memcpy(data + i, word, run);
+			}
+			break;
+		case 2:	/* runs, as in bitmaps */
+			for (i = 0; i < length; i += run)
+			{
+				run = 1 + test_random() % 200;
+				run = MIN(run, length - i);
+				memset(data + i, test_random() & 0xf0, run);
+			}
+			break;
+		default:	/* repeats at short and long distances */
+			test_random_bytes(data, MIN(length, 16));
+			for (i = 16; i < length; i++)
+				data[i] = (test_random() % 8) ? data[i - 1 - test_random() % MIN(i, 4000)] : test_random();
+			break;
+	}
+	return length;
+}
+
+static void
+test_round_trip(RDConnectionRef conn, RD_BOOL big)
+{
+	static Compressor c;
+	static uint8 packet[16384], compressed[20000];
+	int i, length, size, failed = 0;
+	uint8 ctype;
+
+	memset(&c, 0, sizeof(c));
+	c.big = big;
+	compressor_reset(&c);
+
+	for (i = 0; i < 2000; i++)
+	{
+		length = random_packet(packet, big ? sizeof(packet) : 4000);
+		size = compress_packet(&c, packet, length, compressed, &ctype);
+		if (i == 0)
+			ctype |= RDP_MPPC_FLUSH;
+		if (!expands_to(conn, compressed, size, ctype, packet, length))
+			failed++;
+	}
+	CHECK(failed == 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	RDConnectionRef conn = (RDConnectionRef) xmalloc(sizeof(RDConnection));
+
+	memset(conn, 0, sizeof(RDConnection));
+	test_vectors(conn);
+	test_round_trip(conn, False);
+	test_round_trip(conn, True);
+	xfree(conn);
+	return test_result("mppc_test");
+}
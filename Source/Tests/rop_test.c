@@ -0,0 +1,290 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Tests for the raster operations
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Every ROP3 and ROP2, through the rows and the clipped surface
+   operations, is checked against looking up each bit of each pixel in
+   the operation's truth table: bit (p << 2) | (s << 1) | d of the ROP3,
+   then the alpha bits set. The named ROP3s are checked against their
+   formulas, so that the table is read the right way round. */
+
+#import "test.h"
+
+#define OPAQUE		0xff000000
+#define WIDTH		64
+#define HEIGHT		40
+
+/* the truth table, a bit at a time */
+static uint32
+ref_rop3(uint8 rop3, uint32 pat, uint32 src, uint32 dst)
+{
+	uint32 res = 0;
+	int bit, k;
+
+	for (bit = 0; bit < 32; bit++)
+	{
+		k = (((pat >> bit) & 1) << 2) | (((src >> bit) & 1) << 1) | ((dst >> bit) & 1);
+		res |= (uint32) ((rop3 >> k) & 1) << bit;
+	}
+	return res;
+}
+
+/* a ROP2_S is the ROP3 that ignores the pattern */
+static uint8
+rop3_of_rop2_s(int opcode)
+{
+	return (opcode & 0xf) | ((opcode & 0xf) << 4);
+}
+
+/* a ROP2_P is the ROP3 that ignores the source */
+static uint8
+rop3_of_rop2_p(int opcode)
+{
+	return (opcode & 3) | ((opcode & 3) << 2) | ((opcode & 0xc) << 2) | ((opcode & 0xc) << 4);
+}
+
+static void
+test_named(void)
+{
+	uint32 p = test_random(), s = test_random(), d = test_random();
+
+	CHECK(ref_rop3(0x00, p, s, d) == 0);	/* BLACKNESS */
+	CHECK(ref_rop3(0x11, p, s, d) == ~(s | d));	/* NOTSRCERASE */
+	CHECK(ref_rop3(0x33, p, s, d) == ~s);	/* NOTSRCCOPY */
+	CHECK(ref_rop3(0x44, p, s, d) == (s & ~d));	/* SRCERASE */
+	CHECK(ref_rop3(0x55, p, s, d) == ~d);	/* DSTINVERT */
+	CHECK(ref_rop3(0x5a, p, s, d) == (p ^ d));	/* PATINVERT */
+	CHECK(ref_rop3(0x66, p, s, d) == (s ^ d));	/* SRCINVERT */
+	CHECK(ref_rop3(0x88, p, s, d) == (s & d));	/* SRCAND */
+	CHECK(ref_rop3(0xb8, p, s, d) == ((s & d) | (p & ~s)));	/* PSDPxax */
+	CHECK(ref_rop3(0xbb, p, s, d) == (~s | d));	/* MERGEPAINT */
+	CHECK(ref_rop3(0xc0, p, s, d) == (p & s));	/* MERGECOPY */
+	CHECK(ref_rop3(0xcc, p, s, d) == s);	/* SRCCOPY */
+	CHECK(ref_rop3(0xee, p, s, d) == (s | d));	/* SRCPAINT */
+	CHECK(ref_rop3(0xf0, p, s, d) == p);	/* PATCOPY */
+	CHECK(ref_rop3(0xfb, p, s, d) == (p | ~s | d));	/* PATPAINT */
+	CHECK(ref_rop3(0xff, p, s, d) == 0xffffffff);	/* WHITENESS */
+
+	CHECK(rop3_of_rop2_s(12) == 0xcc);
+	CHECK(rop3_of_rop2_s(6) == 0x66);
+	CHECK(rop3_of_rop2_p(12) == 0xf0);
+	CHECK(rop3_of_rop2_p(6) == 0x5a);
+}
+
+static void
+test_rows(void)
+{
+	uint32 dst[40], before[40], src[40], pattern[8], colour;
+	int rop3, opcode, count, offset, i, wrong = 0;
+	uint32 opaque;
+
+	for (rop3 = 0; rop3 < 256; rop3++)
+		for (count = 0; count <= 35; count++)
+		{
+			/* unaligned rows reach the four pixel loops' edges */
+			offset = test_random() % 4;
+			opaque = (count & 1) ? OPAQUE : 0;
+			test_random_bytes((uint8 *) before, sizeof(before));
+			test_random_bytes((uint8 *) src, sizeof(src));
+			test_random_bytes((uint8 *) pattern, sizeof(pattern));
+
+			memcpy(dst, before, sizeof(dst));
+			rop3_row(rop3, dst + offset, src + offset, pattern, count, opaque);
+			for (i = 0; i < count; i++)
+				if (dst[offset + i] != (ref_rop3(rop3, pattern[i & 7], src[offset + i], before[offset + i])
+							| opaque))
+					wrong++;
+
+			/* without a source, it is zero */
+			memcpy(dst, before, sizeof(dst));
+			rop3_row(rop3, dst + offset, NULL, pattern, count, opaque);
+			for (i = 0; i < count; i++)
+				if (dst[offset + i] != (ref_rop3(rop3, pattern[i & 7], 0, before[offset + i]) | opaque))
+					wrong++;
+
+			if (rop3 >= 16)
+				continue;
+			opcode = rop3;
+			colour = test_random();
+
+			memcpy(dst, before, sizeof(dst));
+			rop2_row(opcode, dst + offset, src + offset, count, opaque);
+			for (i = 0; i < count; i++)
+				if (dst[offset + i] != (ref_rop3(rop3_of_rop2_s(opcode), 0, src[offset + i], before[offset + i])
+							| opaque))
+					wrong++;
+
+			memcpy(dst, before, sizeof(dst));
+			rop2_fill_row(opcode, dst + offset, colour, count, opaque);
+			for (i = 0; i < count; i++)
+				if (dst[offset + i] != (ref_rop3(rop3_of_rop2_s(opcode), 0, colour, before[offset + i])
+							| opaque))
+					wrong++;
+
+			/* nothing past the row is touched */
+			for (i = 0; i < 40; i++)
+				if (((i < offset) || (i >= offset + count)) && (dst[i] != before[i]))
+					wrong++;
+		}
+	CHECK(wrong == 0);
+}
+
+/* a surface of opaque pixels, as the UIs keep, top down or bottom up,
+   clipped to a random rectangle inside it */
+static void
+make_surface(RDRopSurface * surface, uint32 * pixels, RD_BOOL bottom_up)
+{
+	int i, cx, cy;
+
+	for (i = 0; i < WIDTH * HEIGHT; i++)
+		pixels[i] = test_random() | OPAQUE;
+	surface->width = WIDTH;
+	surface->height = HEIGHT;
+	surface->stride = bottom_up ? -WIDTH * 4 : WIDTH * 4;
+	surface->pixels = (uint8 *) (bottom_up ? pixels + (HEIGHT - 1) * WIDTH : pixels);
+	surface->clip_left = test_random() % 20;
+	surface->clip_top = test_random() % 20;
+	cx = test_random() % WIDTH;
+	cy = test_random() % HEIGHT;
+	surface->clip_right = MIN(WIDTH, surface->clip_left + cx);
+	surface->clip_bottom = MIN(HEIGHT, surface->clip_top + cy);
+	surface->opaque = OPAQUE;
+}
+
+static uint32 *
+pixel_at(const RDRopSurface * surface, int x, int y)
+{
+	return (uint32 *) (surface->pixels + (sint64) y * surface->stride) + x;
+}
+
+static RD_BOOL
+in_clip(const RDRopSurface * surface, int x, int y)
+{
+	return (x >= surface->clip_left) && (x < surface->clip_right) && (y >= surface->clip_top)
+		&& (y < surface->clip_bottom);
+}
+
+enum
+{
+	OP_FILL,
+	OP_PATTERN,
+	OP_BLIT,
+	OP_SCREENBLT,
+	OP_TRIBLT,
+	OPS
+};
+
+static void
+test_surfaces(void)
+{
+	static uint32 pixels[WIDTH * HEIGHT], before[WIDTH * HEIGHT], source[48 * 32];
+	RDRopSurface surface, old;
+	uint32 tile[64], colour, p, s, expected;
+	int run, op, rop3 = 0, opcode, x, y, cx, cy, srcx, srcy, sx, sy, px, py, xorigin, yorigin, i, wrong = 0;
+	int src_width = 48, src_height = 32;
+	RD_BOOL has_source;
+
+	for (run = 0; run < 4000; run++)
+	{
+		op = run % OPS;
+		make_surface(&surface, pixels, (run / OPS) & 1);
+		memcpy(before, pixels, sizeof(pixels));
+		old = surface;
+		old.pixels = (uint8 *) before + (surface.pixels - (uint8 *) pixels);
+
+		/* brush tiles are opaque too */
+		for (i = 0; i < 64; i++)
+			tile[i] = test_random() | OPAQUE;
+		test_random_bytes((uint8 *) source, sizeof(source));
+		colour = test_random();
+		opcode = test_random() % 16;
+		x = (int) (test_random() % (WIDTH + 20)) - 10;
+		y = (int) (test_random() % (HEIGHT + 20)) - 10;
+		cx = test_random() % 50;
+		cy = test_random() % 30;
+		srcx = (int) (test_random() % (src_width + 10)) - 5;
+		srcy = (int) (test_random() % (src_height + 10)) - 5;
+		xorigin = test_random() % 16;
+		yorigin = test_random() % 16;
+
+		switch (op)
+		{
+			case OP_FILL:
+				rop3 = rop3_of_rop2_s(opcode);
+				rop_fill(&surface, opcode, x, y, cx, cy, colour);
+				break;
+			case OP_PATTERN:
+				rop3 = rop3_of_rop2_p(opcode);
+				rop_pattern(&surface, opcode, x, y, cx, cy, tile, xorigin, yorigin);
+				break;
+			case OP_BLIT:
+				rop3 = rop3_of_rop2_s(opcode);
+				rop_blit(&surface, opcode, x, y, cx, cy, (uint8 *) source, src_width * 4, src_width,
+					 src_height, srcx, srcy);
+				break;
+			case OP_SCREENBLT:
+				/* often overlapping itself */
+				srcx = x + (int) (test_random() % 9) - 4;
+				srcy = y + (int) (test_random() % 5) - 2;
+				rop3 = rop3_of_rop2_s(opcode);
+				rop_screenblt(&surface, opcode, x, y, cx, cy, srcx, srcy);
+				break;
+			default:
+				rop3 = test_random() & 0xff;
+				rop_triblt(&surface, rop3, x, y, cx, cy, (uint8 *) source, src_width * 4, src_width,
+					   src_height, srcx, srcy, tile, xorigin, yorigin);
+				break;
+		}
+
+		for (py = 0; py < HEIGHT; py++)
+			for (px = 0; px < WIDTH; px++)
+			{
+				expected = *pixel_at(&old, px, py);
+				sx = srcx + px - x;
+				sy = srcy + py - y;
+				p = tile[((py - yorigin) & 7) * 8 + ((px - xorigin) & 7)];
+				s = colour;
+				has_source = True;
+				if (op == OP_SCREENBLT)
+				{
+					has_source = (sx >= 0) && (sy >= 0) && (sx < WIDTH) && (sy < HEIGHT);
+					s = has_source ? *pixel_at(&old, sx, sy) : 0;
+				}
+				else if ((op == OP_BLIT) || (op == OP_TRIBLT))
+				{
+					has_source = (sx >= 0) && (sy >= 0) && (sx < src_width) && (sy < src_height);
+					s = has_source ? source[sy * src_width + sx] : 0;
+				}
+				if (has_source && in_clip(&surface, px, py) && (px >= x) && (px < x + cx) && (py >= y)
+				    && (py < y + cy))
+					expected = ref_rop3(rop3, p, s, expected) | OPAQUE;
+				if (*pixel_at(&surface, px, py) != expected)
+					wrong++;
+			}
+	}
+	CHECK(wrong == 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	test_named();
+	test_rows();
+	test_surfaces();
+	return test_result("rop_test");
+}
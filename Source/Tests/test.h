@@ -0,0 +1,69 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Checks shared by the protocol core tests
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Each test is a program, run by ctest (see CMakeLists.txt), that prints
+   the checks that fail and exits with 1 if there were any. Random inputs
+   come from a fixed seed, so that a failure can be reproduced. */
+
+#ifndef _TEST_H
+#define _TEST_H
+
+#import "rdesktop.h"
+
+static int test_failures;
+
+#define CHECK(cond) \
+{ \
+	if (!(cond)) \
+	{ \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		test_failures++; \
+	} \
+}
+
+static uint32 test_seed = 0x2545f491;
+
+/* xorshift32 */
+static inline uint32
+test_random(void)
+{
+	test_seed ^= test_seed << 13;
+	test_seed ^= test_seed >> 17;
+	test_seed ^= test_seed << 5;
+	return test_seed;
+}
+
+static inline void
+test_random_bytes(uint8 * data, int length)
+{
+	int i;
+
+	for (i = 0; i < length; i++)
+		data[i] = test_random();
+}
+
+static inline int
+test_result(const char *name)
+{
+	if (test_failures > 0)
+		fprintf(stderr, "%s: %d checks failed\n", name, test_failures);
+	return (test_failures > 0) ? 1 : 0;
+}
+
+#endif /* _TEST_H */
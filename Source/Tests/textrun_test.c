@@ -0,0 +1,310 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Tests for text runs
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Random TEXT2 orders, with fragments stored and replayed and glyphs
+   hanging off their rectangles and the screen, are rasterized into a
+   run mask and compared with the glyphs drawn one at a time, a pixel at
+   a time, the way the per-glyph drawing did before runs. Half of them
+   are drawn under a cache budget small enough to drop atlases mid-run,
+   and some use glyphs the server never sent. */
+
+#import "test.h"
+
+#define SCREEN_WIDTH	640
+#define SCREEN_HEIGHT	480
+#define FONTS		3
+#define ORDERS		2000
+
+static uint8 screen[SCREEN_WIDTH * SCREEN_HEIGHT];
+
+/* the text cache, as the reference sees it */
+static uint8 fragments[256][256];
+static int fragment_size[256];
+
+typedef struct
+{
+	int left, top, right, bottom;
+} Area;
+
+/* one glyph drawn the old way, clipped to area */
+static void
+ref_glyph(RDConnectionRef conn, uint8 font, uint8 flags, const uint8 * ttext, int *idx, int *x, int *y,
+	  const Area * area)
+{
+	RDFontGlyph *glyph = &conn->fontCache[font][ttext[*idx]];
+	int xyoffset, gx, gy, px, py;
+
+	if (!(flags & TEXT2_IMPLICIT_X))
+	{
+		xyoffset = ttext[++(*idx)];
+		if ((xyoffset & 0x80))
+		{
+			if (flags & TEXT2_VERTICAL)
+				*y += ttext[*idx + 1] | (ttext[*idx + 2] << 8);
+			else
+				*x += ttext[*idx + 1] | (ttext[*idx + 2] << 8);
+			*idx += 2;
+		}
+		else
+		{
+			if (flags & TEXT2_VERTICAL)
+				*y += xyoffset;
+			else
+				*x += xyoffset;
+		}
+	}
+
+	if (glyph->data == NULL)
+		return;
+
+	for (gy = 0; gy < glyph->height; gy++)
+		for (gx = 0; gx < glyph->width; gx++)
+		{
+			px = *x + glyph->offset + gx;
+			py = *y + glyph->baseline + gy;
+			if ((px < area->left) || (px >= area->right) || (py < area->top) || (py >= area->bottom))
+				continue;
+			if (glyph->data[gy * ((glyph->width + 7) / 8) + (gx >> 3)] & (0x80 >> (gx & 7)))
+				screen[py * SCREEN_WIDTH + px] = 0xff;
+		}
+
+	if (flags & TEXT2_IMPLICIT_X)
+		*x += glyph->width;
+}
+
+static void
+ref_text(RDConnectionRef conn, uint8 font, uint8 flags, int x, int y, const uint8 * text, int length,
+	 const Area * area)
+{
+	int i, j;
+	uint8 *entry;
+
+	for (i = 0; i < length;)
+	{
+		switch (text[i])
+		{
+			case 0xff:
+				memcpy(fragments[text[i + 1]], text, text[i + 2]);
+				fragment_size[text[i + 1]] = text[i + 2];
+				length -= i + 3;
+				text += i + 3;
+				i = 0;
+				break;
+
+			case 0xfe:
+				entry = fragments[text[i + 1]];
+				if ((entry[1] == 0) && !(flags & TEXT2_IMPLICIT_X))
+				{
+					if (flags & TEXT2_VERTICAL)
+						y += text[i + 2];
+					else
+						x += text[i + 2];
+				}
+				for (j = 0; j < fragment_size[text[i + 1]]; j++)
+					ref_glyph(conn, font, flags, entry, &j, &x, &y, area);
+				length -= i + 3;
+				text += i + 3;
+				i = 0;
+				break;
+
+			default:
+				ref_glyph(conn, font, flags, text, &i, &x, &y, area);
+				i++;
+				break;
+		}
+	}
+}
+
+/* append count glyph indices, with their positions unless implicit */
+static int
+random_glyphs(uint8 * text, int count, uint8 flags)
+{
+	int i, n = 0, step;
+
+	for (i = 0; i < count; i++)
+	{
+		text[n++] = test_random() % 0xfe;
+		if (flags & TEXT2_IMPLICIT_X)
+			continue;
+		step = test_random() % 24;
+		if (test_random() % 16 == 0)
+		{
+			/* a long step, back or forth */
+			step = (int) (test_random() % 400) - 200;
+			text[n++] = 0x80;
+			text[n++] = step & 0xff;
+			text[n++] = (step >> 8) & 0xff;
+		}
+		else
+			text[n++] = step;
+	}
+	return n;
+}
+
+/* a TEXT2 order's text, storing fragments in the eight ids from base and
+   replaying those it has stored before */
+static int
+random_text(uint8 * text, uint8 flags, int base, RD_BOOL * stored)
+{
+	int n = 0, start = 0, parts = 1 + test_random() % 4, part, id, size;
+
+	for (part = 0; part < parts; part++)
+	{
+		id = base + test_random() % 8;
+		if (stored[id] && (test_random() % 2))
+		{
+			text[n++] = 0xfe;
+			text[n++] = id;
+			text[n++] = test_random() % 32;
+			start = n;
+			continue;
+		}
+
+		n += random_glyphs(text + n, 2 + test_random() % 40, flags);
+		size = n - start;
+		if ((test_random() % 2) && (size < 256))
+		{
+			text[n++] = 0xff;
+			text[n++] = id;
+			text[n++] = size;
+			stored[id] = True;
+			start = n;
+		}
+	}
+	return n;
+}
+
+static void
+put_fonts(RDConnectionRef conn)
+{
+	uint8 data[64 * 8];
+	int font, c, width, height;
+
+	for (font = 0; font < FONTS; font++)
+		for (c = 0; c < 0xfe; c++)
+		{
+			/* leave a few glyphs of the last font out of the cache */
+			if ((font == FONTS - 1) && (c % 128 == 0))
+				continue;
+			width = test_random() % 40;
+			height = 1 + test_random() % 40;
+			test_random_bytes(data, height * ((width + 7) / 8));
+			cache_put_font(conn, font, c, (int) (test_random() % 8) - 4, -(int) (test_random() % 24),
+				       width, height, data);
+		}
+}
+
+static void
+random_area(int *x, int *y, int *cx, int *cy)
+{
+	*x = (int) (test_random() % (SCREEN_WIDTH + 100)) - 50;
+	*y = (int) (test_random() % (SCREEN_HEIGHT + 100)) - 50;
+	*cx = test_random() % 400;
+	*cy = test_random() % 100;
+}
+
+static void
+test_orders(RDConnectionRef conn)
+{
+	static uint8 text[2048];
+	RD_BOOL stored[256] = { False };
+	RDGlyphMask mask;
+	Area area;
+	int order, base, length, x, y, clipx, clipy, clipcx, clipcy, boxx, boxy, boxcx, boxcy, px, py, wrong = 0;
+	uint8 font, flags, got;
+	RD_BOOL inked, outside;
+
+	for (order = 0; order < ORDERS; order++)
+	{
+		/* for the second half, a budget nothing fits in drops atlases
+		   as runs are drawn */
+		if (order == ORDERS / 2)
+			conn->cacheUsage.budget = 1;
+
+		font = test_random() % FONTS;
+		flags = test_random() & (TEXT2_IMPLICIT_X | TEXT2_VERTICAL);
+		/* fragments are replayed with the font and flags they were
+		   stored with */
+		base = (font * 4 + ((flags & TEXT2_IMPLICIT_X) ? 2 : 0) + ((flags & TEXT2_VERTICAL) ? 1 : 0)) * 8;
+		length = random_text(text, flags, base, stored);
+		x = test_random() % SCREEN_WIDTH;
+		y = test_random() % SCREEN_HEIGHT;
+		random_area(&clipx, &clipy, &clipcx, &clipcy);
+		random_area(&boxx, &boxy, &boxcx, &boxcy);
+		if (test_random() % 2)
+			boxcx = test_random() % 2;
+
+		area.left = clipx;
+		area.top = clipy;
+		area.right = clipx + clipcx;
+		area.bottom = clipy + clipcy;
+		if (boxcx > 1)
+		{
+			area.left = MIN(area.left, boxx);
+			area.top = MIN(area.top, boxy);
+			area.right = MAX(area.right, boxx + boxcx);
+			area.bottom = MAX(area.bottom, boxy + boxcy);
+		}
+		area.left = MAX(area.left, 0);
+		area.top = MAX(area.top, 0);
+		area.right = MIN(area.right, SCREEN_WIDTH);
+		area.bottom = MIN(area.bottom, SCREEN_HEIGHT);
+
+		memset(screen, 0, sizeof(screen));
+		ref_text(conn, font, flags, x, y, text, length, &area);
+		inked = text_run_rasterize(conn, font, flags, x, y, clipx, clipy, clipcx, clipcy, boxx, boxy,
+					   boxcx, boxcy, text, length, &mask);
+
+		if (inked)
+		{
+			CHECK((mask.x >= area.left) && (mask.y >= area.top) && (mask.x + mask.width <= area.right)
+			      && (mask.y + mask.height <= area.bottom));
+		}
+		for (py = 0; py < SCREEN_HEIGHT; py++)
+			for (px = 0; px < SCREEN_WIDTH; px++)
+			{
+				outside = !inked || (px < mask.x) || (px >= mask.x + mask.width) || (py < mask.y)
+					|| (py >= mask.y + mask.height);
+				got = outside ? 0 : mask.pixels[(py - mask.y) * mask.width + px - mask.x];
+				if (got != screen[py * SCREEN_WIDTH + px])
+					wrong++;
+			}
+	}
+	CHECK(wrong == 0);
+	CHECK(conn->cacheUsage.freed[CACHE_KIND_GLYPH] > 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	RDConnectionRef conn = (RDConnectionRef) xmalloc(sizeof(RDConnection));
+
+	memset(conn, 0, sizeof(RDConnection));
+	conn->screenWidth = SCREEN_WIDTH;
+	conn->screenHeight = SCREEN_HEIGHT;
+
+	put_fonts(conn);
+	test_orders(conn);
+	CHECK(conn->textRunSize > 0);
+
+	cache_destroy(conn);
+	CHECK((conn->textRun == NULL) && (conn->textRunSize == 0));
+	xfree(conn);
+	return test_result("textrun_test");
+}
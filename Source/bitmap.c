@@ -26,6 +26,7 @@
 /* *INDENT-OFF* */
 
 #import "rdesktop.h"
+#import "bitmap_simd.h"
 
 #define CVAL(p)   (*(p++))
 #ifdef NEED_ALIGN
@@ -53,6 +54,15 @@
 	} \
 }
 
+/* handle a whole run (to the end of the current line) at once; statement uses 'run' */
+#define SPAN(statement) \
+{ \
+	int run = MIN(count, width - x); \
+	statement; \
+	count -= run; \
+	x += run; \
+}
+
 #define MASK_UPDATE() \
 { \
 	mixmask <<= 1; \
@@ -75,8 +85,11 @@ bitmap_decompress1(uint8 * output, int width, int height, uint8 * input, int siz
 	uint8 colour1 = 0, colour2 = 0;
 	uint8 mixmask, mask = 0;
 	uint8 mix = 0xff;
+	uint8 mixpat[RLE_PATTERN_SIZE];
 	int fom_mask = 0;
 
+	rle_make_pattern(mixpat, &mix, 1);
+
 	while (input < end)
 	{
 		fom_mask = 0;
@@ -142,6 +155,7 @@ bitmap_decompress1(uint8 * output, int width, int height, uint8 * input, int siz
 			case 6:	/* SetMix/Mix */
 			case 7:	/* SetMix/FillOrMix */
 				mix = CVAL(input);
+				rle_make_pattern(mixpat, &mix, 1);
 				opcode -= 5;
 				break;
 			case 9:	/* FillOrMix_1 */
@@ -184,21 +198,21 @@ bitmap_decompress1(uint8 * output, int width, int height, uint8 * input, int siz
 					}
 					if (prevline == NULL)
 					{
-						REPEAT(line[x] = 0)
+						SPAN(memset(line + x, 0, run))
 					}
 					else
 					{
-						REPEAT(line[x] = prevline[x])
+						SPAN(memcpy(line + x, prevline + x, run))
 					}
 					break;
 				case 1:	/* Mix */
 					if (prevline == NULL)
 					{
-						REPEAT(line[x] = mix)
+						SPAN(memset(line + x, mix, run))
 					}
 					else
 					{
-						REPEAT(line[x] = prevline[x] ^ mix)
+						SPAN(rle_span_xor(line + x, prevline + x, mixpat, run))
 					}
 					break;
 				case 2:	/* Fill or Mix */
@@ -226,10 +240,10 @@ bitmap_decompress1(uint8 * output, int width, int height, uint8 * input, int siz
 					}
 					break;
 				case 3:	/* Colour */
-					REPEAT(line[x] = colour2)
+					SPAN(memset(line + x, colour2, run))
 					break;
 				case 4:	/* Copy */
-					REPEAT(line[x] = CVAL(input))
+					SPAN(memcpy(line + x, input, run); input += run)
 					break;
 				case 8:	/* Bicolour */
 					REPEAT
@@ -247,10 +261,10 @@ bitmap_decompress1(uint8 * output, int width, int height, uint8 * input, int siz
 					)
 					break;
 				case 0xd:	/* White */
-					REPEAT(line[x] = 0xff)
+					SPAN(memset(line + x, 0xff, run))
 					break;
 				case 0xe:	/* Black */
-					REPEAT(line[x] = 0)
+					SPAN(memset(line + x, 0, run))
 					break;
 				default:
 					unimpl("bitmap opcode 0x%x\n", opcode);
@@ -273,8 +287,11 @@ bitmap_decompress2(uint8 * output, int width, int height, uint8 * input, int siz
 	uint16 colour1 = 0, colour2 = 0;
 	uint8 mixmask, mask = 0;
 	uint16 mix = 0xffff;
+	uint8 mixpat[RLE_PATTERN_SIZE], colpat[RLE_PATTERN_SIZE];
 	int fom_mask = 0;
 
+	rle_make_pattern(mixpat, (uint8 *) &mix, 2);
+
 	while (input < end)
 	{
 		fom_mask = 0;
@@ -336,10 +353,12 @@ bitmap_decompress2(uint8 * output, int width, int height, uint8 * input, int siz
 				CVAL2(input, colour1);
 			case 3:	/* Colour */
 				CVAL2(input, colour2);
+				rle_make_pattern(colpat, (uint8 *) &colour2, 2);
 				break;
 			case 6:	/* SetMix/Mix */
 			case 7:	/* SetMix/FillOrMix */
 				CVAL2(input, mix);
+				rle_make_pattern(mixpat, (uint8 *) &mix, 2);
 				opcode -= 5;
 				break;
 			case 9:	/* FillOrMix_1 */
@@ -382,21 +401,21 @@ bitmap_decompress2(uint8 * output, int width, int height, uint8 * input, int siz
 					}
 					if (prevline == NULL)
 					{
-						REPEAT(line[x] = 0)
+						SPAN(memset(line + x, 0, run * 2))
 					}
 					else
 					{
-						REPEAT(line[x] = prevline[x])
+						SPAN(memcpy(line + x, prevline + x, run * 2))
 					}
 					break;
 				case 1:	/* Mix */
 					if (prevline == NULL)
 					{
-						REPEAT(line[x] = mix)
+						SPAN(rle_span_fill((uint8 *) (line + x), mixpat, run * 2))
 					}
 					else
 					{
-						REPEAT(line[x] = prevline[x] ^ mix)
+						SPAN(rle_span_xor((uint8 *) (line + x), (uint8 *) (prevline + x), mixpat, run * 2))
 					}
 					break;
 				case 2:	/* Fill or Mix */
@@ -424,10 +443,10 @@ bitmap_decompress2(uint8 * output, int width, int height, uint8 * input, int siz
 					}
 					break;
 				case 3:	/* Colour */
-					REPEAT(line[x] = colour2)
+					SPAN(rle_span_fill((uint8 *) (line + x), colpat, run * 2))
 					break;
 				case 4:	/* Copy */
-					REPEAT(CVAL2(input, line[x]))
+					SPAN(memcpy(line + x, input, run * 2); input += run * 2)
 					break;
 				case 8:	/* Bicolour */
 					REPEAT
@@ -446,10 +465,10 @@ bitmap_decompress2(uint8 * output, int width, int height, uint8 * input, int siz
 					)
 					break;
 				case 0xd:	/* White */
-					REPEAT(line[x] = 0xffff)
+					SPAN(memset(line + x, 0xff, run * 2))
 					break;
 				case 0xe:	/* Black */
-					REPEAT(line[x] = 0)
+					SPAN(memset(line + x, 0, run * 2))
 					break;
 				default:
 					unimpl("bitmap opcode 0x%x\n", opcode);
@@ -472,8 +491,11 @@ bitmap_decompress3(uint8 * output, int width, int height, uint8 * input, int siz
 	uint8 colour1[3] = {0, 0, 0}, colour2[3] = {0, 0, 0};
 	uint8 mixmask, mask = 0;
 	uint8 mix[3] = {0xff, 0xff, 0xff};
+	uint8 mixpat[RLE_PATTERN_SIZE], colpat[RLE_PATTERN_SIZE];
 	int fom_mask = 0;
 
+	rle_make_pattern(mixpat, mix, 3);
+
 	while (input < end)
 	{
 		fom_mask = 0;
@@ -540,12 +562,14 @@ bitmap_decompress3(uint8 * output, int width, int height, uint8 * input, int siz
 				colour2[0] = CVAL(input);
 				colour2[1] = CVAL(input);
 				colour2[2] = CVAL(input);
+				rle_make_pattern(colpat, colour2, 3);
 				break;
 			case 6:	/* SetMix/Mix */
 			case 7:	/* SetMix/FillOrMix */
 				mix[0] = CVAL(input);
 				mix[1] = CVAL(input);
 				mix[2] = CVAL(input);
+				rle_make_pattern(mixpat, mix, 3);
 				opcode -= 5;
 				break;
 			case 9:	/* FillOrMix_1 */
@@ -599,44 +623,21 @@ bitmap_decompress3(uint8 * output, int width, int height, uint8 * input, int siz
 					}
 					if (prevline == NULL)
 					{
-						REPEAT
-						(
-							line[x * 3] = 0;
-							line[x * 3 + 1] = 0;
-							line[x * 3 + 2] = 0;
-						)
+						SPAN(memset(line + x * 3, 0, run * 3))
 					}
 					else
 					{
-						REPEAT
-						(
-							line[x * 3] = prevline[x * 3];
-							line[x * 3 + 1] = prevline[x * 3 + 1];
-							line[x * 3 + 2] = prevline[x * 3 + 2];
-						)
+						SPAN(memcpy(line + x * 3, prevline + x * 3, run * 3))
 					}
 					break;
 				case 1:	/* Mix */
 					if (prevline == NULL)
 					{
-						REPEAT
-						(
-							line[x * 3] = mix[0];
-							line[x * 3 + 1] = mix[1];
-							line[x * 3 + 2] = mix[2];
-						)
+						SPAN(rle_span_fill(line + x * 3, mixpat, run * 3))
 					}
 					else
 					{
-						REPEAT
-						(
-							line[x * 3] =
-							 prevline[x * 3] ^ mix[0];
-							line[x * 3 + 1] =
-							 prevline[x * 3 + 1] ^ mix[1];
-							line[x * 3 + 2] =
-							 prevline[x * 3 + 2] ^ mix[2];
-						)
+						SPAN(rle_span_xor(line + x * 3, prevline + x * 3, mixpat, run * 3))
 					}
 					break;
 				case 2:	/* Fill or Mix */
@@ -686,20 +687,10 @@ bitmap_decompress3(uint8 * output, int width, int height, uint8 * input, int siz
 					}
 					break;
 				case 3:	/* Colour */
-					REPEAT
-					(
-						line[x * 3] = colour2 [0];
-						line[x * 3 + 1] = colour2 [1];
-						line[x * 3 + 2] = colour2 [2];
-					)
+					SPAN(rle_span_fill(line + x * 3, colpat, run * 3))
 					break;
 				case 4:	/* Copy */
-					REPEAT
-					(
-						line[x * 3] = CVAL(input);
-						line[x * 3 + 1] = CVAL(input);
-						line[x * 3 + 2] = CVAL(input);
-					)
+					SPAN(memcpy(line + x * 3, input, run * 3); input += run * 3)
 					break;
 				case 8:	/* Bicolour */
 					REPEAT
@@ -722,20 +713,10 @@ bitmap_decompress3(uint8 * output, int width, int height, uint8 * input, int siz
 					)
 					break;
 				case 0xd:	/* White */
-					REPEAT
-					(
-						line[x * 3] = 0xff;
-						line[x * 3 + 1] = 0xff;
-						line[x * 3 + 2] = 0xff;
-					)
+					SPAN(memset(line + x * 3, 0xff, run * 3))
 					break;
 				case 0xe:	/* Black */
-					REPEAT
-					(
-						line[x * 3] = 0;
-						line[x * 3 + 1] = 0;
-						line[x * 3 + 2] = 0;
-					)
+					SPAN(memset(line + x * 3, 0, run * 3))
 					break;
 				default:
 					unimpl("bitmap opcode 0x%x\n", opcode);
@@ -746,7 +727,9 @@ bitmap_decompress3(uint8 * output, int width, int height, uint8 * input, int siz
 	return True;
 }
 
-/* decompress a colour plane */
+/* decompress a colour plane into a contiguous top-down width * height
+   buffer; returns the number of input bytes used, or -1 if the plane
+   overruns either the input or a scanline */
 static int
 process_plane(uint8 * in, int width, int height, uint8 * out, int size)
 {
@@ -761,125 +744,160 @@ process_plane(uint8 * in, int width, int height, uint8 * out, int size)
 	uint8 * last_line;
 	uint8 * this_line;
 	uint8 * org_in;
-	uint8 * org_out;
-	
+	uint8 * end;
+
 	org_in = in;
-	org_out = out;
-	last_line = 0;
-	indexh = 0;
-	while (indexh < height)
+	end = in + size;
+	last_line = NULL;
+	for (indexh = 0; indexh < height; indexh++)
 	{
-		out = (org_out + width * height * 4) - ((indexh + 1) * width * 4);
+		this_line = out + indexh * width;
 		color = 0;
-		this_line = out;
 		indexw = 0;
-		if (last_line == 0)
+		while (indexw < width)
 		{
-			while (indexw < width)
+			if (in >= end)
+				return -1;
+			code = CVAL(in);
+			replen = code & 0xf;
+			collen = (code >> 4) & 0xf;
+			revcode = (replen << 4) | collen;
+			if ((revcode <= 47) && (revcode >= 16))
+			{
+				replen = revcode;
+				collen = 0;
+			}
+			if ((indexw + collen + replen > width) || (collen > end - in))
+				return -1;
+			if (last_line == NULL)
 			{
-				code = CVAL(in);
-				replen = code & 0xf;
-				collen = (code >> 4) & 0xf;
-				revcode = (replen << 4) | collen;
-				if ((revcode <= 47) && (revcode >= 16))
-				{
-					replen = revcode;
-					collen = 0;
-				}
 				while (collen > 0)
 				{
 					color = CVAL(in);
-					*out = color;
-					out += 4;
-					indexw++;
+					this_line[indexw++] = color;
 					collen--;
 				}
-				while (replen > 0)
-				{
-					*out = color;
-					out += 4;
-					indexw++;
-					replen--;
-				}
+				memset(this_line + indexw, color, replen);
+				indexw += replen;
 			}
-		}
-		else
-		{
-			while (indexw < width)
+			else
 			{
-				code = CVAL(in);
-				replen = code & 0xf;
-				collen = (code >> 4) & 0xf;
-				revcode = (replen << 4) | collen;
-				if ((revcode <= 47) && (revcode >= 16))
-				{
-					replen = revcode;
-					collen = 0;
-				}
 				while (collen > 0)
 				{
+					/* low bit is the sign: 2n -> n, 2n + 1 -> -(n + 1) */
 					x = CVAL(in);
-					if (x & 1)
-					{
-						x = x >> 1;
-						x = x + 1;
-						color = -x;
-					}
-					else
-					{
-						x = x >> 1;
-						color = x;
-					}
-					x = last_line[indexw * 4] + color;
-					*out = x;
-					out += 4;
+					color = (x >> 1) ^ -(x & 1);
+					this_line[indexw] = last_line[indexw] + color;
 					indexw++;
 					collen--;
 				}
-				while (replen > 0)
+				if (color == 0)
 				{
-					x = last_line[indexw * 4] + color;
-					*out = x;
-					out += 4;
-					indexw++;
-					replen--;
+					memcpy(this_line + indexw, last_line + indexw, replen);
+					indexw += replen;
+				}
+				else
+				{
+					while (replen > 0)
+					{
+						this_line[indexw] = last_line[indexw] + color;
+						indexw++;
+						replen--;
+					}
 				}
 			}
 		}
-		indexh++;
 		last_line = this_line;
 	}
 	return (int) (in - org_in);
 }
 
-/* 4 byte bitmap decompress */
-static RD_BOOL
-bitmap_decompress4(uint8 * output, int width, int height, uint8 * input, int size)
+/* interleave decoded planes into bottom-up 32 bit scanlines */
+static void
+planar_interleave(uint8 * output, int width, int height, uint8 * a, uint8 * r, uint8 * g, uint8 * b)
 {
-	int code;
+	uint8 *out;
+	int x, y, o;
+
+	for (y = 0; y < height; y++)
+	{
+		out = output + (height - 1 - y) * width * 4;
+		o = y * width;
+		x = 0;
+#ifdef BITMAP_SSE2
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i va = _mm_loadu_si128((const __m128i *) (a + o + x));
+			__m128i vr = _mm_loadu_si128((const __m128i *) (r + o + x));
+			__m128i vg = _mm_loadu_si128((const __m128i *) (g + o + x));
+			__m128i vb = _mm_loadu_si128((const __m128i *) (b + o + x));
+			__m128i bg_lo = _mm_unpacklo_epi8(vb, vg);
+			__m128i bg_hi = _mm_unpackhi_epi8(vb, vg);
+			__m128i ra_lo = _mm_unpacklo_epi8(vr, va);
+			__m128i ra_hi = _mm_unpackhi_epi8(vr, va);
+
+			_mm_storeu_si128((__m128i *) (out + x * 4), _mm_unpacklo_epi16(bg_lo, ra_lo));
+			_mm_storeu_si128((__m128i *) (out + x * 4 + 16), _mm_unpackhi_epi16(bg_lo, ra_lo));
+			_mm_storeu_si128((__m128i *) (out + x * 4 + 32), _mm_unpacklo_epi16(bg_hi, ra_hi));
+			_mm_storeu_si128((__m128i *) (out + x * 4 + 48), _mm_unpackhi_epi16(bg_hi, ra_hi));
+		}
+#endif
+		for (; x < width; x++)
+		{
+			out[x * 4] = b[o + x];
+			out[x * 4 + 1] = g[o + x];
+			out[x * 4 + 2] = r[o + x];
+			out[x * 4 + 3] = a[o + x];
+		}
+	}
+}
+
+/* decode the four planes of a 32 bit planar bitmap into contiguous
+   top-down alpha, red, green and blue planes of width * height bytes each */
+RD_BOOL
+bitmap_decompress_planes(uint8 * planes, int width, int height, uint8 * input, int size)
+{
+	int plane_size = width * height;
 	int bytes_pro;
 	int total_pro;
-	
-	code = CVAL(input);
-	if (code != 0x10)
-	{
+	int i;
+
+	if ((size < 1) || (CVAL(input) != 0x10))
 		return False;
-	}
+
 	total_pro = 1;
-	bytes_pro = process_plane(input, width, height, output + 3, size - total_pro);
-	total_pro += bytes_pro;
-	input += bytes_pro;
-	bytes_pro = process_plane(input, width, height, output + 2, size - total_pro);
-	total_pro += bytes_pro;
-	input += bytes_pro;
-	bytes_pro = process_plane(input, width, height, output + 1, size - total_pro);
-	total_pro += bytes_pro;
-	input += bytes_pro;
-	bytes_pro = process_plane(input, width, height, output + 0, size - total_pro);
-	total_pro += bytes_pro;
+	for (i = 0; i < 4; i++)
+	{
+		bytes_pro = process_plane(input, width, height, planes + i * plane_size, size - total_pro);
+		if (bytes_pro < 0)
+			return False;
+		total_pro += bytes_pro;
+		input += bytes_pro;
+	}
 	return size == total_pro;
 }
 
+/* 4 byte bitmap decompress */
+static RD_BOOL
+bitmap_decompress4(uint8 * output, int width, int height, uint8 * input, int size)
+{
+	uint8 scratch[PLANAR_STACK_PIXELS * 4];
+	uint8 *planes;
+	int plane_size = width * height;
+	RD_BOOL rv;
+
+	planes = (plane_size <= PLANAR_STACK_PIXELS) ? scratch : xmalloc(plane_size * 4);
+
+	rv = bitmap_decompress_planes(planes, width, height, input, size);
+	if (rv)
+		planar_interleave(output, width, height, planes, planes + plane_size,
+				  planes + plane_size * 2, planes + plane_size * 3);
+
+	if (planes != scratch)
+		xfree(planes);
+	return rv;
+}
+
 /* main decompress function */
 RD_BOOL
 bitmap_decompress(uint8 * output, int width, int height, uint8 * input, int size, int Bpp)
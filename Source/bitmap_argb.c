@@ -0,0 +1,556 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Bitmap decompression straight into the 32 bit ARGB backing store format
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* The RLE decoder here follows bitmap_decompress1/2/3 in bitmap.c, but is
+   written once for every pixel size. It only keeps two native scanlines
+   (the current one and the one the opcodes refer back to), and each
+   scanline is converted into the destination as soon as it is complete.
+   When changing the opcode handling in bitmap.c, make the same change here. */
+
+/* indent is confused by this file */
+/* *INDENT-OFF* */
+
+#import "rdesktop.h"
+#import "bitmap_simd.h"
+
+#define CVAL(p)   (*(p++))
+
+/* native scanline pairs up to this many bytes each are kept on the stack */
+#define ROW_STACK_BYTES 4096
+
+/* per-pixel loop, bounded by the run and the end of the current line */
+#define PIXELS(statement) \
+{ \
+	while ((count > 0) && (x < width)) \
+	{ \
+		statement; \
+		count--; \
+		x++; \
+	} \
+}
+
+/* handle a whole run (to the end of the current line) at once; statement uses 'run' */
+#define SPAN(statement) \
+{ \
+	int run = MIN(count, width - x); \
+	statement; \
+	count -= run; \
+	x += run; \
+}
+
+#define MASK_UPDATE() \
+{ \
+	mixmask <<= 1; \
+	if (mixmask == 0) \
+	{ \
+		mask = fom_mask ? fom_mask : CVAL(input); \
+		mixmask = 1; \
+	} \
+}
+
+typedef void (*row_convert_t) (uint8 * out, const uint8 * in, int width, const uint32 * colour_map);
+
+/* 5 and 6 bit channels scaled to 8 bits, rounded */
+static const uint8 expand5[32] = {
+	0x00, 0x08, 0x10, 0x19, 0x21, 0x29, 0x31, 0x3a,
+	0x42, 0x4a, 0x52, 0x5a, 0x63, 0x6b, 0x73, 0x7b,
+	0x84, 0x8c, 0x94, 0x9c, 0xa5, 0xad, 0xb5, 0xbd,
+	0xc5, 0xce, 0xd6, 0xde, 0xe6, 0xef, 0xf7, 0xff
+};
+
+static const uint8 expand6[64] = {
+	0x00, 0x04, 0x08, 0x0c, 0x10, 0x14, 0x18, 0x1c,
+	0x20, 0x24, 0x28, 0x2d, 0x31, 0x35, 0x39, 0x3d,
+	0x41, 0x45, 0x49, 0x4d, 0x51, 0x55, 0x59, 0x5d,
+	0x61, 0x65, 0x69, 0x6d, 0x71, 0x75, 0x79, 0x7d,
+	0x82, 0x86, 0x8a, 0x8e, 0x92, 0x96, 0x9a, 0x9e,
+	0xa2, 0xa6, 0xaa, 0xae, 0xb2, 0xb6, 0xba, 0xbe,
+	0xc2, 0xc6, 0xca, 0xce, 0xd2, 0xd7, 0xdb, 0xdf,
+	0xe3, 0xe7, 0xeb, 0xef, 0xf3, 0xf7, 0xfb, 0xff
+};
+
+/* Scanline converters. The destination is A, R, G, B in memory order, with
+   the alpha channel always opaque. */
+
+static void
+convert_row_8(uint8 * out, const uint8 * in, int width, const uint32 * colour_map)
+{
+	uint32 c;
+	int x;
+
+	for (x = 0; x < width; x++)
+	{
+		c = colour_map[in[x]];
+		out[0] = 0xff;
+		out[1] = c & 0xff;
+		out[2] = (c >> 8) & 0xff;
+		out[3] = (c >> 16) & 0xff;
+		out += 4;
+	}
+}
+
+static void
+convert_row_15(uint8 * out, const uint8 * in, int width, const uint32 * colour_map)
+{
+	uint16 c;
+	int x;
+
+	for (x = 0; x < width; x++)
+	{
+		c = in[0] | (in[1] << 8);
+		out[0] = 0xff;
+		out[1] = expand5[(c >> 10) & 0x1f];
+		out[2] = expand5[(c >> 5) & 0x1f];
+		out[3] = expand5[c & 0x1f];
+		in += 2;
+		out += 4;
+	}
+}
+
+static void
+convert_row_16(uint8 * out, const uint8 * in, int width, const uint32 * colour_map)
+{
+	uint16 c;
+	int x;
+
+	for (x = 0; x < width; x++)
+	{
+		c = in[0] | (in[1] << 8);
+		out[0] = 0xff;
+		out[1] = expand5[(c >> 11) & 0x1f];
+		out[2] = expand6[(c >> 5) & 0x3f];
+		out[3] = expand5[c & 0x1f];
+		in += 2;
+		out += 4;
+	}
+}
+
+static void
+convert_row_24(uint8 * out, const uint8 * in, int width, const uint32 * colour_map)
+{
+	int x;
+
+	for (x = 0; x < width; x++)
+	{
+		out[0] = 0xff;
+		out[1] = in[2];
+		out[2] = in[1];
+		out[3] = in[0];
+		in += 3;
+		out += 4;
+	}
+}
+
+static void
+convert_row_32(uint8 * out, const uint8 * in, int width, const uint32 * colour_map)
+{
+	int x = 0;
+#ifdef BITMAP_SSE2
+	/* B, G, R, X -> X, R, G, B is a byte swap of each pixel */
+	__m128i v, opaque = _mm_set1_epi32(0xff);
+
+	for (; x + 4 <= width; x += 4)
+	{
+		v = _mm_loadu_si128((const __m128i *) (in + x * 4));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+		_mm_storeu_si128((__m128i *) (out + x * 4), _mm_or_si128(v, opaque));
+	}
+#endif
+	for (; x < width; x++)
+	{
+		out[x * 4] = 0xff;
+		out[x * 4 + 1] = in[x * 4 + 2];
+		out[x * 4 + 2] = in[x * 4 + 1];
+		out[x * 4 + 3] = in[x * 4];
+	}
+}
+
+static row_convert_t
+row_converter(int bpp)
+{
+	switch (bpp)
+	{
+		case 8:
+			return convert_row_8;
+		case 15:
+			return convert_row_15;
+		case 16:
+			return convert_row_16;
+		case 24:
+			return convert_row_24;
+		case 32:
+			return convert_row_32;
+		default:
+			unimpl("bpp %d\n", bpp);
+			return NULL;
+	}
+}
+
+static inline void
+pixel_copy(uint8 * dst, const uint8 * src, int Bpp)
+{
+	dst[0] = src[0];
+	if (Bpp > 1)
+	{
+		dst[1] = src[1];
+		if (Bpp > 2)
+			dst[2] = src[2];
+	}
+}
+
+static inline void
+pixel_xor(uint8 * dst, const uint8 * src, const uint8 * mix, int Bpp)
+{
+	dst[0] = src[0] ^ mix[0];
+	if (Bpp > 1)
+	{
+		dst[1] = src[1] ^ mix[1];
+		if (Bpp > 2)
+			dst[2] = src[2] ^ mix[2];
+	}
+}
+
+/* 1, 2 and 3 byte RLE decompress into ARGB */
+static RD_BOOL
+rle_decompress_argb(uint8 * output, int stride, int width, int height, uint8 * input, int size,
+		    int Bpp, row_convert_t convert, const uint32 * colour_map)
+{
+	uint8 *end = input + size;
+	uint8 scratch[ROW_STACK_BYTES * 2];
+	uint8 *rows, *prevline = NULL, *line = NULL;
+	int opcode, count, offset, isfillormix, x = width, y = height;
+	int lastopcode = -1, insertmix = False, bicolour = False;
+	int rowbytes = width * Bpp;
+	uint8 code;
+	uint8 colour1[3] = {0, 0, 0}, colour2[3] = {0, 0, 0};
+	uint8 mixmask, mask = 0;
+	uint8 mix[3] = {0xff, 0xff, 0xff};
+	uint8 mixpat[RLE_PATTERN_SIZE], colpat[RLE_PATTERN_SIZE];
+	static const uint8 black[3] = {0, 0, 0};
+	int fom_mask = 0;
+	RD_BOOL rv = True;
+
+	rows = (rowbytes <= ROW_STACK_BYTES) ? scratch : xmalloc(rowbytes * 2);
+	rle_make_pattern(mixpat, mix, Bpp);
+	rle_make_pattern(colpat, colour2, Bpp);
+
+	while (input < end)
+	{
+		fom_mask = 0;
+		code = CVAL(input);
+		opcode = code >> 4;
+		/* Handle different opcode forms */
+		switch (opcode)
+		{
+			case 0xc:
+			case 0xd:
+			case 0xe:
+				opcode -= 6;
+				count = code & 0xf;
+				offset = 16;
+				break;
+			case 0xf:
+				opcode = code & 0xf;
+				if (opcode < 9)
+				{
+					count = CVAL(input);
+					count |= CVAL(input) << 8;
+				}
+				else
+				{
+					count = (opcode < 0xb) ? 8 : 1;
+				}
+				offset = 0;
+				break;
+			default:
+				opcode >>= 1;
+				count = code & 0x1f;
+				offset = 32;
+				break;
+		}
+		/* Handle strange cases for counts */
+		if (offset != 0)
+		{
+			isfillormix = ((opcode == 2) || (opcode == 7));
+			if (count == 0)
+			{
+				if (isfillormix)
+					count = CVAL(input) + 1;
+				else
+					count = CVAL(input) + offset;
+			}
+			else if (isfillormix)
+			{
+				count <<= 3;
+			}
+		}
+		/* Read preliminary data */
+		switch (opcode)
+		{
+			case 0:	/* Fill */
+				if ((lastopcode == opcode) && !((x == width) && (prevline == NULL)))
+					insertmix = True;
+				break;
+			case 8:	/* Bicolour */
+				memcpy(colour1, input, Bpp);
+				input += Bpp;
+			case 3:	/* Colour */
+				memcpy(colour2, input, Bpp);
+				input += Bpp;
+				rle_make_pattern(colpat, colour2, Bpp);
+				break;
+			case 6:	/* SetMix/Mix */
+			case 7:	/* SetMix/FillOrMix */
+				memcpy(mix, input, Bpp);
+				input += Bpp;
+				rle_make_pattern(mixpat, mix, Bpp);
+				opcode -= 5;
+				break;
+			case 9:	/* FillOrMix_1 */
+				mask = 0x03;
+				opcode = 0x02;
+				fom_mask = 3;
+				break;
+			case 0x0a:	/* FillOrMix_2 */
+				mask = 0x05;
+				opcode = 0x02;
+				fom_mask = 5;
+				break;
+		}
+		lastopcode = opcode;
+		mixmask = 0;
+		/* Output body */
+		while (count > 0)
+		{
+			if (x >= width)
+			{
+				if (y <= 0)
+				{
+					rv = False;
+					goto out;
+				}
+				if (line != NULL)
+					convert(output + y * stride, line, width, colour_map);
+				x = 0;
+				y--;
+				prevline = line;
+				line = rows + (y & 1) * rowbytes;
+			}
+			switch (opcode)
+			{
+				case 0:	/* Fill */
+					if (insertmix)
+					{
+						if (prevline == NULL)
+							pixel_copy(line + x * Bpp, mix, Bpp);
+						else
+							pixel_xor(line + x * Bpp, prevline + x * Bpp, mix, Bpp);
+						insertmix = False;
+						count--;
+						x++;
+					}
+					if (prevline == NULL)
+					{
+						SPAN(memset(line + x * Bpp, 0, run * Bpp))
+					}
+					else
+					{
+						SPAN(memcpy(line + x * Bpp, prevline + x * Bpp, run * Bpp))
+					}
+					break;
+				case 1:	/* Mix */
+					if (prevline == NULL)
+					{
+						SPAN(rle_span_fill(line + x * Bpp, mixpat, run * Bpp))
+					}
+					else
+					{
+						SPAN(rle_span_xor(line + x * Bpp, prevline + x * Bpp, mixpat, run * Bpp))
+					}
+					break;
+				case 2:	/* Fill or Mix */
+					if (prevline == NULL)
+					{
+						PIXELS
+						(
+							MASK_UPDATE();
+							pixel_copy(line + x * Bpp, (mask & mixmask) ? mix : black, Bpp);
+						)
+					}
+					else
+					{
+						PIXELS
+						(
+							MASK_UPDATE();
+							if (mask & mixmask)
+								pixel_xor(line + x * Bpp, prevline + x * Bpp, mix, Bpp);
+							else
+								pixel_copy(line + x * Bpp, prevline + x * Bpp, Bpp);
+						)
+					}
+					break;
+				case 3:	/* Colour */
+					SPAN(rle_span_fill(line + x * Bpp, colpat, run * Bpp))
+					break;
+				case 4:	/* Copy */
+					SPAN(memcpy(line + x * Bpp, input, run * Bpp); input += run * Bpp)
+					break;
+				case 8:	/* Bicolour */
+					PIXELS
+					(
+						if (bicolour)
+						{
+							pixel_copy(line + x * Bpp, colour2, Bpp);
+							bicolour = False;
+						}
+						else
+						{
+							pixel_copy(line + x * Bpp, colour1, Bpp);
+							bicolour = True;
+							count++;
+						}
+					)
+					break;
+				case 0xd:	/* White */
+					SPAN(memset(line + x * Bpp, 0xff, run * Bpp))
+					break;
+				case 0xe:	/* Black */
+					SPAN(memset(line + x * Bpp, 0, run * Bpp))
+					break;
+				default:
+					unimpl("bitmap opcode 0x%x\n", opcode);
+					rv = False;
+					goto out;
+			}
+		}
+	}
+
+	if (line != NULL)
+		convert(output + y * stride, line, width, colour_map);
+
+      out:
+	if (rows != scratch)
+		xfree(rows);
+	return rv;
+}
+
+/* 4 byte (planar) decompress into ARGB */
+static RD_BOOL
+planar_decompress_argb(uint8 * output, int stride, int width, int height, uint8 * input, int size)
+{
+	uint8 scratch[PLANAR_STACK_PIXELS * 4];
+	uint8 *planes, *r, *g, *b, *out;
+	int plane_size = width * height;
+	int x, y, o;
+	RD_BOOL rv;
+
+	planes = (plane_size <= PLANAR_STACK_PIXELS) ? scratch : xmalloc(plane_size * 4);
+
+	rv = bitmap_decompress_planes(planes, width, height, input, size);
+	if (rv)
+	{
+		/* the alpha plane is ignored, as for every other depth */
+		r = planes + plane_size;
+		g = planes + plane_size * 2;
+		b = planes + plane_size * 3;
+		for (y = 0; y < height; y++)
+		{
+			out = output + (height - 1 - y) * stride;
+			o = y * width;
+			x = 0;
+#ifdef BITMAP_SSE2
+			for (; x + 16 <= width; x += 16)
+			{
+				__m128i opaque = _mm_set1_epi8((char) 0xff);
+				__m128i vr = _mm_loadu_si128((const __m128i *) (r + o + x));
+				__m128i vg = _mm_loadu_si128((const __m128i *) (g + o + x));
+				__m128i vb = _mm_loadu_si128((const __m128i *) (b + o + x));
+				__m128i ar_lo = _mm_unpacklo_epi8(opaque, vr);
+				__m128i ar_hi = _mm_unpackhi_epi8(opaque, vr);
+				__m128i gb_lo = _mm_unpacklo_epi8(vg, vb);
+				__m128i gb_hi = _mm_unpackhi_epi8(vg, vb);
+
+				_mm_storeu_si128((__m128i *) (out + x * 4), _mm_unpacklo_epi16(ar_lo, gb_lo));
+				_mm_storeu_si128((__m128i *) (out + x * 4 + 16), _mm_unpackhi_epi16(ar_lo, gb_lo));
+				_mm_storeu_si128((__m128i *) (out + x * 4 + 32), _mm_unpacklo_epi16(ar_hi, gb_hi));
+				_mm_storeu_si128((__m128i *) (out + x * 4 + 48), _mm_unpackhi_epi16(ar_hi, gb_hi));
+			}
+#endif
+			for (; x < width; x++)
+			{
+				out[x * 4] = 0xff;
+				out[x * 4 + 1] = r[o + x];
+				out[x * 4 + 2] = g[o + x];
+				out[x * 4 + 3] = b[o + x];
+			}
+		}
+	}
+
+	if (planes != scratch)
+		xfree(planes);
+	return rv;
+}
+
+/* Decompress a bitmap of the given bits per pixel straight into 32 bit ARGB.
+   output points at the destination's top-left pixel and stride is its bytes
+   per row (0 for width * 4), so a bitmap can be decoded directly into a
+   region of a larger surface. */
+RD_BOOL
+bitmap_decompress_argb(uint8 * output, int stride, int width, int height, uint8 * input, int size,
+		       int bpp, const uint32 * colour_map)
+{
+	row_convert_t convert;
+
+	if (stride == 0)
+		stride = width * 4;
+
+	if (bpp == 32)
+		return planar_decompress_argb(output, stride, width, height, input, size);
+
+	convert = row_converter(bpp);
+	if (convert == NULL)
+		return False;
+
+	return rle_decompress_argb(output, stride, width, height, input, size, (bpp + 7) / 8,
+				   convert, colour_map);
+}
+
+/* Convert uncompressed pixels into 32 bit ARGB. Source rows are in_stride
+   bytes apart; pass the last row and a negative in_stride to flip bottom-up
+   data on the way. */
+void
+bitmap_convert_argb(uint8 * output, int stride, const uint8 * input, int in_stride, int width,
+		    int height, int bpp, const uint32 * colour_map)
+{
+	row_convert_t convert;
+	int y;
+
+	if (stride == 0)
+		stride = width * 4;
+
+	convert = row_converter(bpp);
+	if (convert == NULL)
+		return;
+
+	for (y = 0; y < height; y++)
+		convert(output + y * stride, input + y * in_stride, width, colour_map);
+}
+
+/* *INDENT-ON* */
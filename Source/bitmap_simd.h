@@ -0,0 +1,108 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Span kernels shared by the bitmap decoders
+   Copyright (C) Matthew Chapman 1999-2008
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#ifndef _BITMAP_SIMD_H
+#define _BITMAP_SIMD_H
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define BITMAP_SSE2
+#endif
+
+/* Planar tiles up to this many pixels are decoded on the stack */
+#define PLANAR_STACK_PIXELS (64 * 64)
+
+/* The long-run opcodes (fill, mix, colour, copy, white, black) are done a
+   line segment at a time. Pixel patterns are replicated into a 48 byte
+   buffer (a multiple of 1, 2 and 3 bytes per pixel, and of the 16 byte SSE
+   register width) so the same span routines serve every colour depth. */
+#define RLE_PATTERN_SIZE 48
+
+static inline void
+rle_make_pattern(uint8 * pattern, const uint8 * pixel, int Bpp)
+{
+	int i;
+
+	for (i = 0; i < RLE_PATTERN_SIZE; i++)
+		pattern[i] = pixel[i % Bpp];
+}
+
+/* dst = pattern, len bytes */
+static inline void
+rle_span_fill(uint8 * dst, const uint8 * pattern, int len)
+{
+	int i = 0, j;
+#ifdef BITMAP_SSE2
+	__m128i p0, p1, p2;
+
+	if (len >= RLE_PATTERN_SIZE)
+	{
+		p0 = _mm_loadu_si128((const __m128i *) pattern);
+		p1 = _mm_loadu_si128((const __m128i *) (pattern + 16));
+		p2 = _mm_loadu_si128((const __m128i *) (pattern + 32));
+		for (; i + RLE_PATTERN_SIZE <= len; i += RLE_PATTERN_SIZE)
+		{
+			_mm_storeu_si128((__m128i *) (dst + i), p0);
+			_mm_storeu_si128((__m128i *) (dst + i + 16), p1);
+			_mm_storeu_si128((__m128i *) (dst + i + 32), p2);
+		}
+	}
+#endif
+	for (j = 0; i < len; i++)
+	{
+		dst[i] = pattern[j];
+		if (++j == RLE_PATTERN_SIZE)
+			j = 0;
+	}
+}
+
+/* dst = src ^ pattern, len bytes */
+static inline void
+rle_span_xor(uint8 * dst, const uint8 * src, const uint8 * pattern, int len)
+{
+	int i = 0, j;
+#ifdef BITMAP_SSE2
+	__m128i p0, p1, p2;
+
+	if (len >= RLE_PATTERN_SIZE)
+	{
+		p0 = _mm_loadu_si128((const __m128i *) pattern);
+		p1 = _mm_loadu_si128((const __m128i *) (pattern + 16));
+		p2 = _mm_loadu_si128((const __m128i *) (pattern + 32));
+		for (; i + RLE_PATTERN_SIZE <= len; i += RLE_PATTERN_SIZE)
+		{
+			_mm_storeu_si128((__m128i *) (dst + i),
+					 _mm_xor_si128(_mm_loadu_si128((const __m128i *) (src + i)), p0));
+			_mm_storeu_si128((__m128i *) (dst + i + 16),
+					 _mm_xor_si128(_mm_loadu_si128((const __m128i *) (src + i + 16)), p1));
+			_mm_storeu_si128((__m128i *) (dst + i + 32),
+					 _mm_xor_si128(_mm_loadu_si128((const __m128i *) (src + i + 32)), p2));
+		}
+	}
+#endif
+	for (j = 0; i < len; i++)
+	{
+		dst[i] = src[i] ^ pattern[j];
+		if (++j == RLE_PATTERN_SIZE)
+			j = 0;
+	}
+}
+
+#endif /* _BITMAP_SIMD_H */
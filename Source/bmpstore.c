@@ -0,0 +1,341 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Process-wide store of decoded bitmaps
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Sessions to the same servers are sent the same bitmaps: toolbars,
+   icons, window frames. The bitmap cache orders put them in per
+   connection cache slots, but the decoded bitmaps behind the slots are
+   shared through this store, keyed by a SHA-256 digest of the encoded
+   data, and freed when the last slot lets go. Keys are compared whole,
+   so bitmaps are only shared when their data is the same. Content is
+   only keyed while a second connection is attached (bmpstore_attach):
+   with one there is nothing to share with, and every cache order would
+   pay for the digest.
+
+   Bitmaps the server names by a persistent key are keyed by a digest of
+   that key and the connection's scope, the server and the account the
+   session logs on with (bmpstore_scope): persistent keys are only
+   unique on the server that made them, and another server could send
+   a different bitmap under the same key.
+
+   Any number of slots, in any connections, may hold references to one
+   bitmap; bmpstore_release drops one of them. Bitmaps that never went
+   through the store are released with the same call, so the bitmap cache
+   can release whatever its slots hold. 8 bpp bitmaps are not shared,
+   since their colours depend on each connection's palette.
+
+   Each connection charges the bitmaps it holds to its own budget, but
+   the store charges a stored bitmap to the process once, when it is
+   stored, and takes it off when the last reference goes.
+
+   The store is safe to use from every connection thread at once. */
+
+#import "rdesktop.h"
+#import "ssl.h"
+
+#include <pthread.h>
+
+#define BMPSTORE_BUCKETS	4096
+
+typedef struct _RDStoredBitmap
+{
+	RDBitmapKey key;
+	RDBitmapRef bitmap;
+	int refs;
+	struct _RDStoredBitmap *next_by_key, *next_by_bitmap;
+} RDStoredBitmap;
+
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static RDStoredBitmap *by_key[BMPSTORE_BUCKETS];
+static RDStoredBitmap *by_bitmap[BMPSTORE_BUCKETS];
+static uint32 store_count, store_refs, store_connections;
+
+static uint64
+bmpstore_mix(uint64 h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static uint32
+bmpstore_key_bucket(const RDBitmapKey * key)
+{
+	uint32 h;
+
+	memcpy(&h, key->digest, sizeof(h));
+	return (h ^ key->length ^ (key->width << 16) ^ key->height) % BMPSTORE_BUCKETS;
+}
+
+static uint32
+bmpstore_bitmap_bucket(RDBitmapRef bitmap)
+{
+	return bmpstore_mix((uint64) (uintptr_t) bitmap) % BMPSTORE_BUCKETS;
+}
+
+static RD_BOOL
+bmpstore_key_equal(const RDBitmapKey * a, const RDBitmapKey * b)
+{
+	return (memcmp(a->digest, b->digest, sizeof(a->digest)) == 0) && (a->length == b->length)
+		&& (a->width == b->width) && (a->height == b->height) && (a->bpp == b->bpp)
+		&& (a->source == b->source);
+}
+
+/* Set the scope of a connection's persistent keys, before it connects
+   to server */
+void
+bmpstore_scope(RDConnectionRef conn, const char *server, NSString * domain)
+{
+	SSL_SHA256 sha256;
+	uint8 field[4];
+	int length;
+
+	ssl_sha256_init(&sha256);
+	ssl_sha256_update(&sha256, (const uint8 *) server, strlen(server) + 1);
+	field[0] = conn->tcpPort & 0xff;
+	field[1] = (conn->tcpPort >> 8) & 0xff;
+	ssl_sha256_update(&sha256, field, 2);
+
+	length = CRDGetUTF16LEStringLength(domain);
+	field[0] = length & 0xff;
+	field[1] = (length >> 8) & 0xff;
+	field[2] = (length >> 16) & 0xff;
+	field[3] = (length >> 24) & 0xff;
+	ssl_sha256_update(&sha256, field, 4);
+	ssl_sha256_update(&sha256, (const uint8 *) CRDMakeUTF16LEString(domain), length);
+
+	ssl_sha256_update(&sha256, (const uint8 *) conn->username, strlen(conn->username) + 1);
+	ssl_sha256_final(&sha256, conn->bmpstoreScope);
+}
+
+/* Count a connection as sharing bitmaps through the store, until
+   bmpstore_detach */
+void
+bmpstore_attach(RDConnectionRef conn)
+{
+	if (conn->bmpstoreAttached)
+		return;
+
+	pthread_mutex_lock(&store_lock);
+	store_connections++;
+	pthread_mutex_unlock(&store_lock);
+	conn->bmpstoreAttached = True;
+}
+
+void
+bmpstore_detach(RDConnectionRef conn)
+{
+	if (!conn->bmpstoreAttached)
+		return;
+
+	pthread_mutex_lock(&store_lock);
+	store_connections--;
+	pthread_mutex_unlock(&store_lock);
+	conn->bmpstoreAttached = False;
+}
+
+/* Key a bitmap by the persistent key the server sent with it. Returns
+   False if the bitmap cannot be shared. */
+RD_BOOL
+bmpstore_key_persistent(RDConnectionRef conn, RDBitmapKey * key, const uint8 * persistent_key, int width,
+			int height, int bpp)
+{
+	SSL_SHA256 sha256;
+
+	if (bpp <= 8)
+		return False;
+
+	memset(key, 0, sizeof(RDBitmapKey));
+	ssl_sha256_init(&sha256);
+	ssl_sha256_update(&sha256, conn->bmpstoreScope, sizeof(conn->bmpstoreScope));
+	ssl_sha256_update(&sha256, persistent_key, sizeof(RDHashKey));
+	ssl_sha256_final(&sha256, key->digest);
+	key->width = width;
+	key->height = height;
+	key->bpp = bpp;
+	key->source = BMPSTORE_PERSISTENT;
+	return True;
+}
+
+/* Key a bitmap by a digest of its encoded data, as source says it is
+   encoded. Returns False if the bitmap cannot be shared, or there is no
+   other connection to share it with. */
+RD_BOOL
+bmpstore_key_content(RDBitmapKey * key, uint8 source, const uint8 * data, int length, int width,
+		     int height, int bpp)
+{
+	SSL_SHA256 sha256;
+	RD_BOOL alone;
+
+	if (bpp <= 8)
+		return False;
+
+	pthread_mutex_lock(&store_lock);
+	alone = (store_connections < 2);
+	pthread_mutex_unlock(&store_lock);
+	if (alone)
+		return False;
+
+	memset(key, 0, sizeof(RDBitmapKey));
+	ssl_sha256_init(&sha256);
+	ssl_sha256_update(&sha256, data, length);
+	ssl_sha256_final(&sha256, key->digest);
+	key->length = length;
+	key->width = width;
+	key->height = height;
+	key->bpp = bpp;
+	key->source = source;
+	return True;
+}
+
+/* The stored bitmap with the given key, with a new reference for the
+   caller, or NULL */
+RDBitmapRef
+bmpstore_get(const RDBitmapKey * key)
+{
+	RDStoredBitmap *entry;
+	RDBitmapRef bitmap = NULL;
+
+	pthread_mutex_lock(&store_lock);
+	for (entry = by_key[bmpstore_key_bucket(key)]; entry != NULL; entry = entry->next_by_key)
+	{
+		if (bmpstore_key_equal(&entry->key, key))
+		{
+			entry->refs++;
+			store_refs++;
+			bitmap = entry->bitmap;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&store_lock);
+	return bitmap;
+}
+
+/* Store a newly decoded bitmap under key, handing the caller's reference
+   to the store. If another connection stored the same bitmap meanwhile,
+   the new one is destroyed and the stored one returned instead. */
+RDBitmapRef
+bmpstore_put(const RDBitmapKey * key, RDBitmapRef bitmap)
+{
+	RDStoredBitmap *entry;
+	uint32 bucket = bmpstore_key_bucket(key);
+
+	if (bitmap == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&store_lock);
+	for (entry = by_key[bucket]; entry != NULL; entry = entry->next_by_key)
+	{
+		if (bmpstore_key_equal(&entry->key, key))
+		{
+			entry->refs++;
+			store_refs++;
+			pthread_mutex_unlock(&store_lock);
+
+			ui_destroy_bitmap(bitmap);
+			return entry->bitmap;
+		}
+	}
+
+	entry = (RDStoredBitmap *) xmalloc(sizeof(RDStoredBitmap));
+	entry->key = *key;
+	entry->bitmap = bitmap;
+	entry->refs = 1;
+	entry->next_by_key = by_key[bucket];
+	by_key[bucket] = entry;
+	bucket = bmpstore_bitmap_bucket(bitmap);
+	entry->next_by_bitmap = by_bitmap[bucket];
+	by_bitmap[bucket] = entry;
+	store_count++;
+	store_refs++;
+	pthread_mutex_unlock(&store_lock);
+
+	cache_budget_charge_process(ui_bitmap_bytes(bitmap));
+	return bitmap;
+}
+
+/* Drop a reference to a bitmap, destroying it with the last one. Bitmaps
+   that are not in the store are destroyed at once. */
+void
+bmpstore_release(RDBitmapRef bitmap)
+{
+	RDStoredBitmap **link, *entry;
+
+	if (bitmap == NULL)
+		return;
+
+	pthread_mutex_lock(&store_lock);
+	for (link = &by_bitmap[bmpstore_bitmap_bucket(bitmap)]; *link != NULL; link = &(*link)->next_by_bitmap)
+	{
+		if ((*link)->bitmap == bitmap)
+			break;
+	}
+
+	entry = *link;
+	if (entry != NULL)
+	{
+		store_refs--;
+		if (--entry->refs > 0)
+		{
+			pthread_mutex_unlock(&store_lock);
+			return;
+		}
+
+		*link = entry->next_by_bitmap;
+		for (link = &by_key[bmpstore_key_bucket(&entry->key)]; *link != entry;
+		     link = &(*link)->next_by_key)
+			;
+		*link = entry->next_by_key;
+		store_count--;
+		xfree(entry);
+	}
+	pthread_mutex_unlock(&store_lock);
+
+	if (entry != NULL)
+		cache_budget_charge_process(-ui_bitmap_bytes(bitmap));
+	ui_destroy_bitmap(bitmap);
+}
+
+/* Whether a bitmap is in the store */
+RD_BOOL
+bmpstore_holds(RDBitmapRef bitmap)
+{
+	RDStoredBitmap *entry;
+
+	pthread_mutex_lock(&store_lock);
+	for (entry = by_bitmap[bmpstore_bitmap_bucket(bitmap)]; entry != NULL; entry = entry->next_by_bitmap)
+	{
+		if (entry->bitmap == bitmap)
+			break;
+	}
+	pthread_mutex_unlock(&store_lock);
+	return entry != NULL;
+}
+
+/* How many bitmaps are stored, and how many references they have */
+void
+bmpstore_usage(uint32 * bitmaps, uint32 * references)
+{
+	pthread_mutex_lock(&store_lock);
+	*bitmaps = store_count;
+	*references = store_refs;
+	pthread_mutex_unlock(&store_lock);
+}
@@ -0,0 +1,155 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Expanded brush tiles for pattern fills
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Hatched and patterned fills come in thousands per repaint on desktops
+   with dithered backgrounds, mostly with the same few brushes. Each
+   brush is expanded once into an 8x8 tile of pixels in the UI's format
+   and kept in a small direct mapped cache, keyed on its bits (or, for a
+   colour brush, its brush cache cell) and its colours. Tiles are thrown
+   away when the brush cache or the colour map changes.
+
+   Hatches draw set bits in the foreground, monochrome patterns draw set
+   bits in the background, as in the Cocoa glue. */
+
+#import "rdesktop.h"
+
+/* hatch patterns used by ui_patblt() ui_polygon() ui_ellipse() */
+static const uint8 hatch_patterns[] = {
+	0x00, 0x00, 0x00, 0xff, 0x00, 0x00, 0x00, 0x00,	/* 0 - bsHorizontal */
+	0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,	/* 1 - bsVertical */
+	0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,	/* 2 - bsFDiagonal */
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,	/* 3 - bsBDiagonal */
+	0x08, 0x08, 0x08, 0xff, 0x08, 0x08, 0x08, 0x08,	/* 4 - bsCross */
+	0x81, 0x42, 0x24, 0x18, 0x18, 0x24, 0x42, 0x81	/* 5 - bsDiagCross */
+};
+
+static uint32
+brush_tile_hash(const uint8 * bits, const RDBrushData * bd, uint32 on, uint32 off)
+{
+	uint32 hash = 2166136261u;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		hash = (hash ^ bits[i]) * 16777619u;
+	hash = (hash ^ (uint32) (uintptr_t) bd) * 16777619u;
+	hash = (hash ^ on) * 16777619u;
+	hash = (hash ^ off) * 16777619u;
+	return hash ^ (hash >> 16);
+}
+
+/* The tile for a hatch or pattern brush, with fgcolour and bgcolour
+   already converted to the UI's pixels. Returns NULL for solid and
+   unknown brushes. */
+const uint32 *
+brush_tile_get(RDConnectionRef conn, RDBrush * brush, uint32 fgcolour, uint32 bgcolour)
+{
+	static const uint8 no_bits[8];
+	RDBrushTile *tile;
+	RDBrushData *bd = NULL;
+	const uint8 *bits;
+	uint8 ipattern[8];
+	uint32 on, off;
+	int i, j;
+
+	switch (brush->style)
+	{
+		case 2:	/* Hatch */
+			bits = hatch_patterns + (brush->pattern[0] % 6) * 8;
+			on = fgcolour;
+			off = bgcolour;
+			break;
+
+		case 3:	/* Pattern */
+			if ((brush->bd != NULL) && (brush->bd->colour_code > 1))
+			{
+				bd = brush->bd;
+				bits = no_bits;
+				on = off = 0;
+				break;
+			}
+			if (brush->bd == NULL)	/* rdp4 brush */
+			{
+				for (i = 0; i != 8; i++)
+					ipattern[7 - i] = brush->pattern[i];
+				bits = ipattern;
+			}
+			else
+				bits = brush->bd->data;
+			on = bgcolour;
+			off = fgcolour;
+			break;
+
+		default:
+			return NULL;
+	}
+
+	tile = &conn->brushTiles[brush_tile_hash(bits, bd, on, off) % BRUSH_TILE_ENTRIES];
+	if ((tile->generation == conn->brushTileGeneration) && (tile->bd == bd) && (tile->on == on)
+	    && (tile->off == off) && (memcmp(tile->bits, bits, 8) == 0))
+		return tile->pixels;
+
+	tile->generation = conn->brushTileGeneration;
+	tile->bd = bd;
+	tile->on = on;
+	tile->off = off;
+	memcpy(tile->bits, bits, 8);
+
+	if (bd != NULL)
+	{
+		ui_convert_brush(conn, bd, tile->pixels);
+		return tile->pixels;
+	}
+
+	for (i = 0; i < 8; i++)
+		for (j = 0; j < 8; j++)
+			tile->pixels[i * 8 + j] = (bits[i] & (0x80 >> j)) ? on : off;
+	return tile->pixels;
+}
+
+/* Forget every tile, after the brush cache or the colour map changed */
+void
+brush_tile_flush(RDConnectionRef conn)
+{
+	conn->brushTileGeneration++;
+}
+
+/* Copy a tile over an area already clipped to the surface, which has
+   stride bytes from one row to the next (negative if it is stored bottom
+   up) and pixels pointing at row 0. The tile repeats from xorigin,
+   yorigin. */
+void
+brush_tile_fill(uint8 * pixels, int stride, int x, int y, int cx, int cy, const uint32 * tile, int xorigin,
+		int yorigin)
+{
+	const uint32 *source;
+	uint32 row[8], *p;
+	int i;
+
+	for (; cy > 0; cy--, y++)
+	{
+		/* the tile row, turned so that row[0] lands on x */
+		source = tile + ((y - yorigin) & 7) * 8;
+		for (i = 0; i < 8; i++)
+			row[i] = source[(x - xorigin + i) & 7];
+
+		p = (uint32 *) (pixels + (sint64) y * stride) + x;
+		for (i = 0; i < cx; i++)
+			p[i] = row[i & 7];
+	}
+}
@@ -23,152 +23,101 @@
 
 #define NUM_ELEMENTS(array) (sizeof(array) / sizeof(array[0]))
 #define IS_PERSISTENT(id) (conn->pstcacheFd[id] > 0)
-#define TO_TOP -1
-#define CACHE_IS_SET(idx) (idx >= 0)
 
-/*
- * TODO: Test for optimal value of BUMP_COUNT. TO_TOP gives lowest cpu utilisation but using
- * a positive value will hopefully result in less frequently used bitmaps having a greater chance
- * of being evicted from the cache, and therby reducing the need to load bitmaps from disk.
- * (Jeroen)
- */
-#define BUMP_COUNT 40
-
-static void cache_bump_bitmap(RDConnectionRef conn, uint8 id, uint16 idx, int bump);
 static void cache_evict_bitmap(RDConnectionRef conn, uint8 id);
-/* Setup the bitmap cache lru/mru linked list */
-void
-cache_rebuild_bmpcache_linked_list(RDConnectionRef conn, uint8 id, sint16 * idx, int count)
-{
-	int n = count, c = 0;
-	sint16 n_idx;
-
-	/* find top, skip evicted bitmaps */
-	while (--n >= 0 && conn->bmpcache[id][idx[n]].bitmap == NULL);
-	if (n < 0)
-	{
-		conn->bmpcacheMru[id] = conn->bmpcacheLru[id] = NOT_SET;
-		return;
-	}
+static void cache_trim(RDConnectionRef conn);
 
-	conn->bmpcacheMru[id] = idx[n];
-	conn->bmpcache[id][idx[n]].next = NOT_SET;
-	n_idx = idx[n];
-	c++;
-
-	/* link list */
-	while (n >= 0)
-	{
-		/* skip evicted bitmaps */
-		while (--n >= 0 && conn->bmpcache[id][idx[n]].bitmap == NULL);
-
-		if (n < 0)
-			break;
+static const RDCachePolicy *
+cache_bitmap_policy(RDConnectionRef conn)
+{
+	return (conn->bmpcachePolicy != NULL) ? conn->bmpcachePolicy : cache_policy_find(NULL);
+}
 
-		conn->bmpcache[id][n_idx].previous = idx[n];
-		conn->bmpcache[id][idx[n]].next = n_idx;
-		n_idx = idx[n];
-		c++;
-	}
+/* Note a bitmap cache access for cachesim */
+static void
+cache_trace(RDConnectionRef conn, char op, uint8 id, uint16 idx)
+{
+	if (conn->bmpcacheTrace != NULL)
+		fprintf(conn->bmpcacheTrace, "%c %d %d\n", op, id, idx);
+}
 
-	conn->bmpcache[id][n_idx].previous = NOT_SET;
-	conn->bmpcacheLru[id] = n_idx;
+/* Start recording the bitmap cache accesses of a connection to a trace
+   file that cachesim can replay */
+RD_BOOL
+cache_trace_open(RDConnectionRef conn, const char *path)
+{
+	cache_trace_close(conn);
 
-	if (c != conn->bmpcacheCount[id])
+	conn->bmpcacheTrace = fopen(path, "w");
+	if (conn->bmpcacheTrace == NULL)
 	{
-		error("Oops. %d in bitmap cache linked list, %d in ui cache...\n", c,
-		      conn->bmpcacheCount[id]);
-		exit(1);
+		perror(path);
+		return False;
 	}
+	fprintf(conn->bmpcacheTrace, "# bitmap cache trace: P id idx is a put, G id idx a get\n");
+	return True;
 }
 
-/* Move a bitmap to a new position in the linked list. */
-static void
-cache_bump_bitmap(RDConnectionRef conn, uint8 id, uint16 idx, int bump)
+void
+cache_trace_close(RDConnectionRef conn)
 {
-	int p_idx, n_idx, n;
-
-	if (!IS_PERSISTENT(id))
+	if (conn->bmpcacheTrace == NULL)
 		return;
 
-	if (conn->bmpcacheMru[id] == idx)
-		return;
+	fclose(conn->bmpcacheTrace);
+	conn->bmpcacheTrace = NULL;
+}
 
-	DEBUG_RDP5(("bump bitmap: id=%d, idx=%d, bump=%d\n", id, idx, bump));
+/* Set up the bitmap cache replacement lists from the persistent cache
+   order, oldest first. Bitmaps missing from the order are put first in
+   line for eviction. */
+void
+cache_rebuild_bmpcache_linked_list(RDConnectionRef conn, uint8 id, sint16 * idx, int count)
+{
+	RDCacheLists *lists = &conn->bmpcacheLists[id];
+	const RDCachePolicy *policy = cache_bitmap_policy(conn);
+	int n, missing = 0;
 
-	n_idx = conn->bmpcache[id][idx].next;
-	p_idx = conn->bmpcache[id][idx].previous;
+	cache_lists_reset(lists);
+	for (n = 0; n < count; n++)
+		if ((conn->bmpcache[id][idx[n]].bitmap != NULL) && !cache_lists_holds(lists, idx[n]))
+			policy->insert(lists, idx[n], False);
 
-	if (CACHE_IS_SET(n_idx))
-	{
-		/* remove */
-		--conn->bmpcacheCount[id];
-		if (CACHE_IS_SET(p_idx))
-			conn->bmpcache[id][p_idx].next = n_idx;
-		else
-			conn->bmpcacheLru[id] = n_idx;
-		if (CACHE_IS_SET(n_idx))
-			conn->bmpcache[id][n_idx].previous = p_idx;
-		else
-			conn->bmpcacheMru[id] = p_idx;
-	}
-	else
+	for (n = 0; n < BITMAP_CACHE_ENTRIES; n++)
 	{
-		p_idx = NOT_SET;
-		n_idx = conn->bmpcacheLru[id];
-	}
-
-	if (bump >= 0)
-	{
-		for (n = 0; n < bump && CACHE_IS_SET(n_idx); n++)
+		if ((conn->bmpcache[id][n].bitmap != NULL) && !cache_lists_holds(lists, n))
 		{
-			p_idx = n_idx;
-			n_idx = conn->bmpcache[id][p_idx].next;
+			policy->insert(lists, n, True);
+			missing++;
 		}
 	}
-	else
-	{
-		p_idx = conn->bmpcacheMru[id];
-		n_idx = NOT_SET;
-	}
+	if (missing)
+		warning("%d bitmaps in cache %d were not in the persistent cache order\n", missing, id);
 
-	/* insert */
-	++conn->bmpcacheCount[id];
-	conn->bmpcache[id][idx].previous = p_idx;
-	conn->bmpcache[id][idx].next = n_idx;
-
-	if (p_idx >= 0)
-		conn->bmpcache[id][p_idx].next = idx;
-	else
-		conn->bmpcacheLru[id] = idx;
-
-	if (n_idx >= 0)
-		conn->bmpcache[id][n_idx].previous = idx;
-	else
-		conn->bmpcacheMru[id] = idx;
+	while (cache_lists_count(lists) > BMPCACHE2_C2_CELLS)
+		cache_evict_bitmap(conn, id);
 }
 
-/* Evict the least-recently used bitmap from the cache */
+/* Evict the bitmap the policy picks from the cache */
 static void
 cache_evict_bitmap(RDConnectionRef conn, uint8 id)
 {
-	uint16 idx;
-	int n_idx;
+	RDCacheLists *lists = &conn->bmpcacheLists[id];
+	sint16 idx;
 
 	if (!IS_PERSISTENT(id))
 		return;
 
-	idx = conn->bmpcacheLru[id];
-	n_idx = conn->bmpcache[id][idx].next;
-	DEBUG_RDP5(("evict bitmap: id=%d idx=%d n_idx=%d bmp=%p\n", id, idx, n_idx,
-		    conn->bmpcache[id][idx].bitmap));
+	idx = cache_bitmap_policy(conn)->victim(lists);
+	if (idx == NOT_SET)
+		return;
 
-	ui_destroy_bitmap(conn->bmpcache[id][idx].bitmap);
-	--conn->bmpcacheCount[id];
-	conn->bmpcache[id][idx].bitmap = 0;
+	DEBUG_RDP5(("evict bitmap: id=%d idx=%d bmp=%p\n", id, idx, conn->bmpcache[id][idx].bitmap));
 
-	conn->bmpcacheLru[id] = n_idx;
-	conn->bmpcache[id][n_idx].previous = NOT_SET;
+	cache_lists_remove(lists, idx);
+	cache_budget_charge_bitmap(conn, conn->bmpcache[id][idx].bitmap, -1);
+	bmpstore_release(conn->bmpcache[id][idx].bitmap);
+	conn->bmpcache[id][idx].bitmap = NULL;
 
 	pstcache_touch_bitmap(conn, id, idx, 0);
 }
@@ -177,21 +126,40 @@ cache_evict_bitmap(RDConnectionRef conn, uint8 id)
 RDBitmapRef
 cache_get_bitmap(RDConnectionRef conn, uint8 id, uint16 idx)
 {
+	RD_BOOL loaded = False;
+	FILE *trace = conn->bmpcacheTrace;
+
 	if ((id < NUM_ELEMENTS(conn->bmpcache)) && (idx < NUM_ELEMENTS(conn->bmpcache[0])))
 	{
-		if (conn->bmpcache[id][idx].bitmap || pstcache_load_bitmap(conn, id, idx))
+		cache_trace(conn, 'G', id, idx);
+
+		/* the put behind a load from disk is not the server's, so leave it out of the trace */
+		if (conn->bmpcache[id][idx].bitmap == NULL)
+		{
+			conn->bmpcacheTrace = NULL;
+			loaded = pstcache_load_bitmap(conn, id, idx);
+			conn->bmpcacheTrace = trace;
+			if (loaded && (conn->orderStats != NULL))
+				conn->orderStats->bitmap_disk_loads++;
+		}
+
+		if (conn->bmpcache[id][idx].bitmap != NULL)
 		{
-			if (IS_PERSISTENT(id))
-				cache_bump_bitmap(conn, id, idx, BUMP_COUNT);
+			/* a bitmap just loaded from disk was put in as it was loaded */
+			if (IS_PERSISTENT(id) && !loaded)
+				cache_bitmap_policy(conn)->hit(&conn->bmpcacheLists[id], idx);
 
+			ORDER_STATS_CACHE(conn, bitmap, True);
 			return conn->bmpcache[id][idx].bitmap;
 		}
 	}
 	else if ((id < NUM_ELEMENTS(conn->volatileBc)) && (idx == 0x7fff))
 	{
+		ORDER_STATS_CACHE(conn, bitmap, conn->volatileBc[id] != NULL);
 		return conn->volatileBc[id];
 	}
 
+	ORDER_STATS_CACHE(conn, bitmap, False);
 	error("get bitmap %d:%d\n", id, idx);
 	return NULL;
 }
@@ -200,31 +168,48 @@ cache_get_bitmap(RDConnectionRef conn, uint8 id, uint16 idx)
 void
 cache_put_bitmap(RDConnectionRef conn, uint8 id, uint16 idx, RDBitmapRef bitmap)
 {
+	RDCacheLists *lists;
 	RDBitmapRef old;
 
 	if ((id < NUM_ELEMENTS(conn->bmpcache)) && (idx < NUM_ELEMENTS(conn->bmpcache[0])))
 	{
+		cache_trace(conn, 'P', id, idx);
+
+		/* make room first, so that the new bitmap is not what goes */
+		cache_trim(conn);
+
 		old = conn->bmpcache[id][idx].bitmap;
 		if (old != NULL)
-			ui_destroy_bitmap(old);
+		{
+			cache_budget_charge_bitmap(conn, old, -1);
+			bmpstore_release(old);
+		}
 		conn->bmpcache[id][idx].bitmap = bitmap;
+		if (bitmap != NULL)
+			cache_budget_charge_bitmap(conn, bitmap, 1);
 				
 		if (IS_PERSISTENT(id))
 		{
-			if (old == NULL)
-				conn->bmpcache[id][idx].previous = conn->bmpcache[id][idx].next = NOT_SET;
-
-			cache_bump_bitmap(conn, id, idx, TO_TOP);
-			if (conn->bmpcacheCount[id] > BMPCACHE2_C2_CELLS)
+			lists = &conn->bmpcacheLists[id];
+			cache_lists_remove(lists, idx);
+			cache_bitmap_policy(conn)->insert(lists, idx, False);
+			if (cache_lists_count(lists) > BMPCACHE2_C2_CELLS)
 				cache_evict_bitmap(conn, id);
 		}
 	}
 	else if ((id < NUM_ELEMENTS(conn->volatileBc)) && (idx == 0x7fff))
 	{
+		cache_trim(conn);
+
 		old = conn->volatileBc[id];
 		if (old != NULL)
-			ui_destroy_bitmap(old);
+		{
+			cache_budget_charge_bitmap(conn, old, -1);
+			bmpstore_release(old);
+		}
 		conn->volatileBc[id] = bitmap;
+		if (bitmap != NULL)
+			cache_budget_charge_bitmap(conn, bitmap, 1);
 	}
 	else
 	{
@@ -232,63 +217,91 @@ cache_put_bitmap(RDConnectionRef conn, uint8 id, uint16 idx, RDBitmapRef bitmap)
 	}
 }
 
+/* Store a bitmap loaded ahead of use in a persistent cache, first in line
+   for eviction. Refused when the cell is already filled or the cache is
+   full or over budget, so that precaching never evicts anything. */
+RD_BOOL
+cache_put_precached_bitmap(RDConnectionRef conn, uint8 id, uint16 idx, RDBitmapRef bitmap)
+{
+	RDCacheLists *lists;
+
+	if ((id >= NUM_ELEMENTS(conn->bmpcache)) || (idx >= NUM_ELEMENTS(conn->bmpcache[0]))
+	    || !IS_PERSISTENT(id))
+		return False;
+
+	lists = &conn->bmpcacheLists[id];
+	if ((conn->bmpcache[id][idx].bitmap != NULL) || (cache_lists_count(lists) >= BMPCACHE2_C2_CELLS)
+	    || cache_budget_exceeded(conn))
+		return False;
+
+	conn->bmpcache[id][idx].bitmap = bitmap;
+	cache_budget_charge_bitmap(conn, bitmap, 1);
+	cache_lists_remove(lists, idx);
+	cache_bitmap_policy(conn)->insert(lists, idx, True);
+	return True;
+}
+
 /* Updates the persistent bitmap cache MRU information on exit */
 void
 cache_save_state(RDConnectionRef conn)
 {
 	uint32 id = 0, t = 0;
-	int idx;
+	sint16 order[BITMAP_CACHE_ENTRIES];
+	int n, count;
 
 	for (id = 0; id < NUM_ELEMENTS(conn->bmpcache); id++)
 		if (IS_PERSISTENT(id))
 		{
 			DEBUG_RDP5(("Saving cache state for bitmap cache %d...", id));
-			idx = conn->bmpcacheLru[id];
-			while (idx >= 0)
-			{
-				pstcache_touch_bitmap(conn, id, idx, ++t);
-				idx = conn->bmpcache[id][idx].next;
-			}
+			count = cache_lists_order(&conn->bmpcacheLists[id], order);
+			for (n = 0; n < count; n++)
+				pstcache_touch_bitmap(conn, id, order[n], ++t);
 			DEBUG_RDP5((" %d stamps written.\n", t));
 		}
 }
 
-/* Retrieve a glyph from the font cache */
-RDFontGlyph *
-cache_get_font(RDConnectionRef conn, uint8 font, uint16 character)
+/* Get a glyph of the font cache ready to draw, putting it in its font's
+   atlas if it is not there. The caller has looked it up and counts it. */
+void
+cache_use_glyph(RDConnectionRef conn, uint8 font, RDFontGlyph * glyph)
 {
-	RDFontGlyph *glyph;
-
-	if ((font < NUM_ELEMENTS(conn->fontCache)) && (character < NUM_ELEMENTS(conn->fontCache[0])))
+	if (glyphatlas_placed(conn, font, glyph))
 	{
-		glyph = &conn->fontCache[font][character];
-		if (glyph->pixmap != NULL)
-			return glyph;
+		conn->glyphAtlas[font].used = 1;
+		return;
 	}
 
-	error("get font %d:%d\n", font, character);
-	return NULL;
+	cache_trim(conn);
+	glyphatlas_place(conn, font, glyph);
 }
 
-/* Store a glyph in the font cache */
+/* Store a glyph in the font cache, as 1 bpp rows padded to bytes. It is
+   put in its font's atlas when first used. */
 void
 cache_put_font(RDConnectionRef conn, uint8 font, uint16 character, uint16 offset,
-	       uint16 baseline, uint16 width, uint16 height, RDGlyphRef pixmap)
+	       uint16 baseline, uint16 width, uint16 height, uint8 * data)
 {
-	//debug: printf("Putting shit in font cache at %d:%d and pmap %p\n", font, character, pixmap);
 	RDFontGlyph *glyph;
+	int size = height * ((width + 7) / 8);
 
 	if ((font < NUM_ELEMENTS(conn->fontCache)) && (character < NUM_ELEMENTS(conn->fontCache[0])))
 	{
 		glyph = &conn->fontCache[font][character];
-		if (glyph->pixmap != NULL)
-			ui_destroy_glyph(glyph->pixmap);
+		if (glyph->data != NULL)
+		{
+			cache_budget_charge(conn, CACHE_KIND_GLYPH, -(glyph->height * ((glyph->width + 7) / 8)), -1);
+			xfree(glyph->data);
+		}
 				
 		glyph->offset = offset;
 		glyph->baseline = baseline;
 		glyph->width = width;
 		glyph->height = height;
-		glyph->pixmap = pixmap;
+		glyph->data = xmalloc(MAX(size, 1));
+		memcpy(glyph->data, data, size);
+		glyph->atlas_generation = 0;
+		cache_budget_charge(conn, CACHE_KIND_GLYPH, size, 1);
+		cache_trim(conn);
 	}
 	else
 	{
@@ -314,10 +327,14 @@ cache_put_text(RDConnectionRef conn, uint8 cache_id, void *data, int length)
 
 	text = &conn->textCache[cache_id];
 	if (text->data != NULL)
+	{
+		cache_budget_charge(conn, CACHE_KIND_TEXT, -text->size, -1);
 		xfree(text->data);
+	}
 	text->data = xmalloc(length);
 	text->size = length;
 	memcpy(text->data, data, length);
+	cache_budget_charge(conn, CACHE_KIND_TEXT, length, 1);
 }
 
 /* Retrieve desktop data from the cache */
@@ -331,9 +348,11 @@ cache_get_desktop(RDConnectionRef conn, uint32 offset, int cx, int cy, int bytes
 
 	if ((offset + length) <= sizeof(conn->deskCache))
 	{
+		ORDER_STATS_CACHE(conn, desktop, True);
 		return &conn->deskCache[offset];
 	}
 
+	ORDER_STATS_CACHE(conn, desktop, False);
 	error("get desktop %d:%d\n", offset, length);
 	return NULL;
 }
@@ -373,9 +392,13 @@ cache_get_cursor(RDConnectionRef conn, uint16 cache_idx)
 	{
 		cursor = conn->cursorCache[cache_idx];
 		if (cursor != NULL)
+		{
+			ORDER_STATS_CACHE(conn, cursor, True);
 			return cursor;
+		}
 	}
 
+	ORDER_STATS_CACHE(conn, cursor, False);
 	error("get cursor %d\n", cache_idx);
 	return NULL;
 }
@@ -390,9 +413,15 @@ cache_put_cursor(RDConnectionRef conn, uint16 cache_idx, RDCursorRef cursor)
 	{
 		old = conn->cursorCache[cache_idx];
 		if (old != NULL)
+		{
+			cache_budget_charge(conn, CACHE_KIND_CURSOR, -ui_bitmap_bytes(old), -1);
 			ui_destroy_cursor(old);
+		}
 
 		conn->cursorCache[cache_idx] = cursor;
+		if (cursor != NULL)
+			cache_budget_charge(conn, CACHE_KIND_CURSOR, ui_bitmap_bytes(cursor), 1);
+		cache_trim(conn);
 	}
 	else
 	{
@@ -407,8 +436,10 @@ cache_get_brush_data(RDConnectionRef conn, uint8 colour_code, uint8 idx)
 	colour_code = colour_code == 1 ? 0 : 1;
 	if (idx < NUM_ELEMENTS(conn->brushCache[0]))
 	{
+		ORDER_STATS_CACHE(conn, brush, conn->brushCache[colour_code][idx].data != NULL);
 		return &conn->brushCache[colour_code][idx];
 	}
+	ORDER_STATS_CACHE(conn, brush, False);
 	error("get brush %d %d\n", colour_code, idx);
 	return NULL;
 }
@@ -426,12 +457,139 @@ cache_put_brush_data(RDConnectionRef conn, uint8 colour_code, uint8 idx, RDBrush
 		bd = &conn->brushCache[colour_code][idx];
 		if (bd->data != 0)
 		{
+			cache_budget_charge(conn, CACHE_KIND_BRUSH, -bd->data_size, -1);
 			xfree(bd->data);
 		}
 		memcpy(bd, brush_data, sizeof(RDBrushData));
+		if (bd->data != NULL)
+			cache_budget_charge(conn, CACHE_KIND_BRUSH, bd->data_size, 1);
+		brush_tile_flush(conn);
+		cache_trim(conn);
 	}
 	else
 	{
 		error("put brush %d %d\n", colour_code, idx);
 	}
 }
+
+/* Free the atlas of a font not drawn with since the hand last came
+   round, as a clock over the font caches. Returns False after a full turn
+   that found none. */
+static RD_BOOL
+cache_drop_glyph_atlas(RDConnectionRef conn)
+{
+	RDGlyphAtlas *atlas;
+	int n, font;
+
+	for (n = 0; n < FONT_CACHE_SIZE; n++)
+	{
+		font = conn->glyphAtlasHand;
+		atlas = &conn->glyphAtlas[font];
+		conn->glyphAtlasHand = (font + 1) % FONT_CACHE_SIZE;
+
+		if (atlas->pixels == NULL)
+			continue;
+		if (atlas->used)
+		{
+			atlas->used = 0;
+			continue;
+		}
+
+		glyphatlas_free(conn, font);
+		conn->cacheUsage.freed[CACHE_KIND_GLYPH]++;
+		return True;
+	}
+	return False;
+}
+
+/* Free what can be rebuilt until the caches are back within budget:
+   glyph atlases first, then bitmaps that can be loaded from disk. Called
+   before a new object is stored, so the budget may be overrun by one. */
+static void
+cache_trim(RDConnectionRef conn)
+{
+	int id;
+
+	if (!cache_budget_exceeded(conn))
+		return;
+
+	while (cache_drop_glyph_atlas(conn))
+		if (!cache_budget_exceeded(conn))
+			return;
+
+	for (id = 0; id < NUM_ELEMENTS(conn->bmpcache); id++)
+	{
+		while (IS_PERSISTENT(id) && (cache_lists_count(&conn->bmpcacheLists[id]) > 0))
+		{
+			cache_evict_bitmap(conn, id);
+			conn->cacheUsage.freed[CACHE_KIND_BITMAP]++;
+			if (!cache_budget_exceeded(conn))
+				return;
+		}
+	}
+
+	if (!conn->cacheUsage.warned)
+	{
+		warning("caches hold %llu KB, more than their budget, and nothing more can be freed\n",
+			cache_budget_used(conn) / 1024);
+		conn->cacheUsage.warned = True;
+	}
+}
+
+/* Free everything the caches of a connection hold */
+void
+cache_destroy(RDConnectionRef conn)
+{
+	int i, k;
+
+	bmpstore_detach(conn);
+	for (i = 0; i < BITMAP_CACHE_SIZE; i++)
+	{
+		for (k = 0; k < BITMAP_CACHE_ENTRIES; k++)
+		{
+			bmpstore_release(conn->bmpcache[i][k].bitmap);
+			conn->bmpcache[i][k].bitmap = NULL;
+		}
+		cache_lists_reset(&conn->bmpcacheLists[i]);
+
+		bmpstore_release(conn->volatileBc[i]);
+		conn->volatileBc[i] = NULL;
+	}
+
+	for (i = 0; i < FONT_CACHE_SIZE; i++)
+	{
+		for (k = 0; k < FONT_CACHE_ENTRIES; k++)
+		{
+			xfree(conn->fontCache[i][k].data);
+			memset(&conn->fontCache[i][k], 0, sizeof(RDFontGlyph));
+		}
+	}
+	glyphatlas_destroy(conn);
+	text_run_destroy(conn);
+	xfree(conn->ropSource);
+	conn->ropSource = NULL;
+	conn->ropSourceSize = 0;
+
+	for (i = 0; i < TEXT_CACHE_SIZE; i++)
+	{
+		xfree(conn->textCache[i].data);
+		conn->textCache[i].data = NULL;
+	}
+
+	for (i = 0; i < BRUSH_CACHE_ENTRIES; i++)
+	{
+		for (k = 0; k < BRUSH_CACHE_SIZE; k++)
+		{
+			xfree(conn->brushCache[i][k].data);
+			conn->brushCache[i][k].data = NULL;
+		}
+	}
+
+	for (i = 0; i < CURSOR_CACHE_SIZE; i++)
+	{
+		ui_destroy_cursor(conn->cursorCache[i]);
+		conn->cursorCache[i] = NULL;
+	}
+
+	cache_budget_release(conn);
+}
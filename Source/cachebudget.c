@@ -0,0 +1,164 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Memory accounting for the caches
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* cache.c charges every object it keeps to its connection and to the
+   process, by kind, and asks here whether either is over budget. If so
+   it frees what it can rebuild: glyph atlases, which are filled again
+   from the bits kept with each glyph, and bitmaps in persistent caches, which
+   are loaded again from disk. Everything else the server may refer to at
+   any time, so it stays counted but cannot be freed.
+
+   A bitmap shared through bmpstore.c is charged to every connection that
+   holds it, but to the process only once, by the store, for as long as
+   it is stored. */
+
+#import "rdesktop.h"
+
+#include <pthread.h>
+
+static const char *kind_names[CACHE_KINDS] = { "bitmap", "glyph", "brush", "cursor", "text" };
+
+static pthread_mutex_t budget_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64 process_bytes, process_budget;
+
+/* Limit the bytes the caches of a connection may hold, 0 for no limit */
+void
+cache_budget_set(RDConnectionRef conn, uint64 bytes)
+{
+	conn->cacheUsage.budget = bytes;
+}
+
+/* Limit the bytes the caches of all connections may hold together */
+void
+cache_budget_set_process(uint64 bytes)
+{
+	pthread_mutex_lock(&budget_lock);
+	process_budget = bytes;
+	pthread_mutex_unlock(&budget_lock);
+}
+
+/* Count bytes and items of the given kind in or, negative, out */
+void
+cache_budget_charge(RDConnectionRef conn, int kind, sint64 bytes, int items)
+{
+	RDCacheUsage *usage = &conn->cacheUsage;
+
+	usage->bytes[kind] += bytes;
+	usage->items[kind] += items;
+	if (bytes == 0)
+		return;
+
+	pthread_mutex_lock(&budget_lock);
+	process_bytes += bytes;
+	pthread_mutex_unlock(&budget_lock);
+}
+
+/* Count a bitmap into or, with items negative, out of a connection's
+   bitmap caches. One in the shared store is left off the process total,
+   since the store counts it there. */
+void
+cache_budget_charge_bitmap(RDConnectionRef conn, RDBitmapRef bitmap, int items)
+{
+	sint64 bytes = (sint64) items * ui_bitmap_bytes(bitmap);
+
+	if (!bmpstore_holds(bitmap))
+	{
+		cache_budget_charge(conn, CACHE_KIND_BITMAP, bytes, items);
+		return;
+	}
+
+	conn->cacheUsage.bytes[CACHE_KIND_BITMAP] += bytes;
+	conn->cacheUsage.items[CACHE_KIND_BITMAP] += items;
+	conn->cacheUsage.shared += bytes;
+}
+
+/* Count bytes the store holds for every connection in or out of the
+   process total */
+void
+cache_budget_charge_process(sint64 bytes)
+{
+	pthread_mutex_lock(&budget_lock);
+	process_bytes += bytes;
+	pthread_mutex_unlock(&budget_lock);
+}
+
+/* Bytes held by the caches of a connection */
+uint64
+cache_budget_used(RDConnectionRef conn)
+{
+	uint64 total = 0;
+	int kind;
+
+	for (kind = 0; kind < CACHE_KINDS; kind++)
+		total += conn->cacheUsage.bytes[kind];
+	return total;
+}
+
+/* Whether the connection or the process holds more than it should */
+RD_BOOL
+cache_budget_exceeded(RDConnectionRef conn)
+{
+	RD_BOOL exceeded;
+
+	if ((conn->cacheUsage.budget != 0) && (cache_budget_used(conn) > conn->cacheUsage.budget))
+		return True;
+
+	pthread_mutex_lock(&budget_lock);
+	exceeded = (process_budget != 0) && (process_bytes > process_budget);
+	pthread_mutex_unlock(&budget_lock);
+	return exceeded;
+}
+
+/* Take whatever is still counted for a connection off the process total,
+   once its caches are gone */
+void
+cache_budget_release(RDConnectionRef conn)
+{
+	pthread_mutex_lock(&budget_lock);
+	process_bytes -= MIN(process_bytes, cache_budget_used(conn) - conn->cacheUsage.shared);
+	pthread_mutex_unlock(&budget_lock);
+
+	conn->cacheUsage.shared = 0;
+	memset(conn->cacheUsage.bytes, 0, sizeof(conn->cacheUsage.bytes));
+	memset(conn->cacheUsage.items, 0, sizeof(conn->cacheUsage.items));
+}
+
+void
+cache_budget_dump(RDConnectionRef conn, FILE * out)
+{
+	const RDCacheUsage *usage = &conn->cacheUsage;
+	uint64 process, budget;
+	int kind;
+
+	pthread_mutex_lock(&budget_lock);
+	process = process_bytes;
+	budget = process_budget;
+	pthread_mutex_unlock(&budget_lock);
+
+	fprintf(out, "cache memory %llu KB of %llu KB budget, %llu KB of %llu KB for all sessions\n",
+		cache_budget_used(conn) / 1024, usage->budget / 1024, process / 1024, budget / 1024);
+	for (kind = 0; kind < CACHE_KINDS; kind++)
+	{
+		if ((usage->items[kind] == 0) && (usage->freed[kind] == 0))
+			continue;
+		fprintf(out, "%-14s %9u items %9llu KB %9u freed %9u rebuilt\n", kind_names[kind],
+			usage->items[kind], usage->bytes[kind] / 1024, usage->freed[kind],
+			usage->rebuilt[kind]);
+	}
+}
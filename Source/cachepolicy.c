@@ -0,0 +1,253 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Replacement policies for the persistent bitmap cache
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* With a persistent cache the server may use far more cells than are
+   kept decoded; the rest are loaded back from disk when they are used.
+   Which decoded bitmaps to drop is up to a policy, picked per connection
+   and working on an RDCacheLists alone, so that cachesim can compare the
+   policies on recorded traces. Every operation takes constant time.
+
+	slru	segmented LRU, the default: cells come in on probation and
+		are protected once used again, so a burst of bitmaps used
+		once cannot push out the ones used all the time
+	lru	plain least recently used
+	clock	second chance: a hit only marks the cell, which is passed
+		over once when it comes up for eviction */
+
+#import "rdesktop.h"
+
+/* share of the capacity the segmented LRU protects by default */
+#define SLRU_PROTECTED_CELLS	(BMPCACHE2_C2_CELLS * 4 / 5)
+
+static void
+cache_list_unlink(RDCacheLists * lists, uint16 idx)
+{
+	RDCacheNode *node = &lists->node[idx];
+	int segment = node->segment;
+
+	if (node->previous != NOT_SET)
+		lists->node[node->previous].next = node->next;
+	else
+		lists->lru[segment] = node->next;
+
+	if (node->next != NOT_SET)
+		lists->node[node->next].previous = node->previous;
+	else
+		lists->mru[segment] = node->previous;
+
+	lists->count[segment]--;
+	node->segment = CACHE_NOT_HELD;
+}
+
+/* put a cell that is not held at either end of a list */
+static void
+cache_list_push(RDCacheLists * lists, uint16 idx, int segment, RD_BOOL at_lru)
+{
+	RDCacheNode *node = &lists->node[idx];
+
+	node->segment = segment;
+	node->referenced = 0;
+
+	if (lists->count[segment] == 0)
+	{
+		node->previous = node->next = NOT_SET;
+		lists->lru[segment] = lists->mru[segment] = idx;
+	}
+	else if (at_lru)
+	{
+		node->previous = NOT_SET;
+		node->next = lists->lru[segment];
+		lists->node[node->next].previous = idx;
+		lists->lru[segment] = idx;
+	}
+	else
+	{
+		node->next = NOT_SET;
+		node->previous = lists->mru[segment];
+		lists->node[node->previous].next = idx;
+		lists->mru[segment] = idx;
+	}
+
+	lists->count[segment]++;
+}
+
+/* Both list-based policies take new cells on probation */
+static void
+cache_policy_insert(RDCacheLists * lists, uint16 idx, RD_BOOL cold)
+{
+	cache_list_push(lists, idx, CACHE_PROBATION, cold);
+}
+
+static void
+cache_lru_hit(RDCacheLists * lists, uint16 idx)
+{
+	if (lists->mru[CACHE_PROBATION] == idx)
+		return;
+
+	cache_list_unlink(lists, idx);
+	cache_list_push(lists, idx, CACHE_PROBATION, False);
+}
+
+static sint16
+cache_lru_victim(RDCacheLists * lists)
+{
+	return lists->count[CACHE_PROBATION] ? lists->lru[CACHE_PROBATION] : NOT_SET;
+}
+
+static void
+cache_slru_hit(RDCacheLists * lists, uint16 idx)
+{
+	int limit = lists->protected_cells ? lists->protected_cells : SLRU_PROTECTED_CELLS;
+
+	if (lists->node[idx].segment == CACHE_PROTECTED)
+	{
+		if (lists->mru[CACHE_PROTECTED] == idx)
+			return;
+
+		cache_list_unlink(lists, idx);
+		cache_list_push(lists, idx, CACHE_PROTECTED, False);
+		return;
+	}
+
+	cache_list_unlink(lists, idx);
+	cache_list_push(lists, idx, CACHE_PROTECTED, False);
+
+	/* the protected cell used longest ago gets another go on probation */
+	if (lists->count[CACHE_PROTECTED] > limit)
+	{
+		idx = lists->lru[CACHE_PROTECTED];
+		cache_list_unlink(lists, idx);
+		cache_list_push(lists, idx, CACHE_PROBATION, False);
+	}
+}
+
+static sint16
+cache_slru_victim(RDCacheLists * lists)
+{
+	if (lists->count[CACHE_PROBATION])
+		return lists->lru[CACHE_PROBATION];
+	if (lists->count[CACHE_PROTECTED])
+		return lists->lru[CACHE_PROTECTED];
+	return NOT_SET;
+}
+
+static void
+cache_clock_hit(RDCacheLists * lists, uint16 idx)
+{
+	lists->node[idx].referenced = 1;
+}
+
+/* The probation list is the clock, its LRU end the hand. A marked cell
+   is cleared and moved behind the hand, so each is passed over once. */
+static sint16
+cache_clock_victim(RDCacheLists * lists)
+{
+	sint16 idx;
+
+	while (lists->count[CACHE_PROBATION])
+	{
+		idx = lists->lru[CACHE_PROBATION];
+		if (!lists->node[idx].referenced)
+			return idx;
+
+		cache_list_unlink(lists, idx);
+		cache_list_push(lists, idx, CACHE_PROBATION, False);
+	}
+	return NOT_SET;
+}
+
+static const RDCachePolicy cache_policies[] = {
+	{"slru", cache_policy_insert, cache_slru_hit, cache_slru_victim},
+	{"lru", cache_policy_insert, cache_lru_hit, cache_lru_victim},
+	{"clock", cache_policy_insert, cache_clock_hit, cache_clock_victim}
+};
+
+/* The policy with the given name, or the default for NULL. Returns NULL
+   for a name that is not known. */
+const RDCachePolicy *
+cache_policy_find(const char *name)
+{
+	int i;
+
+	if (name == NULL)
+		return &cache_policies[0];
+
+	for (i = 0; i < sizeof(cache_policies) / sizeof(cache_policies[0]); i++)
+		if (strcmp(cache_policies[i].name, name) == 0)
+			return &cache_policies[i];
+	return NULL;
+}
+
+/* The nth policy, or NULL past the last one */
+const RDCachePolicy *
+cache_policy_at(int n)
+{
+	if ((n < 0) || (n >= sizeof(cache_policies) / sizeof(cache_policies[0])))
+		return NULL;
+	return &cache_policies[n];
+}
+
+/* Empty the lists, keeping their tuning */
+void
+cache_lists_reset(RDCacheLists * lists)
+{
+	int protected_cells = lists->protected_cells;
+
+	memset(lists, 0, sizeof(RDCacheLists));
+	lists->protected_cells = protected_cells;
+}
+
+/* How many cells are held */
+int
+cache_lists_count(RDCacheLists * lists)
+{
+	return lists->count[CACHE_PROBATION] + lists->count[CACHE_PROTECTED];
+}
+
+RD_BOOL
+cache_lists_holds(RDCacheLists * lists, uint16 idx)
+{
+	return lists->node[idx].segment != CACHE_NOT_HELD;
+}
+
+/* Take a cell off the lists, if it is held */
+void
+cache_lists_remove(RDCacheLists * lists, uint16 idx)
+{
+	if (lists->node[idx].segment != CACHE_NOT_HELD)
+		cache_list_unlink(lists, idx);
+}
+
+/* Fill order with the held cells, those to be evicted first first, and
+   return how many there are */
+int
+cache_lists_order(RDCacheLists * lists, sint16 * order)
+{
+	int segment, n = 0;
+	sint16 idx;
+
+	for (segment = CACHE_PROBATION; segment <= CACHE_PROTECTED; segment++)
+	{
+		if (lists->count[segment] == 0)
+			continue;
+		for (idx = lists->lru[segment]; idx != NOT_SET; idx = lists->node[idx].next)
+			order[n++] = idx;
+	}
+	return n;
+}
@@ -0,0 +1,180 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Compare bitmap cache replacement policies on recorded traces
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Command line driver for plain C builds of the protocol core: replays
+   bitmap cache traces, written with the CRDBitmapCacheTracePath default
+   or replay -b, against every policy in cachepolicy.c as if each cache
+   kept only so many cells decoded, and prints how many gets each policy
+   would have served without going to disk. Not part of the Mac
+   application.
+
+   The segmented LRU protects four fifths of the cells unless -p says
+   otherwise.
+
+	cachesim [-c cells] [-p protected cells] trace... */
+
+#import "rdesktop.h"
+
+typedef struct _RDCacheAccess
+{
+	char op;
+	uint8 id;
+	uint16 idx;
+} RDCacheAccess;
+
+static void
+cachesim_usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-c cells] [-p protected cells] trace...\n", name);
+	exit(2);
+}
+
+/* append the accesses in a trace file to the list */
+static RD_BOOL
+cachesim_read(const char *path, RDCacheAccess ** accesses, int *count, int *size)
+{
+	char line[64], op;
+	int id, idx;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		perror(path);
+		return False;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		if ((line[0] == '#') || (line[0] == '\n'))
+			continue;
+		if ((sscanf(line, "%c %d %d", &op, &id, &idx) != 3) || ((op != 'P') && (op != 'G'))
+		    || (id < 0) || (id >= BITMAP_CACHE_SIZE) || (idx < 0) || (idx >= BITMAP_CACHE_ENTRIES))
+		{
+			fprintf(stderr, "%s: bad line: %s", path, line);
+			continue;
+		}
+
+		if (*count == *size)
+		{
+			*size = MAX(*size * 2, 4096);
+			*accesses = (RDCacheAccess *) xrealloc(*accesses, *size * sizeof(RDCacheAccess));
+		}
+		(*accesses)[*count].op = op;
+		(*accesses)[*count].id = id;
+		(*accesses)[*count].idx = idx;
+		(*count)++;
+	}
+
+	fclose(fp);
+	return True;
+}
+
+/* Replay the accesses; a get of a cell that is not held is a miss, and
+   the cell is then held as if loaded from disk */
+static void
+cachesim_run(const RDCachePolicy * policy, RDCacheAccess * accesses, int count, int cells,
+	     int protected_cells, uint32 * hits, uint32 * misses)
+{
+	RDCacheLists *lists = (RDCacheLists *) xmalloc(BITMAP_CACHE_SIZE * sizeof(RDCacheLists));
+	RDCacheLists *l;
+	sint16 victim;
+	int i;
+
+	for (i = 0; i < BITMAP_CACHE_SIZE; i++)
+	{
+		lists[i].protected_cells = protected_cells;
+		cache_lists_reset(&lists[i]);
+	}
+	*hits = *misses = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		l = &lists[accesses[i].id];
+
+		if (accesses[i].op == 'G')
+		{
+			if (cache_lists_holds(l, accesses[i].idx))
+			{
+				(*hits)++;
+				policy->hit(l, accesses[i].idx);
+				continue;
+			}
+			(*misses)++;
+		}
+		else
+		{
+			cache_lists_remove(l, accesses[i].idx);
+		}
+
+		policy->insert(l, accesses[i].idx, False);
+		if (cache_lists_count(l) > cells)
+		{
+			victim = policy->victim(l);
+			if (victim != NOT_SET)
+				cache_lists_remove(l, victim);
+		}
+	}
+
+	xfree(lists);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const RDCachePolicy *policy;
+	RDCacheAccess *accesses = NULL;
+	int c, i, count = 0, size = 0, cells = BMPCACHE2_C2_CELLS, protected_cells = 0;
+	uint32 hits, misses;
+
+	while ((c = getopt(argc, argv, "c:p:")) != -1)
+	{
+		switch (c)
+		{
+			case 'c':
+				cells = atoi(optarg);
+				break;
+			case 'p':
+				protected_cells = atoi(optarg);
+				break;
+			default:
+				cachesim_usage(argv[0]);
+		}
+	}
+	if ((optind == argc) || (cells <= 0) || (protected_cells < 0))
+		cachesim_usage(argv[0]);
+	if (protected_cells == 0)
+		protected_cells = cells * 4 / 5;
+
+	for (i = optind; i < argc; i++)
+		if (!cachesim_read(argv[i], &accesses, &count, &size))
+			return 1;
+
+	printf("%d accesses, %d cells decoded per cache\n", count, cells);
+	printf("%-8s %10s %10s %8s\n", "policy", "hits", "misses", "hit rate");
+	for (i = 0; (policy = cache_policy_at(i)) != NULL; i++)
+	{
+		cachesim_run(policy, accesses, count, cells, protected_cells, &hits, &misses);
+		printf("%-8s %10u %10u %7.2f%%\n", policy->name, hits, misses,
+		       (hits + misses) ? 100.0 * hits / (hits + misses) : 0.0);
+	}
+
+	xfree(accesses);
+	return 0;
+}
@@ -0,0 +1,357 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Session capture and replay
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* A capture records every packet sec_recv hands to the RDP layer, after
+   decryption and without licensing or virtual channel traffic, so that a
+   session can be decoded and drawn again offline. Replaying a capture
+   feeds the packets back through sec_recv in place of the network; the
+   replies the client would send are dropped by tcp_send.
+
+   The file starts with a header:
+	"CoRDcap" 0, uint32 version, uint16 width, height, bpp, flags
+   followed by one record per packet:
+	uint64 microseconds since the capture started, uint8 rdpver,
+	uint32 length, length bytes starting at the RDP header
+   with all integers little endian.
+
+   Replays are deterministic as long as the session was captured from its
+   start and without the persistent bitmap cache, whose contents on disk
+   are not part of the capture. */
+
+#import <errno.h>
+
+#import "rdesktop.h"
+
+#define CAPTURE_MAGIC		"CoRDcap"
+#define CAPTURE_VERSION		1
+#define CAPTURE_HEADER_SIZE	20
+#define CAPTURE_RECORD_SIZE	13
+
+#define CAPTURE_FLAG_RDP5		0x0001
+#define CAPTURE_FLAG_BITMAP_CACHE	0x0002
+#define CAPTURE_FLAG_PERSIST		0x0004
+#define CAPTURE_FLAG_PRECACHE		0x0008
+#define CAPTURE_FLAG_DESKTOP_SAVE	0x0010
+#define CAPTURE_FLAG_POLYGON_ELLIPSE	0x0020
+
+struct _RDCapture
+{
+	/* capturing */
+	FILE *fp;
+	uint64 start;
+
+	/* replaying */
+	uint8 *data, *p, *end;
+	RDStream s;
+	RDReplayStats *stats;
+};
+
+static uint64
+capture_usec(void)
+{
+	return order_stats_clock() / 1000;
+}
+
+static void
+put_le(uint8 * p, uint64 value, int bytes)
+{
+	while (bytes-- > 0)
+	{
+		*(p++) = value & 0xff;
+		value >>= 8;
+	}
+}
+
+static uint64
+get_le(const uint8 * p, int bytes)
+{
+	uint64 value = 0;
+
+	while (bytes-- > 0)
+		value = (value << 8) | p[bytes];
+	return value;
+}
+
+
+#pragma mark -
+#pragma mark Capturing
+
+/* Start capturing the packets of a connection to a file. Call before
+   connecting, so that the capture includes the whole session. */
+RD_BOOL
+capture_open(RDConnectionRef conn, const char *path)
+{
+	uint8 header[CAPTURE_HEADER_SIZE];
+	uint16 flags = 0;
+	FILE *fp;
+
+	fp = fopen(path, "wb");
+	if (fp == NULL)
+	{
+		error("capture: %s: %s\n", path, strerror(errno));
+		return False;
+	}
+
+	if (conn->useRdp5)
+		flags |= CAPTURE_FLAG_RDP5;
+	if (conn->bitmapCache)
+		flags |= CAPTURE_FLAG_BITMAP_CACHE;
+	if (conn->bitmapCachePersist)
+		flags |= CAPTURE_FLAG_PERSIST;
+	if (conn->bitmapCachePrecache)
+		flags |= CAPTURE_FLAG_PRECACHE;
+	if (conn->desktopSave)
+		flags |= CAPTURE_FLAG_DESKTOP_SAVE;
+	if (conn->polygonEllipseOrders)
+		flags |= CAPTURE_FLAG_POLYGON_ELLIPSE;
+
+	memcpy(header, CAPTURE_MAGIC, 8);
+	put_le(header + 8, CAPTURE_VERSION, 4);
+	put_le(header + 12, conn->screenWidth, 2);
+	put_le(header + 14, conn->screenHeight, 2);
+	put_le(header + 16, conn->serverBpp, 2);
+	put_le(header + 18, flags, 2);
+	if (fwrite(header, sizeof(header), 1, fp) != 1)
+	{
+		error("capture: %s: %s\n", path, strerror(errno));
+		fclose(fp);
+		return False;
+	}
+
+	capture_close(conn);
+	conn->capture = (struct _RDCapture *) xmalloc(sizeof(struct _RDCapture));
+	memset(conn->capture, 0, sizeof(struct _RDCapture));
+	conn->capture->fp = fp;
+	conn->capture->start = capture_usec();
+	return True;
+}
+
+/* Record the decrypted packet s, from its current position to its end */
+void
+capture_pdu(RDConnectionRef conn, uint8 rdpver, RDStreamRef s)
+{
+	struct _RDCapture *cap = conn->capture;
+	uint8 record[CAPTURE_RECORD_SIZE];
+	uint32 length = s->end - s->p;
+
+	if ((cap == NULL) || (cap->fp == NULL))
+		return;
+
+	put_le(record, capture_usec() - cap->start, 8);
+	record[8] = rdpver;
+	put_le(record + 9, length, 4);
+	if ((fwrite(record, sizeof(record), 1, cap->fp) != 1)
+	    || (fwrite(s->p, 1, length, cap->fp) != length))
+	{
+		error("capture: write failed, capture stopped\n");
+		fclose(cap->fp);
+		cap->fp = NULL;
+	}
+}
+
+/* Stop capturing or replaying */
+void
+capture_close(RDConnectionRef conn)
+{
+	struct _RDCapture *cap = conn->capture;
+
+	if (cap == NULL)
+		return;
+
+	if (cap->fp != NULL)
+		fclose(cap->fp);
+	xfree(cap->data);
+	xfree(cap->s.data);
+	xfree(cap);
+	conn->capture = NULL;
+}
+
+
+#pragma mark -
+#pragma mark Replaying
+
+/* Load a capture for replay and set up the connection the way the
+   captured one was configured */
+RD_BOOL
+replay_open(RDConnectionRef conn, const char *path)
+{
+	struct _RDCapture *cap;
+	uint8 *data;
+	uint16 flags;
+	long size;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (fp == NULL)
+	{
+		error("replay: %s: %s\n", path, strerror(errno));
+		return False;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	if (size < CAPTURE_HEADER_SIZE)
+	{
+		error("replay: %s is not a capture\n", path);
+		fclose(fp);
+		return False;
+	}
+	data = (uint8 *) xmalloc(size);
+	if (fread(data, size, 1, fp) != 1)
+	{
+		error("replay: %s: %s\n", path, strerror(errno));
+		xfree(data);
+		fclose(fp);
+		return False;
+	}
+	fclose(fp);
+
+	if ((memcmp(data, CAPTURE_MAGIC, 8) != 0) || (get_le(data + 8, 4) != CAPTURE_VERSION))
+	{
+		error("replay: %s is not a version %d capture\n", path, CAPTURE_VERSION);
+		xfree(data);
+		return False;
+	}
+
+	conn->screenWidth = get_le(data + 12, 2);
+	conn->screenHeight = get_le(data + 14, 2);
+	conn->serverBpp = get_le(data + 16, 2);
+	flags = get_le(data + 18, 2);
+	conn->useRdp5 = (flags & CAPTURE_FLAG_RDP5) != 0;
+	conn->bitmapCache = (flags & CAPTURE_FLAG_BITMAP_CACHE) != 0;
+	conn->bitmapCachePrecache = (flags & CAPTURE_FLAG_PRECACHE) != 0;
+	conn->desktopSave = (flags & CAPTURE_FLAG_DESKTOP_SAVE) != 0;
+	conn->polygonEllipseOrders = (flags & CAPTURE_FLAG_POLYGON_ELLIPSE) != 0;
+	conn->bitmapCachePersist = 0;
+	if (flags & CAPTURE_FLAG_PERSIST)
+		warning("replay: captured with the persistent bitmap cache, some bitmaps will be missing\n");
+
+	/* replies are dropped, so don't spend time encrypting them */
+	conn->useEncryption = 0;
+	conn->licenseIssued = 1;
+
+	capture_close(conn);
+	cap = (struct _RDCapture *) xmalloc(sizeof(struct _RDCapture));
+	memset(cap, 0, sizeof(struct _RDCapture));
+	cap->data = data;
+	cap->p = data + CAPTURE_HEADER_SIZE;
+	cap->end = data + size;
+	conn->capture = cap;
+	return True;
+}
+
+RD_BOOL
+replay_active(RDConnectionRef conn)
+{
+	return (conn->capture != NULL) && (conn->capture->data != NULL);
+}
+
+/* Stands in for sec_recv while replaying: returns the next captured
+   packet, or NULL at the end of the capture */
+RDStreamRef
+replay_recv(RDConnectionRef conn, uint8 * rdpver)
+{
+	struct _RDCapture *cap = conn->capture;
+	RDStreamRef s = &cap->s;
+	uint32 length;
+
+	if (cap->p + CAPTURE_RECORD_SIZE > cap->end)
+		return NULL;
+
+	length = get_le(cap->p + 9, 4);
+	if (cap->p + CAPTURE_RECORD_SIZE + length > cap->end)
+	{
+		error("replay: capture truncated\n");
+		cap->p = cap->end;
+		return NULL;
+	}
+	*rdpver = cap->p[8];
+
+	/* the RDP layer may change a packet while parsing it, so work on a copy */
+	if (length > s->size)
+	{
+		s->data = (uint8 *) xrealloc(s->data, length);
+		s->size = length;
+	}
+	memcpy(s->data, cap->p + CAPTURE_RECORD_SIZE, length);
+	s->p = s->data;
+	s->end = s->data + length;
+	cap->p += CAPTURE_RECORD_SIZE + length;
+
+	if (cap->stats != NULL)
+	{
+		cap->stats->pdus++;
+		cap->stats->bytes += length;
+	}
+	return s;
+}
+
+/* Decode and draw the whole capture as fast as possible, through whatever
+   ui_* backend is linked in. Mirrors -[CRDSession stream:handleEvent:].
+   Order statistics are turned on if they are not already. */
+void
+replay_run(RDConnectionRef conn, RDReplayStats * stats)
+{
+	uint32 ext_disc_reason = 0;
+	uint64 start;
+	RDStreamRef s;
+	uint8 type;
+
+	memset(stats, 0, sizeof(RDReplayStats));
+	conn->capture->stats = stats;
+	if (conn->orderStats == NULL)
+		order_stats_enable(conn, 0);
+
+	start = capture_usec();
+	while ((s = rdp_recv(conn, &type)) != NULL)
+	{
+		switch (type)
+		{
+			case RDP_PDU_DEMAND_ACTIVE:
+				process_demand_active(conn, s);
+				break;
+			case RDP_PDU_DEACTIVATE:
+			case RDP_PDU_REDIRECT:
+			case 0:
+				break;
+			case RDP_PDU_DATA:
+				if (process_data_pdu(conn, s, &ext_disc_reason))
+					goto done;
+				break;
+			default:
+				unimpl("PDU %d\n", type);
+		}
+	}
+      done:
+	stats->usec = capture_usec() - start;
+	conn->capture->stats = NULL;
+}
+
+/* Print frames/s and MB/s, followed by the order statistics */
+void
+replay_report(RDConnectionRef conn, RDReplayStats * stats, FILE * out)
+{
+	double seconds = (stats->usec > 0) ? stats->usec / 1e6 : 1e-6;
+
+	fprintf(out, "%u packets, %llu bytes in %.3f s: %.1f frames/s, %.2f MB/s\n",
+		stats->pdus, stats->bytes, seconds, stats->pdus / seconds,
+		stats->bytes / seconds / (1024 * 1024));
+	order_stats_dump(conn, out);
+}
@@ -73,52 +73,81 @@ channel_init(RDConnectionRef conn, RDVirtualChannel * channel, uint32 length)
 void
 channel_send(RDConnectionRef conn, RDStreamRef s, RDVirtualChannel * channel)
 {
-	uint32 length, flags;
-	uint32 thislength, remaining;
-	uint8 *data;
+	channel_send_gather(conn, s, channel, NULL, 0);
+}
+
+/* Send the data in s after the channel header followed by count buffers
+   of payload (fewer than SEND_GATHER_MAX), which go from where they
+   are, encrypted in place if the connection is, rather than being
+   copied into packets. The first
+   chunk's headers are in s; those of each later chunk are written at the
+   front of the packet buffer, over the first chunk's, which have been
+   sent and are the same size, so they end where the data in s starts.
+   Returns False, having sent nothing, if there are too many buffers. */
+RD_BOOL
+channel_send_gather(RDConnectionRef conn, RDStreamRef s, RDVirtualChannel * channel, struct iovec * payload, int count)
+{
+	struct iovec rest[SEND_GATHER_MAX], chunk[SEND_GATHER_MAX], *next = rest;
+	uint32 length, flags, thislength, remaining, part;
+	uint32 sec_flags = conn->useEncryption ? SEC_ENCRYPT : 0;
+	int n;
+
+	if ((count < 0) || (count >= SEND_GATHER_MAX))
+	{
+		error("channel_send: %d buffers, at most %d\n", count, SEND_GATHER_MAX - 1);
+		return False;
+	}
 
-	/* first fragment sent in-place */
 	s_pop_layer(s, channel_hdr);
-	length = s->end - s->p - 8;
+	rest[0].iov_base = s->p + 8;
+	rest[0].iov_len = s->end - s->p - 8;
+	if (count > 0)
+		memcpy(rest + 1, payload, count * sizeof(struct iovec));
+	remaining = length = transport_iov_length(rest, count + 1);
 
 	DEBUG_CHANNEL(("channel_send, length = %d\n", length));
 
-	thislength = MIN(length, CHANNEL_CHUNK_LENGTH);
-/* Note: In the original clipboard implementation, this number was
-   1592, not 1600. However, I don't remember the reason and 1600 seems
-   to work so.. This applies only to *this* length, not the length of
-   continuation or ending packets. */
-	remaining = length - thislength;
-	flags = (remaining == 0) ? CHANNEL_FLAG_FIRST | CHANNEL_FLAG_LAST : CHANNEL_FLAG_FIRST;
-	if (channel->flags & CHANNEL_OPTION_SHOW_PROTOCOL)
-		flags |= CHANNEL_FLAG_SHOW_PROTOCOL;
-
-	out_uint32_le(s, length);
-	out_uint32_le(s, flags);
-	data = s->end = s->p + thislength;
-	DEBUG_CHANNEL(("Sending %d bytes with FLAG_FIRST\n", thislength));
-	sec_send_to_channel(conn, s, conn->useEncryption ? SEC_ENCRYPT : 0, channel->mcs_id);
-
-	/* subsequent segments copied (otherwise would have to generate headers backwards) */
-	while (remaining > 0)
+/* Note: In the original clipboard implementation, the first chunk was
+   1592 bytes, not 1600. However, I don't remember the reason and 1600
+   seems to work so.. */
+	flags = CHANNEL_FLAG_FIRST;
+	do
 	{
 		thislength = MIN(remaining, CHANNEL_CHUNK_LENGTH);
 		remaining -= thislength;
-		flags = (remaining == 0) ? CHANNEL_FLAG_LAST : 0;
+		if (remaining == 0)
+			flags |= CHANNEL_FLAG_LAST;
 		if (channel->flags & CHANNEL_OPTION_SHOW_PROTOCOL)
 			flags |= CHANNEL_FLAG_SHOW_PROTOCOL;
 
 		DEBUG_CHANNEL(("Sending %d bytes with flags %d\n", thislength, flags));
 
-		s = sec_init(conn, conn->useEncryption ? SEC_ENCRYPT : 0, thislength + 8);
+		if (!(flags & CHANNEL_FLAG_FIRST))
+			s = sec_init(conn, sec_flags, 8);
 		out_uint32_le(s, length);
 		out_uint32_le(s, flags);
-		out_uint8p(s, data, thislength);
 		s_mark_end(s);
-		sec_send_to_channel(conn, s, conn->useEncryption ? SEC_ENCRYPT : 0, channel->mcs_id);
 
-		data += thislength;
+		/* take this chunk's data from the front of what is left */
+		for (n = 0; thislength > 0; next++)
+		{
+			part = MIN(thislength, next->iov_len);
+			if (part == 0)
+				continue;
+			chunk[n].iov_base = next->iov_base;
+			chunk[n++].iov_len = part;
+			next->iov_base = (uint8 *) next->iov_base + part;
+			next->iov_len -= part;
+			thislength -= part;
+			if (next->iov_len != 0)
+				break;
+		}
+		sec_send_to_channel_gather(conn, s, sec_flags, channel->mcs_id, chunk, n);
+
+		flags = 0;
 	}
+	while (remaining > 0);
+	return True;
 }
 
 void
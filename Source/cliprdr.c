@@ -33,21 +33,28 @@
 #define CLIPRDR_RESPONSE		1
 #define CLIPRDR_ERROR			2
 
+/* The data is sent from where it is, and scrambled if the connection is
+   encrypted */
 static void
 cliprdr_send_packet(RDConnectionRef conn, uint16 type, uint16 status, uint8 * data, uint32 length)
 {
 	RDStreamRef s;
+	uint8 pad[4] = { 0, 0, 0, 0 };	/* pad? */
+	struct iovec payload[2];
 
 	DEBUG_CLIPBOARD(("CLIPRDR send: type=%d, status=%d, length=%d\n", type, status, length));
 
-	s = channel_init(conn, conn->cliprdrChannel, length + 12);
+	s = channel_init(conn, conn->cliprdrChannel, 8);
 	out_uint16_le(s, type);
 	out_uint16_le(s, status);
 	out_uint32_le(s, length);
-	out_uint8p(s, data, length);
-	out_uint32(s, 0);	/* pad? */
 	s_mark_end(s);
-	channel_send(conn, s, conn->cliprdrChannel);
+
+	payload[0].iov_base = data;
+	payload[0].iov_len = length;
+	payload[1].iov_base = pad;
+	payload[1].iov_len = sizeof(pad);
+	channel_send_gather(conn, s, conn->cliprdrChannel, payload, 2);
 }
 
 /* Helper which announces our readiness to supply clipboard data
@@ -30,12 +30,18 @@
 #define CURSOR_CACHE_SIZE 0x20
 #define BRUSH_CACHE_ENTRIES 2
 #define BRUSH_CACHE_SIZE 64
+#define BRUSH_TILE_ENTRIES 64
 #define TEXT_CACHE_SIZE 256
 
 #define FONT_CACHE_SIZE 12
 #define FONT_CACHE_ENTRIES 256
 
 #define TIMEOUT_LENGTH 20
+#define SEND_GATHER_MAX 4	/* buffers of payload a packet can be sent from */
+#define EVENT_LOOP_TIMERS 8
+#define INPUT_RING_SIZE 512	/* a power of two */
+#define INPUT_BATCH_SIZE 15	/* the most a fast path input header can count */
+#define INPUT_FLUSH_INTERVAL 10000	/* microseconds a batch of pointer moves may wait */
 
 #define NOT_SET -1
 
@@ -231,6 +237,18 @@ enum RDP_INPUT_DEVICE
 #define MOUSE_FLAG_BUTTON5      0x0380
 #define MOUSE_FLAG_DOWN         0x8000
 
+/* Fast path input */
+#define FASTPATH_INPUT_ACTION_FASTPATH	0x0
+#define FASTPATH_INPUT_ENCRYPTED	0x2
+#define FASTPATH_INPUT_HEADER_MAX	11	/* header, two length bytes, signature */
+
+#define FASTPATH_INPUT_EVENT_SCANCODE	0x0
+#define FASTPATH_INPUT_EVENT_MOUSE	0x1
+#define FASTPATH_INPUT_EVENT_SYNC	0x3
+
+#define FASTPATH_INPUT_KBDFLAGS_RELEASE		0x01
+#define FASTPATH_INPUT_KBDFLAGS_EXTENDED	0x02
+
 /* Raster operation masks */
 #define ROP2_S(rop3) (rop3 & 0xf)
 #define ROP2_P(rop3) ((rop3 & 0x3) | ((rop3 & 0x30) >> 2))
@@ -293,6 +311,12 @@ enum RDP_INPUT_DEVICE
 #define RDP_CAPSET_COLCACHE	10
 #define RDP_CAPLEN_COLCACHE	0x08
 
+#define RDP_CAPSET_INPUT 13
+#define RDP_CAPLEN_INPUT 0x58
+#define INPUT_FLAG_SCANCODES 0x0001
+#define INPUT_FLAG_FASTPATH_INPUT 0x0008
+#define INPUT_FLAG_FASTPATH_INPUT2 0x0020
+
 #define RDP_CAPSET_BRUSHCACHE 15
 #define RDP_CAPLEN_BRUSHCACHE 0x08
 
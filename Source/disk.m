@@ -19,7 +19,9 @@
 */
 
 #import "rdesktop.h"
+#ifdef __OBJC__
 #import "CRDShared.h"
+#endif
 
 #import <sys/types.h>
 #import <sys/stat.h>
@@ -39,6 +41,9 @@
 #import <sys/statvfs.h>
 #import <sys/param.h>
 #import <sys/mount.h>
+#ifdef __linux__
+#import <sys/vfs.h>		/* statfs */
+#endif
 
 
 #define STATFS_FN(path, buf) (statfs(path,buf))
@@ -1071,7 +1076,11 @@ disk_query_directory(RDConnectionRef conn, NTHandle handle, uint32 info_class, c
 
 			if (S_ISDIR(fstat.st_mode))
 				file_attributes |= FILE_ATTRIBUTE_DIRECTORY;
+#ifdef __OBJC__
 			if (CRDPathIsHidden([NSString stringWithUTF8String:fullpath]))
+#else
+			if (pdirent->d_name[0] == '.')
+#endif
 				file_attributes |= FILE_ATTRIBUTE_HIDDEN;
 			if (!file_attributes)
 				file_attributes |= FILE_ATTRIBUTE_NORMAL;
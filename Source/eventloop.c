@@ -0,0 +1,353 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Event loop for the connection thread
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* The connection thread sleeps in a single epoll (Linux) or kqueue (Mac
+   OS X) wait on the server's socket and a wakeup descriptor, an eventfd
+   or a pipe, which other threads signal when they have queued input or
+   want the loop to stop. The wait ends no later than the earliest timer.
+   Each pass handles the wakeup first, so that input is sent before the
+   next screen update is decoded, then the socket, then any timers that
+   are due. Packets already read from the socket do not make it readable
+   again, so while the socket's owner says it has some buffered, the wait
+   does not block and the socket is handled on every pass.
+
+   A wakeup is only written when none is pending, so a burst of input
+   costs one write and one read. */
+
+#import <unistd.h>
+#import <errno.h>
+#import <fcntl.h>
+
+#import "rdesktop.h"
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define EVENT_LOOP_EPOLL
+#else
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+#ifndef EVENT_LOOP_EPOLL
+/* the eventfd is made non-blocking when it is created, the pipe here */
+static void
+event_loop_set_nonblocking(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+#endif
+
+/* add or remove fd from the descriptors the loop waits on */
+static RD_BOOL
+event_loop_control(RDEventLoop * loop, int fd, RD_BOOL add)
+{
+#ifdef EVENT_LOOP_EPOLL
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	return epoll_ctl(loop->poller, add ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fd, &event) == 0;
+#else
+	struct kevent event;
+
+	EV_SET(&event, fd, EVFILT_READ, add ? EV_ADD : EV_DELETE, 0, 0, NULL);
+	return kevent(loop->poller, &event, 1, NULL, 0, NULL) == 0;
+#endif
+}
+
+RD_BOOL
+event_loop_init(RDEventLoop * loop)
+{
+	int fds[2];
+
+	memset(loop, 0, sizeof(RDEventLoop));
+	loop->fd = loop->wake_read = loop->wake_write = -1;
+
+#ifdef EVENT_LOOP_EPOLL
+	loop->poller = epoll_create1(EPOLL_CLOEXEC);
+	fds[0] = fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fds[0] < 0)
+		fds[0] = fds[1] = -1;
+#else
+	loop->poller = kqueue();
+	if (pipe(fds) == 0)
+	{
+		event_loop_set_nonblocking(fds[0]);
+		event_loop_set_nonblocking(fds[1]);
+	}
+	else
+		fds[0] = fds[1] = -1;
+#endif
+
+	loop->wake_read = fds[0];
+	loop->wake_write = fds[1];
+	if ((loop->poller < 0) || (loop->wake_read < 0) || !event_loop_control(loop, loop->wake_read, True))
+	{
+		error("event loop: %s\n", strerror(errno));
+		event_loop_destroy(loop);
+		return False;
+	}
+	return True;
+}
+
+void
+event_loop_destroy(RDEventLoop * loop)
+{
+	if (loop->poller >= 0)
+		close(loop->poller);
+	if (loop->wake_read >= 0)
+		close(loop->wake_read);
+	if ((loop->wake_write >= 0) && (loop->wake_write != loop->wake_read))
+		close(loop->wake_write);
+	loop->poller = loop->wake_read = loop->wake_write = loop->fd = -1;
+}
+
+/* Call handler whenever fd can be read; -1 to stop watching */
+RD_BOOL
+event_loop_watch(RDEventLoop * loop, int fd, RDEventHandler handler, void *context)
+{
+	if (loop->fd >= 0)
+		event_loop_control(loop, loop->fd, False);
+
+	loop->fd = fd;
+	loop->readable = handler;
+	loop->readable_context = context;
+	if ((fd >= 0) && !event_loop_control(loop, fd, True))
+	{
+		error("event loop: %s\n", strerror(errno));
+		loop->fd = -1;
+		return False;
+	}
+	return True;
+}
+
+/* Have the watched descriptor's handler called, without waiting, while
+   check (given the handler's context) says that data it has already read
+   from the descriptor is waiting to be handled */
+void
+event_loop_on_buffered(RDEventLoop * loop, RDEventCheck check)
+{
+	loop->buffered = check;
+}
+
+/* Call handler on the loop's thread after event_loop_wake */
+void
+event_loop_on_wake(RDEventLoop * loop, RDEventHandler handler, void *context)
+{
+	loop->wake = handler;
+	loop->wake_context = context;
+}
+
+/* Wake the loop from any thread */
+void
+event_loop_wake(RDEventLoop * loop)
+{
+#ifdef EVENT_LOOP_EPOLL
+	uint64 one = 1;
+#else
+	uint8 one = 1;
+#endif
+
+	if (__sync_lock_test_and_set(&loop->woken, 1) != 0)
+		return;
+	if (write(loop->wake_write, &one, sizeof(one)) < 0)
+		error("event loop: wake: %s\n", strerror(errno));
+}
+
+/* Whether a wakeup has been raised that the loop has not handled yet, so
+   that a handler doing a lot of work can return to let it through */
+RD_BOOL
+event_loop_wake_pending(RDEventLoop * loop)
+{
+	return loop->woken != 0;
+}
+
+/* Ask event_loop_run to return, from any thread */
+void
+event_loop_stop(RDEventLoop * loop)
+{
+	loop->stopped = True;
+	event_loop_wake(loop);
+}
+
+/* Call handler after usec microseconds and then, if interval is not 0,
+   every interval microseconds. Returns the timer, or -1 if all are in
+   use. */
+int
+event_loop_add_timer(RDEventLoop * loop, uint64 usec, uint64 interval, RDEventHandler handler, void *context)
+{
+	RDEventTimer *timer;
+	int i;
+
+	for (i = 0; i < EVENT_LOOP_TIMERS; i++)
+	{
+		timer = &loop->timers[i];
+		if (timer->deadline != 0)
+			continue;
+		timer->deadline = order_stats_clock() + usec * 1000;
+		timer->interval = interval * 1000;
+		timer->handler = handler;
+		timer->context = context;
+		return i;
+	}
+	return -1;
+}
+
+void
+event_loop_cancel_timer(RDEventLoop * loop, int timer)
+{
+	if ((timer >= 0) && (timer < EVENT_LOOP_TIMERS))
+		loop->timers[timer].deadline = 0;
+}
+
+/* the earliest deadline, 0 if there are no timers */
+static uint64
+event_loop_next_deadline(RDEventLoop * loop)
+{
+	uint64 next = 0;
+	int i;
+
+	for (i = 0; i < EVENT_LOOP_TIMERS; i++)
+	{
+		if ((loop->timers[i].deadline != 0) && ((next == 0) || (loop->timers[i].deadline < next)))
+			next = loop->timers[i].deadline;
+	}
+	return next;
+}
+
+/* run the timers that are due; a timer that fires once is freed first,
+   so its handler may add it again */
+static int
+event_loop_fire_timers(RDEventLoop * loop)
+{
+	uint64 now = order_stats_clock();
+	RDEventTimer *timer;
+	int i, fired = 0;
+
+	for (i = 0; i < EVENT_LOOP_TIMERS; i++)
+	{
+		timer = &loop->timers[i];
+		if ((timer->deadline == 0) || (timer->deadline > now))
+			continue;
+
+		if (timer->interval == 0)
+			timer->deadline = 0;
+		else
+		{
+			timer->deadline += timer->interval;
+			if (timer->deadline <= now)
+				timer->deadline = now + timer->interval;
+		}
+		timer->handler(timer->context);
+		fired++;
+	}
+	return fired;
+}
+
+/* Wait up to timeout_ms milliseconds (-1 for as long as it takes) for
+   the wakeup, the watched descriptor or a timer, and run their handlers.
+   Returns the number of handlers run, or -1 if the wait failed. */
+int
+event_loop_run_once(RDEventLoop * loop, int timeout_ms)
+{
+	uint64 now, next, wait;
+	RD_BOOL woken = False, readable = False, buffered;
+	uint8 drain[64];
+	int i, n, handled = 0;
+#ifdef EVENT_LOOP_EPOLL
+	struct epoll_event events[2];
+#else
+	struct kevent events[2];
+	struct timespec ts;
+#endif
+
+	if ((next = event_loop_next_deadline(loop)) != 0)
+	{
+		now = order_stats_clock();
+		wait = (next > now) ? (next - now + 999999) / 1000000 : 0;
+		if ((timeout_ms < 0) || (wait < (uint64) timeout_ms))
+			timeout_ms = (int) MIN(wait, 0x7fffffff);
+	}
+
+	/* data already read is as good as readable; only look for wakeups */
+	buffered = (loop->fd >= 0) && (loop->buffered != NULL) && loop->buffered(loop->readable_context);
+	if (buffered)
+		timeout_ms = 0;
+
+#ifdef EVENT_LOOP_EPOLL
+	n = epoll_wait(loop->poller, events, 2, timeout_ms);
+#else
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+	n = kevent(loop->poller, NULL, 0, events, 2, (timeout_ms < 0) ? NULL : &ts);
+#endif
+	if (n < 0)
+	{
+		if (errno == EINTR)
+			return 0;
+		error("event loop: %s\n", strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+#ifdef EVENT_LOOP_EPOLL
+		int fd = events[i].data.fd;
+#else
+		int fd = (int) events[i].ident;
+#endif
+		if (fd == loop->wake_read)
+			woken = True;
+		else if (fd == loop->fd)
+			readable = True;
+	}
+
+	readable = readable || buffered;
+	if (woken)
+	{
+		while (read(loop->wake_read, drain, sizeof(drain)) > 0) ;
+		__sync_lock_release(&loop->woken);
+		if (loop->wake != NULL)
+			loop->wake(loop->wake_context);
+		handled++;
+	}
+	if (readable && (loop->readable != NULL) && !loop->stopped)
+	{
+		loop->readable(loop->readable_context);
+		handled++;
+	}
+	if (!loop->stopped)
+		handled += event_loop_fire_timers(loop);
+	return handled;
+}
+
+/* Run until event_loop_stop, or until waiting fails */
+void
+event_loop_run(RDEventLoop * loop)
+{
+	while (!loop->stopped)
+	{
+		if (event_loop_run_once(loop, -1) < 0)
+			break;
+	}
+}
@@ -0,0 +1,241 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Glyph atlases for text drawing
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* The glyphs of each font cache are packed, one byte a pixel, into a
+   single surface as they are first drawn: left to right along shelves
+   as tall as their tallest glyph, the surface growing downwards as
+   shelves are added. A text run (textrun.c) is drawn by copying the
+   glyphs' parts of the atlas into a coverage mask for the run, which the
+   UI then fills with the foreground colour in one go.
+
+   Glyphs replaced in the font cache leave their space behind. When an
+   atlas is full it is started again from empty, by moving to a new
+   generation; the glyphs of older generations are placed again when
+   they are next drawn. Glyphs too large for any atlas are drawn straight
+   from their bits. */
+
+#import "rdesktop.h"
+
+#define ATLAS_WIDTH		512
+#define ATLAS_MIN_HEIGHT	32
+#define ATLAS_MAX_HEIGHT	512
+
+/* make the atlas at least height rows tall */
+static RD_BOOL
+glyphatlas_grow(RDConnectionRef conn, RDGlyphAtlas * atlas, int height)
+{
+	int new_height = MAX(atlas->height, ATLAS_MIN_HEIGHT);
+
+	while (new_height < height)
+		new_height *= 2;
+	if (new_height > ATLAS_MAX_HEIGHT)
+		return False;
+	if ((atlas->pixels != NULL) && (new_height == atlas->height))
+		return True;
+
+	atlas->pixels = (uint8 *) xrealloc(atlas->pixels, ATLAS_WIDTH * new_height);
+	cache_budget_charge(conn, CACHE_KIND_GLYPH, (sint64) ATLAS_WIDTH * (new_height - atlas->height), 0);
+	atlas->height = new_height;
+	return True;
+}
+
+/* start a new generation in the space the atlas has */
+static void
+glyphatlas_restart(RDGlyphAtlas * atlas)
+{
+	atlas->shelf_x = atlas->shelf_y = atlas->shelf_height = 0;
+	atlas->generation++;
+}
+
+/* Whether a glyph is in its font's atlas */
+RD_BOOL
+glyphatlas_placed(RDConnectionRef conn, uint8 font, RDFontGlyph * glyph)
+{
+	RDGlyphAtlas *atlas = &conn->glyphAtlas[font];
+
+	return (glyph->atlas_generation != 0) && (glyph->atlas_generation == atlas->generation)
+		&& (atlas->pixels != NULL);
+}
+
+/* Put a glyph in its font's atlas. Returns False if it is too large, in
+   which case it is drawn from its bits. */
+RD_BOOL
+glyphatlas_place(RDConnectionRef conn, uint8 font, RDFontGlyph * glyph)
+{
+	RDGlyphAtlas *atlas = &conn->glyphAtlas[font];
+	int width = glyph->width, height = glyph->height, scanline = (width + 7) / 8, x, y;
+	uint8 *out;
+	const uint8 *in;
+
+	if (glyphatlas_placed(conn, font, glyph))
+	{
+		atlas->used = 1;
+		return True;
+	}
+	if ((width == 0) || (height == 0) || (width > ATLAS_WIDTH) || (height > ATLAS_MAX_HEIGHT)
+	    || (glyph->data == NULL))
+		return False;
+
+	if (atlas->generation == 0)
+		atlas->generation = 1;
+	else if (glyph->atlas_generation != 0)
+		conn->cacheUsage.rebuilt[CACHE_KIND_GLYPH]++;
+
+	if (atlas->shelf_x + width > ATLAS_WIDTH)
+	{
+		atlas->shelf_y += atlas->shelf_height;
+		atlas->shelf_x = atlas->shelf_height = 0;
+	}
+	if (!glyphatlas_grow(conn, atlas, atlas->shelf_y + height))
+	{
+		glyphatlas_restart(atlas);
+		if (!glyphatlas_grow(conn, atlas, height))
+			return False;
+	}
+
+	glyph->atlas_x = atlas->shelf_x;
+	glyph->atlas_y = atlas->shelf_y;
+	glyph->atlas_generation = atlas->generation;
+	atlas->shelf_x += width;
+	atlas->shelf_height = MAX(atlas->shelf_height, height);
+	atlas->used = 1;
+
+	for (y = 0; y < height; y++)
+	{
+		in = glyph->data + y * scanline;
+		out = atlas->pixels + (glyph->atlas_y + y) * ATLAS_WIDTH + glyph->atlas_x;
+		for (x = 0; x < width; x++)
+			out[x] = (in[x >> 3] & (0x80 >> (x & 7))) ? 0xff : 0;
+	}
+	return True;
+}
+
+/* Free a font's atlas; its glyphs are placed again as they are drawn */
+void
+glyphatlas_free(RDConnectionRef conn, uint8 font)
+{
+	RDGlyphAtlas *atlas = &conn->glyphAtlas[font];
+
+	if (atlas->pixels == NULL)
+		return;
+
+	cache_budget_charge(conn, CACHE_KIND_GLYPH, -(sint64) ATLAS_WIDTH * atlas->height, 0);
+	xfree(atlas->pixels);
+	atlas->pixels = NULL;
+	atlas->height = 0;
+	atlas->used = 0;
+	glyphatlas_restart(atlas);
+}
+
+/* Clear the coverage mask for a text run over the given screen area.
+   The mask's buffer belongs to the connection and is reused. */
+void
+glyphatlas_begin_run(RDConnectionRef conn, RDGlyphMask * mask, int x, int y, int width, int height)
+{
+	int size;
+
+	width = MAX(width, 0);
+	height = MAX(height, 0);
+	size = width * height;
+
+	if (size > conn->glyphMaskSize)
+	{
+		conn->glyphMask = (uint8 *) xrealloc(conn->glyphMask, size);
+		conn->glyphMaskSize = size;
+	}
+
+	mask->pixels = conn->glyphMask;
+	mask->x = x;
+	mask->y = y;
+	mask->width = width;
+	mask->height = height;
+	mask->inked = False;
+	memset(mask->pixels, 0, size);
+}
+
+/* Add a glyph drawn with its top left corner at x, y to the mask */
+void
+glyphatlas_blit(RDConnectionRef conn, uint8 font, RDFontGlyph * glyph, int x, int y, RDGlyphMask * mask)
+{
+	RDGlyphAtlas *atlas = &conn->glyphAtlas[font];
+	int srcx = 0, srcy = 0, cx = glyph->width, cy = glyph->height, scanline = (glyph->width + 7) / 8;
+	int i, bit;
+	const uint8 *in;
+	uint8 *out;
+
+	/* clip to the mask */
+	x -= mask->x;
+	y -= mask->y;
+	if (x < 0)
+	{
+		srcx = -x;
+		cx += x;
+		x = 0;
+	}
+	if (y < 0)
+	{
+		srcy = -y;
+		cy += y;
+		y = 0;
+	}
+	cx = MIN(cx, mask->width - x);
+	cy = MIN(cy, mask->height - y);
+	if ((cx <= 0) || (cy <= 0))
+		return;
+
+	mask->inked = True;
+	out = mask->pixels + y * mask->width + x;
+
+	if (glyphatlas_placed(conn, font, glyph))
+	{
+		in = atlas->pixels + (glyph->atlas_y + srcy) * ATLAS_WIDTH + glyph->atlas_x + srcx;
+		for (; cy > 0; cy--, in += ATLAS_WIDTH, out += mask->width)
+			for (i = 0; i < cx; i++)
+				out[i] |= in[i];
+		return;
+	}
+
+	if (glyph->data == NULL)
+		return;
+
+	in = glyph->data + srcy * scanline;
+	for (; cy > 0; cy--, in += scanline, out += mask->width)
+	{
+		for (i = 0; i < cx; i++)
+		{
+			bit = srcx + i;
+			if (in[bit >> 3] & (0x80 >> (bit & 7)))
+				out[i] = 0xff;
+		}
+	}
+}
+
+/* Free every atlas of a connection and the run mask */
+void
+glyphatlas_destroy(RDConnectionRef conn)
+{
+	int font;
+
+	for (font = 0; font < FONT_CACHE_SIZE; font++)
+		glyphatlas_free(conn, font);
+
+	xfree(conn->glyphMask);
+	conn->glyphMask = NULL;
+	conn->glyphMaskSize = 0;
+}
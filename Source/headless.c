@@ -0,0 +1,811 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Headless software framebuffer backend for the ui_* drawing API
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Stands in for CRDDrawingGlue.m in plain C builds of the protocol core,
+   so decoding and rendering can be run and profiled without Cocoa. It is
+   not part of the Mac application. The screen is a 32 bit framebuffer in
+   the same layout as CRDBitmap (0xff,R,G,B bytes, rows top-down), hung off
+   conn->ui by headless_init. Unlike the Cocoa glue it applies the ROP2
+   opcodes it is given. */
+
+#import "rdesktop.h"
+
+#include <math.h>
+
+typedef struct _RDFramebuffer
+{
+	int width, height;
+	uint8 *pixels;
+	RDColorMapRef colour_map;
+	int clip_left, clip_top, clip_right, clip_bottom;	/* right and bottom exclusive */
+	uint32 updates;
+} RDFramebuffer;
+
+/* bitmaps hold ARGB pixels, glyphs one byte (0 or 1) per pixel and
+   cursors nothing */
+struct _RDSurface
+{
+	int width, height;
+	uint8 *data;
+};
+
+#define FB_FROM_CONN	RDFramebuffer *fb = (RDFramebuffer *)conn->ui
+#define FB_PIXEL(fb,x,y)	((uint32 *)((fb)->pixels + ((y) * (fb)->width + (x)) * 4))
+
+#pragma mark -
+#pragma mark Pixels
+
+static inline uint32
+fb_pixel(uint8 r, uint8 g, uint8 b)
+{
+	uint8 p[4] = { 0xff, r, g, b };
+	uint32 v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+/* same conversion as -[CRDSessionView rgbForRDCColor:] */
+static uint32
+fb_colour(RDConnectionRef conn, int colour)
+{
+	FB_FROM_CONN;
+	uint32 t;
+
+	switch (conn->serverBpp)
+	{
+		case 16:
+			return fb_pixel((((colour >> 11) & 0x1f) * 255 + 15) / 31,
+					(((colour >> 5) & 0x3f) * 255 + 31) / 63,
+					((colour & 0x1f) * 255 + 15) / 31);
+		case 15:
+			return fb_pixel((((colour >> 10) & 0x1f) * 255 + 15) / 31,
+					(((colour >> 5) & 0x1f) * 255 + 15) / 31,
+					((colour & 0x1f) * 255 + 15) / 31);
+		case 8:
+			t = (fb->colour_map != NULL) ? fb->colour_map[colour & 0xff] : 0;
+			break;
+		default:
+			t = colour;
+			break;
+	}
+	return fb_pixel(t & 0xff, (t >> 8) & 0xff, (t >> 16) & 0xff);
+}
+
+/* the framebuffer as seen by the raster operations */
+static void
+fb_surface(RDFramebuffer * fb, RDRopSurface * surface)
+{
+	surface->pixels = fb->pixels;
+	surface->stride = fb->width * 4;
+	surface->width = fb->width;
+	surface->height = fb->height;
+	surface->clip_left = fb->clip_left;
+	surface->clip_top = fb->clip_top;
+	surface->clip_right = fb->clip_right;
+	surface->clip_bottom = fb->clip_bottom;
+	surface->opaque = fb_pixel(0, 0, 0);
+}
+
+/* clip a destination rectangle to the clip region, moving the source
+   origin along with it; returns False when nothing is left */
+static RD_BOOL
+fb_clip(RDFramebuffer * fb, int *x, int *y, int *cx, int *cy, int *srcx, int *srcy)
+{
+	int dx = 0, dy = 0;
+
+	if (*x < fb->clip_left)
+		dx = fb->clip_left - *x;
+	if (*y < fb->clip_top)
+		dy = fb->clip_top - *y;
+	*x += dx;
+	*y += dy;
+	*cx = MIN(*cx - dx, fb->clip_right - *x);
+	*cy = MIN(*cy - dy, fb->clip_bottom - *y);
+	if (srcx != NULL)
+	{
+		*srcx += dx;
+		*srcy += dy;
+	}
+	return (*cx > 0) && (*cy > 0);
+}
+
+static inline void
+fb_plot(RDFramebuffer * fb, int opcode, int x, int y, uint32 colour)
+{
+	if ((x < fb->clip_left) || (x >= fb->clip_right) || (y < fb->clip_top)
+	    || (y >= fb->clip_bottom))
+		return;
+	rop2_fill_row(opcode, FB_PIXEL(fb, x, y), colour, 1, fb_pixel(0, 0, 0));
+}
+
+static void
+fb_fill(RDFramebuffer * fb, int opcode, int x, int y, int cx, int cy, uint32 colour)
+{
+	RDRopSurface surface;
+
+	fb_surface(fb, &surface);
+	rop_fill(&surface, opcode, x, y, cx, cy, colour);
+	fb->updates++;
+}
+
+/* combine ARGB source pixels (src_stride bytes per row, src_width x
+   src_height) into the framebuffer */
+static void
+fb_blit(RDFramebuffer * fb, int opcode, int x, int y, int cx, int cy, const uint8 * src,
+	int src_stride, int src_width, int src_height, int srcx, int srcy)
+{
+	RDRopSurface surface;
+
+	fb_surface(fb, &surface);
+	rop_blit(&surface, opcode, x, y, cx, cy, src, src_stride, src_width, src_height, srcx, srcy);
+	fb->updates++;
+}
+
+/* fill one scanline span [x1, x2) with an 8x8 brush tile */
+static void
+fb_span(RDFramebuffer * fb, int opcode, int x1, int x2, int y, const uint32 * tile, int xorigin,
+	int yorigin)
+{
+	RDRopSurface surface;
+
+	fb_surface(fb, &surface);
+	rop_pattern(&surface, opcode, x1, y, x2 - x1, 1, tile, xorigin, yorigin);
+}
+
+/* the 8x8 tile for a brush: solid brushes are filled into solid, the
+   others come from the brush tile cache */
+static const uint32 *
+fb_brush(RDConnectionRef conn, RDBrush * brush, int bgcolour, int fgcolour, uint32 * solid)
+{
+	const uint32 *tile;
+	uint32 on;
+	int i, style = (brush != NULL) ? brush->style : 0;
+
+	if (style == 0)
+	{
+		on = fb_colour(conn, fgcolour);
+		for (i = 0; i < 64; i++)
+			solid[i] = on;
+		return solid;
+	}
+
+	tile = brush_tile_get(conn, brush, fb_colour(conn, fgcolour), fb_colour(conn, bgcolour));
+	if (tile == NULL)
+		unimpl("brush %d\n", style);
+	return tile;
+}
+
+/* Bresenham, leaving out the end point like GDI */
+static void
+fb_line(RDFramebuffer * fb, int opcode, int x1, int y1, int x2, int y2, uint32 colour)
+{
+	int dx = abs(x2 - x1), dy = -abs(y2 - y1);
+	int sx = (x1 < x2) ? 1 : -1, sy = (y1 < y2) ? 1 : -1;
+	int err = dx + dy, e2;
+
+	while ((x1 != x2) || (y1 != y2))
+	{
+		fb_plot(fb, opcode, x1, y1, colour);
+		e2 = 2 * err;
+		if (e2 >= dy)
+		{
+			err += dy;
+			x1 += sx;
+		}
+		if (e2 <= dx)
+		{
+			err += dx;
+			y1 += sy;
+		}
+	}
+	fb->updates++;
+}
+
+static int
+fb_compare_double(const void *a, const void *b)
+{
+	double d = ((const double *) a)[0] - ((const double *) b)[0];
+
+	return (d < 0) ? -1 : (d > 0);
+}
+
+
+#pragma mark -
+#pragma mark Setup
+
+/* Give a connection a black screenWidth x screenHeight framebuffer in
+   conn->ui; the ui_* functions below draw into it. */
+RD_BOOL
+headless_init(RDConnectionRef conn)
+{
+	RDFramebuffer *fb = xmalloc(sizeof(RDFramebuffer));
+
+	memset(fb, 0, sizeof(RDFramebuffer));
+	conn->ui = fb;
+	ui_resize_window(conn);
+	return fb->pixels != NULL;
+}
+
+void
+headless_deinit(RDConnectionRef conn)
+{
+	FB_FROM_CONN;
+
+	if (fb == NULL)
+		return;
+	xfree(fb->pixels);
+	xfree(fb->colour_map);
+	xfree(fb);
+	conn->ui = NULL;
+}
+
+/* The framebuffer as 0xff,R,G,B pixels, width*4 bytes per row. updates,
+   if given, receives the number of drawing operations so far. */
+uint8 *
+headless_get_pixels(RDConnectionRef conn, int *width, int *height, uint32 * updates)
+{
+	FB_FROM_CONN;
+
+	*width = fb->width;
+	*height = fb->height;
+	if (updates != NULL)
+		*updates = fb->updates;
+	return fb->pixels;
+}
+
+
+#pragma mark -
+#pragma mark Resizing the Connection Window
+
+void
+ui_resize_window(RDConnectionRef conn)
+{
+	FB_FROM_CONN;
+	int i;
+
+	xfree(fb->pixels);
+	fb->width = conn->screenWidth;
+	fb->height = conn->screenHeight;
+	fb->pixels = xmalloc(fb->width * fb->height * 4);
+	for (i = 0; i < fb->width * fb->height; i++)
+		((uint32 *) fb->pixels)[i] = fb_pixel(0, 0, 0);
+	ui_reset_clip(conn);
+}
+
+
+#pragma mark -
+#pragma mark Colormap
+
+RDColorMapRef
+ui_create_colourmap(RDColorMap * colours)
+{
+	unsigned int *map = xmalloc(MAX(colours->ncolours, 256) * sizeof(unsigned int));
+	int i;
+
+	memset(map, 0, MAX(colours->ncolours, 256) * sizeof(unsigned int));
+	for (i = 0; i < colours->ncolours; i++)
+		map[i] = (colours->colours[i].blue << 16) | (colours->colours[i].green << 8) |
+			colours->colours[i].red;
+	return map;
+}
+
+void
+ui_set_colourmap(RDConnectionRef conn, RDColorMapRef map)
+{
+	FB_FROM_CONN;
+
+	xfree(fb->colour_map);
+	fb->colour_map = map;
+}
+
+RDColorMapRef
+ui_get_colourmap(RDConnectionRef conn)
+{
+	FB_FROM_CONN;
+
+	return fb->colour_map;
+}
+
+
+#pragma mark -
+#pragma mark Bitmap
+
+RDBitmapRef
+ui_create_bitmap(RDConnectionRef conn, int width, int height, uint8 * data)
+{
+	FB_FROM_CONN;
+	uint8 *argb = xmalloc(width * height * 4);
+
+	bitmap_convert_argb(argb, 0, data, width * ((conn->serverBpp + 7) / 8), width, height,
+			    conn->serverBpp, fb->colour_map);
+	return ui_create_bitmap_argb(conn, width, height, argb);
+}
+
+void
+ui_paint_bitmap(RDConnectionRef conn, int x, int y, int cx, int cy, int width, int height,
+		uint8 * data)
+{
+	RDBitmapRef bitmap = ui_create_bitmap(conn, width, height, data);
+
+	ui_memblt(conn, 12, x, y, cx, cy, bitmap, 0, 0);
+	ui_destroy_bitmap(bitmap);
+}
+
+/* The _argb variants take ownership of an already converted (malloc'd) ARGB8888 buffer */
+RDBitmapRef
+ui_create_bitmap_argb(RDConnectionRef conn, int width, int height, uint8 * argb)
+{
+	RDBitmapRef bitmap = xmalloc(sizeof(struct _RDSurface));
+
+	bitmap->width = width;
+	bitmap->height = height;
+	bitmap->data = argb;
+	return bitmap;
+}
+
+void
+ui_paint_bitmap_argb(RDConnectionRef conn, int x, int y, int cx, int cy, int width, int height,
+		     uint8 * argb)
+{
+	FB_FROM_CONN;
+
+	fb_blit(fb, 12, x, y, cx, cy, argb, width * 4, width, height, 0, 0);
+	xfree(argb);
+}
+
+void
+ui_memblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBitmapRef src,
+	  int srcx, int srcy)
+{
+	FB_FROM_CONN;
+
+	fb_blit(fb, opcode, x, y, cx, cy, src->data, src->width * 4, src->width, src->height, srcx,
+		srcy);
+}
+
+void
+ui_destroy_bitmap(RDBitmapRef bmp)
+{
+	if (bmp == NULL)
+		return;
+	xfree(bmp->data);
+	xfree(bmp);
+}
+
+int
+ui_bitmap_bytes(RDBitmapRef bmp)
+{
+	if (bmp == NULL)
+		return 0;
+	return sizeof(struct _RDSurface) + ((bmp->data != NULL) ? bmp->width * bmp->height * 4 : 0);
+}
+
+/* expand an 8x8 colour brush from the brush cache into framebuffer pixels */
+void
+ui_convert_brush(RDConnectionRef conn, RDBrushData * bd, uint32 * pixels)
+{
+	FB_FROM_CONN;
+
+	bitmap_convert_argb((uint8 *) pixels, 0, bd->data, 8 * (bd->colour_code - 2), 8, 8, conn->serverBpp,
+			    fb->colour_map);
+}
+
+
+#pragma mark -
+#pragma mark Desktop Cache
+
+/* The desktop cache keeps raw framebuffer pixels; it is only ever read
+   back by ui_desktop_restore, so there is no need for server colours. */
+void
+ui_desktop_save(RDConnectionRef conn, uint32 offset, int x, int y, int cx, int cy)
+{
+	FB_FROM_CONN;
+	int srcx = x, srcy = y;
+
+	if ((x < 0) || (y < 0) || (x + cx > fb->width) || (y + cy > fb->height))
+	{
+		warning("desktop save outside the screen\n");
+		return;
+	}
+	cache_put_desktop(conn, offset * 4, cx, cy, fb->width * 4, 4,
+			  fb->pixels + (srcy * fb->width + srcx) * 4);
+}
+
+void
+ui_desktop_restore(RDConnectionRef conn, uint32 offset, int x, int y, int cx, int cy)
+{
+	FB_FROM_CONN;
+	uint8 *data = cache_get_desktop(conn, offset * 4, cx, cy, 4);
+
+	if (data == NULL)
+		return;
+	fb_blit(fb, 12, x, y, cx, cy, data, cx * 4, cx, cy, 0, 0);
+}
+
+
+#pragma mark -
+#pragma mark Managing Draw Session
+
+void
+ui_begin_update(RDConnectionRef conn)
+{
+}
+
+void
+ui_end_update(RDConnectionRef conn)
+{
+}
+
+
+#pragma mark -
+#pragma mark General Drawing
+
+void
+ui_rect(RDConnectionRef conn, int x, int y, int cx, int cy, int colour)
+{
+	FB_FROM_CONN;
+
+	fb_fill(fb, 12, x, y, cx, cy, fb_colour(conn, colour));
+}
+
+void
+ui_line(RDConnectionRef conn, uint8 opcode, int startx, int starty, int endx, int endy,
+	RDPen * pen)
+{
+	FB_FROM_CONN;
+
+	fb_line(fb, opcode, startx, starty, endx, endy, fb_colour(conn, pen->colour));
+}
+
+void
+ui_screenblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, int srcx, int srcy)
+{
+	FB_FROM_CONN;
+	RDRopSurface surface;
+
+	fb_surface(fb, &surface);
+	rop_screenblt(&surface, opcode, x, y, cx, cy, srcx, srcy);
+	fb->updates++;
+}
+
+void
+ui_destblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy)
+{
+	FB_FROM_CONN;
+
+	/* destination-only opcodes ignore the source */
+	fb_fill(fb, opcode, x, y, cx, cy, 0);
+}
+
+void
+ui_patblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBrush * brush,
+	  int bgcolour, int fgcolour)
+{
+	FB_FROM_CONN;
+	RDRopSurface surface;
+	uint32 solid[64];
+	const uint32 *tile;
+
+	if ((tile = fb_brush(conn, brush, bgcolour, fgcolour, solid)) == NULL)
+		return;
+	if ((brush == NULL) || (brush->style == 0))
+	{
+		fb_fill(fb, opcode, x, y, cx, cy, tile[0]);
+		return;
+	}
+	fb_surface(fb, &surface);
+	rop_pattern(&surface, opcode, x, y, cx, cy, tile, brush->xorigin, brush->yorigin);
+	fb->updates++;
+}
+
+/* opcode is a full ROP3 here, over the brush, the bitmap and the screen */
+void
+ui_triblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBitmapRef src, int srcx,
+	  int srcy, RDBrush * brush, int bgcolour, int fgcolour)
+{
+	FB_FROM_CONN;
+	RDRopSurface surface;
+	uint32 solid[64];
+	const uint32 *tile;
+
+	if ((src == NULL) || ((tile = fb_brush(conn, brush, bgcolour, fgcolour, solid)) == NULL))
+		return;
+	fb_surface(fb, &surface);
+	rop_triblt(&surface, opcode, x, y, cx, cy, src->data, src->width * 4, src->width, src->height, srcx,
+		   srcy, tile, (brush != NULL) ? brush->xorigin : 0, (brush != NULL) ? brush->yorigin : 0);
+	fb->updates++;
+}
+
+void
+ui_polyline(RDConnectionRef conn, uint8 opcode, RDPoint * points, int npoints, RDPen * pen)
+{
+	FB_FROM_CONN;
+	uint32 colour = fb_colour(conn, pen->colour);
+	int i, x, y;
+
+	/* points after the first are relative to the previous one */
+	if (npoints < 1)
+		return;
+	x = points[0].x;
+	y = points[0].y;
+	for (i = 1; i < npoints; i++)
+	{
+		fb_line(fb, opcode, x, y, x + points[i].x, y + points[i].y, colour);
+		x += points[i].x;
+		y += points[i].y;
+	}
+}
+
+void
+ui_polygon(RDConnectionRef conn, uint8 opcode, uint8 fillmode, RDPoint * point, int npoints,
+	   RDBrush * brush, int bgcolour, int fgcolour)
+{
+	FB_FROM_CONN;
+	uint32 solid[64];
+	const uint32 *tile;
+	int *px, *py, i, j, n, y, top, bottom, winding;
+	double *cross, fy;
+
+	if ((fillmode != ALTERNATE) && (fillmode != WINDING))
+	{
+		unimpl("polygon fill mode %d\n", fillmode);
+		return;
+	}
+	if ((npoints < 3) || ((tile = fb_brush(conn, brush, bgcolour, fgcolour, solid)) == NULL))
+		return;
+
+	/* points after the first are relative to the previous one */
+	px = xmalloc(npoints * sizeof(int));
+	py = xmalloc(npoints * sizeof(int));
+	cross = xmalloc(npoints * 2 * sizeof(double));
+	px[0] = point[0].x;
+	py[0] = point[0].y;
+	top = bottom = py[0];
+	for (i = 1; i < npoints; i++)
+	{
+		px[i] = px[i - 1] + point[i].x;
+		py[i] = py[i - 1] + point[i].y;
+		top = MIN(top, py[i]);
+		bottom = MAX(bottom, py[i]);
+	}
+	top = MAX(top, fb->clip_top);
+	bottom = MIN(bottom, fb->clip_bottom - 1);
+
+	/* sample every scanline through pixel centres; each crossing is
+	   stored as (x, direction) */
+	for (y = top; y <= bottom; y++)
+	{
+		fy = y + 0.5;
+		n = 0;
+		for (i = 0; i < npoints; i++)
+		{
+			j = (i + 1) % npoints;
+			if ((py[i] <= fy) == (py[j] <= fy))
+				continue;
+			cross[n * 2] = px[i] + (fy - py[i]) * (px[j] - px[i]) / (double) (py[j] - py[i]);
+			cross[n * 2 + 1] = (py[j] > py[i]) ? 1 : -1;
+			n++;
+		}
+		qsort(cross, n, 2 * sizeof(double), fb_compare_double);
+
+		winding = 0;
+		for (i = 0; i + 1 < n; i++)
+		{
+			winding += (int) cross[i * 2 + 1];
+			if ((fillmode == ALTERNATE) ? (i % 2 == 0) : (winding != 0))
+				fb_span(fb, opcode, (int) ceil(cross[i * 2] - 0.5),
+					(int) ceil(cross[i * 2 + 2] - 0.5), y, tile,
+					brush ? brush->xorigin : 0, brush ? brush->yorigin : 0);
+		}
+	}
+	fb->updates++;
+
+	xfree(px);
+	xfree(py);
+	xfree(cross);
+}
+
+void
+ui_ellipse(RDConnectionRef conn, uint8 opcode, uint8 fillmode, int x, int y, int cx, int cy,
+	   RDBrush * brush, int bgcolour, int fgcolour)
+{
+	FB_FROM_CONN;
+	uint32 solid[64];
+	const uint32 *tile;
+	double rx = cx / 2.0, ry = cy / 2.0, d;
+	int *left, *right, row, i;
+
+	if ((cx <= 0) || (cy <= 0) || ((tile = fb_brush(conn, brush, bgcolour, fgcolour, solid)) == NULL))
+		return;
+
+	/* span of each row, sampled through pixel centres */
+	left = xmalloc((cy + 2) * sizeof(int));
+	right = xmalloc((cy + 2) * sizeof(int));
+	left[0] = right[0] = left[cy + 1] = right[cy + 1] = 0;
+	for (row = 0; row < cy; row++)
+	{
+		d = (row + 0.5 - ry) / ry;
+		d = rx * sqrt(MAX(0.0, 1.0 - d * d));
+		left[row + 1] = x + (int) ceil(rx - d - 0.5);
+		right[row + 1] = x + (int) ceil(rx + d - 0.5);
+	}
+
+	for (row = 1; row <= cy; row++)
+	{
+		if (fillmode)
+		{
+			fb_span(fb, opcode, left[row], right[row], y + row - 1, tile,
+				brush ? brush->xorigin : 0, brush ? brush->yorigin : 0);
+			continue;
+		}
+
+		/* outline: pixels on the edge of the filled shape */
+		for (i = left[row]; i < right[row]; i++)
+		{
+			if ((i == left[row]) || (i == right[row] - 1) || (i < left[row - 1])
+			    || (i >= right[row - 1]) || (i < left[row + 1]) || (i >= right[row + 1]))
+				fb_span(fb, opcode, i, i + 1, y + row - 1, tile, 0, 0);
+		}
+	}
+	fb->updates++;
+
+	xfree(left);
+	xfree(right);
+}
+
+
+#pragma mark -
+#pragma mark Text drawing
+
+RDGlyphRef
+ui_create_glyph(RDConnectionRef conn, int width, int height, const uint8 * data)
+{
+	RDGlyphRef glyph = xmalloc(sizeof(struct _RDSurface));
+	int scanline = (width + 7) / 8, i, j;
+
+	glyph->width = width;
+	glyph->height = height;
+	glyph->data = xmalloc(MAX(width * height, 1));
+	for (i = 0; i < height; i++)
+		for (j = 0; j < width; j++)
+			glyph->data[i * width + j] = (data[i * scanline + j / 8] & (0x80 >> (j % 8))) != 0;
+	return glyph;
+}
+
+void
+ui_destroy_glyph(RDGlyphRef glyph)
+{
+	ui_destroy_bitmap(glyph);
+}
+
+/* fill the inked pixels of a text run's coverage mask, whose bytes are
+   0 or 0xff; selecting with the byte widened to a word keeps the loop
+   free of branches */
+static void
+fb_fill_mask(RDFramebuffer * fb, const RDGlyphMask * mask, uint32 colour)
+{
+	int x = mask->x, y = mask->y, cx = mask->width, cy = mask->height, srcx = 0, srcy = 0, i;
+	const uint8 *m;
+	uint32 *p, select;
+
+	if (!fb_clip(fb, &x, &y, &cx, &cy, &srcx, &srcy))
+		return;
+	for (; cy > 0; cy--, y++, srcy++)
+	{
+		m = mask->pixels + srcy * mask->width + srcx;
+		p = FB_PIXEL(fb, x, y);
+		for (i = 0; i < cx; i++)
+		{
+			select = (uint32) (sint32) (sint8) m[i];
+			p[i] = (p[i] & ~select) | (colour & select);
+		}
+	}
+}
+
+void
+ui_draw_text(RDConnectionRef conn, uint8 font, uint8 flags, uint8 opcode, int mixmode, int x, int y,
+	     int clipx, int clipy, int clipcx, int clipcy, int boxx, int boxy, int boxcx, int boxcy,
+	     RDBrush * brush, int bgcolour, int fgcolour, uint8 * text, uint8 length)
+{
+	FB_FROM_CONN;
+	RDGlyphMask mask;
+	uint32 foreground = fb_colour(conn, fgcolour), background = fb_colour(conn, bgcolour);
+
+	if (boxx + boxcx >= fb->width)
+		boxcx = fb->width - boxx;
+
+	/* Paint background */
+	if (boxcx > 1)
+		fb_fill(fb, 12, boxx, boxy, boxcx, boxcy, background);
+	else if (mixmode == MIX_OPAQUE)
+		fb_fill(fb, 12, clipx, clipy, clipcx, clipcy, background);
+
+	if (text_run_rasterize(conn, font, flags, x, y, clipx, clipy, clipcx, clipcy, boxx, boxy, boxcx, boxcy,
+			       text, length, &mask))
+		fb_fill_mask(fb, &mask, foreground);
+	fb->updates++;
+}
+
+
+#pragma mark -
+#pragma mark Clipping drawing
+
+void
+ui_set_clip(RDConnectionRef conn, int x, int y, int cx, int cy)
+{
+	FB_FROM_CONN;
+
+	fb->clip_left = MAX(x, 0);
+	fb->clip_top = MAX(y, 0);
+	fb->clip_right = MIN(x + cx, fb->width);
+	fb->clip_bottom = MIN(y + cy, fb->height);
+}
+
+void
+ui_reset_clip(RDConnectionRef conn)
+{
+	ui_set_clip(conn, 0, 0, conn->screenWidth, conn->screenHeight);
+}
+
+
+#pragma mark -
+#pragma mark Cursors and Pointers
+
+RDCursorRef
+ui_create_cursor(RDConnectionRef conn, signed int x, signed int y, int width, int height,
+		 uint8 * andmask, uint8 * xormask, int bpp)
+{
+	RDCursorRef cursor = xmalloc(sizeof(struct _RDSurface));
+
+	cursor->width = width;
+	cursor->height = height;
+	cursor->data = NULL;
+	return cursor;
+}
+
+void
+ui_set_null_cursor(RDConnectionRef conn)
+{
+}
+
+void
+ui_set_cursor(RDConnectionRef conn, RDCursorRef cursor)
+{
+}
+
+void
+ui_destroy_cursor(RDCursorRef cursor)
+{
+	ui_destroy_bitmap(cursor);
+}
+
+void
+ui_move_pointer(RDConnectionRef conn, int x, int y)
+{
+}
+
+
+#pragma mark -
+#pragma mark User Alerts
+
+void
+ui_bell(void)
+{
+}
@@ -0,0 +1,102 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Input event ring between the UI and connection threads
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Fast mouse motion gives hundreds of events a second, each of which
+   has to reach the connection thread. They go through a fixed ring
+   without locks or allocation: the UI thread writes an event and then
+   publishes it by moving head on, the connection thread reads it and
+   then frees its slot by moving tail on. Each counter has only one
+   writer, so all the ordering needed is a full barrier between reading
+   the other side's counter and touching a slot, and another between
+   touching the slot and storing one's own counter. __sync_synchronize
+   is used, as the event loop uses the __sync builtins, since the
+   compilers the Mac build supports have no __atomic ones.
+
+   With coalescing on, a mouse move that is followed in the ring by
+   another is skipped when popped; only where the pointer ended up is
+   sent. Clicks, wheel turns and keys are never skipped, so moves are
+   not reordered around them. */
+
+#import "rdesktop.h"
+
+#define INPUT_RING_MASK	(INPUT_RING_SIZE - 1)
+
+static RD_BOOL
+input_ring_is_move(const RDInputEvent * event)
+{
+	return (event->type == RDP_INPUT_MOUSE) && (event->deviceFlags == MOUSE_FLAG_MOVE);
+}
+
+void
+input_ring_init(RDInputRing * ring, RD_BOOL coalesce)
+{
+	memset(ring, 0, sizeof(RDInputRing));
+	ring->coalesce = coalesce;
+}
+
+/* Add an event; UI thread only. Returns False if the ring is full. */
+RD_BOOL
+input_ring_push(RDInputRing * ring, const RDInputEvent * event)
+{
+	uint32 head = ring->head, tail = ring->tail;
+
+	if (head - tail >= INPUT_RING_SIZE)
+		return False;
+
+	/* the slot is not written before the pop that freed it is done */
+	__sync_synchronize();
+	ring->events[head & INPUT_RING_MASK] = *event;
+	__sync_synchronize();
+	ring->head = head + 1;
+	return True;
+}
+
+/* Take the oldest event; connection thread only. Returns False if there
+   is none. */
+RD_BOOL
+input_ring_pop(RDInputRing * ring, RDInputEvent * event)
+{
+	uint32 tail = ring->tail, head = ring->head;
+
+	if (tail == head)
+		return False;
+
+	/* the events are not read before the push that published them */
+	__sync_synchronize();
+
+	if (ring->coalesce)
+	{
+		while ((head - tail > 1) && input_ring_is_move(&ring->events[tail & INPUT_RING_MASK])
+		       && input_ring_is_move(&ring->events[(tail + 1) & INPUT_RING_MASK]))
+			tail++;
+	}
+
+	*event = ring->events[tail & INPUT_RING_MASK];
+	__sync_synchronize();
+	ring->tail = tail + 1;
+	return True;
+}
+
+/* Drop every event pushed so far; connection thread only */
+void
+input_ring_clear(RDInputRing * ring)
+{
+	__sync_synchronize();
+	ring->tail = ring->head;
+}
@@ -19,7 +19,6 @@
 */
 
 #import "rdesktop.h"
-#import <Foundation/NSString.h>
 
 /* Send a self-contained ISO PDU */
 static void
@@ -135,11 +134,18 @@ iso_init(RDConnectionRef conn, int length)
 /* Send an ISO data PDU */
 void
 iso_send(RDConnectionRef conn, RDStreamRef s)
+{
+	iso_send_gather(conn, s, NULL, 0);
+}
+
+/* Send an ISO data PDU followed by count buffers of payload */
+void
+iso_send_gather(RDConnectionRef conn, RDStreamRef s, struct iovec * payload, int count)
 {
 	uint16 length;
 
 	s_pop_layer(s, iso_hdr);
-	length = s->end - s->p;
+	length = s->end - s->p + transport_iov_length(payload, count);
 
 	out_uint8(s, 3);	/* version */
 	out_uint8(s, 0);	/* reserved */
@@ -149,7 +155,10 @@ iso_send(RDConnectionRef conn, RDStreamRef s)
 	out_uint8(s, ISO_PDU_DT);	/* code */
 	out_uint8(s, 0x80);	/* eot */
 
-	tcp_send(conn, s);
+	if (count == 0)
+		tcp_send(conn, s);
+	else
+		tcp_send_gather(conn, s, payload, count);
 }
 
 /* Receive ISO transport data packet */
@@ -0,0 +1,191 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   LZ4 block compression
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* A small implementation of the LZ4 block format, used for the payloads
+   of the persistent bitmap cache. A block is a run of sequences, each a
+   token (literal length << 4 | match length - 4), the literal length
+   continued in bytes of 255, the literals, a 16 bit little endian match
+   offset and the match length continued likewise. The last sequence has
+   literals only, and the last LZ4_LAST_LITERALS bytes are always
+   literals, so that blocks stay readable by other LZ4 decoders.
+
+   Both functions keep no state and are safe to call from any thread. */
+
+#import "rdesktop.h"
+
+#define LZ4_MIN_MATCH		4
+#define LZ4_LAST_LITERALS	5
+#define LZ4_MATCH_LIMIT		12	/* no match may start this close to the end */
+#define LZ4_MAX_OFFSET		0xffff
+#define LZ4_HASH_BITS		12
+
+#define LZ4_READ32(p)	((uint32) (p)[0] | (uint32) (p)[1] << 8 | (uint32) (p)[2] << 16 | (uint32) (p)[3] << 24)
+#define LZ4_HASH(v)	(((v) * 2654435761U) >> (32 - LZ4_HASH_BITS))
+
+/* write a length continuation: bytes of 255 and the rest */
+static uint8 *
+lz4_put_length(uint8 * out, int length)
+{
+	while (length >= 255)
+	{
+		*(out++) = 255;
+		length -= 255;
+	}
+	*(out++) = length;
+	return out;
+}
+
+/* Compress length bytes of input into output, which has room for
+   out_size bytes. Returns the compressed length, or 0 if it would not
+   fit, in which case the data is best stored as it is. */
+int
+lz4_compress(const uint8 * input, int length, uint8 * output, int out_size)
+{
+	int table[1 << LZ4_HASH_BITS];
+	const uint8 *ip = input, *anchor = input, *match, *end = input + length;
+	const uint8 *match_limit = end - LZ4_MATCH_LIMIT, *match_end = end - LZ4_LAST_LITERALS;
+	uint8 *op = output, *out_end = output + out_size, *token;
+	int literals, match_length;
+	uint32 h;
+
+	memset(table, 0xff, sizeof(table));
+
+	while (ip < match_limit)
+	{
+		h = LZ4_HASH(LZ4_READ32(ip));
+		match = (table[h] >= 0) ? input + table[h] : NULL;
+		table[h] = ip - input;
+
+		if ((match == NULL) || (ip - match > LZ4_MAX_OFFSET)
+		    || (LZ4_READ32(match) != LZ4_READ32(ip)))
+		{
+			ip++;
+			continue;
+		}
+
+		/* extend the match backwards over pending literals, then forwards */
+		while ((ip > anchor) && (match > input) && (ip[-1] == match[-1]))
+		{
+			ip--;
+			match--;
+		}
+		match_length = LZ4_MIN_MATCH;
+		while ((ip + match_length < match_end) && (ip[match_length] == match[match_length]))
+			match_length++;
+
+		literals = ip - anchor;
+		if (op + 1 + literals / 255 + 1 + literals + 2 + match_length / 255 + 1 > out_end)
+			return 0;
+
+		token = op++;
+		*token = (MIN(literals, 15) << 4) | MIN(match_length - LZ4_MIN_MATCH, 15);
+		if (literals >= 15)
+			op = lz4_put_length(op, literals - 15);
+		memcpy(op, anchor, literals);
+		op += literals;
+
+		*(op++) = (ip - match) & 0xff;
+		*(op++) = (ip - match) >> 8;
+		if (match_length - LZ4_MIN_MATCH >= 15)
+			op = lz4_put_length(op, match_length - LZ4_MIN_MATCH - 15);
+
+		ip += match_length;
+		anchor = ip;
+	}
+
+	/* last literals */
+	literals = end - anchor;
+	if (op + 1 + literals / 255 + 1 + literals > out_end)
+		return 0;
+	*(op++) = MIN(literals, 15) << 4;
+	if (literals >= 15)
+		op = lz4_put_length(op, literals - 15);
+	memcpy(op, anchor, literals);
+	op += literals;
+
+	return op - output;
+}
+
+/* Decompress a block into output, which must come out at exactly
+   out_size bytes. Returns False for a malformed block. */
+RD_BOOL
+lz4_decompress(const uint8 * input, int length, uint8 * output, int out_size)
+{
+	const uint8 *ip = input, *in_end = input + length;
+	uint8 *op = output, *out_end = output + out_size, *match;
+	int literals, match_length, offset;
+	uint8 token, b;
+
+	while (ip < in_end)
+	{
+		token = *(ip++);
+
+		literals = token >> 4;
+		if (literals == 15)
+		{
+			do
+			{
+				if (ip >= in_end)
+					return False;
+				b = *(ip++);
+				literals += b;
+			}
+			while (b == 255);
+		}
+		if ((literals > in_end - ip) || (literals > out_end - op))
+			return False;
+		memcpy(op, ip, literals);
+		op += literals;
+		ip += literals;
+
+		/* the last sequence ends after its literals */
+		if (ip == in_end)
+			break;
+
+		if (in_end - ip < 2)
+			return False;
+		offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if ((offset == 0) || (offset > op - output))
+			return False;
+
+		match_length = token & 15;
+		if (match_length == 15)
+		{
+			do
+			{
+				if (ip >= in_end)
+					return False;
+				b = *(ip++);
+				match_length += b;
+			}
+			while (b == 255);
+		}
+		match_length += LZ4_MIN_MATCH;
+		if (match_length > out_end - op)
+			return False;
+
+		/* matches may overlap their own output, so copy bytewise */
+		match = op - offset;
+		while (match_length-- > 0)
+			*(op++) = *(match++);
+	}
+
+	return op == out_end;
+}
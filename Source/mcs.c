@@ -313,11 +313,18 @@ mcs_init(RDConnectionRef conn, int length)
 /* Send an MCS transport data packet to a specific channel */
 void
 mcs_send_to_channel(RDConnectionRef conn, RDStreamRef s, uint16 channel)
+{
+	mcs_send_to_channel_gather(conn, s, channel, NULL, 0);
+}
+
+/* Send an MCS transport data packet followed by count buffers of payload */
+void
+mcs_send_to_channel_gather(RDConnectionRef conn, RDStreamRef s, uint16 channel, struct iovec * payload, int count)
 {
 	uint16 length;
 
 	s_pop_layer(s, mcs_hdr);
-	length = s->end - s->p - 8;
+	length = s->end - s->p - 8 + transport_iov_length(payload, count);
 	length |= 0x8000;
 
 	out_uint8(s, (MCS_SDRQ << 2));
@@ -326,7 +333,7 @@ mcs_send_to_channel(RDConnectionRef conn, RDStreamRef s, uint16 channel)
 	out_uint8(s, 0x70);	/* flags */
 	out_uint16_be(s, length);
 
-	iso_send(conn, s);
+	iso_send_gather(conn, s, payload, count);
 }
 
 /* Send an MCS transport data packet to the global channel */
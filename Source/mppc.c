@@ -54,15 +54,125 @@
 
 
 
+/* Decoding: */
+
+/* the bit stream is read most significant bit first through a 64 bit   */
+/* buffer. the buffer is refilled whenever it holds less than the        */
+/* longest code (a 64k copy with the longest length, 49 bits), and a     */
+/* refill leaves at least 56 bits unless the input has run out. the type */
+/* of the next code is looked up from its top five bits.                 */
+
+#define MPPC_LITERAL 0
+#define MPPC_COPY    1
+
+typedef struct
+{
+	uint8 type;
+	uint8 prefix;		/* bits before the value */
+	uint8 bits;		/* bits of value */
+	uint16 base;		/* added to the value */
+} mppc_code;
+
+#define LIT_LO	{ MPPC_LITERAL, 1, 7, 0 }
+#define LIT_HI	{ MPPC_LITERAL, 2, 7, 0x80 }
+
+/* literals: 0 + 7 bits, 10 + 7 bits (+ 0x80)  */
+/* offsets:  1111 + 6 bits, 1110 + 8 bits (+ 64), 110 + 13 bits (+ 320) */
+static const mppc_code codes_8k[32] = {
+	LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO,
+	LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO,
+	LIT_HI, LIT_HI, LIT_HI, LIT_HI, LIT_HI, LIT_HI, LIT_HI, LIT_HI,
+	{ MPPC_COPY, 3, 13, 320 }, { MPPC_COPY, 3, 13, 320 },
+	{ MPPC_COPY, 3, 13, 320 }, { MPPC_COPY, 3, 13, 320 },
+	{ MPPC_COPY, 4, 8, 64 }, { MPPC_COPY, 4, 8, 64 },
+	{ MPPC_COPY, 4, 6, 0 }, { MPPC_COPY, 4, 6, 0 }
+};
+
+/* literals as above */
+/* offsets:  11111 + 6 bits, 11110 + 8 bits (+ 64), 1110 + 11 bits (+ 320), */
+/*           110 + 16 bits (+ 2368) */
+static const mppc_code codes_64k[32] = {
+	LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO,
+	LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO, LIT_LO,
+	LIT_HI, LIT_HI, LIT_HI, LIT_HI, LIT_HI, LIT_HI, LIT_HI, LIT_HI,
+	{ MPPC_COPY, 3, 16, 2368 }, { MPPC_COPY, 3, 16, 2368 },
+	{ MPPC_COPY, 3, 16, 2368 }, { MPPC_COPY, 3, 16, 2368 },
+	{ MPPC_COPY, 4, 11, 320 }, { MPPC_COPY, 4, 11, 320 },
+	{ MPPC_COPY, 5, 8, 64 }, { MPPC_COPY, 5, 6, 0 }
+};
+
+static inline uint64
+load_be64(const uint8 * p)
+{
+	return ((uint64) p[0] << 56) | ((uint64) p[1] << 48) | ((uint64) p[2] << 40) |
+		((uint64) p[3] << 32) | ((uint64) p[4] << 24) | ((uint64) p[5] << 16) |
+		((uint64) p[6] << 8) | (uint64) p[7];
+}
+
+/* copy a match inside the history. the areas can overlap; a source less */
+/* than eight bytes behind the destination repeats what has just been    */
+/* written, so it is copied byte by byte. otherwise eight byte words are  */
+/* safe in either direction */
+static inline void
+mppc_copy(uint8 * dict, int dst, int src, int len)
+{
+	int dist = dst - src;
+
+	if ((dist >= 8) || (dist <= 0))
+	{
+		for (; len >= 8; len -= 8, dst += 8, src += 8)
+			memcpy(dict + dst, dict + src, 8);
+	}
+	else if (dist == 1)
+	{
+		memset(dict + dst, dict[src], len);
+		return;
+	}
+	while (len-- > 0)
+		dict[dst++] = dict[src++];
+}
+
+#define MPPC_MAX_CODE 49
+
+#define REFILL() \
+{ \
+	if (nbits < MPPC_MAX_CODE) \
+	{ \
+		if (i + 8 <= clen) \
+		{ \
+			bitbuf |= load_be64(data + i) >> nbits; \
+			i += (63 - nbits) >> 3; \
+			nbits |= 56; \
+		} \
+		else \
+		{ \
+			while ((nbits <= 56) && (i < clen)) \
+			{ \
+				bitbuf |= (uint64) data[i++] << (56 - nbits); \
+				nbits += 8; \
+			} \
+		} \
+	} \
+}
+
+#define CONSUME(n) \
+{ \
+	bitbuf <<= (n); \
+	nbits -= (n); \
+}
+
 int
 mppc_expand(RDConnectionRef conn, uint8 * data, uint32 clen, uint8 ctype, uint32 * roff, uint32 * rlen)
 {
-	int k, walker_len = 0, walker;
+	uint64 bitbuf = 0;
+	int nbits = 0;
 	uint32 i = 0;
-	int next_offset, match_off;
-	int match_len;
-	int old_offset, match_bits;
+	int next_offset, old_offset;
+	int match_off, match_len, ones, len_bits, k;
+	uint32 value;
+	const mppc_code *code;
 	RD_BOOL big = ctype & RDP_MPPC_BIG ? True : False;
+	const mppc_code *codes = big ? codes_64k : codes_8k;
 
 	uint8 *dict = conn->mppcDict.hist;
 
@@ -84,290 +194,78 @@ mppc_expand(RDConnectionRef conn, uint8 * data, uint32 clen, uint8 ctype, uint32
 		conn->mppcDict.roff = 0;
 	}
 
-	*roff = 0;
-	*rlen = 0;
-
-	walker = conn->mppcDict.roff;
-
-	next_offset = walker;
+	next_offset = conn->mppcDict.roff;
 	old_offset = next_offset;
 	*roff = old_offset;
+	*rlen = 0;
 	if (clen == 0)
 		return 0;
-	clen += i;
 
-	do
+	while (1)
 	{
-		if (walker_len == 0)
-		{
-			if (i >= clen)
-				break;
-			walker = data[i++] << 24;
-			walker_len = 8;
-		}
-		if (walker >= 0)
-		{
-			if (walker_len < 8)
-			{
-				if (i >= clen)
-				{
-					if (walker != 0)
-						return -1;
-					break;
-				}
-				walker |= (data[i++] & 0xff) << (24 - walker_len);
-				walker_len += 8;
-			}
-			if (next_offset >= RDP_MPPC_DICT_SIZE)
-				return -1;
-			dict[next_offset++] = (((uint32) walker) >> ((uint32) 24));
-			walker <<= 8;
-			walker_len -= 8;
-			continue;
-		}
-		walker <<= 1;
-		/* fetch next 8-bits */
-		if (--walker_len == 0)
+		REFILL();
+
+		/* less than a literal left: only zero padding is allowed */
+		if (nbits < 8)
 		{
-			if (i >= clen)
+			if (bitbuf != 0)
 				return -1;
-			walker = data[i++] << 24;
-			walker_len = 8;
+			break;
 		}
-		/* literal decoding */
-		if (walker >= 0)
+
+		code = &codes[bitbuf >> 59];
+		if (nbits < code->prefix + code->bits)
+			return -1;
+		value = (uint32) ((bitbuf << code->prefix) >> (64 - code->bits)) + code->base;
+		CONSUME(code->prefix + code->bits);
+
+		if (code->type == MPPC_LITERAL)
 		{
-			if (walker_len < 8)
-			{
-				if (i >= clen)
-					return -1;
-				walker |= (data[i++] & 0xff) << (24 - walker_len);
-				walker_len += 8;
-			}
 			if (next_offset >= RDP_MPPC_DICT_SIZE)
 				return -1;
-			dict[next_offset++] = (uint8) (walker >> 24 | 0x80);
-			walker <<= 8;
-			walker_len -= 8;
+			dict[next_offset++] = value;
 			continue;
 		}
-
-		/* decode offset  */
-		/* length pair    */
-		walker <<= 1;
-		if (--walker_len < (big ? 3 : 2))
-		{
-			if (i >= clen)
-				return -1;
-			walker |= (data[i++] & 0xff) << (24 - walker_len);
-			walker_len += 8;
-		}
-
-		if (big)
+		match_off = value;
+
+		/* length of match, this is how it works len of:
+		   3: 0
+		   4-7: 10 followed by 2 bits of the value
+		   8-15: 110 followed by 3 bits of the value
+		   16-31: 1110 followed by 4 bits of the value
+		   ... and so forth, up to 4096-8191 (8k) or 32768-65535 (64k)
+
+		   i.e. 4097 is encoded as: 111111111110 000000000001
+		   meaning 4096 + 1...
+		 */
+		ones = (~bitbuf == 0) ? 64 : __builtin_clzll(~bitbuf);
+		if (ones >= nbits)
+			return -1;
+		if (ones == 0)
 		{
-			/* offset decoding where offset len is:
-			   -63: 11111 followed by the lower 6 bits of the value
-			   64-319: 11110 followed by the lower 8 bits of the value ( value - 64 )
-			   320-2367: 1110 followed by lower 11 bits of the value ( value - 320 )
-			   2368-65535: 110 followed by lower 16 bits of the value ( value - 2368 )
-			 */
-			switch (((uint32) walker) >> ((uint32) 29))
-			{
-				case 7:	/* - 63 */
-					for (; walker_len < 9; walker_len += 8)
-					{
-						if (i >= clen)
-							return -1;
-						walker |= (data[i++] & 0xff) << (24 - walker_len);
-					}
-					walker <<= 3;
-					match_off = ((uint32) walker) >> ((uint32) 26);
-					walker <<= 6;
-					walker_len -= 9;
-					break;
-
-				case 6:	/* 64 - 319 */
-					for (; walker_len < 11; walker_len += 8)
-					{
-						if (i >= clen)
-							return -1;
-						walker |= (data[i++] & 0xff) << (24 - walker_len);
-					}
-
-					walker <<= 3;
-					match_off = (((uint32) walker) >> ((uint32) 24)) + 64;
-					walker <<= 8;
-					walker_len -= 11;
-					break;
-
-				case 5:
-				case 4:	/* 320 - 2367 */
-					for (; walker_len < 13; walker_len += 8)
-					{
-						if (i >= clen)
-							return -1;
-						walker |= (data[i++] & 0xff) << (24 - walker_len);
-					}
-
-					walker <<= 2;
-					match_off = (((uint32) walker) >> ((uint32) 21)) + 320;
-					walker <<= 11;
-					walker_len -= 13;
-					break;
-
-				default:	/* 2368 - 65535 */
-					for (; walker_len < 17; walker_len += 8)
-					{
-						if (i >= clen)
-							return -1;
-						walker |= (data[i++] & 0xff) << (24 - walker_len);
-					}
-
-					walker <<= 1;
-					match_off = (((uint32) walker) >> ((uint32) 16)) + 2368;
-					walker <<= 16;
-					walker_len -= 17;
-					break;
-			}
+			match_len = 3;
+			CONSUME(1);
 		}
 		else
 		{
-			/* offset decoding where offset len is:
-			   -63: 1111 followed by the lower 6 bits of the value
-			   64-319: 1110 followed by the lower 8 bits of the value ( value - 64 )
-			   320-8191: 110 followed by the lower 13 bits of the value ( value - 320 )
-			 */
-			switch (((uint32) walker) >> ((uint32) 30))
-			{
-				case 3:	/* - 63 */
-					if (walker_len < 8)
-					{
-						if (i >= clen)
-							return -1;
-						walker |= (data[i++] & 0xff) << (24 - walker_len);
-						walker_len += 8;
-					}
-					walker <<= 2;
-					match_off = ((uint32) walker) >> ((uint32) 26);
-					walker <<= 6;
-					walker_len -= 8;
-					break;
-
-				case 2:	/* 64 - 319 */
-					for (; walker_len < 10; walker_len += 8)
-					{
-						if (i >= clen)
-							return -1;
-						walker |= (data[i++] & 0xff) << (24 - walker_len);
-					}
-
-					walker <<= 2;
-					match_off = (((uint32) walker) >> ((uint32) 24)) + 64;
-					walker <<= 8;
-					walker_len -= 10;
-					break;
-
-				default:	/* 320 - 8191 */
-					for (; walker_len < 14; walker_len += 8)
-					{
-						if (i >= clen)
-							return -1;
-						walker |= (data[i++] & 0xff) << (24 - walker_len);
-					}
-
-					match_off = (walker >> 18) + 320;
-					walker <<= 14;
-					walker_len -= 14;
-					break;
-			}
-		}
-		if (walker_len == 0)
-		{
-			if (i >= clen)
+			/* 11 or 14 bits of value at most */
+			if (ones > (big ? 14 : 11))
 				return -1;
-			walker = data[i++] << 24;
-			walker_len = 8;
+			len_bits = ones + 1;
+			if (nbits < ones + 1 + len_bits)
+				return -1;
+			match_len = (int) ((bitbuf << (ones + 1)) >> (64 - len_bits)) | (1 << len_bits);
+			CONSUME(ones + 1 + len_bits);
 		}
 
-		/* decode length of match */
-		match_len = 0;
-		if (walker >= 0)
-		{		/* special case - length of 3 is in bit 0 */
-			match_len = 3;
-			walker <<= 1;
-			walker_len--;
-		}
-		else
-		{
-			/* this is how it works len of:
-			   4-7: 10 followed by 2 bits of the value
-			   8-15: 110 followed by 3 bits of the value
-			   16-31: 1110 followed by 4 bits of the value
-			   32-63: .... and so forth
-			   64-127:
-			   128-255:
-			   256-511:
-			   512-1023:
-			   1024-2047:
-			   2048-4095:
-			   4096-8191:
-
-			   i.e. 4097 is encoded as: 111111111110 000000000001
-			   meaning 4096 + 1...
-			 */
-			match_bits = big ? 14 : 11;	/* 11 or 14 bits of value at most */
-			do
-			{
-				walker <<= 1;
-				if (--walker_len == 0)
-				{
-					if (i >= clen)
-						return -1;
-					walker = data[i++] << 24;
-					walker_len = 8;
-				}
-				if (walker >= 0)
-					break;
-				if (--match_bits == 0)
-				{
-					return -1;
-				}
-			}
-			while (1);
-			match_len = (big ? 16 : 13) - match_bits;
-			walker <<= 1;
-			if (--walker_len < match_len)
-			{
-				for (; walker_len < match_len; walker_len += 8)
-				{
-					if (i >= clen)
-					{
-						return -1;
-					}
-					walker |= (data[i++] & 0xff) << (24 - walker_len);
-				}
-			}
-
-			match_bits = match_len;
-			match_len =
-				((walker >> (32 - match_bits)) & (~(-1 << match_bits))) | (1 <<
-											   match_bits);
-			walker <<= match_bits;
-			walker_len -= match_bits;
-		}
 		if (next_offset + match_len >= RDP_MPPC_DICT_SIZE)
-		{
 			return -1;
-		}
-		/* memory areas can overlap - meaning we can't use mem*** functions */
 		k = (next_offset - match_off) & (big ? 65535 : 8191);
-		do
-		{
-			dict[next_offset++] = dict[k++];
-		}
-		while (--match_len != 0);
+		if (k + match_len > RDP_MPPC_DICT_SIZE)
+			return -1;
+		mppc_copy(dict, next_offset, k, match_len);
+		next_offset += match_len;
 	}
-	while (1);
 
 	/* store history offset */
 	conn->mppcDict.roff = next_offset;
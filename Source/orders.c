@@ -215,6 +215,7 @@ process_destblt(RDConnectionRef conn, RDStreamRef s, DESTBLT_ORDER * os, uint32
 	DEBUG(("DESTBLT(op=0x%x,x=%d,y=%d,cx=%d,cy=%d)\n",
 	       os->opcode, os->x, os->y, os->cx, os->cy));
 
+	ORDER_STATS_RENDER(conn);
 	ui_destblt(conn, ROP2_S(os->opcode), os->x, os->y, os->cx, os->cy);
 }
 
@@ -252,6 +253,7 @@ process_patblt(RDConnectionRef conn, RDStreamRef s, PATBLT_ORDER * os, uint32 pr
 
 	setup_brush(conn, &brush, &os->brush);
 	
+	ORDER_STATS_RENDER(conn);
 	ui_patblt(conn, ROP2_P(os->opcode), os->x, os->y, os->cx, os->cy,
 		  &brush, os->bgcolour, os->fgcolour);
 }
@@ -284,6 +286,7 @@ process_screenblt(RDConnectionRef conn, RDStreamRef s, SCREENBLT_ORDER * os, uin
 	DEBUG(("SCREENBLT(op=0x%x,x=%d,y=%d,cx=%d,cy=%d,srcx=%d,srcy=%d)\n",
 	       os->opcode, os->x, os->y, os->cx, os->cy, os->srcx, os->srcy));
 
+	ORDER_STATS_RENDER(conn);
 	ui_screenblt(conn, ROP2_S(os->opcode), os->x, os->y, os->cx, os->cy, os->srcx, os->srcy);
 }
 
@@ -323,6 +326,7 @@ process_line(RDConnectionRef conn, RDStreamRef s, LINE_ORDER * os, uint32 presen
 		return;
 	}
 
+	ORDER_STATS_RENDER(conn);
 	ui_line(conn, os->opcode - 1, os->startx, os->starty, os->endx, os->endy, &os->pen);
 }
 
@@ -363,6 +367,7 @@ process_rect(RDConnectionRef conn, RDStreamRef s, RECT_ORDER * os, uint32 presen
 
 	DEBUG(("RECT(x=%d,y=%d,cx=%d,cy=%d,fg=0x%x)\n", os->x, os->y, os->cx, os->cy, os->colour));
 
+	ORDER_STATS_RENDER(conn);
 	ui_rect(conn, os->x, os->y, os->cx, os->cy, os->colour);
 }
 
@@ -396,6 +401,7 @@ process_desksave(RDConnectionRef conn, RDStreamRef s, DESKSAVE_ORDER * os, uint3
 	width = os->right - os->left + 1;
 	height = os->bottom - os->top + 1;
 
+	ORDER_STATS_RENDER(conn);
 	if (os->action == 0)
 		ui_desktop_save(conn, os->offset, os->left, os->top, width, height);
 	else
@@ -445,6 +451,7 @@ process_memblt(RDConnectionRef conn, RDStreamRef s, MEMBLT_ORDER * os, uint32 pr
 	if (bitmap == NULL)
 		return;
 
+	ORDER_STATS_RENDER(conn);
 	ui_memblt(conn, ROP2_S(os->opcode), os->x, os->y, os->cx, os->cy, bitmap, os->srcx, os->srcy);
 }
 
@@ -506,7 +513,8 @@ process_triblt(RDConnectionRef conn, RDStreamRef s, TRIBLT_ORDER * os, uint32 pr
 
 	setup_brush(conn, &brush, &os->brush);
 	
-	ui_triblt(os->opcode, os->x, os->y, os->cx, os->cy,
+	ORDER_STATS_RENDER(conn);
+	ui_triblt(conn, os->opcode, os->x, os->y, os->cx, os->cy,
 		  bitmap, os->srcx, os->srcy, &brush, os->bgcolour, os->fgcolour);
 }
 
@@ -580,6 +588,7 @@ process_polygon(RDConnectionRef conn, RDStreamRef s, POLYGON_ORDER * os, uint32
 		flags <<= 2;
 	}
 
+	ORDER_STATS_RENDER(conn);
 	if (next - 1 == os->npoints)
 		ui_polygon(conn, os->opcode - 1, os->fillmode, points, os->npoints + 1, NULL, 0,
 			   os->fgcolour);
@@ -668,6 +677,7 @@ process_polygon2(RDConnectionRef conn, RDStreamRef s, POLYGON2_ORDER * os, uint3
 		flags <<= 2;
 	}
 
+	ORDER_STATS_RENDER(conn);
 	if (next - 1 == os->npoints)
 		ui_polygon(conn, os->opcode - 1, os->fillmode, points, os->npoints + 1,
 			   &brush, os->bgcolour, os->fgcolour);
@@ -747,6 +757,7 @@ process_polyline(RDConnectionRef conn, RDStreamRef s, POLYLINE_ORDER * os, uint3
 		flags <<= 2;
 	}
 
+	ORDER_STATS_RENDER(conn);
 	if (next - 1 == os->lines)
 		ui_polyline(conn, os->opcode - 1, points, os->lines + 1, &pen);
 	else
@@ -783,6 +794,7 @@ process_ellipse(RDConnectionRef conn, RDStreamRef s, ELLIPSE_ORDER * os, uint32
 	DEBUG(("ELLIPSE(l=%d,t=%d,r=%d,b=%d,op=0x%x,fm=%d,fg=0x%x)\n", os->left, os->top,
 	       os->right, os->bottom, os->opcode, os->fillmode, os->fgcolour));
 
+	ORDER_STATS_RENDER(conn);
 	ui_ellipse(conn, os->opcode - 1, os->fillmode, os->left, os->top, os->right - os->left,
 		   os->bottom - os->top, NULL, 0, os->fgcolour);
 }
@@ -825,6 +837,7 @@ process_ellipse2(RDConnectionRef conn, RDStreamRef s, ELLIPSE2_ORDER * os, uint3
 
 	setup_brush(conn, &brush, &os->brush);
 	
+	ORDER_STATS_RENDER(conn);
 	ui_ellipse(conn, os->opcode - 1, os->fillmode, os->left, os->top, os->right - os->left,
 		   os->bottom - os->top, &brush, os->bgcolour, os->fgcolour);
 }
@@ -903,6 +916,7 @@ process_text2(RDConnectionRef conn, RDStreamRef s, TEXT2_ORDER * os, uint32 pres
 
 	setup_brush(conn, &brush, &os->brush);
 	
+	ORDER_STATS_RENDER(conn);
 	ui_draw_text(conn, os->font, os->flags, os->opcode - 1, os->mixmode, os->x, os->y,
 		     os->clipleft, os->cliptop, os->clipright - os->clipleft,
 		     os->clipbottom - os->cliptop, os->boxleft, os->boxtop,
@@ -910,15 +924,27 @@ process_text2(RDConnectionRef conn, RDStreamRef s, TEXT2_ORDER * os, uint32 pres
 		     &brush, os->bgcolour, os->fgcolour, os->text, os->length);
 }
 
+/* Take a bitmap another cache order already decoded from the shared store */
+static RDBitmapRef
+shared_bitmap(RDConnectionRef conn, const RDBitmapKey * key)
+{
+	RDBitmapRef bitmap = bmpstore_get(key);
+
+	if ((bitmap != NULL) && (conn->orderStats != NULL))
+		conn->orderStats->bitmap_shared++;
+	return bitmap;
+}
+
 /* Process a raw bitmap cache order */
 static void
 process_raw_bmpcache(RDConnectionRef conn, RDStreamRef s)
 {
 	RDBitmapRef bitmap;
+	RDBitmapKey key;
+	RD_BOOL shared;
 	uint16 cache_idx, bufsize;
 	uint8 cache_id, width, height, bpp, Bpp;
-	uint8 *data, *inverted;
-	int y;
+	uint8 *data, *argb;
 
 	in_uint8(s, cache_id);
 	in_uint8s(s, 1);	/* pad */
@@ -931,15 +957,22 @@ process_raw_bmpcache(RDConnectionRef conn, RDStreamRef s)
 	in_uint8p(s, data, bufsize);
 
 	DEBUG(("RAW_BMPCACHE(cx=%d,cy=%d,id=%d,idx=%d)\n", width, height, cache_id, cache_idx));
-	inverted = (uint8 *) xmalloc(width * height * Bpp);
-	for (y = 0; y < height; y++)
+
+	shared = bmpstore_key_content(&key, BMPSTORE_RAW, data, bufsize, width, height, bpp);
+	if (shared && ((bitmap = shared_bitmap(conn, &key)) != NULL))
 	{
-		memcpy(&inverted[(height - y - 1) * (width * Bpp)], &data[y * (width * Bpp)],
-		       width * Bpp);
+		cache_put_bitmap(conn, cache_id, cache_idx, bitmap);
+		return;
 	}
 
-	bitmap = ui_create_bitmap(conn, width, height, inverted);
-	xfree(inverted);
+	/* rows arrive bottom-up */
+	argb = (uint8 *) xmalloc(width * height * 4);
+	bitmap_convert_argb(argb, 0, data + (height - 1) * (width * Bpp), -(width * Bpp), width, height,
+			    bpp, ui_get_colourmap(conn));
+
+	bitmap = ui_create_bitmap_argb(conn, width, height, argb);
+	if (shared)
+		bitmap = bmpstore_put(&key, bitmap);
 	cache_put_bitmap(conn, cache_id, cache_idx, bitmap);
 }
 
@@ -948,9 +981,11 @@ static void
 process_bmpcache(RDConnectionRef conn, RDStreamRef s)
 {
 	RDBitmapRef bitmap;
+	RDBitmapKey key;
+	RD_BOOL shared;
 	uint16 cache_idx, size;
-	uint8 cache_id, width, height, bpp, Bpp;
-	uint8 *data, *bmpdata;
+	uint8 cache_id, width, height, bpp;
+	uint8 *data, *argb;
 	uint16 bufsize, pad2, row_size, final_size;
 	uint8 pad1;
 
@@ -961,7 +996,6 @@ process_bmpcache(RDConnectionRef conn, RDStreamRef s)
 	in_uint8(s, width);
 	in_uint8(s, height);
 	in_uint8(s, bpp);
-	Bpp = (bpp + 7) / 8;
 	in_uint16_le(s, bufsize);	/* bufsize */
 	in_uint16_le(s, cache_idx);
 
@@ -984,19 +1018,27 @@ process_bmpcache(RDConnectionRef conn, RDStreamRef s)
 
 	DEBUG(("BMPCACHE(cx=%d,cy=%d,id=%d,idx=%d,bpp=%d,size=%d,pad1=%d,bufsize=%d,pad2=%d,rs=%d,fs=%d)\n", width, height, cache_id, cache_idx, bpp, size, pad1, bufsize, pad2, row_size, final_size));
 
-	bmpdata = (uint8 *) xmalloc(width * height * Bpp);
+	shared = bmpstore_key_content(&key, BMPSTORE_COMPRESSED, data, size, width, height, bpp);
+	if (shared && ((bitmap = shared_bitmap(conn, &key)) != NULL))
+	{
+		cache_put_bitmap(conn, cache_id, cache_idx, bitmap);
+		return;
+	}
+
+	argb = (uint8 *) xmalloc(width * height * 4);
 
-	if (bitmap_decompress(bmpdata, width, height, data, size, Bpp))
+	if (bitmap_decompress_argb(argb, 0, width, height, data, size, bpp, ui_get_colourmap(conn)))
 	{
-		bitmap = ui_create_bitmap(conn, width, height, bmpdata);
+		bitmap = ui_create_bitmap_argb(conn, width, height, argb);
+		if (shared)
+			bitmap = bmpstore_put(&key, bitmap);
 		cache_put_bitmap(conn, cache_id, cache_idx, bitmap);
 	}
 	else
 	{
 		DEBUG(("Failed to decompress bitmap data\n"));
+		xfree(argb);
 	}
-
-	xfree(bmpdata);
 }
 
 /* Process a bitmap cache v2 order */
@@ -1004,10 +1046,12 @@ static void
 process_bmpcache2(RDConnectionRef conn, RDStreamRef s, uint16 flags, RD_BOOL compressed)
 {
 	RDBitmapRef bitmap;
+	RDBitmapKey key;
+	RD_BOOL shared;
 	int y;
 	uint8 cache_id, cache_idx_low, width, height, Bpp;
 	uint16 cache_idx, bufsize;
-	uint8 *data, *bmpdata, *bitmap_id;
+	uint8 *data, *bmpdata, *argb, *bitmap_id;
 
 	bitmap_id = NULL;	/* prevent compiler warning */
 	cache_id = flags & ID_MASK;
@@ -1044,6 +1088,39 @@ process_bmpcache2(RDConnectionRef conn, RDStreamRef s, uint16 flags, RD_BOOL com
 	DEBUG(("BMPCACHE2(compr=%d,flags=%x,cx=%d,cy=%d,id=%d,idx=%d,Bpp=%d,bs=%d)\n",
 	       compressed, flags, width, height, cache_id, cache_idx, Bpp, bufsize));
 
+	if (!(flags & PERSIST))
+	{
+		shared = bmpstore_key_content(&key, compressed ? BMPSTORE_COMPRESSED : BMPSTORE_RAW, data, bufsize,
+					      width, height, conn->serverBpp);
+		if (shared && ((bitmap = shared_bitmap(conn, &key)) != NULL))
+		{
+			cache_put_bitmap(conn, cache_id, cache_idx, bitmap);
+			return;
+		}
+
+		/* nothing needs the native pixels, so decode straight into the UI's format */
+		argb = (uint8 *) xmalloc(width * height * 4);
+
+		if (!compressed)
+		{
+			bitmap_convert_argb(argb, 0, data + (height - 1) * (width * Bpp), -(width * Bpp),
+					    width, height, conn->serverBpp, ui_get_colourmap(conn));
+		}
+		else if (!bitmap_decompress_argb(argb, 0, width, height, data, bufsize, conn->serverBpp,
+						 ui_get_colourmap(conn)))
+		{
+			DEBUG(("Failed to decompress bitmap data\n"));
+			xfree(argb);
+			return;
+		}
+
+		bitmap = ui_create_bitmap_argb(conn, width, height, argb);
+		if (shared)
+			bitmap = bmpstore_put(&key, bitmap);
+		cache_put_bitmap(conn, cache_id, cache_idx, bitmap);
+		return;
+	}
+
 	bmpdata = (uint8 *) xmalloc(width * height * Bpp);
 
 	if (compressed)
@@ -1062,14 +1139,21 @@ process_bmpcache2(RDConnectionRef conn, RDStreamRef s, uint16 flags, RD_BOOL com
 			       &data[y * (width * Bpp)], width * Bpp);
 	}
 
-	bitmap = ui_create_bitmap(conn, width, height, bmpdata);
+	/* the native pixels are still needed for the persistent cache */
+	shared = bmpstore_key_persistent(conn, &key, bitmap_id, width, height, conn->serverBpp);
+	bitmap = shared ? shared_bitmap(conn, &key) : NULL;
+	if (bitmap == NULL)
+	{
+		bitmap = ui_create_bitmap(conn, width, height, bmpdata);
+		if (shared)
+			bitmap = bmpstore_put(&key, bitmap);
+	}
 
 	if (bitmap)
 	{
 		cache_put_bitmap(conn, cache_id, cache_idx, bitmap);
-		if (flags & PERSIST)
-			pstcache_save_bitmap(conn, cache_id, cache_idx, bitmap_id, width, height,
-					     width * height * Bpp, bmpdata);
+		pstcache_save_bitmap(conn, cache_id, cache_idx, bitmap_id, width, height,
+				     width * height * Bpp, bmpdata);
 	}
 	else
 	{
@@ -1108,7 +1192,10 @@ process_colcache(RDConnectionRef conn, RDStreamRef s)
 	hmap = ui_create_colourmap(&map);
 
 	if (cache_id)
+	{
 		ui_set_colourmap(conn, hmap);
+		brush_tile_flush(conn);
+	}
 
 	xfree(map.colours);
 }
@@ -1117,7 +1204,6 @@ process_colcache(RDConnectionRef conn, RDStreamRef s)
 static void
 process_fontcache(RDConnectionRef conn, RDStreamRef s)
 {
-	RDGlyphRef bitmap;
 	uint8 font, nglyphs;
 	uint16 character, offset, baseline, width, height;
 	int i, datasize;
@@ -1139,8 +1225,7 @@ process_fontcache(RDConnectionRef conn, RDStreamRef s)
 		datasize = (height * ((width + 7) / 8) + 3) & ~3;
 		in_uint8p(s, data, datasize);
 
-		bitmap = ui_create_glyph(conn, width, height, data);
-		cache_put_font(conn, font, character, offset, baseline, width, height, bitmap);
+		cache_put_font(conn, font, character, offset, baseline, width, height, data);
 	}
 }
 
@@ -1307,12 +1392,17 @@ process_orders(RDConnectionRef conn, RDStreamRef s, uint16 num_orders)
 {
 	RDP_ORDER_STATE *os = &conn->orderState;
 	uint32 present;
-	uint8 order_flags;
+	uint8 order_flags, secondary_type;
+	uint8 *order_start;
 	int size, processed = 0;
 	RD_BOOL delta;
 
+	if (conn->pstcachePrecache != NULL)
+		pstcache_precache_poll(conn);
+
 	while (processed < num_orders)
 	{
+		order_start = s->p;
 		in_uint8(s, order_flags);
 
 		if (!(order_flags & RDP_ORDER_STANDARD))
@@ -1321,9 +1411,16 @@ process_orders(RDConnectionRef conn, RDStreamRef s, uint16 num_orders)
 			break;
 		}
 
+		if (conn->orderStats != NULL)
+			order_stats_begin(conn);
+
 		if (order_flags & RDP_ORDER_SECONDARY)
 		{
+			secondary_type = s->p[4];
 			process_secondary_order(conn, s);
+
+			if (conn->orderStats != NULL)
+				order_stats_end(conn, True, secondary_type, s->p - order_start);
 		}
 		else
 		{
@@ -1432,10 +1529,16 @@ process_orders(RDConnectionRef conn, RDStreamRef s, uint16 num_orders)
 
 			if (order_flags & RDP_ORDER_BOUNDS)
 				ui_reset_clip(conn);
+
+			if (conn->orderStats != NULL)
+				order_stats_end(conn, False, os->order_type, s->p - order_start);
 		}
 
 		processed++;
 	}
+
+	if (conn->orderStats != NULL)
+		order_stats_tick(conn);
 #if 0
 	/* not true when RDP_COMPRESSION is set */
 	if (s->p != conn->nextPacket)
@@ -366,3 +366,22 @@ typedef struct _RDP_COLCACHE_ORDER
 
 }
 RDP_COLCACHE_ORDER;
+
+/* Order statistics (orderstats.c): order handlers mark where parsing ends
+   and drawing starts, and the caches count their lookups */
+#define ORDER_STATS_RENDER(conn) \
+{ \
+	if ((conn)->orderStats != NULL) \
+		(conn)->orderStats->render_start = order_stats_clock(); \
+}
+
+#define ORDER_STATS_CACHE(conn, cache, hit) \
+{ \
+	if ((conn)->orderStats != NULL) \
+	{ \
+		if (hit) \
+			(conn)->orderStats->cache.hits++; \
+		else \
+			(conn)->orderStats->cache.misses++; \
+	} \
+}
@@ -0,0 +1,243 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Order statistics
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Counts, bytes and timings of every drawing order type, and hit rates of
+   the caches the orders draw from. Always compiled in; while
+   conn->orderStats is NULL the only cost is a pointer test per order.
+   Time is split at ORDER_STATS_RENDER, which the order handlers place in
+   front of their ui_* call: before it is parsing, after it is rendering.
+   The secondary (cache) orders only parse and decode, so all of their
+   time counts as parsing.
+
+   The statistics belong to the connection thread. Enable, disable and
+   read them from that thread, or while no PDU is being processed. */
+
+#import "rdesktop.h"
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+static const char *primary_names[RDP_STATS_ORDER_TYPES] = {
+	[RDP_ORDER_DESTBLT] = "destblt",[RDP_ORDER_PATBLT] = "patblt",
+	[RDP_ORDER_SCREENBLT] = "screenblt",[RDP_ORDER_LINE] = "line",
+	[RDP_ORDER_RECT] = "rect",[RDP_ORDER_DESKSAVE] = "desksave",
+	[RDP_ORDER_MEMBLT] = "memblt",[RDP_ORDER_TRIBLT] = "triblt",
+	[RDP_ORDER_POLYGON] = "polygon",[RDP_ORDER_POLYGON2] = "polygon2",
+	[RDP_ORDER_POLYLINE] = "polyline",[RDP_ORDER_ELLIPSE] = "ellipse",
+	[RDP_ORDER_ELLIPSE2] = "ellipse2",[RDP_ORDER_TEXT2] = "text2"
+};
+
+static const char *secondary_names[RDP_STATS_SECONDARY_TYPES] = {
+	[RDP_ORDER_RAW_BMPCACHE] = "raw_bmpcache",[RDP_ORDER_COLCACHE] = "colcache",
+	[RDP_ORDER_BMPCACHE] = "bmpcache",[RDP_ORDER_FONTCACHE] = "fontcache",
+	[RDP_ORDER_RAW_BMPCACHE2] = "raw_bmpcache2",[RDP_ORDER_BMPCACHE2] = "bmpcache2",
+	[RDP_ORDER_BRUSHCACHE] = "brushcache"
+};
+
+/* Nanoseconds from an arbitrary starting point */
+uint64
+order_stats_clock(void)
+{
+#ifdef __APPLE__
+	static mach_timebase_info_data_t timebase;
+
+	if (timebase.denom == 0)
+		mach_timebase_info(&timebase);
+	return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* Start keeping statistics, dumping them to stderr every dump_interval
+   seconds (0 for never). Already kept statistics are left alone. */
+void
+order_stats_enable(RDConnectionRef conn, int dump_interval)
+{
+	if (conn->orderStats == NULL)
+	{
+		conn->orderStats = (RDOrderStats *) xmalloc(sizeof(RDOrderStats));
+		order_stats_reset(conn);
+	}
+	conn->orderStats->dump_interval = MAX(dump_interval, 0);
+	conn->orderStats->next_dump = order_stats_clock() + (uint64) dump_interval * 1000000000;
+}
+
+void
+order_stats_disable(RDConnectionRef conn)
+{
+	xfree(conn->orderStats);
+	conn->orderStats = NULL;
+}
+
+void
+order_stats_reset(RDConnectionRef conn)
+{
+	RDOrderStats *stats = conn->orderStats;
+	int dump_interval;
+	uint64 next_dump;
+
+	if (stats == NULL)
+		return;
+
+	dump_interval = stats->dump_interval;
+	next_dump = stats->next_dump;
+	memset(stats, 0, sizeof(RDOrderStats));
+	stats->dump_interval = dump_interval;
+	stats->next_dump = next_dump;
+	stats->since = order_stats_clock();
+}
+
+/* The statistics kept so far, or NULL when disabled */
+const RDOrderStats *
+order_stats_get(RDConnectionRef conn)
+{
+	return conn->orderStats;
+}
+
+void
+order_stats_begin(RDConnectionRef conn)
+{
+	conn->orderStats->render_start = 0;
+	conn->orderStats->order_start = order_stats_clock();
+}
+
+/* Account for the order started by order_stats_begin. secondary selects
+   the secondary order types; bytes is the length of the order. */
+void
+order_stats_end(RDConnectionRef conn, RD_BOOL secondary, uint8 type, int bytes)
+{
+	RDOrderStats *stats = conn->orderStats;
+	RDOrderTypeStats *t;
+	uint64 now = order_stats_clock(), total, render = 0;
+	int bucket = 0;
+
+	if (secondary)
+		t = &stats->secondary[type % RDP_STATS_SECONDARY_TYPES];
+	else
+		t = &stats->primary[type % RDP_STATS_ORDER_TYPES];
+
+	total = now - stats->order_start;
+	if (stats->render_start != 0)
+		render = now - stats->render_start;
+
+	t->count++;
+	t->bytes += bytes;
+	t->parse_nsec += total - render;
+	t->render_nsec += render;
+
+	if (total >= 256)
+		bucket = MIN(63 - __builtin_clzll(total) - 7, RDP_STATS_BUCKETS - 1);
+	t->histogram[bucket]++;
+}
+
+/* Dump the statistics if the dump interval has passed */
+void
+order_stats_tick(RDConnectionRef conn)
+{
+	RDOrderStats *stats = conn->orderStats;
+	uint64 now;
+
+	if ((stats == NULL) || (stats->dump_interval == 0))
+		return;
+
+	now = order_stats_clock();
+	if (now < stats->next_dump)
+		return;
+
+	stats->next_dump = now + (uint64) stats->dump_interval * 1000000000;
+	order_stats_dump(conn, stderr);
+}
+
+/* upper bound, in microseconds, of the histogram bucket holding the
+   given fraction of the orders; the last bucket has no upper bound */
+static double
+order_stats_percentile(const RDOrderTypeStats * t, double fraction)
+{
+	uint32 seen = 0, want = (uint32) (t->count * fraction);
+	int i;
+
+	for (i = 0; i < RDP_STATS_BUCKETS - 1; i++)
+	{
+		seen += t->histogram[i];
+		if (seen > want)
+			break;
+	}
+	return (256 << i) / 1e3;
+}
+
+static void
+order_stats_dump_type(FILE * out, const char *name, const RDOrderTypeStats * t)
+{
+	if (t->count == 0)
+		return;
+
+	fprintf(out, "%-14s %9u %11llu %10.3f %10.3f %8.2f %8.2f %8.2f\n",
+		name ? name : "unknown", t->count, t->bytes, t->parse_nsec / 1e6,
+		t->render_nsec / 1e6, (t->parse_nsec + t->render_nsec) / 1e3 / t->count,
+		order_stats_percentile(t, 0.5), order_stats_percentile(t, 0.99));
+}
+
+static void
+order_stats_dump_cache(FILE * out, const char *name, const RDCacheStats * c)
+{
+	uint32 total = c->hits + c->misses;
+
+	if (total == 0)
+		return;
+
+	fprintf(out, "%-14s %9u hits %9u misses (%.1f%% hit)\n", name, c->hits, c->misses,
+		100.0 * c->hits / total);
+}
+
+void
+order_stats_dump(RDConnectionRef conn, FILE * out)
+{
+	const RDOrderStats *stats = conn->orderStats;
+	int i;
+
+	if (stats == NULL)
+		return;
+
+	fprintf(out, "order statistics over %.1f s (times in ms, per order in us)\n",
+		(order_stats_clock() - stats->since) / 1e9);
+	fprintf(out, "%-14s %9s %11s %10s %10s %8s %8s %8s\n", "order", "count", "bytes",
+		"parse", "render", "mean", "median", "p99");
+	for (i = 0; i < RDP_STATS_ORDER_TYPES; i++)
+		order_stats_dump_type(out, primary_names[i], &stats->primary[i]);
+	for (i = 0; i < RDP_STATS_SECONDARY_TYPES; i++)
+		order_stats_dump_type(out, secondary_names[i], &stats->secondary[i]);
+
+	order_stats_dump_cache(out, "bitmap cache", &stats->bitmap);
+	if (stats->bitmap_disk_loads != 0)
+		fprintf(out, "%-14s %9u hits loaded from disk\n", "", stats->bitmap_disk_loads);
+	if (stats->bitmap_shared != 0)
+		fprintf(out, "%-14s %9u bitmaps shared instead of decoded\n", "", stats->bitmap_shared);
+	order_stats_dump_cache(out, "glyph cache", &stats->glyph);
+	order_stats_dump_cache(out, "brush cache", &stats->brush);
+	order_stats_dump_cache(out, "cursor cache", &stats->cursor);
+	order_stats_dump_cache(out, "desktop cache", &stats->desktop);
+	cache_budget_dump(conn, out);
+}
@@ -0,0 +1,514 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Glue for plain C builds of the protocol core
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* What CRDVestigialGlue.m, CRDMixedGlue.m and CRDShared.m give the
+   protocol core in the Mac application, for builds without Cocoa (see
+   CMakeLists.txt), which draw into the headless framebuffer (headless.c).
+   There is no pasteboard and no printer; strings handed to rdp_connect
+   are UTF-8 C strings rather than NSStrings. Not part of the Mac
+   application. */
+
+#import "rdesktop.h"
+
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#pragma mark -
+#pragma mark CRDVestigialGlue.m
+
+char *
+next_arg(char *src, char needle)
+{
+	char *nextval;
+	char *p;
+	char *mvp = 0;
+
+	/* EOS */
+	if (*src == (char) 0x00)
+		return 0;
+
+	p = src;
+	/*  skip escaped needles */
+	while ((nextval = strchr(p, needle)))
+	{
+		mvp = nextval - 1;
+		/* found backslashed needle */
+		if (*mvp == '\\' && (mvp > src))
+		{
+			/* move string one to the left */
+			while (*(mvp + 1) != (char) 0x00)
+			{
+				*mvp = *(mvp + 1);
+				mvp++;
+			}
+			*mvp = (char) 0x00;
+			p = nextval;
+		}
+		else
+		{
+			p = nextval + 1;
+			break;
+		}
+	}
+
+	/* more args available */
+	if (nextval)
+	{
+		*nextval = (char) 0x00;
+		return ++nextval;
+	}
+
+	/* no more args after this, jump to EOS */
+	nextval = src + strlen(src);
+	return nextval;
+}
+
+void
+toupper_str(char *p)
+{
+	while (*p)
+	{
+		if ((*p >= 'a') && (*p <= 'z'))
+			*p = toupper((int) *p);
+		p++;
+	}
+}
+
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+	{
+		error("xmalloc %d\n", size);
+		exit(1);
+	}
+	return mem;
+}
+
+void *
+xrealloc(void *oldmem, int size)
+{
+	void *mem;
+
+	if (size < 1)
+		size = 1;
+
+	mem = realloc(oldmem, size);
+	if (mem == NULL)
+	{
+		error("xrealloc %d\n", size);
+		exit(1);
+	}
+	return mem;
+}
+
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+/* report an error */
+void
+error(char *format, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "ERROR: ");
+
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+}
+
+/* report a warning */
+void
+warning(char *format, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "WARNING: ");
+
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+}
+
+/* report an unimplemented protocol feature */
+void
+unimpl(char *format, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "NOT IMPLEMENTED: ");
+
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+}
+
+/* produce a hex dump */
+void
+hexdump(unsigned char *p, unsigned int len)
+{
+	unsigned char *line = p;
+	unsigned int i, thisline, offset = 0;
+
+	while (offset < len)
+	{
+		printf("%04x ", offset);
+		thisline = len - offset;
+		if (thisline > 16)
+			thisline = 16;
+
+		for (i = 0; i < thisline; i++)
+			printf("%02x ", line[i]);
+
+		for (; i < 16; i++)
+			printf("   ");
+
+		for (i = 0; i < thisline; i++)
+			printf("%c", (line[i] >= 0x20 && line[i] < 0x7f) ? line[i] : '.');
+
+		printf("\n");
+		offset += thisline;
+		line += thisline;
+	}
+}
+
+/* Generate a 32-byte random for the secure transport code. */
+void
+generate_random(uint8 * random)
+{
+	int fd;
+
+	if ((fd = open("/dev/urandom", O_RDONLY)) != -1)
+	{
+		if (read(fd, random, 32) != 32)
+			error("generate_random: %s\n", strerror(errno));
+		close(fd);
+	}
+}
+
+/* Create the bitmap cache directory */
+RD_BOOL
+rd_pstcache_mkdir(void)
+{
+	char *home;
+	char bmpcache_dir[256];
+
+	home = getenv("HOME");
+
+	if (home == NULL)
+		return False;
+
+	snprintf(bmpcache_dir, sizeof(bmpcache_dir), "%s/%s", home, ".rdesktop");
+
+	if ((mkdir(bmpcache_dir, S_IRWXU) == -1) && errno != EEXIST)
+	{
+		perror(bmpcache_dir);
+		return False;
+	}
+
+	snprintf(bmpcache_dir, sizeof(bmpcache_dir), "%s/%s", home, ".rdesktop/cache");
+
+	if ((mkdir(bmpcache_dir, S_IRWXU) == -1) && errno != EEXIST)
+	{
+		perror(bmpcache_dir);
+		return False;
+	}
+
+	return True;
+}
+
+/* open a file in the .rdesktop directory */
+int
+rd_open_file(char *filename)
+{
+	char *home;
+	char fn[256];
+	int fd;
+
+	home = getenv("HOME");
+	if (home == NULL)
+		return -1;
+	snprintf(fn, sizeof(fn), "%s/.rdesktop/%s", home, filename);
+	fd = open(fn, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	if (fd == -1)
+		perror(fn);
+	return fd;
+}
+
+/* close file */
+void
+rd_close_file(int fd)
+{
+	close(fd);
+}
+
+/* read from file*/
+int
+rd_read_file(int fd, void *ptr, int len)
+{
+	return read(fd, ptr, len);
+}
+
+/* write to file */
+int
+rd_write_file(int fd, void *ptr, int len)
+{
+	return write(fd, ptr, len);
+}
+
+/* move file pointer */
+int
+rd_lseek_file(int fd, int offset)
+{
+	return lseek(fd, offset, SEEK_SET);
+}
+
+/* do a write lock on a file */
+RD_BOOL
+rd_lock_file(int fd, int start, int len)
+{
+	struct flock lock;
+
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	lock.l_start = start;
+	lock.l_len = len;
+	if (fcntl(fd, F_SETLK, &lock) == -1)
+		return False;
+	return True;
+}
+
+#define LTOA_BUFSIZE (sizeof(long) * 8 + 1)
+char *
+l_to_a(long N, int base)
+{
+	char *ret = malloc(LTOA_BUFSIZE);
+	char *head = ret, buf[LTOA_BUFSIZE], *tail;
+	int divrem;
+
+	if (base < 36 || 2 > base)
+		base = 10;
+
+	if (N < 0)
+	{
+		*head++ = '-';
+		N = -N;
+	}
+
+	tail = buf + sizeof(buf);
+	*--tail = 0;
+
+	do
+	{
+		divrem = N % base;
+		*--tail = (divrem <= 9) ? divrem + '0' : divrem + 'a' - 10;
+		N /= base;
+	}
+	while (N);
+
+	strcpy(head, tail);
+	return ret;
+}
+
+void
+save_licence(unsigned char *data, int length)
+{
+}
+
+int
+load_licence(unsigned char **data)
+{
+	return 0;
+}
+
+unsigned int
+read_keyboard_state(void)
+{
+	return 0;
+}
+
+uint16
+ui_get_numlock_state(unsigned int state)
+{
+	return KBD_FLAG_NUMLOCK;
+}
+
+
+#pragma mark -
+#pragma mark CRDMixedGlue.m
+
+void
+ui_clip_format_announce(RDConnectionRef conn, uint8 * data, uint32 length)
+{
+}
+
+void
+ui_clip_handle_data(RDConnectionRef conn, uint8 * data, uint32 length)
+{
+}
+
+void
+ui_clip_request_data(RDConnectionRef conn, uint32 format)
+{
+}
+
+void
+ui_clip_sync(RDConnectionRef conn)
+{
+}
+
+void
+ui_clip_request_failed(RDConnectionRef conn)
+{
+}
+
+void
+ui_clip_set_mode(RDConnectionRef conn, const char *optarg)
+{
+}
+
+
+#pragma mark -
+#pragma mark CRDShared.m
+
+/* the next Unicode character of a UTF-8 string, U+FFFD for a bad one */
+static uint32
+plain_utf8_next(const uint8 ** s)
+{
+	const uint8 *p = *s;
+	uint32 c = *p++;
+	int more = 0;
+
+	if (c >= 0xf0 && c < 0xf8)
+	{
+		c &= 0x07;
+		more = 3;
+	}
+	else if (c >= 0xe0)
+	{
+		c &= 0x0f;
+		more = 2;
+	}
+	else if (c >= 0xc0)
+	{
+		c &= 0x1f;
+		more = 1;
+	}
+	else if (c >= 0x80)
+		c = 0xfffd;
+
+	for (; more > 0; more--, p++)
+	{
+		if ((*p & 0xc0) != 0x80)
+		{
+			c = 0xfffd;
+			break;
+		}
+		c = (c << 6) | (*p & 0x3f);
+	}
+	*s = p;
+	return (c > 0x10ffff) ? 0xfffd : c;
+}
+
+static void
+plain_out_uint16_le(uint8 * out, uint32 value)
+{
+	out[0] = value & 0xff;
+	out[1] = (value >> 8) & 0xff;
+}
+
+/* Convert a UTF-8 string to UTF-16LE, into out if it is not NULL;
+   returns the length in bytes, without the terminator */
+static int
+plain_utf16le(const char *src, uint8 * out)
+{
+	const uint8 *p = (const uint8 *) src;
+	uint32 c;
+	int length = 0;
+
+	while (*p != 0)
+	{
+		c = plain_utf8_next(&p);
+		if (c >= 0x10000)
+		{
+			c -= 0x10000;
+			if (out != NULL)
+			{
+				plain_out_uint16_le(out + length, 0xd800 | (c >> 10));
+				plain_out_uint16_le(out + length + 2, 0xdc00 | (c & 0x3ff));
+			}
+			length += 4;
+		}
+		else
+		{
+			if (out != NULL)
+				plain_out_uint16_le(out + length, c);
+			length += 2;
+		}
+	}
+	return length;
+}
+
+/* The Cocoa version returns autoreleased data; here the string lives
+   until this has been called as many times again as there are buffers,
+   which is plenty for rdp_send_logon_info. */
+const char *
+CRDMakeUTF16LEString(NSString * src)
+{
+	static uint8 *buffers[4];
+	static int next;
+	uint8 **buffer = &buffers[next++ % 4];
+	int length;
+
+	if (src == NULL)
+		return "";
+
+	length = plain_utf16le((const char *) src, NULL);
+	*buffer = (uint8 *) xrealloc(*buffer, length + 2);
+	plain_utf16le((const char *) src, *buffer);
+	(*buffer)[length] = (*buffer)[length + 1] = 0;
+	return (const char *) *buffer;
+}
+
+int
+CRDGetUTF16LEStringLength(NSString * src)
+{
+	return (src != NULL) ? plain_utf16le((const char *) src, NULL) : 0;
+}
+
+
+#pragma mark -
+#pragma mark printer.m
+
+/* no printers are redirected */
+DEVICE_FNS printer_fns = {
+	NULL,			/* create */
+	NULL,			/* close */
+	NULL,			/* read */
+	NULL,			/* write */
+	NULL			/* device_control */
+};
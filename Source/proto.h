@@ -19,15 +19,43 @@
 
 #pragma mark bitmap.c
 RD_BOOL bitmap_decompress(uint8 * output, int width, int height, uint8 * input, int size, int Bpp);
+RD_BOOL bitmap_decompress_planes(uint8 * planes, int width, int height, uint8 * input, int size);
+
+#pragma mark -
+#pragma mark bitmap_argb.c
+RD_BOOL bitmap_decompress_argb(uint8 * output, int stride, int width, int height, uint8 * input, int size, int bpp, const uint32 * colour_map);
+void bitmap_convert_argb(uint8 * output, int stride, const uint8 * input, int in_stride, int width, int height, int bpp, const uint32 * colour_map);
+
+#pragma mark -
+#pragma mark bmpstore.c
+void bmpstore_scope(RDConnectionRef conn, const char *server, NSString * domain);
+void bmpstore_attach(RDConnectionRef conn);
+void bmpstore_detach(RDConnectionRef conn);
+RD_BOOL bmpstore_key_persistent(RDConnectionRef conn, RDBitmapKey * key, const uint8 * persistent_key, int width, int height, int bpp);
+RD_BOOL bmpstore_key_content(RDBitmapKey * key, uint8 source, const uint8 * data, int length, int width, int height, int bpp);
+RDBitmapRef bmpstore_get(const RDBitmapKey * key);
+RDBitmapRef bmpstore_put(const RDBitmapKey * key, RDBitmapRef bitmap);
+void bmpstore_release(RDBitmapRef bitmap);
+RD_BOOL bmpstore_holds(RDBitmapRef bitmap);
+void bmpstore_usage(uint32 * bitmaps, uint32 * references);
+
+#pragma mark -
+#pragma mark brushtile.c
+const uint32 *brush_tile_get(RDConnectionRef conn, RDBrush * brush, uint32 fgcolour, uint32 bgcolour);
+void brush_tile_flush(RDConnectionRef conn);
+void brush_tile_fill(uint8 * pixels, int stride, int x, int y, int cx, int cy, const uint32 * tile, int xorigin, int yorigin);
 
 #pragma mark -
 #pragma mark cache.c
+RD_BOOL cache_trace_open(RDConnectionRef conn, const char *path);
+void cache_trace_close(RDConnectionRef conn);
 void cache_rebuild_bmpcache_linked_list(RDConnectionRef conn, uint8 cache_id, sint16 * cache_idx, int count);
 RDBitmapRef cache_get_bitmap(RDConnectionRef conn, uint8 cache_id, uint16 cache_idx);
 void cache_put_bitmap(RDConnectionRef conn, uint8 cache_id, uint16 cache_idx, RDBitmapRef bitmap);
+RD_BOOL cache_put_precached_bitmap(RDConnectionRef conn, uint8 cache_id, uint16 cache_idx, RDBitmapRef bitmap);
 void cache_save_state(RDConnectionRef conn);
-RDFontGlyph *cache_get_font(RDConnectionRef conn, uint8 font, uint16 character);
-void cache_put_font(RDConnectionRef conn, uint8 font, uint16 character, uint16 offset, uint16 baseline, uint16 width, uint16 height, RDGlyphRef pixmap);
+void cache_use_glyph(RDConnectionRef conn, uint8 font, RDFontGlyph * glyph);
+void cache_put_font(RDConnectionRef conn, uint8 font, uint16 character, uint16 offset, uint16 baseline, uint16 width, uint16 height, uint8 * data);
 RDDataBlob *cache_get_text(RDConnectionRef conn, uint8 cache_id);
 void cache_put_text(RDConnectionRef conn, uint8 cache_id, void *data, int length);
 uint8 *cache_get_desktop(RDConnectionRef conn, uint32 offset, int cx, int cy, int bytes_per_pixel);
@@ -36,12 +64,47 @@ RDCursorRef cache_get_cursor(RDConnectionRef conn, uint16 cache_idx);
 void cache_put_cursor(RDConnectionRef conn, uint16 cache_idx, RDCursorRef cursor);
 RDBrushData *cache_get_brush_data(RDConnectionRef conn, uint8 colour_code, uint8 idx);
 void cache_put_brush_data(RDConnectionRef conn, uint8 colour_code, uint8 idx, RDBrushData * brush_data);
+void cache_destroy(RDConnectionRef conn);
+
+#pragma mark -
+#pragma mark cachebudget.c
+void cache_budget_set(RDConnectionRef conn, uint64 bytes);
+void cache_budget_set_process(uint64 bytes);
+void cache_budget_charge(RDConnectionRef conn, int kind, sint64 bytes, int items);
+void cache_budget_charge_bitmap(RDConnectionRef conn, RDBitmapRef bitmap, int items);
+void cache_budget_charge_process(sint64 bytes);
+uint64 cache_budget_used(RDConnectionRef conn);
+RD_BOOL cache_budget_exceeded(RDConnectionRef conn);
+void cache_budget_release(RDConnectionRef conn);
+void cache_budget_dump(RDConnectionRef conn, FILE * out);
+
+#pragma mark -
+#pragma mark cachepolicy.c
+const RDCachePolicy *cache_policy_find(const char *name);
+const RDCachePolicy *cache_policy_at(int n);
+void cache_lists_reset(RDCacheLists * lists);
+int cache_lists_count(RDCacheLists * lists);
+RD_BOOL cache_lists_holds(RDCacheLists * lists, uint16 idx);
+void cache_lists_remove(RDCacheLists * lists, uint16 idx);
+int cache_lists_order(RDCacheLists * lists, sint16 * order);
+
+#pragma mark -
+#pragma mark capture.c
+RD_BOOL capture_open(RDConnectionRef conn, const char *path);
+void capture_pdu(RDConnectionRef conn, uint8 rdpver, RDStreamRef s);
+void capture_close(RDConnectionRef conn);
+RD_BOOL replay_open(RDConnectionRef conn, const char *path);
+RD_BOOL replay_active(RDConnectionRef conn);
+RDStreamRef replay_recv(RDConnectionRef conn, uint8 * rdpver);
+void replay_run(RDConnectionRef conn, RDReplayStats * stats);
+void replay_report(RDConnectionRef conn, RDReplayStats * stats, FILE * out);
 
 #pragma mark -
 #pragma mark channels.c
 RDVirtualChannel *channel_register(RDConnectionRef conn, char *name, uint32 flags, void (*callback) (RDConnectionRef, RDStreamRef));
 RDStreamRef channel_init(RDConnectionRef conn, RDVirtualChannel * channel, uint32 length);
 void channel_send(RDConnectionRef conn, RDStreamRef s, RDVirtualChannel * channel);
+RD_BOOL channel_send_gather(RDConnectionRef conn, RDStreamRef s, RDVirtualChannel * channel, struct iovec * payload, int count);
 void channel_process(RDConnectionRef conn, RDStreamRef s, uint16 mcs_channel);
 
 #pragma mark -
@@ -64,14 +127,57 @@ NTStatus disk_query_directory(RDConnectionRef conn, NTHandle handle, uint32 info
 NTStatus disk_create_notify(RDConnectionRef conn, NTHandle handle, uint32 info_class);
 NTStatus disk_check_notify(RDConnectionRef conn, NTHandle handle);
 
+#pragma mark -
+#pragma mark eventloop.c
+RD_BOOL event_loop_init(RDEventLoop * loop);
+void event_loop_destroy(RDEventLoop * loop);
+RD_BOOL event_loop_watch(RDEventLoop * loop, int fd, RDEventHandler handler, void *context);
+void event_loop_on_buffered(RDEventLoop * loop, RDEventCheck check);
+void event_loop_on_wake(RDEventLoop * loop, RDEventHandler handler, void *context);
+void event_loop_wake(RDEventLoop * loop);
+RD_BOOL event_loop_wake_pending(RDEventLoop * loop);
+void event_loop_stop(RDEventLoop * loop);
+int event_loop_add_timer(RDEventLoop * loop, uint64 usec, uint64 interval, RDEventHandler handler, void *context);
+void event_loop_cancel_timer(RDEventLoop * loop, int timer);
+int event_loop_run_once(RDEventLoop * loop, int timeout_ms);
+void event_loop_run(RDEventLoop * loop);
+
+#pragma mark -
+#pragma mark glyphatlas.c
+RD_BOOL glyphatlas_placed(RDConnectionRef conn, uint8 font, RDFontGlyph * glyph);
+RD_BOOL glyphatlas_place(RDConnectionRef conn, uint8 font, RDFontGlyph * glyph);
+void glyphatlas_free(RDConnectionRef conn, uint8 font);
+void glyphatlas_begin_run(RDConnectionRef conn, RDGlyphMask * mask, int x, int y, int width, int height);
+void glyphatlas_blit(RDConnectionRef conn, uint8 font, RDFontGlyph * glyph, int x, int y, RDGlyphMask * mask);
+void glyphatlas_destroy(RDConnectionRef conn);
+
+#pragma mark -
+#pragma mark lz4.c
+int lz4_compress(const uint8 * input, int length, uint8 * output, int out_size);
+RD_BOOL lz4_decompress(const uint8 * input, int length, uint8 * output, int out_size);
+
 #pragma mark -
 #pragma mark mppc.c
 int mppc_expand(RDConnectionRef conn, uint8 * data, uint32 clen, uint8 ctype, uint32 * roff, uint32 * rlen);
 
+#pragma mark -
+#pragma mark headless.c
+RD_BOOL headless_init(RDConnectionRef conn);
+void headless_deinit(RDConnectionRef conn);
+uint8 *headless_get_pixels(RDConnectionRef conn, int *width, int *height, uint32 * updates);
+
+#pragma mark -
+#pragma mark inputring.c
+void input_ring_init(RDInputRing * ring, RD_BOOL coalesce);
+RD_BOOL input_ring_push(RDInputRing * ring, const RDInputEvent * event);
+RD_BOOL input_ring_pop(RDInputRing * ring, RDInputEvent * event);
+void input_ring_clear(RDInputRing * ring);
+
 #pragma mark -
 #pragma mark iso.c
 RDStreamRef iso_init(RDConnectionRef conn, int length);
 void iso_send(RDConnectionRef conn, RDStreamRef s);
+void iso_send_gather(RDConnectionRef conn, RDStreamRef s, struct iovec * payload, int count);
 RDStreamRef iso_recv(RDConnectionRef conn, uint8 * rdpver);
 RD_BOOL iso_connect(RDConnectionRef conn, const char *server, char *username, RD_BOOL reconnect);
 void iso_disconnect(RDConnectionRef conn);
@@ -85,6 +191,7 @@ void licence_process(RDConnectionRef conn, RDStreamRef s);
 #pragma mark mcs.c
 RDStreamRef mcs_init(RDConnectionRef conn, int length);
 void mcs_send_to_channel(RDConnectionRef conn, RDStreamRef s, uint16 channel);
+void mcs_send_to_channel_gather(RDConnectionRef conn, RDStreamRef s, uint16 channel, struct iovec * payload, int count);
 void mcs_send(RDConnectionRef conn, RDStreamRef s);
 RDStreamRef mcs_recv(RDConnectionRef conn, uint16 * channel, uint8 * rdpver);
 RD_BOOL mcs_connect(RDConnectionRef conn, const char *server, RDStreamRef mcs_data, char *username, RD_BOOL reconnect);
@@ -96,10 +203,29 @@ void mcs_reset_state(RDConnectionRef conn);
 void process_orders(RDConnectionRef conn, RDStreamRef s, uint16 num_orders);
 void reset_order_state(RDConnectionRef conn);
 
+#pragma mark -
+#pragma mark orderstats.c
+uint64 order_stats_clock(void);
+void order_stats_enable(RDConnectionRef conn, int dump_interval);
+void order_stats_disable(RDConnectionRef conn);
+void order_stats_reset(RDConnectionRef conn);
+const RDOrderStats *order_stats_get(RDConnectionRef conn);
+void order_stats_begin(RDConnectionRef conn);
+void order_stats_end(RDConnectionRef conn, RD_BOOL secondary, uint8 type, int bytes);
+void order_stats_tick(RDConnectionRef conn);
+void order_stats_dump(RDConnectionRef conn, FILE * out);
+
 #pragma mark -
 #pragma mark parallel.c
 int parallel_enum_devices(RDConnectionRef conn, uint32 * id, char *optarg);
 
+#pragma mark -
+#pragma mark plainglue.c (CRDShared.m in the application)
+#ifndef __OBJC__
+const char *CRDMakeUTF16LEString(NSString * src);
+int CRDGetUTF16LEStringLength(NSString * src);
+#endif
+
 #pragma mark -
 #pragma mark printer.c
 void printer_enum_devices(RDConnectionRef conn);
@@ -115,7 +241,11 @@ void pstcache_touch_bitmap(RDConnectionRef conn, uint8 id, uint16 idx, uint32 st
 RD_BOOL pstcache_load_bitmap(RDConnectionRef conn, uint8 id, uint16 idx);
 RD_BOOL pstcache_save_bitmap(RDConnectionRef conn, uint8 id, uint16 idx, uint8 * hash_key, uint16 wd, uint16 ht, uint16 len, uint8 * data);
 int pstcache_enumerate(RDConnectionRef conn, uint8 id, RDHashKey * keylist);
+void pstcache_precache(RDConnectionRef conn);
+void pstcache_precache_poll(RDConnectionRef conn);
 RD_BOOL pstcache_init(RDConnectionRef conn, uint8 id);
+void pstcache_close(RDConnectionRef conn);
+int pstcache_check_file(const char *path, RD_BOOL compact, FILE * out);
 
 #pragma mark -
 #pragma mark CRDVestigialGlue (formerly rdesktop.c)
@@ -154,6 +284,8 @@ RDStreamRef rdp_recv(RDConnectionRef conn, uint8 * type);
 void rdp_out_unistr(RDStreamRef s, const char *string, int len);
 int rdp_in_unistr(RDStreamRef s, char *string, int uni_len);
 void rdp_send_input(RDConnectionRef conn, uint32 time, uint16 message_type, uint16 device_flags, uint16 param1, uint16 param2);
+RD_BOOL rdp_queue_input(RDConnectionRef conn, uint32 time, uint16 message_type, uint16 device_flags, uint16 param1, uint16 param2);
+void rdp_flush_input(RDConnectionRef conn);
 void rdp_send_client_window_status(RDConnectionRef conn, int status);
 void process_colour_pointer_pdu(RDConnectionRef conn, RDStreamRef s);
 void process_new_pointer_pdu(RDConnectionRef conn, RDStreamRef s);
@@ -196,6 +328,18 @@ void wave_out_volume(uint16 left, uint16 right);
 void wave_out_write(RDStreamRef s, uint16 tick, uint8 index);
 void wave_out_play(void);
 
+#pragma mark -
+#pragma mark rop.c
+void rop2_row(int opcode, uint32 * dst, const uint32 * src, int count, uint32 opaque);
+void rop2_fill_row(int opcode, uint32 * dst, uint32 colour, int count, uint32 opaque);
+void rop3_row(uint8 rop3, uint32 * dst, const uint32 * src, const uint32 * pattern, int count, uint32 opaque);
+void rop_fill(const RDRopSurface * surface, int opcode, int x, int y, int cx, int cy, uint32 colour);
+void rop_pattern(const RDRopSurface * surface, int opcode, int x, int y, int cx, int cy, const uint32 * tile, int xorigin, int yorigin);
+RD_BOOL rop_clip_blit(const RDRopSurface * surface, int *x, int *y, int *cx, int *cy, int *srcx, int *srcy, int src_width, int src_height);
+void rop_blit(const RDRopSurface * surface, int opcode, int x, int y, int cx, int cy, const uint8 * src, int src_stride, int src_width, int src_height, int srcx, int srcy);
+void rop_screenblt(const RDRopSurface * surface, int opcode, int x, int y, int cx, int cy, int srcx, int srcy);
+void rop_triblt(const RDRopSurface * surface, uint8 rop3, int x, int y, int cx, int cy, const uint8 * src, int src_stride, int src_width, int src_height, int srcx, int srcy, const uint32 * tile, int xorigin, int yorigin);
+
 #pragma mark -
 #pragma mark secure.c
 void sec_hash_48(uint8 * out, uint8 * in, uint8 * salt1, uint8 * salt2, uint8 salt);
@@ -205,7 +349,10 @@ void sec_sign(uint8 * signature, int siglen, uint8 * session_key, int keylen, ui
 void sec_decrypt(RDConnectionRef conn, uint8 * data, int length);
 RDStreamRef sec_init(RDConnectionRef conn, uint32 flags, int maxlen);
 void sec_send_to_channel(RDConnectionRef conn, RDStreamRef s, uint32 flags, uint16 channel);
+void sec_send_to_channel_gather(RDConnectionRef conn, RDStreamRef s, uint32 flags, uint16 channel, struct iovec * payload, int count);
 void sec_send(RDConnectionRef conn, RDStreamRef s, uint32 flags);
+RDStreamRef sec_fastpath_init(RDConnectionRef conn, int maxlen);
+void sec_fastpath_send(RDConnectionRef conn, RDStreamRef s, int count);
 void sec_process_mcs_data(RDConnectionRef conn, RDStreamRef s);
 RDStreamRef sec_recv(RDConnectionRef conn, uint8 * rdpver);
 RD_BOOL sec_connect(RDConnectionRef conn, const char *server, char *username, RD_BOOL reconnect);
@@ -222,12 +369,37 @@ RD_BOOL serial_get_event(RDConnectionRef conn, NTHandle handle, uint32 * result)
 #pragma mark tcp.c
 RDStreamRef tcp_init(RDConnectionRef conn, uint32 maxlen);
 void tcp_send(RDConnectionRef conn, RDStreamRef s);
+void tcp_send_gather(RDConnectionRef conn, RDStreamRef s, struct iovec * payload, int count);
 RDStreamRef tcp_recv(RDConnectionRef conn, RDStreamRef s, uint32 length);
 RD_BOOL tcp_connect(RDConnectionRef conn, const char *server);
 void tcp_disconnect(RDConnectionRef conn);
 char *tcp_get_address(RDConnectionRef conn);
 void tcp_reset_state(RDConnectionRef conn);
 
+#pragma mark -
+#pragma mark textrun.c
+RD_BOOL text_run_rasterize(RDConnectionRef conn, uint8 font, uint8 flags, int x, int y, int clipx, int clipy, int clipcx, int clipcy, int boxx, int boxy, int boxcx, int boxcy, uint8 * text, int length, RDGlyphMask * mask);
+void text_run_destroy(RDConnectionRef conn);
+
+#pragma mark -
+#pragma mark transport.c
+RDStreamRef transport_recv(RDTransport * t, RDStreamRef s, uint32 length);
+RD_BOOL transport_has_pdu(RDTransport * t);
+RD_BOOL transport_send(RDTransport * t, const uint8 * data, int length);
+uint32 transport_iov_length(const struct iovec * iov, int count);
+RD_BOOL transport_sendv(RDTransport * t, struct iovec * iov, int count);
+void transport_close(RDTransport * t);
+void transport_socket_attach(RDTransport * t, int fd);
+RD_BOOL transport_socket_connect(RDTransport * t, const char *server, int port);
+
+#pragma mark -
+#pragma mark workpool.c
+void workpool_init(int threads);
+void workpool_run(int count, workpool_fn fn, void *ctx);
+RDWorkBatchRef workpool_start(int count, workpool_fn fn, void *ctx);
+RD_BOOL workpool_finished(RDWorkBatchRef batch);
+void workpool_wait(RDWorkBatchRef batch);
+
 #pragma mark -
 #pragma mark CRDDrawingStubs.m (formerly xclip.c)
 void ui_clip_format_announce(RDConnectionRef conn, uint8 * data, uint32 length);
@@ -250,7 +422,11 @@ int ui_select(RDConnectionRef conn);
 void ui_move_pointer(RDConnectionRef conn, int x, int y);
 RDBitmapRef ui_create_bitmap(RDConnectionRef conn, int width, int height, uint8 * data);
 void ui_paint_bitmap(RDConnectionRef conn, int x, int y, int cx, int cy, int width, int height, uint8 * data);
+RDBitmapRef ui_create_bitmap_argb(RDConnectionRef conn, int width, int height, uint8 * argb);
+void ui_paint_bitmap_argb(RDConnectionRef conn, int x, int y, int cx, int cy, int width, int height, uint8 * argb);
 void ui_destroy_bitmap(RDBitmapRef bmp);
+int ui_bitmap_bytes(RDBitmapRef bmp);
+void ui_convert_brush(RDConnectionRef conn, RDBrushData * bd, uint32 * pixels);
 RDGlyphRef ui_create_glyph(RDConnectionRef conn, int width, int height, const uint8 * data);
 void ui_destroy_glyph(RDGlyphRef glyph);
 RDCursorRef ui_create_cursor(RDConnectionRef conn, signed int x, signed int y, int width, int height, uint8 * andmask, uint8 * xormask, int bpp);
@@ -260,6 +436,7 @@ void ui_set_null_cursor(RDConnectionRef conn);
 RDColorMapRef ui_create_colourmap(RDColorMap * colours);
 void ui_destroy_colourmap(RDColorMapRef map);
 void ui_set_colourmap(RDConnectionRef conn, RDColorMapRef map);
+RDColorMapRef ui_get_colourmap(RDConnectionRef conn);
 void ui_set_clip(RDConnectionRef conn, int x, int y, int cx, int cy);
 void ui_reset_clip(RDConnectionRef conn);
 void ui_bell(void);
@@ -267,7 +444,7 @@ void ui_destblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy
 void ui_patblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBrush * brush, int bgcolour, int fgcolour);
 void ui_screenblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, int srcx, int srcy);
 void ui_memblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBitmapRef src, int srcx, int srcy);
-void ui_triblt(uint8 opcode, int x, int y, int cx, int cy, RDBitmapRef src, int srcx, int srcy, RDBrush * brush, int bgcolour, int fgcolour);
+void ui_triblt(RDConnectionRef conn, uint8 opcode, int x, int y, int cx, int cy, RDBitmapRef src, int srcx, int srcy, RDBrush * brush, int bgcolour, int fgcolour);
 void ui_line(RDConnectionRef conn, uint8 opcode, int startx, int starty, int endx, int endy, RDPen * pen);
 void ui_rect(RDConnectionRef conn, int x, int y, int cx, int cy, int colour);
 void ui_polygon(RDConnectionRef conn, uint8 opcode, uint8 fillmode, RDPoint* point, int npoints, RDBrush * brush, int bgcolour, int fgcolour);
@@ -18,37 +18,407 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 */
 
+#import <errno.h>
+#import <fcntl.h>
+#import <sys/stat.h>
+#import <sys/mman.h>
+
 #import "rdesktop.h"
 
 #define MAX_CELL_SIZE		0x1000	/* pixels */
 
 #define IS_PERSISTENT(id) (id < 8 && conn->pstcacheFd[id] > 0)
 
+/* A version 2 cache file is a RDPersistentCacheFileHeader, an index of
+   BMPCACHE2_NUM_PSTCELLS entries and the cell payloads, each only as long
+   as its bitmap, LZ4 compressed when that is smaller, and checked with
+   a CRC-32. A payload is rewritten in place when the new one fits and
+   appended otherwise; the space left behind is reclaimed by compacting
+   the file when it is opened, or when appending runs out of room.
+
+   Version 1 files, a fixed MAX_CELL_SIZE cell per entry and no header,
+   are converted when opened.
+
+   The files are mapped whole, so that loads read the payloads in place
+   and stamp updates are plain stores, written back by the kernel. A map
+   covers the largest the data of BMPCACHE2_NUM_PSTCELLS cells can be,
+   and the file grows into it PSTCACHE_GROW_SIZE bytes at a time. */
+#define PSTCACHE_MAGIC		"CoRDpst"
+#define PSTCACHE_VERSION	2
+#define PSTCACHE_GROW_SIZE	0x40000
+
+#define PSTCACHE_CELL_LZ4	0x01
+
+#define MAX_DATA_SIZE(Bpp)	((Bpp) * MAX_CELL_SIZE)
+#define DATA_START		(sizeof(RDPersistentCacheFileHeader) \
+				 + BMPCACHE2_NUM_PSTCELLS * sizeof(RDPersistentCacheIndexEntry))
+#define MAP_SIZE(Bpp)		(DATA_START + BMPCACHE2_NUM_PSTCELLS * MAX_DATA_SIZE(Bpp))
+#define FILE_HEADER(map)	((RDPersistentCacheFileHeader *) (map))
+#define INDEX_ENTRY(map, idx) \
+	((RDPersistentCacheIndexEntry *) ((map) + sizeof(RDPersistentCacheFileHeader)) + (idx))
+
+/* the version 1 layout */
+#define V1_CELL_SIZE(Bpp)	(MAX_DATA_SIZE(Bpp) + sizeof(RDPersistentCacheCellHeader))
+
 const uint8 zero_key[] = { 0, 0, 0, 0, 0, 0, 0, 0 };
 
+/* Precaching decodes the most recently used cells on the pool threads,
+   between sending the key list and the first orders, and installs them
+   from the connection thread once all are done. A cell that is saved
+   again meanwhile is stale and is not installed. The file is not
+   compacted while a precache is pending, so its payloads stay put. */
+struct _RDPrecache
+{
+	uint8 id;
+	int count;
+	const uint8 *map;
+	uint32 size;
+	int Bpp, bpp;
+	uint16 idx[BMPCACHE2_C2_CELLS];	/* most recently used first */
+	RDPersistentCacheIndexEntry entry[BMPCACHE2_C2_CELLS];
+	uint8 *argb[BMPCACHE2_C2_CELLS];
+	uint8 stale[BMPCACHE2_NUM_PSTCELLS];
+	RDWorkBatchRef batch;
+};
+
+typedef struct
+{
+	uint32 stamp;
+	sint16 idx;
+} RDPersistentCacheOrder;
+
+static const uint32 crc_table[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+/* CRC-32 (as in zip and PNG) */
+static uint32
+pstcache_crc32(const uint8 * data, int length)
+{
+	uint32 crc = 0xffffffff;
+
+	while (length-- > 0)
+	{
+		crc ^= *(data++);
+		crc = (crc >> 4) ^ crc_table[crc & 15];
+		crc = (crc >> 4) ^ crc_table[crc & 15];
+	}
+	return ~crc;
+}
+
+/* Whether an index entry's payload lies between DATA_START and end and
+   could hold its bitmap. A compressed payload is only kept when it is
+   shorter than the bitmap, so no payload is longer than length. */
+static RD_BOOL
+pstcache_entry_fits(const RDPersistentCacheIndexEntry * entry, uint32 end, int Bpp)
+{
+	return (entry->offset >= DATA_START) && (entry->offset <= end) && (entry->stored <= end - entry->offset)
+		&& (entry->length <= MAX_DATA_SIZE(Bpp)) && (entry->width * entry->height * Bpp <= entry->length)
+		&& (entry->stored <= entry->length);
+}
+
+/* The bitmap data of a cell, checked against its CRC: a pointer into the
+   map for a stored payload, or buffer, holding MAX_DATA_SIZE(Bpp) bytes,
+   for a compressed one. NULL if the cell is empty or damaged. Safe to
+   call from any thread as long as the cell is not being written. */
+static const uint8 *
+pstcache_cell_data(const uint8 * map, uint32 size, int Bpp, const RDPersistentCacheIndexEntry * entry,
+		   uint8 * buffer)
+{
+	const uint8 *payload = map + entry->offset;
+
+	if (!pstcache_entry_fits(entry, size, Bpp))
+		return NULL;
+
+	if (pstcache_crc32(payload, entry->stored) != entry->crc)
+		return NULL;
+
+	if (!(entry->flags & PSTCACHE_CELL_LZ4))
+		return (entry->stored == entry->length) ? payload : NULL;
+
+	if (!lz4_decompress(payload, entry->stored, buffer, entry->length))
+		return NULL;
+	return buffer;
+}
+
+static void
+pstcache_format(uint8 * map, int Bpp)
+{
+	RDPersistentCacheFileHeader *header = FILE_HEADER(map);
+
+	memset(map, 0, DATA_START);
+	memcpy(header->magic, PSTCACHE_MAGIC, sizeof(header->magic));
+	header->version = PSTCACHE_VERSION;
+	header->bpp = Bpp;
+	header->cells = BMPCACHE2_NUM_PSTCELLS;
+	header->data_end = DATA_START;
+}
+
+static int
+pstcache_compare_offsets(const void *a, const void *b)
+{
+	const RDPersistentCacheIndexEntry *x = *(RDPersistentCacheIndexEntry * const *) a;
+	const RDPersistentCacheIndexEntry *y = *(RDPersistentCacheIndexEntry * const *) b;
+
+	return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/* Mark in bad the cells whose payloads do not fit pstcache_entry_fits
+   below the end of the data, or overlap the payload of another cell, and
+   return how many there are. Only a checked index may be compacted or
+   have its payloads rewritten in place. */
+static int
+pstcache_check_index(uint8 * map, int Bpp, uint8 * bad)
+{
+	RDPersistentCacheIndexEntry *live[BMPCACHE2_NUM_PSTCELLS], *entry;
+	uint32 data_end = FILE_HEADER(map)->data_end, end = DATA_START;
+	int idx, n = 0, count = 0;
+
+	memset(bad, 0, BMPCACHE2_NUM_PSTCELLS);
+	for (idx = 0; idx < BMPCACHE2_NUM_PSTCELLS; idx++)
+	{
+		entry = INDEX_ENTRY(map, idx);
+		if (entry->offset == 0)
+			continue;
+		if (pstcache_entry_fits(entry, data_end, Bpp))
+		{
+			live[n++] = entry;
+		}
+		else
+		{
+			bad[idx] = True;
+			count++;
+		}
+	}
+
+	qsort(live, n, sizeof(live[0]), pstcache_compare_offsets);
+	for (idx = 0; idx < n; idx++)
+	{
+		if (live[idx]->offset < end)
+		{
+			bad[live[idx] - INDEX_ENTRY(map, 0)] = True;
+			count++;
+			continue;
+		}
+		end = live[idx]->offset + live[idx]->stored;
+	}
+	return count;
+}
+
+/* Move the payloads to the front of the data, in file order, and return
+   the new end of the data. The index is updated as each payload moves,
+   and must have been checked with pstcache_check_index. */
+static uint32
+pstcache_compact_map(uint8 * map)
+{
+	RDPersistentCacheIndexEntry *live[BMPCACHE2_NUM_PSTCELLS], *entry;
+	uint32 end = DATA_START;
+	int idx, n = 0;
+
+	for (idx = 0; idx < BMPCACHE2_NUM_PSTCELLS; idx++)
+	{
+		entry = INDEX_ENTRY(map, idx);
+		if (entry->offset != 0)
+			live[n++] = entry;
+	}
+
+	qsort(live, n, sizeof(live[0]), pstcache_compare_offsets);
+	for (idx = 0; idx < n; idx++)
+	{
+		if (live[idx]->offset != end)
+		{
+			memmove(map + end, map + live[idx]->offset, live[idx]->stored);
+			live[idx]->offset = end;
+		}
+		end += live[idx]->stored;
+	}
+
+	FILE_HEADER(map)->data_end = end;
+	return end;
+}
+
+/* the bytes of payload still in use */
+static uint32
+pstcache_live_size(const uint8 * map)
+{
+	uint32 live = 0;
+	int idx;
+
+	for (idx = 0; idx < BMPCACHE2_NUM_PSTCELLS; idx++)
+		if (INDEX_ENTRY(map, idx)->offset != 0)
+			live += INDEX_ENTRY(map, idx)->stored;
+	return live;
+}
+
+/* compact an open cache file and give the space back */
+static void
+pstcache_compact(RDConnectionRef conn, uint8 id)
+{
+	uint32 end = pstcache_compact_map(conn->pstcacheMap[id]);
+
+	if (ftruncate(conn->pstcacheFd[id], end) == 0)
+		conn->pstcacheSize[id] = end;
+}
+
+/* write a cell; stamp is kept as it is given */
+static RD_BOOL
+pstcache_put_cell(RDConnectionRef conn, uint8 id, uint16 idx, uint8 * key, uint8 width, uint8 height,
+		  uint16 length, uint8 * data, uint32 stamp)
+{
+	RDPersistentCacheIndexEntry *entry = INDEX_ENTRY(conn->pstcacheMap[id], idx);
+	RDPersistentCacheFileHeader *header = FILE_HEADER(conn->pstcacheMap[id]);
+	uint8 packed[MAX_DATA_SIZE(4)], *payload = data, flags = 0;
+	uint32 offset, size, map_size = MAP_SIZE(conn->pstcacheBpp);
+	int stored = length;
+
+	if (conn->bitmapCacheCompress && (length > 0))
+	{
+		stored = lz4_compress(data, length, packed, length - 1);
+		if (stored > 0)
+		{
+			payload = packed;
+			flags |= PSTCACHE_CELL_LZ4;
+		}
+		else
+		{
+			stored = length;
+		}
+	}
+
+	/* reuse the old payload's room, or append */
+	offset = entry->offset;
+	if ((offset == 0) || (entry->stored < stored))
+	{
+		offset = header->data_end;
+		if ((offset + stored > map_size) && (conn->pstcachePrecache == NULL))
+		{
+			entry->offset = 0;
+			pstcache_compact(conn, id);
+			offset = header->data_end;
+		}
+		if (offset + stored > map_size)
+			return False;
+
+		if (offset + stored > conn->pstcacheSize[id])
+		{
+			size = MIN((offset + stored + PSTCACHE_GROW_SIZE - 1) / PSTCACHE_GROW_SIZE * PSTCACHE_GROW_SIZE,
+				   map_size);
+			if (ftruncate(conn->pstcacheFd[id], size) == -1)
+			{
+				warning("could not grow the persistent bitmap cache: %s\n", strerror(errno));
+				return False;
+			}
+			conn->pstcacheSize[id] = size;
+		}
+		header->data_end = offset + stored;
+	}
+
+	/* the payload first, so that an interrupted write fails its CRC */
+	memcpy(conn->pstcacheMap[id] + offset, payload, stored);
+	memcpy(entry->key, key, sizeof(RDHashKey));
+	entry->width = width;
+	entry->height = height;
+	entry->flags = flags;
+	entry->length = length;
+	entry->stored = stored;
+	entry->stamp = stamp;
+	entry->crc = pstcache_crc32(payload, stored);
+	entry->offset = offset;
+	return True;
+}
+
+/* Rewrite a version 1 file in the current format. The live cells are
+   read into memory first, since the new layout overlaps the old one. */
+static RD_BOOL
+pstcache_convert_v1(RDConnectionRef conn, uint8 id, uint32 file_size)
+{
+	RDPersistentCacheCellHeader *cellhdr;
+	uint32 cell_size = V1_CELL_SIZE(conn->pstcacheBpp), n;
+	uint8 *old;
+	int idx, converted = 0;
+
+	/* the last cell is only as long as its bitmap */
+	file_size = MIN(file_size, BMPCACHE2_NUM_PSTCELLS * cell_size);
+	n = (file_size + cell_size - 1) / cell_size;
+	old = (uint8 *) xmalloc(MAX(file_size, 1));
+	if (pread(conn->pstcacheFd[id], old, file_size, 0) != (ssize_t) file_size)
+		n = 0;
+
+	if (ftruncate(conn->pstcacheFd[id], DATA_START) == -1)
+	{
+		xfree(old);
+		return False;
+	}
+	conn->pstcacheSize[id] = DATA_START;
+	pstcache_format(conn->pstcacheMap[id], conn->pstcacheBpp);
+
+	for (idx = 0; idx < n; idx++)
+	{
+		cellhdr = (RDPersistentCacheCellHeader *) (old + idx * cell_size);
+		if ((idx * cell_size + sizeof(RDPersistentCacheCellHeader) > file_size)
+		    || (idx * cell_size + sizeof(RDPersistentCacheCellHeader) + cellhdr->length > file_size))
+			break;
+		if (memcmp(cellhdr->key, zero_key, sizeof(RDHashKey)) == 0)
+			break;
+		if ((cellhdr->length > MAX_DATA_SIZE(conn->pstcacheBpp))
+		    || (cellhdr->width * cellhdr->height * conn->pstcacheBpp > cellhdr->length))
+			break;
+		if (!pstcache_put_cell(conn, id, idx, cellhdr->key, cellhdr->width, cellhdr->height,
+				       cellhdr->length, (uint8 *) (cellhdr + 1), cellhdr->stamp))
+			break;
+		converted++;
+	}
+
+	DEBUG(("converted %d cells of a version 1 persistent bitmap cache\n", converted));
+	xfree(old);
+	return True;
+}
+
+static void
+pstcache_close_file(RDConnectionRef conn, uint8 id)
+{
+	msync(conn->pstcacheMap[id], conn->pstcacheSize[id], MS_ASYNC);
+	munmap(conn->pstcacheMap[id], MAP_SIZE(conn->pstcacheBpp));
+	rd_close_file(conn->pstcacheFd[id]);
+	conn->pstcacheMap[id] = NULL;
+	conn->pstcacheSize[id] = 0;
+	conn->pstcacheFd[id] = 0;
+}
+
+/* whether a mapped file has a usable version 2 header */
+static RD_BOOL
+pstcache_check_header(const uint8 * map, uint32 size, int Bpp)
+{
+	const RDPersistentCacheFileHeader *header = FILE_HEADER(map);
+
+	return (size >= DATA_START) && (memcmp(header->magic, PSTCACHE_MAGIC, sizeof(header->magic)) == 0)
+		&& (header->version == PSTCACHE_VERSION) && (header->bpp == Bpp)
+		&& (header->cells == BMPCACHE2_NUM_PSTCELLS) && (header->data_end >= DATA_START)
+		&& (header->data_end <= size);
+}
+
 
 /* Update mru stamp/index for a bitmap */
 void
 pstcache_touch_bitmap(RDConnectionRef conn, uint8 cache_id, uint16 cache_idx, uint32 stamp)
 {
-	int fd;
-
 	if (!IS_PERSISTENT(cache_id) || cache_idx >= BMPCACHE2_NUM_PSTCELLS)
 		return;
 
-	fd = conn->pstcacheFd[cache_id];
-	rd_lseek_file(fd, 12 + cache_idx * (conn->pstcacheBpp * MAX_CELL_SIZE + sizeof(RDPersistentCacheCellHeader)));
-	rd_write_file(fd, &stamp, sizeof(stamp));
+	INDEX_ENTRY(conn->pstcacheMap[cache_id], cache_idx)->stamp = stamp;
 }
 
 /* Load a bitmap from the persistent cache */
 RD_BOOL
 pstcache_load_bitmap(RDConnectionRef conn, uint8 cache_id, uint16 cache_idx)
 {
-	uint8 *celldata;
-	int fd;
-	RDPersistentCacheCellHeader cellhdr;
-	RDBitmapRef bitmap;
+	RDPersistentCacheIndexEntry *entry;
+	uint8 buffer[MAX_DATA_SIZE(4)];
+	const uint8 *data;
+	RDBitmapRef bitmap = NULL;
+	RDBitmapKey key;
+	RD_BOOL shared;
 
 	if (!conn->bitmapCachePersist)
 		return False;
@@ -56,17 +426,28 @@ pstcache_load_bitmap(RDConnectionRef conn, uint8 cache_id, uint16 cache_idx)
 	if (!IS_PERSISTENT(cache_id) || cache_idx >= BMPCACHE2_NUM_PSTCELLS)
 		return False;
 
-	fd = conn->pstcacheFd[cache_id];
-	rd_lseek_file(fd, cache_idx * (conn->pstcacheBpp * MAX_CELL_SIZE + sizeof(RDPersistentCacheCellHeader)));
-	rd_read_file(fd, &cellhdr, sizeof(RDPersistentCacheCellHeader));
-	celldata = (uint8 *) xmalloc(cellhdr.length);
-	rd_read_file(fd, celldata, cellhdr.length);
+	entry = INDEX_ENTRY(conn->pstcacheMap[cache_id], cache_idx);
+	if (entry->offset == 0)
+		return False;
 
-	bitmap = ui_create_bitmap(conn, cellhdr.width, cellhdr.height, celldata);
+	shared = bmpstore_key_persistent(conn, &key, entry->key, entry->width, entry->height, conn->serverBpp);
+	if (shared)
+		bitmap = bmpstore_get(&key);
+
+	if (bitmap == NULL)
+	{
+		data = pstcache_cell_data(conn->pstcacheMap[cache_id], conn->pstcacheSize[cache_id],
+					  conn->pstcacheBpp, entry, buffer);
+		if (data == NULL)
+			return False;
+
+		bitmap = ui_create_bitmap(conn, entry->width, entry->height, (uint8 *) data);
+		if (shared)
+			bitmap = bmpstore_put(&key, bitmap);
+	}
 	DEBUG(("Load bitmap from disk: id=%d, idx=%d, bmp=0x%p)\n", cache_id, cache_idx, bitmap));
 	cache_put_bitmap(conn, cache_id, cache_idx, bitmap);
 
-	xfree(celldata);
 	return True;
 }
 
@@ -75,34 +456,38 @@ RD_BOOL
 pstcache_save_bitmap(RDConnectionRef conn, uint8 cache_id, uint16 cache_idx, uint8 * key,
 		     uint16 width, uint16 height, uint16 length, uint8 * data)
 {
-	int fd;
-	RDPersistentCacheCellHeader cellhdr;
-
 	if (!IS_PERSISTENT(cache_id) || cache_idx >= BMPCACHE2_NUM_PSTCELLS)
 		return False;
 
-	memcpy(cellhdr.key, key, sizeof(RDHashKey));
-	cellhdr.width = width;
-	cellhdr.height = height;
-	cellhdr.length = length;
-	cellhdr.stamp = 0;
+	if (length > MAX_DATA_SIZE(conn->pstcacheBpp))
+		return False;
 
-	fd = conn->pstcacheFd[cache_id];
-	rd_lseek_file(fd, cache_idx * (conn->pstcacheBpp * MAX_CELL_SIZE + sizeof(RDPersistentCacheCellHeader)));
-	rd_write_file(fd, &cellhdr, sizeof(RDPersistentCacheCellHeader));
-	rd_write_file(fd, data, length);
+	if ((conn->pstcachePrecache != NULL) && (conn->pstcachePrecache->id == cache_id))
+		conn->pstcachePrecache->stale[cache_idx] = True;
 
-	return True;
+	return pstcache_put_cell(conn, cache_id, cache_idx, key, width, height, length, data, 0);
+}
+
+static int
+pstcache_compare_stamps(const void *a, const void *b)
+{
+	const RDPersistentCacheOrder *x = a, *y = b;
+
+	if (x->stamp != y->stamp)
+		return (x->stamp < y->stamp) ? -1 : 1;
+	return x->idx - y->idx;
 }
 
-/* List the bitmap keys from the persistent cache file */
+/* List the bitmap keys from the persistent cache file. Only the index is
+   read; the bitmaps worth precaching are noted for pstcache_precache. */
 int
 pstcache_enumerate(RDConnectionRef conn, uint8 id, RDHashKey * keylist)
 {
-	int fd, idx, n;
-	sint16 mru_idx[BITMAP_CACHE_ENTRIES];
-	uint32 mru_stamp[BITMAP_CACHE_ENTRIES];
-	RDPersistentCacheCellHeader cellhdr;
+	int idx, n;
+	sint16 mru_idx[BMPCACHE2_NUM_PSTCELLS];
+	RDPersistentCacheOrder order[BMPCACHE2_NUM_PSTCELLS];
+	RDPersistentCacheIndexEntry *entry;
+	struct _RDPrecache *precache;
 
 	if (!(conn->bitmapCache && conn->bitmapCachePersist && IS_PERSISTENT(id)))
 		return 0;
@@ -114,48 +499,147 @@ pstcache_enumerate(RDConnectionRef conn, uint8 id, RDHashKey * keylist)
 	DEBUG_RDP5(("Persistent bitmap cache enumeration... "));
 	for (idx = 0; idx < BMPCACHE2_NUM_PSTCELLS; idx++)
 	{
-		fd = conn->pstcacheFd[id];
-		rd_lseek_file(fd, idx * (conn->pstcacheBpp * MAX_CELL_SIZE + sizeof(RDPersistentCacheCellHeader)));
-		if (rd_read_file(fd, &cellhdr, sizeof(RDPersistentCacheCellHeader)) <= 0)
+		entry = INDEX_ENTRY(conn->pstcacheMap[id], idx);
+
+		if ((entry->offset == 0) || (memcmp(entry->key, zero_key, sizeof(RDHashKey)) == 0))
 			break;
 
-		if (memcmp(cellhdr.key, zero_key, sizeof(RDHashKey)) != 0)
-		{
-			memcpy(keylist[idx], cellhdr.key, sizeof(RDHashKey));
+		memcpy(keylist[idx], entry->key, sizeof(RDHashKey));
+		order[idx].stamp = entry->stamp;
+		order[idx].idx = idx;
+	}
 
-			/* Pre-cache (not possible for 8bpp because 8bpp needs a colourmap) */
-			if (conn->bitmapCachePrecache && cellhdr.stamp && conn->serverBpp > 8)
-				pstcache_load_bitmap(conn, id, idx);
+	DEBUG_RDP5(("%d cached bitmaps.\n", idx));
 
-			/* Sort by stamp */
-			for (n = idx; n > 0 && cellhdr.stamp < mru_stamp[n - 1]; n--)
-			{
-				mru_idx[n] = mru_idx[n - 1];
-				mru_stamp[n] = mru_stamp[n - 1];
-			}
+	/* Sort by stamp, oldest first */
+	qsort(order, idx, sizeof(RDPersistentCacheOrder), pstcache_compare_stamps);
+	for (n = 0; n < idx; n++)
+		mru_idx[n] = order[n].idx;
 
-			mru_idx[n] = idx;
-			mru_stamp[n] = cellhdr.stamp;
-		}
-		else
+	/* Pre-cache (not possible for 8bpp because 8bpp needs a colourmap) as
+	   many of the most recently used bitmaps as the cache holds */
+	if (conn->bitmapCachePrecache && conn->serverBpp > 8 && conn->pstcachePrecache == NULL)
+	{
+		precache = (struct _RDPrecache *) xmalloc(sizeof(struct _RDPrecache));
+		memset(precache, 0, sizeof(struct _RDPrecache));
+		precache->id = id;
+		precache->map = conn->pstcacheMap[id];
+		precache->size = conn->pstcacheSize[id];
+		precache->Bpp = conn->pstcacheBpp;
+		precache->bpp = conn->serverBpp;
+
+		for (n = idx - 1; n >= 0 && order[n].stamp != 0 && precache->count < BMPCACHE2_C2_CELLS; n--)
 		{
-			break;
+			precache->idx[precache->count] = order[n].idx;
+			precache->entry[precache->count] = *INDEX_ENTRY(conn->pstcacheMap[id], order[n].idx);
+			precache->count++;
 		}
-	}
 
-	DEBUG_RDP5(("%d cached bitmaps.\n", idx));
+		if (precache->count > 0)
+			conn->pstcachePrecache = precache;
+		else
+			xfree(precache);
+	}
 
 	cache_rebuild_bmpcache_linked_list(conn, id, mru_idx, idx);
 	conn->pstcacheEnumerated = True;
 	return idx;
 }
 
+static void
+pstcache_precache_cell(void *ctx, int i)
+{
+	struct _RDPrecache *precache = ctx;
+	RDPersistentCacheIndexEntry *entry = &precache->entry[i];
+	uint8 buffer[MAX_DATA_SIZE(4)];
+	const uint8 *data;
+
+	data = pstcache_cell_data(precache->map, precache->size, precache->Bpp, entry, buffer);
+	if (data == NULL)
+		return;
+
+	precache->argb[i] = (uint8 *) xmalloc(entry->width * entry->height * 4);
+	bitmap_convert_argb(precache->argb[i], 0, data, entry->width * precache->Bpp, entry->width,
+			    entry->height, precache->bpp, NULL);
+}
+
+/* Start decoding the bitmaps noted by pstcache_enumerate, once the key
+   list is on its way to the server */
+void
+pstcache_precache(RDConnectionRef conn)
+{
+	struct _RDPrecache *precache = conn->pstcachePrecache;
+
+	if ((precache == NULL) || (precache->batch != NULL))
+		return;
+
+	precache->batch = workpool_start(precache->count, pstcache_precache_cell, precache);
+}
+
+/* wait for a precache to finish and free it, along with whatever was not installed */
+static void
+pstcache_precache_free(RDConnectionRef conn)
+{
+	struct _RDPrecache *precache = conn->pstcachePrecache;
+	int i;
+
+	if (precache == NULL)
+		return;
+
+	if (precache->batch != NULL)
+		workpool_wait(precache->batch);
+	for (i = 0; i < precache->count; i++)
+		xfree(precache->argb[i]);
+	xfree(precache);
+	conn->pstcachePrecache = NULL;
+}
+
+/* Install the precached bitmaps if they are ready; never blocks. Cells
+   loaded or saved since the enumeration keep what they have. */
+void
+pstcache_precache_poll(RDConnectionRef conn)
+{
+	struct _RDPrecache *precache = conn->pstcachePrecache;
+	RDPersistentCacheIndexEntry *entry;
+	RDBitmapRef bitmap;
+	RDBitmapKey key;
+	int i, installed = 0;
+
+	if ((precache == NULL) || (precache->batch == NULL) || !workpool_finished(precache->batch))
+		return;
+
+	for (i = 0; i < precache->count; i++)
+	{
+		if ((precache->argb[i] == NULL) || precache->stale[precache->idx[i]])
+			continue;
+
+		entry = &precache->entry[i];
+		bitmap = ui_create_bitmap_argb(conn, entry->width, entry->height, precache->argb[i]);
+		precache->argb[i] = NULL;
+		if (bmpstore_key_persistent(conn, &key, entry->key, entry->width, entry->height, precache->bpp))
+			bitmap = bmpstore_put(&key, bitmap);
+
+		if (cache_put_precached_bitmap(conn, precache->id, precache->idx[i], bitmap))
+			installed++;
+		else
+			bmpstore_release(bitmap);
+	}
+
+	DEBUG_RDP5(("Precached %d of %d bitmaps.\n", installed, precache->count));
+	pstcache_precache_free(conn);
+}
+
 /* initialise the persistent bitmap cache */
 RD_BOOL
 pstcache_init(RDConnectionRef conn, uint8 cache_id)
 {
 	int fd;
 	char filename[256];
+	struct stat st;
+	uint32 map_size, live;
+	uint8 bad[BMPCACHE2_NUM_PSTCELLS];
+	int idx, dropped;
+	void *map;
 
 	if (conn->pstcacheEnumerated)
 		return True;
@@ -186,6 +670,150 @@ pstcache_init(RDConnectionRef conn, uint8 cache_id)
 		return False;
 	}
 
+	map_size = MAP_SIZE(conn->pstcacheBpp);
+	map = (fstat(fd, &st) == 0) ? mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+	if (map == MAP_FAILED)
+	{
+		warning("Persistent bitmap caching is disabled. (The file could not be mapped)\n");
+		rd_close_file(fd);
+		return False;
+	}
+
 	conn->pstcacheFd[cache_id] = fd;
+	conn->pstcacheMap[cache_id] = (uint8 *) map;
+	conn->pstcacheSize[cache_id] = MIN((uint32) st.st_size, map_size);
+
+	if ((st.st_size >= (off_t) sizeof(PSTCACHE_MAGIC))
+	    && (memcmp(map, PSTCACHE_MAGIC, sizeof(PSTCACHE_MAGIC)) != 0))
+	{
+		if (!pstcache_convert_v1(conn, cache_id, st.st_size))
+		{
+			warning("Persistent bitmap caching is disabled. (%s)\n", strerror(errno));
+			pstcache_close_file(conn, cache_id);
+			return False;
+		}
+	}
+	else if (!pstcache_check_header(map, conn->pstcacheSize[cache_id], conn->pstcacheBpp))
+	{
+		/* new, or from an incompatible version: start over */
+		if (ftruncate(fd, DATA_START) == -1)
+		{
+			warning("Persistent bitmap caching is disabled. (%s)\n", strerror(errno));
+			pstcache_close_file(conn, cache_id);
+			return False;
+		}
+		conn->pstcacheSize[cache_id] = DATA_START;
+		pstcache_format(map, conn->pstcacheBpp);
+	}
+
+	/* drop the cells a damaged or truncated file has lost */
+	dropped = pstcache_check_index(map, conn->pstcacheBpp, bad);
+	if (dropped > 0)
+	{
+		warning("dropped %d damaged cells of the persistent bitmap cache\n", dropped);
+		for (idx = 0; idx < BMPCACHE2_NUM_PSTCELLS; idx++)
+			if (bad[idx])
+				memset(INDEX_ENTRY(map, idx), 0, sizeof(RDPersistentCacheIndexEntry));
+	}
+
+	/* reclaim the room of replaced payloads once it outweighs the rest */
+	live = pstcache_live_size(map);
+	if (FILE_HEADER(map)->data_end - DATA_START > 2 * live + PSTCACHE_GROW_SIZE)
+		pstcache_compact(conn, cache_id);
+
 	return True;
 }
+
+/* Unmap and close the persistent bitmap cache files. Dirty cells are
+   queued for writing, without waiting for the disk. */
+void
+pstcache_close(RDConnectionRef conn)
+{
+	int id;
+
+	pstcache_precache_free(conn);
+
+	for (id = 0; id < 8; id++)
+		if (IS_PERSISTENT(id))
+			pstcache_close_file(conn, id);
+}
+
+/* Check every cell of a cache file and print a summary to out. With
+   compact, damaged cells are dropped and the file is compacted. Returns
+   the number of damaged cells, or -1 if the file could not be used. */
+int
+pstcache_check_file(const char *path, RD_BOOL compact, FILE * out)
+{
+	RDPersistentCacheFileHeader header;
+	RDPersistentCacheIndexEntry *entry;
+	uint8 buffer[MAX_DATA_SIZE(4)], misplaced[BMPCACHE2_NUM_PSTCELLS], *map;
+	uint32 map_size, size, live = 0, raw = 0, end;
+	int fd, idx, cells = 0, bad = 0;
+	struct stat st;
+
+	fd = open(path, compact ? O_RDWR : O_RDONLY);
+	if ((fd == -1) || (fstat(fd, &st) == -1))
+	{
+		fprintf(out, "%s: %s\n", path, strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return -1;
+	}
+
+	if ((pread(fd, &header, sizeof(header), 0) != sizeof(header))
+	    || (memcmp(header.magic, PSTCACHE_MAGIC, sizeof(header.magic)) != 0)
+	    || (header.version != PSTCACHE_VERSION) || (header.bpp < 1) || (header.bpp > 4))
+	{
+		fprintf(out, "%s: not a version %d cache file (older files are converted when next used)\n",
+			path, PSTCACHE_VERSION);
+		close(fd);
+		return -1;
+	}
+
+	map_size = MAP_SIZE(header.bpp);
+	size = MIN((uint32) st.st_size, map_size);
+	map = mmap(NULL, map_size, compact ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	if ((map == MAP_FAILED) || !pstcache_check_header(map, size, header.bpp))
+	{
+		fprintf(out, "%s: damaged file header\n", path);
+		if (map != MAP_FAILED)
+			munmap(map, map_size);
+		close(fd);
+		return -1;
+	}
+
+	pstcache_check_index(map, header.bpp, misplaced);
+	for (idx = 0; idx < BMPCACHE2_NUM_PSTCELLS; idx++)
+	{
+		entry = INDEX_ENTRY(map, idx);
+		if (entry->offset == 0)
+			continue;
+
+		if (misplaced[idx] || (pstcache_cell_data(map, size, header.bpp, entry, buffer) == NULL))
+		{
+			fprintf(out, "%s: cell %d is damaged\n", path, idx);
+			if (compact)
+				memset(entry, 0, sizeof(RDPersistentCacheIndexEntry));
+			bad++;
+			continue;
+		}
+		cells++;
+		live += entry->stored;
+		raw += entry->length;
+	}
+
+	fprintf(out, "%s: %d bpp, %d cells, %u bytes of bitmaps stored in %u (%.0f%%), %u bytes in file\n",
+		path, header.bpp * 8, cells, raw, live, raw ? 100.0 * live / raw : 100.0, size);
+
+	if (compact)
+	{
+		end = pstcache_compact_map(map);
+		msync(map, end, MS_SYNC);
+		if (ftruncate(fd, end) == 0)
+			fprintf(out, "%s: compacted to %u bytes\n", path, end);
+	}
+
+	munmap(map, map_size);
+	close(fd);
+	return bad;
+}
@@ -0,0 +1,71 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Verify and compact persistent bitmap cache files
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Command line driver for plain C builds of the protocol core: checks the
+   CRC and compression of every cell in the given cache files, usually
+   ~/.rdesktop/cache/pstcache_*, and with -c drops damaged cells and
+   compacts the files. Run it while no session is using the files.
+   Not part of the Mac application.
+
+	pstcheck [-c] file... */
+
+#import "rdesktop.h"
+
+static void
+pstcheck_usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-c] file...\n", name);
+	exit(2);
+}
+
+int
+main(int argc, char *argv[])
+{
+	RD_BOOL compact = False;
+	int c, i, status = 0;
+
+	while ((c = getopt(argc, argv, "c")) != -1)
+	{
+		switch (c)
+		{
+			case 'c':
+				compact = True;
+				break;
+			default:
+				pstcheck_usage(argv[0]);
+		}
+	}
+	if (optind == argc)
+		pstcheck_usage(argv[0]);
+
+	for (i = optind; i < argc; i++)
+	{
+		switch (pstcache_check_file(argv[i], compact, stdout))
+		{
+			case 0:
+				break;
+			case -1:
+				status = MAX(status, 2);
+				break;
+			default:
+				status = MAX(status, 1);
+		}
+	}
+	return status;
+}
@@ -24,6 +24,7 @@
 #import <dirent.h>
 #import <sys/time.h>
 #import <sys/select.h>
+#import <sys/uio.h>		/* iovec */
 #import <unistd.h>
 #include <limits.h>		/* PATH_MAX */
 
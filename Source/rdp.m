@@ -24,8 +24,10 @@
 #import "rdesktop.h"
 #import "ssl.h"
 
+#ifdef __OBJC__
 #import "CRDSessionView.h"
 #import "CRDShared.h"
+#endif
 
 #ifdef HAVE_ICONV
 #ifdef HAVE_ICONV_H
@@ -47,7 +49,7 @@ rdp_recv(RDConnectionRef conn, uint8 * type)
 
 	if ((rdp_s == NULL) || (conn->nextPacket >= rdp_s->end) || (conn->nextPacket == NULL))
 	{
-		rdp_s = sec_recv(conn, &rdpver);
+		rdp_s = conn->rdpStream = sec_recv(conn, &rdpver);
 		if (rdp_s == NULL)
 			return NULL;
 		if (rdpver == 0xff)
@@ -58,8 +60,9 @@ rdp_recv(RDConnectionRef conn, uint8 * type)
 		}
 		else if (rdpver != 3)
 		{
-			/* rdp5_process should move conn->nextPacket ok */
+			/* a fast path packet is handled whole */
 			rdp5_process(conn, rdp_s);
+			conn->nextPacket = rdp_s->end;
 			*type = 0;
 			return rdp_s;
 		}
@@ -386,27 +389,149 @@ rdp_send_synchronise(RDConnectionRef conn)
 	rdp_send_data(conn, s, RDP_DATA_PDU_SYNCHRONISE);
 }
 
-/* Send a single input event */
-void
-rdp_send_input(RDConnectionRef conn, uint32 time, uint16 message_type, uint16 device_flags, uint16 param1, uint16 param2)
+/* Input is queued in a batch of up to INPUT_BATCH_SIZE events and sent
+   in one packet: by fast path, which skips the MCS and share headers,
+   when the server has offered it, and otherwise as one slow path input
+   PDU carrying them all. A pointer move queued straight after another
+   replaces it. */
+
+/* Whether an event has a fast path form */
+static RD_BOOL
+rdp_fastpath_input_supported(uint16 message_type)
+{
+	return (message_type == RDP_INPUT_SCANCODE) || (message_type == RDP_INPUT_MOUSE)
+		|| (message_type == RDP_INPUT_SYNCHRONIZE);
+}
+
+static void
+rdp_out_fastpath_input(RDStreamRef s, RDInputEvent * event)
+{
+	uint8 flags = 0;
+
+	switch (event->type)
+	{
+		case RDP_INPUT_SCANCODE:
+			if (event->deviceFlags & KBD_FLAG_UP)
+				flags |= FASTPATH_INPUT_KBDFLAGS_RELEASE;
+			if (event->deviceFlags & KBD_FLAG_EXT)
+				flags |= FASTPATH_INPUT_KBDFLAGS_EXTENDED;
+			out_uint8(s, (FASTPATH_INPUT_EVENT_SCANCODE << 5) | flags);
+			out_uint8(s, event->param1);
+			break;
+
+		case RDP_INPUT_MOUSE:
+			out_uint8(s, FASTPATH_INPUT_EVENT_MOUSE << 5);
+			out_uint16_le(s, event->deviceFlags);
+			out_uint16_le(s, event->param1);
+			out_uint16_le(s, event->param2);
+			break;
+
+		case RDP_INPUT_SYNCHRONIZE:
+			out_uint8(s, (FASTPATH_INPUT_EVENT_SYNC << 5) | (event->param1 & 0x1f));
+			break;
+	}
+}
+
+static RD_BOOL
+rdp_input_is_move(uint16 message_type, uint16 device_flags)
+{
+	return (message_type == RDP_INPUT_MOUSE) && (device_flags == MOUSE_FLAG_MOVE);
+}
+
+static void
+rdp_send_input_pdu(RDConnectionRef conn, RDInputEvent * events, int count, RD_BOOL fastpath)
 {
 	RDStreamRef s;
+	int i;
 
-	s = rdp_init_data(conn, 16);
+	if (fastpath)
+	{
+		s = sec_fastpath_init(conn, count * 7);
+		for (i = 0; i < count; i++)
+			rdp_out_fastpath_input(s, &events[i]);
+		s_mark_end(s);
+		sec_fastpath_send(conn, s, count);
+		return;
+	}
 
-	out_uint16_le(s, 1);	/* number of events */
+	s = rdp_init_data(conn, 4 + count * 12);
+
+	out_uint16_le(s, count);	/* number of events */
 	out_uint16(s, 0);	/* pad */
 
-	out_uint32_le(s, time);
-	out_uint16_le(s, message_type);
-	out_uint16_le(s, device_flags);
-	out_uint16_le(s, param1);
-	out_uint16_le(s, param2);
+	for (i = 0; i < count; i++)
+	{
+		out_uint32_le(s, events[i].time);
+		out_uint16_le(s, events[i].type);
+		out_uint16_le(s, events[i].deviceFlags);
+		out_uint16_le(s, events[i].param1);
+		out_uint16_le(s, events[i].param2);
+	}
 
 	s_mark_end(s);
 	rdp_send_data(conn, s, RDP_DATA_PDU_INPUT);
 }
 
+/* Send the queued input */
+void
+rdp_flush_input(RDConnectionRef conn)
+{
+	int count = conn->inputBatchCount;
+
+	if (count == 0)
+		return;
+
+	conn->inputBatchCount = 0;
+	rdp_send_input_pdu(conn, conn->inputBatch, count, conn->fastPathInput);
+}
+
+/* Queue an input event. Returns True if it should be sent soon, False
+   if it is a pointer move, which can wait to be sent with the next. */
+RD_BOOL
+rdp_queue_input(RDConnectionRef conn, uint32 time, uint16 message_type, uint16 device_flags, uint16 param1, uint16 param2)
+{
+	RDInputEvent *event, single;
+	RD_BOOL move = rdp_input_is_move(message_type, device_flags);
+
+	if (conn->fastPathInput && !rdp_fastpath_input_supported(message_type))
+	{
+		/* it goes alone, by slow path, after what was queued before it */
+		single.time = time;
+		single.type = message_type;
+		single.deviceFlags = device_flags;
+		single.param1 = param1;
+		single.param2 = param2;
+		rdp_flush_input(conn);
+		rdp_send_input_pdu(conn, &single, 1, False);
+		return False;
+	}
+
+	event = conn->inputBatch + conn->inputBatchCount;
+	if (move && (conn->inputBatchCount > 0) && rdp_input_is_move(event[-1].type, event[-1].deviceFlags))
+		event--;
+	else
+	{
+		if (conn->inputBatchCount == INPUT_BATCH_SIZE)
+			rdp_flush_input(conn);
+		event = &conn->inputBatch[conn->inputBatchCount++];
+	}
+
+	event->time = time;
+	event->type = message_type;
+	event->deviceFlags = device_flags;
+	event->param1 = param1;
+	event->param2 = param2;
+	return !move;
+}
+
+/* Send an input event, and any queued before it, now */
+void
+rdp_send_input(RDConnectionRef conn, uint32 time, uint16 message_type, uint16 device_flags, uint16 param1, uint16 param2)
+{
+	rdp_queue_input(conn, time, message_type, device_flags, param1, param2);
+	rdp_flush_input(conn);
+}
+
 /* Send a client window information PDU */
 void
 rdp_send_client_window_status(RDConnectionRef conn, int status)
@@ -479,6 +604,8 @@ rdp_enum_bmpcache2(RDConnectionRef conn)
 
 		offset += 169;
 	}
+
+	pstcache_precache(conn);
 }
 
 /* Send an (empty) font information PDU */
@@ -710,19 +837,21 @@ rdp_out_brushcache_caps(RDStreamRef s)
 	out_uint32_le(s, 1);	/* cache type */
 }
 
-static const uint8 caps_0x0d[] = {
-	0x01, 0x00, 0x00, 0x00, 0x09, 0x04, 0x00, 0x00,
-	0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x0C, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-	0x00, 0x00, 0x00, 0x00
-};
+/* Output input capability set */
+static void
+rdp_out_input_caps(RDStreamRef s)
+{
+	out_uint16_le(s, RDP_CAPSET_INPUT);
+	out_uint16_le(s, RDP_CAPLEN_INPUT);
+
+	out_uint16_le(s, INPUT_FLAG_SCANCODES | INPUT_FLAG_FASTPATH_INPUT2);	/* Flags */
+	out_uint16(s, 0);	/* Pad */
+	out_uint32_le(s, 0x409);	/* Keyboard layout */
+	out_uint32_le(s, 4);	/* Keyboard type */
+	out_uint32_le(s, 0);	/* Keyboard subtype */
+	out_uint32_le(s, 12);	/* Function keys */
+	out_uint8s(s, 64);	/* IME file name */
+}
 
 static const uint8 caps_0x0c[] = { 0x01, 0x00, 0x00, 0x00 };
 
@@ -759,7 +888,7 @@ rdp_send_confirm_active(RDConnectionRef conn)
 		RDP_CAPLEN_COLCACHE +
 		RDP_CAPLEN_ACTIVATE + RDP_CAPLEN_CONTROL +
 		RDP_CAPLEN_SHARE +
-		RDP_CAPLEN_BRUSHCACHE + 0x58 + 0x08 + 0x08 + 0x34 /* unknown caps */  +
+		RDP_CAPLEN_BRUSHCACHE + RDP_CAPLEN_INPUT + 0x08 + 0x08 + 0x34 /* unknown caps */  +
 		4 /* w2k fix, why? */ ;
 
 	if (conn->useRdp5)
@@ -805,7 +934,7 @@ rdp_send_confirm_active(RDConnectionRef conn)
 	rdp_out_share_caps(s);
 	rdp_out_brushcache_caps(s);
 
-	rdp_out_unknown_caps(s, 0x0d, 0x58, caps_0x0d);	/* CAPSTYPE_INPUT */
+	rdp_out_input_caps(s);
 	rdp_out_unknown_caps(s, 0x0c, 0x08, caps_0x0c); /* CAPSTYPE_SOUND */
 	rdp_out_unknown_caps(s, 0x0e, 0x08, caps_0x0e); /* CAPSTYPE_FONT */
 	rdp_out_unknown_caps(s, 0x10, 0x34, caps_0x10);	/* CAPSTYPE_GLYPHCACHE */
@@ -827,6 +956,16 @@ rdp_process_general_caps(RDConnectionRef conn, RDStreamRef s)
 		conn->useRdp5 = False;
 }
 
+/* Process an input capability set */
+static void
+rdp_process_input_caps(RDConnectionRef conn, RDStreamRef s)
+{
+	uint16 flags;
+
+	in_uint16_le(s, flags);
+	conn->fastPathInput = (flags & (INPUT_FLAG_FASTPATH_INPUT | INPUT_FLAG_FASTPATH_INPUT2)) != 0;
+}
+
 /* Process a bitmap capability set */
 static void
 rdp_process_bitmap_caps(RDConnectionRef conn, RDStreamRef s)
@@ -847,9 +986,11 @@ rdp_process_bitmap_caps(RDConnectionRef conn, RDStreamRef s)
 	 */
 	if (conn->serverBpp != bpp)
 	{
-		CRDSessionView *view = conn->ui;
 		warning("colour depth changed from %d to %d\n", conn->serverBpp, bpp);
-		[view setBitdepth:bpp];
+#ifdef __OBJC__
+		/* the headless framebuffer converts colours by conn->serverBpp */
+		[(CRDSessionView *) conn->ui setBitdepth:bpp];
+#endif
 		conn->serverBpp = bpp;
 	}
 	if (conn->screenWidth != width || conn->screenHeight != height)
@@ -871,6 +1012,7 @@ rdp_process_server_caps(RDConnectionRef conn, RDStreamRef s, uint16 length)
 	uint16 ncapsets, capset_type, capset_length;
 
 	start = s->p;
+	conn->fastPathInput = False;
 
 	in_uint16_le(s, ncapsets);
 	in_uint8s(s, 2);	/* pad */
@@ -894,6 +1036,10 @@ rdp_process_server_caps(RDConnectionRef conn, RDStreamRef s, uint16 length)
 			case RDP_CAPSET_BITMAP:
 				rdp_process_bitmap_caps(conn, s);
 				break;
+
+			case RDP_CAPSET_INPUT:
+				rdp_process_input_caps(conn, s);
+				break;
 		}
 
 		s->p = next;
@@ -1053,75 +1199,130 @@ process_pointer_pdu(RDConnectionRef conn, RDStreamRef s)
 	}
 }
 
-/* Process bitmap updates */
+/* One rectangle of a bitmap update, decoded on the worker pool */
+typedef struct _RDBitmapUpdate
+{
+	uint16 left, top, cx, cy, width, height, bpp, compress;
+	uint32 size;
+	uint8 *data;
+	uint8 *argb;
+} RDBitmapUpdate;
+
+typedef struct _RDBitmapUpdateBatch
+{
+	RDBitmapUpdate *updates;
+	RDColorMapRef colour_map;
+} RDBitmapUpdateBatch;
+
+static void
+decode_bitmap_update(void *ctx, int i)
+{
+	RDBitmapUpdateBatch *batch = (RDBitmapUpdateBatch *) ctx;
+	RDBitmapUpdate *update = &batch->updates[i];
+	int rowsize = update->width * ((update->bpp + 7) / 8);
+
+	/* decoded straight into the UI's ARGB format; ui_paint_bitmap_argb takes the buffer */
+	update->argb = (uint8 *) xmalloc(update->width * update->height * 4);
+
+	if (!update->compress)
+	{
+		/* rows arrive bottom-up */
+		bitmap_convert_argb(update->argb, 0, update->data + (update->height - 1) * rowsize, -rowsize,
+				    update->width, update->height, update->bpp, batch->colour_map);
+	}
+	else if (!bitmap_decompress_argb(update->argb, 0, update->width, update->height, update->data,
+					 update->size, update->bpp, batch->colour_map))
+	{
+		xfree(update->argb);
+		update->argb = NULL;
+	}
+}
+
+/* Process bitmap updates. The rectangles are independent, so they are
+   decoded in parallel and then painted in protocol order. */
 void
 process_bitmap_updates(RDConnectionRef conn, RDStreamRef s)
 {
+	RDBitmapUpdateBatch batch;
+	RDBitmapUpdate *update;
 	uint16 num_updates;
-	uint16 left, top, right, bottom, width, height;
-	uint16 cx, cy, bpp, Bpp, compress, bufsize, size;
-	uint8 *data, *bmpdata;
+	uint16 right, bottom, Bpp, bufsize, compressed_size;
+	uint64 length;
 	int i;
 
 	in_uint16_le(s, num_updates);
+	if (num_updates == 0)
+		return;
+
+	batch.updates = (RDBitmapUpdate *) xmalloc(sizeof(RDBitmapUpdate) * num_updates);
+	batch.colour_map = ui_get_colourmap(conn);
 
 	for (i = 0; i < num_updates; i++)
 	{
-		in_uint16_le(s, left);
-		in_uint16_le(s, top);
+		update = &batch.updates[i];
+		in_uint16_le(s, update->left);
+		in_uint16_le(s, update->top);
 		in_uint16_le(s, right);
 		in_uint16_le(s, bottom);
-		in_uint16_le(s, width);
-		in_uint16_le(s, height);
-		in_uint16_le(s, bpp);
-		Bpp = (bpp + 7) / 8;
-		in_uint16_le(s, compress);
+		in_uint16_le(s, update->width);
+		in_uint16_le(s, update->height);
+		in_uint16_le(s, update->bpp);
+		Bpp = (update->bpp + 7) / 8;
+		in_uint16_le(s, update->compress);
 		in_uint16_le(s, bufsize);
 
-		cx = right - left + 1;
-		cy = bottom - top + 1;
+		update->cx = right - update->left + 1;
+		update->cy = bottom - update->top + 1;
 
 		DEBUG(("BITMAP_UPDATE(l=%d,t=%d,r=%d,b=%d,w=%d,h=%d,Bpp=%d,cmp=%d)\n",
-		       left, top, right, bottom, width, height, Bpp, compress));
+		       update->left, update->top, right, bottom, update->width, update->height, Bpp,
+		       update->compress));
 
-		if (!compress)
+		if (!update->compress)
 		{
-			int y;
-			bmpdata = (uint8 *) xmalloc(width * height * Bpp);
-			for (y = 0; y < height; y++)
-			{
-				in_uint8a(s, &bmpdata[(height - y - 1) * (width * Bpp)],
-					  width * Bpp);
-			}
-			ui_paint_bitmap(conn, left, top, cx, cy, width, height, bmpdata);
-			xfree(bmpdata);
-			continue;
+			length = (uint64) update->width * update->height * Bpp;
 		}
-
-
-		if (compress & 0x400)
+		else if (update->compress & 0x400)
 		{
-			size = bufsize;
+			length = bufsize;
 		}
 		else
 		{
 			in_uint8s(s, 2);	/* pad */
-			in_uint16_le(s, size);
+			in_uint16_le(s, compressed_size);
 			in_uint8s(s, 4);	/* line_size, final_size */
+			length = compressed_size;
 		}
-		in_uint8p(s, data, size);
-		bmpdata = (uint8 *) xmalloc(width * height * Bpp);
-		if (bitmap_decompress(bmpdata, width, height, data, size, Bpp))
+
+		/* decode only the updates whose data is all there */
+		if (!s_check(s) || (length > (uint64) (s->end - s->p)))
 		{
-			ui_paint_bitmap(conn, left, top, cx, cy, width, height, bmpdata);
+			error("bitmap update %d of %d needs %llu bytes, the PDU has %d\n", i + 1, num_updates,
+			      (unsigned long long) length, (int) (s->end - s->p));
+			num_updates = i;
+			break;
+		}
+		update->size = length;
+		in_uint8p(s, update->data, update->size);
+	}
+
+	workpool_run(num_updates, decode_bitmap_update, &batch);
+
+	for (i = 0; i < num_updates; i++)
+	{
+		update = &batch.updates[i];
+		if (update->argb != NULL)
+		{
+			ui_paint_bitmap_argb(conn, update->left, update->top, update->cx, update->cy,
+					     update->width, update->height, update->argb);
 		}
 		else
 		{
 			DEBUG_RDP5(("Failed to decompress data\n"));
 		}
-
-		xfree(bmpdata);
 	}
+
+	xfree(batch.updates);
 }
 
 /* Process a palette update */
@@ -1276,11 +1477,9 @@ process_data_pdu(RDConnectionRef conn, RDStreamRef s, uint32 * ext_disc_reason)
 
 		/* len -= 18; */
 
-		/* allocate memory and copy the uncompressed data into the temporary stream */
-		ns->data = (uint8 *) xrealloc(ns->data, rlen);
-
-		memcpy((ns->data), (unsigned char *) (conn->mppcDict.hist + roff), rlen);
-
+		/* the temporary stream is a view of the history buffer; it
+		   stays valid until the next packet is expanded */
+		ns->data = conn->mppcDict.hist + roff;
 		ns->size = rlen;
 		ns->end = (ns->data + ns->size);
 		ns->p = ns->data;
@@ -1398,6 +1597,8 @@ RD_BOOL
 rdp_connect(RDConnectionRef conn, const char *server, uint32 flags, NSString *domain, NSString *username, NSString *password,
 	    const char *command, const char *directory, RD_BOOL reconnect)
 {
+	bmpstore_scope(conn, server, domain);
+	bmpstore_attach(conn);
 	if (!sec_connect(conn, server, conn->username, reconnect))
 		return False;
 
@@ -1410,6 +1611,7 @@ void
 rdp_reset_state(RDConnectionRef conn)
 {
 	conn->nextPacket = NULL;	/* reset the packet information */
+	conn->rdpStream = NULL;
 	conn->shareID = 0;
 	sec_reset_state(conn);
 }
@@ -1418,5 +1620,7 @@ rdp_reset_state(RDConnectionRef conn)
 void
 rdp_disconnect(RDConnectionRef conn)
 {
+	cache_save_state(conn);
+	pstcache_close(conn);
 	sec_disconnect(conn);
 }
@@ -57,15 +57,13 @@ rdp5_process(RDConnectionRef conn, RDStreamRef s)
 			
 		if (ctype & RDP_MPPC_COMPRESSED)
 		{
-			fprintf(stderr, "RDP5 conn:%p stream:%p length:%d ctype:%d\n", conn, s, length, ctype);
+			DEBUG_RDP5(("RDP5 conn:%p stream:%p length:%d ctype:%d\n", conn, s, length, ctype));
 			if (mppc_expand(conn, s->p, length, ctype, &roff, &rlen) == -1)
 				error("error while decompressing packet\n");
 
-			/* allocate memory and copy the uncompressed data into the temporary stream */
-			ns->data = (uint8 *) xrealloc(ns->data, rlen);
-
-			memcpy((ns->data), (unsigned char *) (conn->mppcDict.hist + roff), rlen);
-
+			/* the temporary stream is a view of the history buffer; it
+			   stays valid until the next packet is expanded */
+			ns->data = conn->mppcDict.hist + roff;
 			ns->size = rlen;
 			ns->end = (ns->data + ns->size);
 			ns->p = ns->data;
@@ -33,9 +33,6 @@
   http://www.osronline.com/
 */
 
-#import "CRDShared.h"
-#import "CRDSession.h"
-
 #import <unistd.h>
 #import <sys/types.h>
 #import <sys/time.h>
@@ -230,27 +227,31 @@ rdpdr_send_available(RDConnectionRef conn)
 	channel_send(conn, s, conn->rdpdrChannel);
 }
 
+/* The buffer is sent from where it is, and scrambled if the connection
+   is encrypted */
 static void
 rdpdr_send_completion(RDConnectionRef conn, uint32 device, uint32 requestID, uint32 status, uint32 result, uint8 * buffer,
 		      uint32 length)
 {
 	uint8 magic[4] = "rDCI";
 	RDStreamRef s;
+	struct iovec payload;
 
-	s = channel_init(conn, conn->rdpdrChannel, 20 + length);
+	s = channel_init(conn, conn->rdpdrChannel, 20);
 	out_uint8a(s, magic, 4);
 	out_uint32_le(s, device);
 	out_uint32_le(s, requestID);
 	out_uint32_le(s, status);
 	out_uint32_le(s, result);
-	out_uint8p(s, buffer, length);
 	s_mark_end(s);
 
 #ifdef WITH_DEBUG_RDP5
 	printf("--> rdpdr_send_completion\n");
 	/* hexdump(s->channel_hdr + 8, s->end - s->channel_hdr - 8); */
 #endif
-	channel_send(conn, s, conn->rdpdrChannel);
+	payload.iov_base = buffer;
+	payload.iov_len = length;
+	channel_send_gather(conn, s, conn->rdpdrChannel, &payload, 1);
 }
 
 static void
@@ -745,7 +746,7 @@ rdpdr_init(RDConnectionRef conn)
 static RD_BOOL
 add_async_iorequest(RDConnectionRef conn, uint32 device, uint32 file, uint32 fid, uint32 major, uint32 length, DEVICE_FNS * fns, uint8 * buffer, uint32 offset) 
 {
-	CRDLog(CRDLogLevelInfo, @"Adding IO-req for fd %d", file);
+	DEBUG(("RDPDR: Adding IO-req for fd %d\n", file));
 	
 	RDAsynchronousIORequest *newRequest = calloc(1, sizeof(RDAsynchronousIORequest));
 	newRequest->device = device;
@@ -781,7 +782,7 @@ add_async_iorequest(RDConnectionRef conn, uint32 device, uint32 file, uint32 fid
 RDAsynchronousIORequest *
 rdpdr_remove_iorequest(RDConnectionRef conn, uint32 fd, RDAsynchronousIORequest *requestToRemove)
 {
-	CRDLog(CRDLogLevelInfo, @"Removing IO-req for fd %d", fd);
+	DEBUG(("RDPDR: Removing IO-req for fd %d\n", fd));
 
 	if (requestToRemove == NULL)
 		return NULL;
@@ -810,7 +811,7 @@ rdpdr_remove_iorequest(RDConnectionRef conn, uint32 fd, RDAsynchronousIORequest
 void 
 rdpdr_io_available_event(RDConnectionRef conn, uint32 file, RDAsynchronousIORequest *iorq)
 {
-	CRDLog(CRDLogLevelInfo, @"Data became available for fd %d", file);
+	DEBUG(("RDPDR: Data became available for fd %d\n", file));
 
 	if (iorq == NULL)
 	{
@@ -822,7 +823,7 @@ rdpdr_io_available_event(RDConnectionRef conn, uint32 file, RDAsynchronousIORequ
 	
 	if (iorq == NULL)
 	{
-		CRDLog(CRDLogLevelInfo, @"Couldn't find a matching iorq for file %u", file);
+		DEBUG(("RDPDR: Couldn't find a matching iorq for file %u\n", file));
 		return;
 	}	
 	
@@ -917,6 +918,7 @@ RD_BOOL
 rdpdr_abort_io(RDConnectionRef conn, uint32 fd, uint32 major, NTStatus status)
 {
 	uint32 result;
+	uint8 pad = 0;
 	RDAsynchronousIORequest *iorq;
 
 	iorq = conn->fileInfo[fd].firstIORequest;
@@ -926,7 +928,7 @@ rdpdr_abort_io(RDConnectionRef conn, uint32 fd, uint32 major, NTStatus status)
 		if ((iorq->fd == fd) && (major == 0 || iorq->major == major))
 		{
 			result = 0;
-			rdpdr_send_completion(conn, iorq->device, iorq->fid, status, result, (uint8 *) "", 1);
+			rdpdr_send_completion(conn, iorq->device, iorq->fid, status, result, &pad, 1);
 
 			iorq->aborted = 1;
 			return True;
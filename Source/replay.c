@@ -0,0 +1,118 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Replay a session capture as a benchmark
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Command line driver for plain C builds of the protocol core: decodes a
+   capture written with the CRDCaptureSessionsPath default into the
+   headless framebuffer and prints the throughput and per-order timings.
+   With -b the bitmap cache accesses of the first iteration are written
+   to a trace for cachesim. Not part of the Mac application.
+
+	replay [-t threads] [-n iterations] [-b trace] capture */
+
+#import "rdesktop.h"
+
+static void
+replay_usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-t threads] [-n iterations] [-b trace] capture\n", name);
+	exit(2);
+}
+
+/* the state CRDFillDefaultConnection gives a new session */
+static RDConnectionRef
+replay_new_connection(void)
+{
+	RDConnectionRef conn = (RDConnectionRef) xmalloc(sizeof(RDConnection));
+
+	memset(conn, 0, sizeof(RDConnection));
+	conn->useBitmapCompression = 1;
+	conn->currentStatus = 1;
+	conn->serverRdpVersion = 1;
+	conn->keyboardLayout = 0x409;
+	conn->keyboardType = 4;
+	conn->keyboardFunctionkeys = 12;
+	conn->errorCode = ConnectionErrorNone;
+	return conn;
+}
+
+static void
+replay_free_connection(RDConnectionRef conn)
+{
+	cache_destroy(conn);
+	capture_close(conn);
+	cache_trace_close(conn);
+	order_stats_disable(conn);
+	headless_deinit(conn);
+	xfree(conn);
+}
+
+int
+main(int argc, char *argv[])
+{
+	RDConnectionRef conn;
+	RDReplayStats stats;
+	const char *trace = NULL;
+	int c, threads = 0, iterations = 1, i;
+
+	while ((c = getopt(argc, argv, "t:n:b:")) != -1)
+	{
+		switch (c)
+		{
+			case 't':
+				threads = atoi(optarg);
+				break;
+			case 'n':
+				iterations = MAX(atoi(optarg), 1);
+				break;
+			case 'b':
+				trace = optarg;
+				break;
+			default:
+				replay_usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		replay_usage(argv[0]);
+
+	workpool_init(threads);
+
+	/* every iteration starts from a fresh connection, as the capture did */
+	for (i = 0; i < iterations; i++)
+	{
+		conn = replay_new_connection();
+		if (!replay_open(conn, argv[optind]) || !headless_init(conn))
+		{
+			replay_free_connection(conn);
+			return 1;
+		}
+		if ((i == 0) && (trace != NULL) && !cache_trace_open(conn, trace))
+		{
+			replay_free_connection(conn);
+			return 1;
+		}
+
+		replay_run(conn, &stats);
+		if (iterations > 1)
+			printf("iteration %d: ", i + 1);
+		replay_report(conn, &stats, stdout);
+
+		replay_free_connection(conn);
+	}
+	return 0;
+}
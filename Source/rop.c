@@ -0,0 +1,348 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Raster operations on 32 bit surfaces
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* A raster operation is a truth table: bit k of a ROP3 gives the result
+   for pattern bit k & 4, source bit k & 2 and destination bit k & 1. The
+   opcodes the UIs get for destblt, screenblt and memblt (ROP2_S) are the
+   low four bits of that, over source and destination; for patblt
+   (ROP2_P) they are over pattern and destination in the same places. So
+   one table of sixteen serves both, with the pattern standing in for the
+   source, and every ROP3 is worked out exactly from its bits.
+
+   Pixels are opaque 32 bit words in whatever byte order the UI keeps;
+   the operations work on all bits at once, and the alpha bits are set
+   again afterwards. Copy, xor, and, or and invert, which is nearly all
+   that servers send, are done four pixels at a time with SSE2. */
+
+#import "rdesktop.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define ROP_SSE2
+#endif
+
+static inline uint32
+rop2_pixel(int opcode, uint32 src, uint32 dst)
+{
+	switch (opcode & 0xf)
+	{
+		case 0:	return 0;
+		case 1:	return ~(src | dst);
+		case 2:	return ~src & dst;
+		case 3:	return ~src;
+		case 4:	return src & ~dst;
+		case 5:	return ~dst;
+		case 6:	return src ^ dst;
+		case 7:	return ~(src & dst);
+		case 8:	return src & dst;
+		case 9:	return ~(src ^ dst);
+		case 10: return dst;
+		case 11: return ~src | dst;
+		case 12: return src;
+		case 13: return src | ~dst;
+		case 14: return src | dst;
+		default: return ~0;
+	}
+}
+
+static inline uint32
+rop3_pixel(uint8 rop3, uint32 pat, uint32 src, uint32 dst)
+{
+	uint32 res = 0;
+	int k;
+
+	for (k = 0; k < 8; k++)
+	{
+		if (rop3 & (1 << k))
+			res |= ((k & 4) ? pat : ~pat) & ((k & 2) ? src : ~src) & ((k & 1) ? dst : ~dst);
+	}
+	return res;
+}
+
+/* dst = op(src, dst) for count pixels; with src NULL the source is colour */
+static void
+rop2_span(int opcode, uint32 * dst, const uint32 * src, uint32 colour, int count, uint32 opaque)
+{
+	int i = 0;
+#ifdef ROP_SSE2
+	__m128i s = _mm_set1_epi32(colour), ones = _mm_set1_epi32(-1), alpha = _mm_set1_epi32(opaque), d, r;
+
+	switch (opcode & 0xf)
+	{
+		case 3:
+		case 5:
+		case 6:
+		case 8:
+		case 12:
+		case 14:
+			for (; i + 4 <= count; i += 4)
+			{
+				if (src != NULL)
+					s = _mm_loadu_si128((const __m128i *) (src + i));
+				d = _mm_loadu_si128((const __m128i *) (dst + i));
+				switch (opcode & 0xf)
+				{
+					case 3:	r = _mm_xor_si128(s, ones); break;
+					case 5:	r = _mm_xor_si128(d, ones); break;
+					case 6:	r = _mm_xor_si128(s, d); break;
+					case 8:	r = _mm_and_si128(s, d); break;
+					case 14: r = _mm_or_si128(s, d); break;
+					default: r = s; break;
+				}
+				_mm_storeu_si128((__m128i *) (dst + i), _mm_or_si128(r, alpha));
+			}
+			break;
+	}
+#endif
+	if (src != NULL)
+	{
+		for (; i < count; i++)
+			dst[i] = rop2_pixel(opcode, src[i], dst[i]) | opaque;
+	}
+	else
+	{
+		for (; i < count; i++)
+			dst[i] = rop2_pixel(opcode, colour, dst[i]) | opaque;
+	}
+}
+
+/* dst = op(src, dst) for count pixels */
+void
+rop2_row(int opcode, uint32 * dst, const uint32 * src, int count, uint32 opaque)
+{
+	rop2_span(opcode, dst, src, 0, count, opaque);
+}
+
+/* dst = op(colour, dst) for count pixels */
+void
+rop2_fill_row(int opcode, uint32 * dst, uint32 colour, int count, uint32 opaque)
+{
+	rop2_span(opcode, dst, NULL, colour, count, opaque);
+}
+
+/* dst = op(pattern, src, dst) for count pixels, where pattern holds the
+   eight pattern pixels of the row, pattern[0] falling on dst[0]. src may
+   be NULL for operations that do not use it. */
+void
+rop3_row(uint8 rop3, uint32 * dst, const uint32 * src, const uint32 * pattern, int count, uint32 opaque)
+{
+	int i;
+
+	/* operations that ignore the pattern are ROP2s over the source */
+	if (((rop3 >> 4) & 0xf) == (rop3 & 0xf))
+	{
+		if (src != NULL)
+			rop2_row(rop3 & 0xf, dst, src, count, opaque);
+		else
+			rop2_fill_row(rop3 & 0xf, dst, 0, count, opaque);
+		return;
+	}
+
+	/* and those that ignore the source are ROP2s over the pattern */
+	if (((rop3 >> 2) & 0x33) == (rop3 & 0x33))
+	{
+		for (i = 0; i < count; i += 8)
+			rop2_row((rop3 & 3) | ((rop3 >> 2) & 0xc), dst + i, pattern, MIN(8, count - i), opaque);
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		dst[i] = rop3_pixel(rop3, pattern[i & 7], (src != NULL) ? src[i] : 0, dst[i]) | opaque;
+}
+
+/* clip a destination rectangle to the surface's clip rectangle, moving
+   the source origin along with it; returns False when nothing is left */
+static RD_BOOL
+rop_clip(const RDRopSurface * surface, int *x, int *y, int *cx, int *cy, int *srcx, int *srcy)
+{
+	int dx = 0, dy = 0;
+
+	if (*x < surface->clip_left)
+		dx = surface->clip_left - *x;
+	if (*y < surface->clip_top)
+		dy = surface->clip_top - *y;
+	*x += dx;
+	*y += dy;
+	*cx = MIN(*cx - dx, surface->clip_right - *x);
+	*cy = MIN(*cy - dy, surface->clip_bottom - *y);
+	if (srcx != NULL)
+	{
+		*srcx += dx;
+		*srcy += dy;
+	}
+	return (*cx > 0) && (*cy > 0);
+}
+
+#define ROP_ROW(surface,x,y)	((uint32 *) ((surface)->pixels + (sint64) (y) * (surface)->stride) + (x))
+
+/* the eight pixels of a tile row that fall from x onwards */
+static void
+rop_pattern_row(uint32 * row, const uint32 * tile, int x, int y, int xorigin, int yorigin)
+{
+	const uint32 *source = tile + ((y - yorigin) & 7) * 8;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		row[i] = source[(x - xorigin + i) & 7];
+}
+
+/* Combine a solid colour with a rectangle of the surface */
+void
+rop_fill(const RDRopSurface * surface, int opcode, int x, int y, int cx, int cy, uint32 colour)
+{
+	if (!rop_clip(surface, &x, &y, &cx, &cy, NULL, NULL))
+		return;
+	for (; cy > 0; cy--, y++)
+		rop2_fill_row(opcode, ROP_ROW(surface, x, y), colour, cx, surface->opaque);
+}
+
+/* Combine an 8x8 tile, repeated from xorigin, yorigin, with a rectangle
+   of the surface; opcode is a ROP2_P */
+void
+rop_pattern(const RDRopSurface * surface, int opcode, int x, int y, int cx, int cy, const uint32 * tile,
+	    int xorigin, int yorigin)
+{
+	uint32 row[8], *p;
+	int i;
+
+	if (!rop_clip(surface, &x, &y, &cx, &cy, NULL, NULL))
+		return;
+	if ((opcode & 0xf) == 12)
+	{
+		brush_tile_fill(surface->pixels, surface->stride, x, y, cx, cy, tile, xorigin, yorigin);
+		return;
+	}
+
+	for (; cy > 0; cy--, y++)
+	{
+		rop_pattern_row(row, tile, x, y, xorigin, yorigin);
+		p = ROP_ROW(surface, x, y);
+		for (i = 0; i < cx; i += 8)
+			rop2_row(opcode, p + i, row, MIN(8, cx - i), surface->opaque);
+	}
+}
+
+/* clip a source rectangle of src_width x src_height too */
+static RD_BOOL
+rop_clip_source(int *x, int *y, int *cx, int *cy, int *srcx, int *srcy, int src_width, int src_height)
+{
+	if (*srcx < 0)
+	{
+		*x -= *srcx;
+		*cx += *srcx;
+		*srcx = 0;
+	}
+	if (*srcy < 0)
+	{
+		*y -= *srcy;
+		*cy += *srcy;
+		*srcy = 0;
+	}
+	*cx = MIN(*cx, src_width - *srcx);
+	*cy = MIN(*cy, src_height - *srcy);
+	return (*cx > 0) && (*cy > 0);
+}
+
+/* Clip a blit from a src_width x src_height source as rop_blit and
+   rop_triblt do, for callers that prepare only the source pixels read */
+RD_BOOL
+rop_clip_blit(const RDRopSurface * surface, int *x, int *y, int *cx, int *cy, int *srcx, int *srcy,
+	      int src_width, int src_height)
+{
+	return rop_clip(surface, x, y, cx, cy, srcx, srcy)
+		&& rop_clip_source(x, y, cx, cy, srcx, srcy, src_width, src_height);
+}
+
+/* Combine source pixels, src_stride bytes a row, with a rectangle of the
+   surface; opcode is a ROP2_S */
+void
+rop_blit(const RDRopSurface * surface, int opcode, int x, int y, int cx, int cy, const uint8 * src,
+	 int src_stride, int src_width, int src_height, int srcx, int srcy)
+{
+	if (!rop_clip_blit(surface, &x, &y, &cx, &cy, &srcx, &srcy, src_width, src_height))
+		return;
+
+	for (; cy > 0; cy--, y++, srcy++)
+		rop2_row(opcode, ROP_ROW(surface, x, y), (const uint32 *) (src + srcy * src_stride) + srcx, cx,
+			 surface->opaque);
+}
+
+/* Combine another rectangle of the surface with it, the two possibly
+   overlapping; opcode is a ROP2_S */
+void
+rop_screenblt(const RDRopSurface * surface, int opcode, int x, int y, int cx, int cy, int srcx, int srcy)
+{
+	int row, first, last, step;
+
+	if (!rop_clip(surface, &x, &y, &cx, &cy, &srcx, &srcy)
+	    || !rop_clip_source(&x, &y, &cx, &cy, &srcx, &srcy, surface->width, surface->height))
+		return;
+
+	/* go through the rows away from the overlap; within a row, a copy
+	   (of pixels already opaque) is a memmove and anything else reads
+	   the source from a copy */
+	if ((srcy == y) && (srcx < x + cx) && (x < srcx + cx))
+	{
+		uint32 *copy;
+
+		if ((opcode & 0xf) == 12)
+		{
+			for (row = 0; row < cy; row++)
+				memmove(ROP_ROW(surface, x, y + row), ROP_ROW(surface, srcx, srcy + row), cx * 4);
+			return;
+		}
+
+		copy = (uint32 *) xmalloc(cx * 4);
+
+		for (row = 0; row < cy; row++)
+		{
+			memcpy(copy, ROP_ROW(surface, srcx, srcy + row), cx * 4);
+			rop2_row(opcode, ROP_ROW(surface, x, y + row), copy, cx, surface->opaque);
+		}
+		xfree(copy);
+		return;
+	}
+
+	first = (srcy < y) ? cy - 1 : 0;
+	last = (srcy < y) ? -1 : cy;
+	step = (srcy < y) ? -1 : 1;
+	for (row = first; row != last; row += step)
+		rop2_row(opcode, ROP_ROW(surface, x, y + row), ROP_ROW(surface, srcx, srcy + row), cx,
+			 surface->opaque);
+}
+
+/* Combine source pixels and an 8x8 tile with a rectangle of the surface,
+   under any of the 256 ROP3s */
+void
+rop_triblt(const RDRopSurface * surface, uint8 rop3, int x, int y, int cx, int cy, const uint8 * src,
+	   int src_stride, int src_width, int src_height, int srcx, int srcy, const uint32 * tile, int xorigin,
+	   int yorigin)
+{
+	uint32 row[8];
+
+	if (!rop_clip_blit(surface, &x, &y, &cx, &cy, &srcx, &srcy, src_width, src_height))
+		return;
+
+	for (; cy > 0; cy--, y++, srcy++)
+	{
+		rop_pattern_row(row, tile, x, y, xorigin, yorigin);
+		rop3_row(rop3, ROP_ROW(surface, x, y), (const uint32 *) (src + srcy * src_stride) + srcx, row, cx,
+			 surface->opaque);
+	}
+}
@@ -155,23 +155,25 @@ buf_out_uint32(uint8 * buffer, uint32 value)
 	buffer[3] = (value >> 24) & 0xff;
 }
 
-/* Generate a MAC hash (5.2.3.1), using a combination of SHA1 and MD5 */
-void
-sec_sign(uint8 * signature, int siglen, uint8 * session_key, int keylen, uint8 * data, int datalen)
+/* Generate a MAC hash of count buffers of data taken in turn */
+static void
+sec_sign_gather(uint8 * signature, int siglen, uint8 * session_key, int keylen, struct iovec * data, int count)
 {
 	uint8 shasig[20];
 	uint8 md5sig[16];
 	uint8 lenhdr[4];
 	SHA_CTX sha;
 	MD5_CTX md5;
+	int i;
 
-	buf_out_uint32(lenhdr, datalen);
+	buf_out_uint32(lenhdr, transport_iov_length(data, count));
 
 	SHA1_Init(&sha);
 	SHA1_Update(&sha, session_key, keylen);
 	SHA1_Update(&sha, pad_54, 40);
 	SHA1_Update(&sha, lenhdr, 4);
-	SHA1_Update(&sha, data, datalen);
+	for (i = 0; i < count; i++)
+		SHA1_Update(&sha, data[i].iov_base, data[i].iov_len);
 	SHA1_Final(shasig, &sha);
 
 	MD5_Init(&md5);
@@ -183,6 +185,17 @@ sec_sign(uint8 * signature, int siglen, uint8 * session_key, int keylen, uint8 *
 	memcpy(signature, md5sig, siglen);
 }
 
+/* Generate a MAC hash (5.2.3.1), using a combination of SHA1 and MD5 */
+void
+sec_sign(uint8 * signature, int siglen, uint8 * session_key, int keylen, uint8 * data, int datalen)
+{
+	struct iovec part;
+
+	part.iov_base = data;
+	part.iov_len = datalen;
+	sec_sign_gather(signature, siglen, session_key, keylen, &part, 1);
+}
+
 /* Update an encryption key */
 static void
 sec_update(RDConnectionRef conn, uint8 * key, uint8 * update_key)
@@ -211,10 +224,12 @@ sec_update(RDConnectionRef conn, uint8 * key, uint8 * update_key)
 		sec_make_40bit(key);
 }
 
-/* Encrypt data using RC4 */
+/* Encrypt, in place, count buffers of one packet's data using RC4 */
 static void
-sec_encrypt(RDConnectionRef conn, uint8 * data, int length)
+sec_encrypt_gather(RDConnectionRef conn, struct iovec * data, int count)
 {
+	int i;
+
 	if (conn->secEncryptUseCount == 4096)
 	{
 		sec_update(conn, conn->secEncryptKey, conn->secEncryptUpdateKey);
@@ -222,10 +237,22 @@ sec_encrypt(RDConnectionRef conn, uint8 * data, int length)
 		conn->secEncryptUseCount = 0;
 	}
 
-	RC4(&conn->rc4EncryptKey, length, data, data);
+	for (i = 0; i < count; i++)
+		RC4(&conn->rc4EncryptKey, data[i].iov_len, data[i].iov_base, data[i].iov_base);
 	conn->secEncryptUseCount++;
 }
 
+/* Encrypt data using RC4 */
+static void
+sec_encrypt(RDConnectionRef conn, uint8 * data, int length)
+{
+	struct iovec part;
+
+	part.iov_base = data;
+	part.iov_len = length;
+	sec_encrypt_gather(conn, &part, 1);
+}
+
 /* Decrypt data using RC4 */
 void
 sec_decrypt(RDConnectionRef conn, uint8 * data, int length)
@@ -262,7 +289,7 @@ sec_rsa_encrypt(uint8 * out, uint8 * in, int len, uint32 modulus_size, uint8 * m
 		uint8 * exponent)
 {
 	BN_CTX *ctx;
-	BIGNUM mod, exp, x, y;
+	BIGNUM *mod, *exp, *x, *y;
 	uint8 inr[SEC_MAX_MODULUS_SIZE];
 	int outlen;
 
@@ -272,24 +299,24 @@ sec_rsa_encrypt(uint8 * out, uint8 * in, int len, uint32 modulus_size, uint8 * m
 	reverse(inr, len);
 
 	ctx = BN_CTX_new();
-	BN_init(&mod);
-	BN_init(&exp);
-	BN_init(&x);
-	BN_init(&y);
-
-	BN_bin2bn(modulus, modulus_size, &mod);
-	BN_bin2bn(exponent, SEC_EXPONENT_SIZE, &exp);
-	BN_bin2bn(inr, len, &x);
-	BN_mod_exp(&y, &x, &exp, &mod, ctx);
-	outlen = BN_bn2bin(&y, out);
+	mod = BN_new();
+	exp = BN_new();
+	x = BN_new();
+	y = BN_new();
+
+	BN_bin2bn(modulus, modulus_size, mod);
+	BN_bin2bn(exponent, SEC_EXPONENT_SIZE, exp);
+	BN_bin2bn(inr, len, x);
+	BN_mod_exp(y, x, exp, mod, ctx);
+	outlen = BN_bn2bin(y, out);
 	reverse(out, outlen);
 	if (outlen < modulus_size)
 		memset(out + outlen, 0, modulus_size - outlen);
 
-	BN_free(&y);
-	BN_clear_free(&x);
-	BN_free(&exp);
-	BN_free(&mod);
+	BN_free(y);
+	BN_clear_free(x);
+	BN_free(exp);
+	BN_free(mod);
 	BN_CTX_free(ctx);
 }
 
@@ -314,7 +341,16 @@ sec_init(RDConnectionRef conn, uint32 flags, int maxlen)
 void
 sec_send_to_channel(RDConnectionRef conn, RDStreamRef s, uint32 flags, uint16 channel)
 {
-	int datalen;
+	sec_send_to_channel_gather(conn, s, flags, channel, NULL, 0);
+}
+
+/* Transmit secure transport packet over specified channel, followed by
+   count buffers of payload, which are encrypted where they are */
+void
+sec_send_to_channel_gather(RDConnectionRef conn, RDStreamRef s, uint32 flags, uint16 channel, struct iovec * payload,
+			   int count)
+{
+	struct iovec data[SEND_GATHER_MAX + 1];
 
 	s_pop_layer(s, sec_hdr);
 	if (!conn->licenseIssued || (flags & SEC_ENCRYPT))
@@ -323,18 +359,75 @@ sec_send_to_channel(RDConnectionRef conn, RDStreamRef s, uint32 flags, uint16 ch
 	if (flags & SEC_ENCRYPT)
 	{
 		flags &= ~SEC_ENCRYPT;
-		datalen = s->end - s->p - 8;
+		data[0].iov_base = s->p + 8;
+		data[0].iov_len = s->end - s->p - 8;
+		if (count > 0)
+			memcpy(data + 1, payload, count * sizeof(struct iovec));
 
 #if WITH_DEBUG_NETWORK
 		DEBUG(("Sending encrypted packet:\n"));
-		hexdump(s->p + 8, datalen);
+		hexdump(s->p + 8, data[0].iov_len);
 #endif
 
-		sec_sign(s->p, 8, conn->secSignKey, conn->rc4KeyLen, s->p + 8, datalen);
-		sec_encrypt(conn, s->p + 8, datalen);
+		sec_sign_gather(s->p, 8, conn->secSignKey, conn->rc4KeyLen, data, count + 1);
+		sec_encrypt_gather(conn, data, count + 1);
+	}
+
+	mcs_send_to_channel_gather(conn, s, channel, payload, count);
+}
+
+/* Initialise a fast path input packet, leaving room for the largest header */
+RDStreamRef
+sec_fastpath_init(RDConnectionRef conn, int maxlen)
+{
+	RDStreamRef s;
+
+	s = tcp_init(conn, maxlen + FASTPATH_INPUT_HEADER_MAX);
+	s_push_layer(s, sec_hdr, FASTPATH_INPUT_HEADER_MAX);
+
+	return s;
+}
+
+/* Transmit a fast path input packet of count events. It skips the MCS,
+   X.224 and TPKT layers; its header, whose length depends on the
+   events', is written and the events moved up against it. */
+void
+sec_fastpath_send(RDConnectionRef conn, RDStreamRef s, int count)
+{
+	uint8 *events = s->sec_hdr + FASTPATH_INPUT_HEADER_MAX, signature[8];
+	int datalen = s->end - events, length, flags = 0;
+
+	length = 2 + datalen;
+	if (conn->useEncryption)
+	{
+		flags |= FASTPATH_INPUT_ENCRYPTED;
+		length += 8;
+
+		sec_sign(signature, 8, conn->secSignKey, conn->rc4KeyLen, events, datalen);
+		sec_encrypt(conn, events, datalen);
 	}
+	if (length >= 0x80)
+		length++;
 
-	mcs_send_to_channel(conn, s, channel);
+	s->p = s->sec_hdr;
+	out_uint8(s, FASTPATH_INPUT_ACTION_FASTPATH | (count << 2) | (flags << 6));
+	if (length < 0x80)
+	{
+		out_uint8(s, length);
+	}
+	else
+	{
+		out_uint16_be(s, (length | 0x8000));
+	}
+	if (flags & FASTPATH_INPUT_ENCRYPTED)
+	{
+		out_uint8p(s, signature, 8);
+	}
+
+	memmove(s->p, events, datalen);
+	s->end = s->p + datalen;
+
+	tcp_send(conn, s);
 }
 
 /* Transmit secure transport packet */
@@ -488,6 +581,21 @@ sec_parse_public_key(RDConnectionRef conn, RDStreamRef s, uint8 ** modulus, uint
 static RD_BOOL
 sec_parse_x509_key(RDConnectionRef conn, X509 * cert)
 {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	const unsigned char *key;
+	int keylen;
+
+	/* By some reason, Microsoft sets the OID of the Public RSA key to
+	   the oid for "MD5 with RSA Encryption" instead of "RSA Encryption",
+	   and newer OpenSSL will not decode the key under it. Whatever the
+	   OID, the key bits are an RSAPublicKey, so read them directly. */
+	if (!X509_PUBKEY_get0_param(NULL, &key, &keylen, NULL, X509_get_X509_PUBKEY(cert))
+	    || ((conn->serverPublicKey = d2i_RSAPublicKey(NULL, &key, keylen)) == NULL))
+	{
+		error("Failed to extract public key from certificate\n");
+		return False;
+	}
+#else
 	EVP_PKEY *epk = NULL;
 	/* By some reason, Microsoft sets the OID of the Public RSA key to
 	   the oid for "MD5 with RSA Encryption" instead of "RSA Encryption"
@@ -508,6 +616,7 @@ sec_parse_x509_key(RDConnectionRef conn, X509 * cert)
 	}
 
 	conn->serverPublicKey = RSAPublicKey_dup((RSA *) epk->pkey.ptr);
+#endif
 
 	conn->serverPublicKeyLen = RSA_size(conn->serverPublicKey);
 	if ((conn->serverPublicKeyLen < 64) || (conn->serverPublicKeyLen > SEC_MAX_MODULUS_SIZE))
@@ -799,6 +908,9 @@ sec_recv(RDConnectionRef conn, uint8 * rdpver)
 	uint16 channel;
 	RDStreamRef s;
 
+	if (replay_active(conn))
+		return replay_recv(conn, rdpver);
+
 	while ((s = mcs_recv(conn, &channel, rdpver)) != NULL)
 	{
 		if (rdpver != NULL)
@@ -810,6 +922,8 @@ sec_recv(RDConnectionRef conn, uint8 * rdpver)
 					in_uint8s(s, 8);	/* signature */
 					sec_decrypt(conn, s->p, s->end - s->p);
 				}
+				if (conn->capture != NULL)
+					capture_pdu(conn, *rdpver, s);
 				return s;
 			}
 		}
@@ -871,6 +985,8 @@ sec_recv(RDConnectionRef conn, uint8 * rdpver)
 			return s;
 		}
 
+		if (conn->capture != NULL)
+			capture_pdu(conn, 3, s);
 		return s;
 	}
 
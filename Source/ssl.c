@@ -39,6 +39,24 @@ ssl_sha1_final(SSL_SHA1 * sha1, uint8 * out_data)
 	SHA1_Final(out_data, sha1);
 }
 
+void
+ssl_sha256_init(SSL_SHA256 * sha256)
+{
+	SHA256_Init(sha256);
+}
+
+void
+ssl_sha256_update(SSL_SHA256 * sha256, const uint8 * data, uint32 len)
+{
+	SHA256_Update(sha256, data, len);
+}
+
+void
+ssl_sha256_final(SSL_SHA256 * sha256, uint8 * out_data)
+{
+	SHA256_Final(out_data, sha256);
+}
+
 void
 ssl_md5_init(SSL_MD5 * md5)
 {
@@ -88,7 +106,7 @@ ssl_rsa_encrypt(uint8 * out, uint8 * in, int len, uint32 modulus_size, uint8 * m
 		uint8 * exponent)
 {
 	BN_CTX *ctx;
-	BIGNUM mod, exp, x, y;
+	BIGNUM *mod, *exp, *x, *y;
 	uint8 inr[SEC_MAX_MODULUS_SIZE];
 	int outlen;
 
@@ -98,24 +116,24 @@ ssl_rsa_encrypt(uint8 * out, uint8 * in, int len, uint32 modulus_size, uint8 * m
 	reverse(inr, len);
 
 	ctx = BN_CTX_new();
-	BN_init(&mod);
-	BN_init(&exp);
-	BN_init(&x);
-	BN_init(&y);
-
-	BN_bin2bn(modulus, modulus_size, &mod);
-	BN_bin2bn(exponent, SEC_EXPONENT_SIZE, &exp);
-	BN_bin2bn(inr, len, &x);
-	BN_mod_exp(&y, &x, &exp, &mod, ctx);
-	outlen = BN_bn2bin(&y, out);
+	mod = BN_new();
+	exp = BN_new();
+	x = BN_new();
+	y = BN_new();
+
+	BN_bin2bn(modulus, modulus_size, mod);
+	BN_bin2bn(exponent, SEC_EXPONENT_SIZE, exp);
+	BN_bin2bn(inr, len, x);
+	BN_mod_exp(y, x, exp, mod, ctx);
+	outlen = BN_bn2bin(y, out);
 	reverse(out, outlen);
 	if (outlen < (int) modulus_size)
 		memset(out + outlen, 0, modulus_size - outlen);
 
-	BN_free(&y);
-	BN_clear_free(&x);
-	BN_free(&exp);
-	BN_free(&mod);
+	BN_free(y);
+	BN_clear_free(x);
+	BN_free(exp);
+	BN_free(mod);
 	BN_CTX_free(ctx);
 }
 
@@ -137,8 +155,23 @@ ssl_cert_free(SSL_CERT * cert)
 SSL_RKEY *
 ssl_cert_to_rkey(SSL_CERT * cert, uint32 * key_len)
 {
-	EVP_PKEY *epk = NULL;
 	SSL_RKEY *lkey;
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	const unsigned char *key;
+	int keylen;
+
+	/* By some reason, Microsoft sets the OID of the Public RSA key to
+	   the oid for "MD5 with RSA Encryption" instead of "RSA Encryption",
+	   and newer OpenSSL will not decode the key under it. Whatever the
+	   OID, the key bits are an RSAPublicKey, so read them directly. */
+	if (!X509_PUBKEY_get0_param(NULL, &key, &keylen, NULL, X509_get_X509_PUBKEY(cert))
+	    || ((lkey = d2i_RSAPublicKey(NULL, &key, keylen)) == NULL))
+	{
+		error("Failed to extract public key from certificate\n");
+		return NULL;
+	}
+#else
+	EVP_PKEY *epk = NULL;
 	int nid;
 
 	/* By some reason, Microsoft sets the OID of the Public RSA key to
@@ -162,6 +195,7 @@ ssl_cert_to_rkey(SSL_CERT * cert, uint32 * key_len)
 
 	lkey = RSAPublicKey_dup((RSA *) epk->pkey.ptr);
 	EVP_PKEY_free(epk);
+#endif
 	*key_len = RSA_size(lkey);
 	return lkey;
 }
@@ -199,16 +233,23 @@ int
 ssl_rkey_get_exp_mod(SSL_RKEY * rkey, uint8 * exponent, uint32 max_exp_len, uint8 * modulus,
 		     uint32 max_mod_len)
 {
+	const BIGNUM *e, *n;
 	int len;
 
-	if ((BN_num_bytes(rkey->e) > (int) max_exp_len) ||
-	    (BN_num_bytes(rkey->n) > (int) max_mod_len))
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	RSA_get0_key(rkey, &n, &e, NULL);
+#else
+	e = rkey->e;
+	n = rkey->n;
+#endif
+	if ((BN_num_bytes(e) > (int) max_exp_len) ||
+	    (BN_num_bytes(n) > (int) max_mod_len))
 	{
 		return 1;
 	}
-	len = BN_bn2bin(rkey->e, exponent);
+	len = BN_bn2bin(e, exponent);
 	reverse(exponent, len);
-	len = BN_bn2bin(rkey->n, modulus);
+	len = BN_bn2bin(n, modulus);
 	reverse(modulus, len);
 	return 0;
 }
@@ -228,8 +269,5 @@ ssl_sig_ok(uint8 * exponent, uint32 exp_len, uint8 * modulus, uint32 mod_len,
 void
 ssl_hmac_md5(const void *key, int key_len, const unsigned char *msg, int msg_len, unsigned char *md)
 {
-	HMAC_CTX ctx;
-	HMAC_CTX_init(&ctx);
 	HMAC(EVP_md5(), key, key_len, msg, msg_len, md, NULL);
-	HMAC_CTX_cleanup(&ctx);
 }
\ No newline at end of file
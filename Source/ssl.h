@@ -36,6 +36,7 @@
 
 #define SSL_RC4 RC4_KEY
 #define SSL_SHA1 SHA_CTX
+#define SSL_SHA256 SHA256_CTX
 #define SSL_MD5 MD5_CTX
 #define SSL_CERT X509
 #define SSL_RKEY RSA
@@ -43,6 +44,9 @@
 void ssl_sha1_init(SSL_SHA1 * sha1);
 void ssl_sha1_update(SSL_SHA1 * sha1, uint8 * data, uint32 len);
 void ssl_sha1_final(SSL_SHA1 * sha1, uint8 * out_data);
+void ssl_sha256_init(SSL_SHA256 * sha256);
+void ssl_sha256_update(SSL_SHA256 * sha256, const uint8 * data, uint32 len);
+void ssl_sha256_final(SSL_SHA256 * sha256, uint8 * out_data);
 void ssl_md5_init(SSL_MD5 * md5);
 void ssl_md5_update(SSL_MD5 * md5, uint8 * data, uint32 len);
 void ssl_md5_final(SSL_MD5 * md5, uint8 * out_data);
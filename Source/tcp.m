@@ -29,6 +29,7 @@
 #import "rdesktop.h"
 
 
+#ifdef __OBJC__
 #import <SystemConfiguration/SystemConfiguration.h> 
 #import <Foundation/NSStream.h>
 #import <Foundation/NSString.h>
@@ -39,6 +40,7 @@
 static void tcp_cfhost_lookup_finished(CFHostRef theHost, CFHostInfoType typeInfo, const CFStreamError *error, void *info);
 
 @class AppController;
+#endif
 
 #ifndef INADDR_NONE
 #define INADDR_NONE ((unsigned long) -1)
@@ -62,74 +64,65 @@ tcp_init(RDConnectionRef conn, uint32 maxlen)
 /* Send TCP transport data packet */
 void
 tcp_send(RDConnectionRef conn, RDStreamRef s)
-{	
-	NSOutputStream *os = conn->outputStream;
-	
-	int length = s->end - s->data;
-	int sent, total = 0;
-	while (total < length) {
-		sent = [os write:s->data + total  maxLength:length - total];
-		if (sent < 0) {
-			error("send: %s\n", strerror(errno));
-			return;
-		}
-		total += sent;
-	}
+{
+	/* a replayed session has nobody to answer */
+	if (replay_active(conn))
+		return;
+
+	transport_send(&conn->transport, s->data, s->end - s->data);
+}
+
+/* Send a TCP transport data packet whose headers are in s and whose
+   payload is count buffers elsewhere, in one write */
+void
+tcp_send_gather(RDConnectionRef conn, RDStreamRef s, struct iovec * payload, int count)
+{
+	struct iovec iov[SEND_GATHER_MAX + 1];
+
+	if (replay_active(conn))
+		return;
+
+	iov[0].iov_base = s->data;
+	iov[0].iov_len = s->end - s->data;
+	if (count > 0)
+		memcpy(iov + 1, payload, count * sizeof(struct iovec));
+	transport_sendv(&conn->transport, iov, count + 1);
 }
 
 /* Receive a message on the TCP layer */
 RDStreamRef
 tcp_recv(RDConnectionRef conn, RDStreamRef s, uint32 length)
 {
-	NSInputStream *is = conn->inputStream;
-	unsigned int new_length, end_offset, p_offset;
-	int rcvd = 0;
+	return transport_recv(&conn->transport, s, length);
+}
 
-	if (s == NULL)
-	{
-		/* read into "new" stream */
-		if (length > conn->inStream.size)
-		{
-			conn->inStream.data = (uint8 *) xrealloc(conn->inStream.data, length);
-			conn->inStream.size = length;
-		}
-		conn->inStream.end = conn->inStream.p = conn->inStream.data;
-		s = &conn->inStream;
-	}
-	else
+#ifdef __OBJC__
+/* The session's streams only connect, through a SOCKS proxy if need be.
+   They are then closed, leaving their socket open, and the transport
+   reads and writes it itself, so that the connection thread can wait on
+   it in its event loop (eventloop.c). Returns the socket, -1 if the
+   streams have none. */
+static int
+tcp_stream_take_socket(NSInputStream *is, NSOutputStream *os)
+{
+	CFDataRef data;
+	CFSocketNativeHandle socket = -1;
+	
+	data = CFWriteStreamCopyProperty((CFWriteStreamRef) os, kCFStreamPropertySocketNativeHandle);
+	if (data != NULL)
 	{
-		/* append to existing stream */
-		new_length = (s->end - s->data) + length;
-		if (new_length > s->size)
-		{
-			p_offset = s->p - s->data;
-			end_offset = s->end - s->data;
-			s->data = (uint8 *) xrealloc(s->data, new_length);
-			s->size = new_length;
-			s->p = s->data + p_offset;
-			s->end = s->data + end_offset;
-		}
+		socket = *(CFSocketNativeHandle *) CFDataGetBytePtr(data);
+		CFRelease(data);
 	}
-
-	while (length > 0)
+	
+	if (socket >= 0)
 	{
-		rcvd = [is read:s->end maxLength:length];
-		if (rcvd < 0)
-		{
-			error("recv: %s\n", strerror(errno));
-			return NULL;
-		}
-		else if (rcvd == 0)
-		{
-			error("Connection closed\n");
-			return NULL;
-		}
-
-		s->end += rcvd;
-		length -= rcvd;
+		CFReadStreamSetProperty((CFReadStreamRef) is, kCFStreamPropertyShouldCloseNativeSocket, kCFBooleanFalse);
+		CFWriteStreamSetProperty((CFWriteStreamRef) os, kCFStreamPropertyShouldCloseNativeSocket, kCFBooleanFalse);
 	}
-
-	return s;
+	[is close];
+	[os close];
+	return socket;
 }
 
 /* Establish a connection on the TCP layer */
@@ -228,11 +221,16 @@ tcp_connect(RDConnectionRef conn, const char *server)
 	else if (conn->errorCode == ConnectionErrorCanceled)
 		goto Cleanup;
 	
-	conn->inputStream = [is retain];
-	conn->outputStream = [os retain];
+	int socket = tcp_stream_take_socket(is, os);
+	if (socket < 0)
+	{
+		error("%s: couldn't get the connection's socket\n", __FUNCTION__);
+		conn->errorCode = ConnectionErrorGeneral;
+		goto Cleanup;
+	}
+	transport_socket_attach(&conn->transport, socket);
 	
-	conn->outStream.size = conn->inStream.size = 4096;
-	conn->inStream.data = xmalloc(conn->inStream.size);
+	conn->outStream.size = 4096;
 	conn->outStream.data = xmalloc(conn->outStream.size);
 	
 Cleanup:
@@ -245,30 +243,36 @@ Cleanup:
 	return conn->errorCode == ConnectionErrorNone;
 }
 
+#else
+
+/* Establish a connection on the TCP layer; plain C builds of the protocol
+   core have no proxy settings to honour, so connect the socket directly */
+RD_BOOL
+tcp_connect(RDConnectionRef conn, const char *server)
+{
+	if (!transport_socket_connect(&conn->transport, server, conn->tcpPort))
+	{
+		conn->errorCode = ConnectionErrorGeneral;
+		return False;
+	}
+
+	conn->outStream.size = 4096;
+	conn->outStream.data = xmalloc(conn->outStream.size);
+	return True;
+}
+#endif
+
 /* Disconnect on the TCP layer */
 void
 tcp_disconnect(RDConnectionRef conn)
 {
-	[conn->inputStream close];
-	[conn->inputStream release];
-	conn->inputStream = NULL;
-	
-	[conn->outputStream close];
-	[conn->outputStream release];	
-	conn->outputStream = NULL;
+	transport_close(&conn->transport);
 }
 
 char *
 tcp_get_address(RDConnectionRef conn)
 {
-	NSOutputStream *os = conn->outputStream;
-	CFWriteStreamRef stream;
-	CFSocketNativeHandle socket;
-	CFDataRef data;
-	
-	stream = (CFWriteStreamRef) os;
-	data = CFWriteStreamCopyProperty(stream, kCFStreamPropertySocketNativeHandle);
-	socket = *(CFSocketNativeHandle *) CFDataGetBytePtr(data);
+	int socket = conn->transport.fd;
     
 	char *ipaddr = malloc(32);
     struct sockaddr_in sockaddr;
@@ -281,8 +285,6 @@ tcp_get_address(RDConnectionRef conn)
     else
         strcpy(ipaddr, "127.0.0.1");
 
-    CFRelease(data);
-    
     return ipaddr;
 }
 
@@ -291,24 +293,10 @@ tcp_get_address(RDConnectionRef conn)
 void
 tcp_reset_state(RDConnectionRef conn)
 {
-	/* Clear the incoming stream */
-	[(id)conn->inputStream release];
-	conn->inputStream = NULL;
-	if (conn->inStream.data != NULL)
-		xfree(conn->inStream.data);
-	conn->inStream.p = NULL;
-	conn->inStream.end = NULL;
-	conn->inStream.data = NULL;
-	conn->inStream.size = 0;
-	conn->inStream.iso_hdr = NULL;
-	conn->inStream.mcs_hdr = NULL;
-	conn->inStream.sec_hdr = NULL;
-	conn->inStream.rdp_hdr = NULL;
-	conn->inStream.channel_hdr = NULL;
+	/* Close the socket and clear the incoming buffer */
+	transport_close(&conn->transport);
 
 	/* Clear the outgoing stream */
-	[(id)conn->outputStream release];
-	conn->outputStream = NULL;
 	if (conn->outStream.data != NULL)
 		xfree(conn->outStream.data);
 	conn->outStream.p = NULL;
@@ -323,6 +311,7 @@ tcp_reset_state(RDConnectionRef conn)
 }
 
 
+#ifdef __OBJC__
 static void
 tcp_cfhost_lookup_finished(CFHostRef host, CFHostInfoType typeInfo, const CFStreamError *streamError, void *info)
 {
@@ -364,8 +353,4 @@ tcp_cfhost_lookup_finished(CFHostRef host, CFHostInfoType typeInfo, const CFStre
 		
 	lookupInfo->address = ipaddr;
 }
-
-
-
-
-
+#endif
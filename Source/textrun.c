@@ -0,0 +1,228 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Text runs for glyph index orders
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* The text of a TEXT2 order is drawn in three passes, the same for every
+   UI: the glyph indices, with any fragments it stores (0xff) or replays
+   (0xfe) from the text cache, are resolved into an array of glyphs at
+   their places on the screen; the array is clipped once against the
+   area the order may draw in; and what is left is copied from the glyph
+   atlases into one coverage mask, which the UI fills with the
+   foreground colour. */
+
+#import "rdesktop.h"
+
+/* make room for count more glyphs after the first n of the run */
+static void
+text_run_reserve(RDConnectionRef conn, int n, int count)
+{
+	if (n + count <= conn->textRunSize)
+		return;
+
+	conn->textRunSize = MAX(conn->textRunSize * 2, n + count);
+	conn->textRun = (RDTextGlyph *) xrealloc(conn->textRun, conn->textRunSize * sizeof(RDTextGlyph));
+}
+
+/* Resolve the glyph index at ttext[*idx] into the run, moving *idx past
+   its position bytes and the pen past the glyph */
+static void
+text_run_glyph(RDConnectionRef conn, uint8 font, uint8 flags, const uint8 * ttext, int *idx, int *x, int *y,
+	       int *n, int *misses)
+{
+	RDFontGlyph *glyph = (font < FONT_CACHE_SIZE) ? &conn->fontCache[font][ttext[*idx]] : NULL;
+	RDTextGlyph *placed;
+	int xyoffset;
+
+	if (!(flags & TEXT2_IMPLICIT_X))
+	{
+		xyoffset = ttext[++(*idx)];
+		if ((xyoffset & 0x80))
+		{
+			if (flags & TEXT2_VERTICAL)
+				*y += ttext[*idx + 1] | (ttext[*idx + 2] << 8);
+			else
+				*x += ttext[*idx + 1] | (ttext[*idx + 2] << 8);
+			*idx += 2;
+		}
+		else
+		{
+			if (flags & TEXT2_VERTICAL)
+				*y += xyoffset;
+			else
+				*x += xyoffset;
+		}
+	}
+
+	if ((glyph == NULL) || (glyph->data == NULL))
+	{
+		(*misses)++;
+		return;
+	}
+
+	cache_use_glyph(conn, font, glyph);
+	placed = &conn->textRun[(*n)++];
+	placed->glyph = glyph;
+	placed->x = *x + glyph->offset;
+	placed->y = *y + glyph->baseline;
+
+	if (flags & TEXT2_IMPLICIT_X)
+		*x += glyph->width;
+}
+
+/* Resolve a TEXT2 fragment into the connection's run array, storing and
+   replaying text cache entries as it goes. Returns the number of glyphs. */
+static int
+text_run_resolve(RDConnectionRef conn, uint8 font, uint8 flags, int x, int y, uint8 * text, int length)
+{
+	RDDataBlob *entry;
+	int i, j, n = 0, misses = 0;
+
+	text_run_reserve(conn, 0, length);
+	for (i = 0; i < length;)
+	{
+		switch (text[i])
+		{
+			case 0xff:
+				if (i + 2 < length)
+				{
+					cache_put_text(conn, text[i + 1], text, text[i + 2]);
+				}
+				else
+				{
+					error("this shouldn't be happening\n");
+					length = 0;
+					break;
+				}
+
+				/* After FF command, move pointer to first character */
+				length -= i + 3;
+				text = &(text[i + 3]);
+				i = 0;
+				break;
+
+			case 0xfe:
+				entry = cache_get_text(conn, text[i + 1]);
+				if (entry != NULL)
+				{
+					if ((((uint8 *) (entry->data))[1] == 0)
+					    && (!(flags & TEXT2_IMPLICIT_X)))
+					{
+						if (flags & TEXT2_VERTICAL)
+							y += text[i + 2];
+						else
+							x += text[i + 2];
+					}
+
+					text_run_reserve(conn, n, entry->size);
+					for (j = 0; j < entry->size; j++)
+					{
+						text_run_glyph(conn, font, flags, (uint8 *) entry->data, &j, &x, &y, &n,
+							       &misses);
+					}
+				}
+
+				i += (i + 2 < length) ? 3 : 2;
+				length -= i;
+				/* After FE command, move pointer to first character */
+				text = &(text[i]);
+				i = 0;
+				text_run_reserve(conn, n, length);
+				break;
+
+			default:
+				text_run_glyph(conn, font, flags, text, &i, &x, &y, &n, &misses);
+				i++;
+				break;
+		}
+	}
+
+	if (conn->orderStats != NULL)
+	{
+		conn->orderStats->glyph.hits += n;
+		conn->orderStats->glyph.misses += misses;
+	}
+	if (misses)
+		error("text run: %d glyphs missing from font %d\n", misses, font);
+	return n;
+}
+
+/* Draw the glyphs of a TEXT2 order into a coverage mask. Glyphs are
+   clipped to the order's background rectangle and, if it has one, its
+   opaque rectangle, and to the screen; the mask covers only what is left.
+   Returns False if no glyph pixels are inside, when the mask is empty. */
+RD_BOOL
+text_run_rasterize(RDConnectionRef conn, uint8 font, uint8 flags, int x, int y, int clipx, int clipy, int clipcx,
+		   int clipcy, int boxx, int boxy, int boxcx, int boxcy, uint8 * text, int length,
+		   RDGlyphMask * mask)
+{
+	int left = clipx, top = clipy, right = clipx + clipcx, bottom = clipy + clipcy;
+	int minx = INT_MAX, miny = INT_MAX, maxx = INT_MIN, maxy = INT_MIN;
+	int i, n, kept = 0;
+	RDTextGlyph *run;
+
+	n = text_run_resolve(conn, font, flags, x, y, text, length);
+
+	if (boxcx > 1)
+	{
+		left = MIN(left, boxx);
+		top = MIN(top, boxy);
+		right = MAX(right, boxx + boxcx);
+		bottom = MAX(bottom, boxy + boxcy);
+	}
+	left = MAX(left, 0);
+	top = MAX(top, 0);
+	right = MIN(right, conn->screenWidth);
+	bottom = MIN(bottom, conn->screenHeight);
+
+	/* drop the glyphs wholly outside, and shrink the area to the rest */
+	run = conn->textRun;
+	for (i = 0; i < n; i++)
+	{
+		if ((run[i].x >= right) || (run[i].y >= bottom) || (run[i].x + run[i].glyph->width <= left)
+		    || (run[i].y + run[i].glyph->height <= top) || (run[i].glyph->width == 0)
+		    || (run[i].glyph->height == 0))
+			continue;
+
+		minx = MIN(minx, run[i].x);
+		miny = MIN(miny, run[i].y);
+		maxx = MAX(maxx, run[i].x + run[i].glyph->width);
+		maxy = MAX(maxy, run[i].y + run[i].glyph->height);
+		run[kept++] = run[i];
+	}
+	if (kept == 0)
+		return False;
+
+	left = MAX(left, minx);
+	top = MAX(top, miny);
+	right = MIN(right, maxx);
+	bottom = MIN(bottom, maxy);
+
+	glyphatlas_begin_run(conn, mask, left, top, right - left, bottom - top);
+	for (i = 0; i < kept; i++)
+		glyphatlas_blit(conn, font, run[i].glyph, run[i].x, run[i].y, mask);
+	return mask->inked;
+}
+
+/* Free the run array of a connection */
+void
+text_run_destroy(RDConnectionRef conn)
+{
+	xfree(conn->textRun);
+	conn->textRun = NULL;
+	conn->textRunSize = 0;
+}
@@ -0,0 +1,370 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Buffered transport to the server
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* The ISO layer asks for a packet in two pieces, its header and then its
+   body, and a busy session sends many small fast path packets. Rather
+   than read each piece from the socket, the transport reads whatever has
+   arrived, as much as its buffer holds, and hands out packets as streams
+   pointing into the buffer. A packet stays where it is until the next
+   one is asked for; only when a packet would run off the end of the
+   buffer are the unfinished bytes moved back to the front.
+
+   How the bytes are moved is up to the read and write operations; the
+   socket ones here are used both by the Cocoa glue, on the socket its
+   NSStreams connected (tcp.m), and on sockets connected here. */
+
+#import <unistd.h>		/* read write close */
+#import <sys/uio.h>		/* writev */
+#import <errno.h>
+#import <fcntl.h>
+#import <poll.h>
+#import <sys/socket.h>
+#import <netdb.h>		/* getaddrinfo */
+#import <netinet/in.h>
+#import <netinet/tcp.h>		/* TCP_NODELAY */
+
+#import "rdesktop.h"
+
+#define TRANSPORT_BUFFER_SIZE	(128 * 1024)
+
+/* point a stream whose bytes have moved from old to buffer at them again */
+static void
+transport_rebase(RDStreamRef s, uint8 * old, uint8 * buffer)
+{
+#define REBASE(ptr)	if ((ptr) != NULL) (ptr) = buffer + ((ptr) - old)
+	REBASE(s->p);
+	REBASE(s->end);
+	REBASE(s->data);
+	REBASE(s->iso_hdr);
+	REBASE(s->mcs_hdr);
+	REBASE(s->sec_hdr);
+	REBASE(s->rdp_hdr);
+	REBASE(s->channel_hdr);
+#undef REBASE
+}
+
+/* make room for length more bytes of the packet being received, moving
+   it to the front of the buffer and, if need be, making the buffer larger */
+static void
+transport_make_room(RDTransport * t, uint32 length)
+{
+	uint8 *old = t->buffer + t->head;
+	int need = t->taken - t->head + length;
+
+	if (t->head > 0)
+	{
+		memmove(t->buffer, t->buffer + t->head, t->tail - t->head);
+		t->taken -= t->head;
+		t->tail -= t->head;
+		t->head = 0;
+	}
+	if (need > t->size)
+	{
+		t->size = MAX(need, t->size * 2);
+		t->buffer = (uint8 *) xrealloc(t->buffer, t->size);
+	}
+	transport_rebase(&t->s, old, t->buffer);
+}
+
+/* Receive length bytes. With s NULL they start a new packet, for which a
+   stream is returned; otherwise they are added to the end of s, which
+   must be the stream of the packet being received. Returns NULL if the
+   connection failed or was closed. */
+RDStreamRef
+transport_recv(RDTransport * t, RDStreamRef s, uint32 length)
+{
+	int n;
+
+	if (t->buffer == NULL)
+	{
+		t->size = TRANSPORT_BUFFER_SIZE;
+		t->buffer = (uint8 *) xmalloc(t->size);
+		t->head = t->taken = t->tail = 0;
+	}
+
+	if (s == NULL)
+	{
+		/* the previous packet has been dealt with */
+		if (t->taken == t->tail)
+			t->taken = t->tail = 0;
+		t->head = t->taken;
+
+		s = &t->s;
+		memset(s, 0, sizeof(RDStream));
+		s->data = s->p = s->end = t->buffer + t->head;
+	}
+
+	if (t->taken + length > t->size)
+		transport_make_room(t, length);
+
+	while (t->tail - t->taken < length)
+	{
+		n = t->read(t, t->buffer + t->tail, t->size - t->tail);
+		if (n < 0)
+		{
+			error("recv: %s\n", strerror(errno));
+			return NULL;
+		}
+		else if (n == 0)
+		{
+			error("Connection closed\n");
+			return NULL;
+		}
+		t->tail += n;
+	}
+
+	t->taken += length;
+	s->end += length;
+	s->size = t->taken - t->head;
+	return s;
+}
+
+/* Whether a whole packet, TPKT or fast path, has been read from the
+   server and not yet asked for, so that receiving it will not wait on
+   the socket */
+RD_BOOL
+transport_has_pdu(RDTransport * t)
+{
+	const uint8 *p = t->buffer + t->taken;
+	int available = t->tail - t->taken;
+	uint32 length;
+
+	if (available < 4)
+		return False;
+	if (p[0] == 3)
+		length = (p[2] << 8) | p[3];
+	else if (p[1] & 0x80)
+		length = ((p[1] & 0x7f) << 8) | p[2];
+	else
+		length = p[1];
+
+	/* a bad length is taken as whole, to be reported by the ISO layer */
+	return available >= MAX(length, 4);
+}
+
+/* Send length bytes, however many writes it takes */
+RD_BOOL
+transport_send(RDTransport * t, const uint8 * data, int length)
+{
+	int sent, total = 0;
+
+	while (total < length)
+	{
+		sent = t->write(t, data + total, length - total);
+		if (sent <= 0)
+		{
+			error("send: %s\n", strerror(errno));
+			return False;
+		}
+		total += sent;
+	}
+	return True;
+}
+
+/* The total length of count buffers */
+uint32
+transport_iov_length(const struct iovec * iov, int count)
+{
+	uint32 length = 0;
+
+	while (count-- > 0)
+		length += (iov++)->iov_len;
+	return length;
+}
+
+/* Send count buffers in turn, in as few writes as the operations allow.
+   The buffers are used up. */
+RD_BOOL
+transport_sendv(RDTransport * t, struct iovec * iov, int count)
+{
+	int sent;
+
+	while ((count > 0) && (iov->iov_len == 0))
+	{
+		iov++;
+		count--;
+	}
+
+	while (count > 0)
+	{
+		if (t->writev != NULL)
+			sent = t->writev(t, iov, count);
+		else
+			sent = t->write(t, iov->iov_base, iov->iov_len);
+		if (sent <= 0)
+		{
+			error("send: %s\n", strerror(errno));
+			return False;
+		}
+
+		/* skip what has gone, including any empty buffers after it */
+		while ((count > 0) && ((size_t) sent >= iov->iov_len))
+		{
+			sent -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0)
+		{
+			iov->iov_base = (uint8 *) iov->iov_base + sent;
+			iov->iov_len -= sent;
+		}
+	}
+	return True;
+}
+
+/* Close the connection and free the buffer; the transport can then be
+   used for another */
+void
+transport_close(RDTransport * t)
+{
+	if (t->close != NULL)
+		t->close(t);
+	xfree(t->buffer);
+	memset(t, 0, sizeof(RDTransport));
+	t->fd = -1;
+}
+
+
+#pragma mark -
+#pragma mark Sockets
+
+/* The socket does not block, so that the event loop (eventloop.c) can
+   read only what has arrived; the rest of a packet that is still on its
+   way is waited for here. */
+static RD_BOOL
+transport_socket_wait(RDTransport * t, short events)
+{
+	struct pollfd pfd;
+
+	if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+		return False;
+
+	pfd.fd = t->fd;
+	pfd.events = events;
+	return (poll(&pfd, 1, TIMEOUT_LENGTH * 1000) > 0) || (errno == EINTR);
+}
+
+static int
+transport_socket_read(RDTransport * t, uint8 * data, int length)
+{
+	int n;
+
+	while (((n = recv(t->fd, data, length, 0)) < 0) && transport_socket_wait(t, POLLIN)) ;
+	return n;
+}
+
+static int
+transport_socket_write(RDTransport * t, const uint8 * data, int length)
+{
+	int flags = 0, n;
+
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	while (((n = send(t->fd, data, length, flags)) < 0) && transport_socket_wait(t, POLLOUT)) ;
+	return n;
+}
+
+static int
+transport_socket_writev(RDTransport * t, const struct iovec * iov, int count)
+{
+	struct msghdr msg;
+	int flags = 0, n;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = (struct iovec *) iov;
+	msg.msg_iovlen = count;
+
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	while (((n = sendmsg(t->fd, &msg, flags)) < 0) && transport_socket_wait(t, POLLOUT)) ;
+	return n;
+}
+
+static void
+transport_socket_close(RDTransport * t)
+{
+	if (t->fd >= 0)
+		close(t->fd);
+	t->fd = -1;
+}
+
+/* Use a connected socket, which the transport then owns and makes non-blocking */
+void
+transport_socket_attach(RDTransport * t, int fd)
+{
+	int on = 1;
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *) &on, sizeof(on));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, (void *) &on, sizeof(on));
+#endif
+
+	t->head = t->taken = t->tail = 0;
+	t->handle = NULL;
+	t->fd = fd;
+	t->read = transport_socket_read;
+	t->write = transport_socket_write;
+	t->writev = transport_socket_writev;
+	t->close = transport_socket_close;
+}
+
+/* Connect a socket to server at port */
+RD_BOOL
+transport_socket_connect(RDTransport * t, const char *server, int port)
+{
+	struct addrinfo hints, *res, *ai;
+	char service[8];
+	int fd = -1, err;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service, sizeof(service), "%d", port);
+
+	if ((err = getaddrinfo(server, service, &hints, &res)) != 0)
+	{
+		error("getaddrinfo: %s\n", gai_strerror(err));
+		return False;
+	}
+
+	for (ai = res; ai != NULL; ai = ai->ai_next)
+	{
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if (fd < 0)
+	{
+		error("connect: %s: %s\n", server, strerror(errno));
+		return False;
+	}
+
+	transport_socket_attach(t, fd);
+	return True;
+}
@@ -18,9 +18,21 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
 */
 
+#ifdef __OBJC__
 @class CRDBitmap;
 @class CRDSession;
 @class CRDSessionView;
+#else
+/* Plain C builds of the protocol core (headless.c) see the Cocoa objects
+   as opaque pointers, and bitmaps as headless surfaces */
+typedef struct _RDSurface CRDBitmap;
+typedef void CRDSession;
+typedef void CRDSessionView;
+typedef void NSString;
+typedef void NSFileHandle;
+typedef void *PMPrinter;
+typedef signed char BOOL;
+#endif
 
 
 typedef int RD_BOOL;
@@ -97,15 +109,65 @@ typedef struct _RDBrush
 	RDBrushData *bd;
 } RDBrush;
 
+/* A brush expanded into 8x8 pixels of the UI's format (brushtile.c) */
+typedef struct _RDBrushTile
+{
+	uint32 generation;
+	uint8 bits[8];
+	RDBrushData *bd;	/* colour brushes only */
+	uint32 on, off;
+	uint32 pixels[64];
+} RDBrushTile;
+
 typedef struct _RDFontGlyph
 {
 	sint16 offset;
 	sint16 baseline;
 	uint16 width;
 	uint16 height;
-	RDBitmapRef pixmap;
+	uint8 *data;		/* 1 bpp rows padded to bytes */
+	uint16 atlas_x, atlas_y;
+	uint32 atlas_generation;	/* 0 if never placed in the atlas */
 } RDFontGlyph;
 
+/* The glyphs of one font cache packed in an A8 surface (glyphatlas.c) */
+typedef struct _RDGlyphAtlas
+{
+	uint8 *pixels;
+	int height;
+	int shelf_x, shelf_y, shelf_height;
+	uint32 generation;	/* glyphs placed in an earlier one must be placed again */
+	uint8 used;		/* since the trimming hand last passed */
+} RDGlyphAtlas;
+
+/* Coverage of a text run, one byte a pixel, at x, y on the screen */
+typedef struct _RDGlyphMask
+{
+	uint8 *pixels;
+	int x, y, width, height;
+	RD_BOOL inked;
+} RDGlyphMask;
+
+/* 32 bit pixels for the raster operations (rop.c): pixels points at row
+   0, stride is the bytes from one row to the next (negative if the rows
+   are stored bottom up), the clip rectangle's right and bottom edges are
+   exclusive, and opaque holds the alpha bits, which are always set */
+typedef struct _RDRopSurface
+{
+	uint8 *pixels;
+	int stride;
+	int width, height;
+	int clip_left, clip_top, clip_right, clip_bottom;
+	uint32 opaque;
+} RDRopSurface;
+
+/* A glyph of a text run, with its top left corner at x, y (textrun.c) */
+typedef struct _RDTextGlyph
+{
+	RDFontGlyph *glyph;
+	int x, y;
+} RDTextGlyph;
+
 typedef struct _RDDataBlob
 {
 	void *data;
@@ -130,6 +192,74 @@ typedef struct _RDComp
 	RDStream ns;
 } RDComp;
 
+/* The byte stream to the server (transport.c). read and write move what
+   they can, returning the byte count, 0 at the end of the stream or -1
+   on error; writev, which may be NULL, writes from several buffers in
+   turn, and close may be NULL. The buffer holds, from head, the packet
+   being received, then from taken what has been read but not yet asked
+   for, up to tail. */
+typedef struct _RDTransport
+{
+	int (*read) (struct _RDTransport * t, uint8 * data, int length);
+	int (*write) (struct _RDTransport * t, const uint8 * data, int length);
+	int (*writev) (struct _RDTransport * t, const struct iovec * iov, int count);
+	void (*close) (struct _RDTransport * t);
+	void *handle;
+	int fd;
+
+	uint8 *buffer;
+	int size, head, taken, tail;
+	RDStream s;
+} RDTransport;
+
+/* What the connection thread waits on (eventloop.c): one descriptor to
+   read, a wakeup that other threads can raise, and a few timers. Times
+   are in nanoseconds of order_stats_clock(). */
+typedef void (*RDEventHandler) (void *context);
+typedef RD_BOOL (*RDEventCheck) (void *context);
+
+typedef struct _RDEventTimer
+{
+	uint64 deadline;	/* 0 when the slot is free */
+	uint64 interval;	/* 0 for a timer that fires once */
+	RDEventHandler handler;
+	void *context;
+} RDEventTimer;
+
+typedef struct _RDEventLoop
+{
+	int poller;		/* epoll or kqueue descriptor */
+	int wake_read, wake_write;	/* the same eventfd, or a pipe */
+	volatile int woken;
+
+	int fd;
+	RDEventHandler readable;
+	RDEventCheck buffered;	/* data already read, for which fd will not wake the loop */
+	void *readable_context;
+	RDEventHandler wake;
+	void *wake_context;
+	RDEventTimer timers[EVENT_LOOP_TIMERS];
+	volatile RD_BOOL stopped;
+} RDEventLoop;
+
+typedef struct _RDInputEvent
+{
+	uint32 time;
+	uint16 type, deviceFlags, param1, param2;
+} RDInputEvent;
+
+/* Input on its way from the UI thread, which alone pushes, to the
+   connection thread, which alone pops (inputring.c). head and tail count
+   events ever pushed and popped; the events lie between them so that
+   each side's counter stays on its own cache line. */
+typedef struct _RDInputRing
+{
+	volatile uint32 head;
+	RD_BOOL coalesce;	/* pop only the last of consecutive mouse moves */
+	RDInputEvent events[INPUT_RING_SIZE];
+	volatile uint32 tail;
+} RDInputRing;
+
 /* RDPDR */
 typedef uint32 NTStatus;
 typedef uint32 NTHandle;
@@ -137,7 +267,8 @@ typedef uint32 NTHandle;
 /* PSTCACHE */
 typedef uint8 RDHashKey[8];
 
-/* Header for an entry in the persistent bitmap cache file */
+/* Header for an entry in a version 1 persistent bitmap cache file, which
+   has fixed size cells and no file header */
 typedef struct RDPersistentCacheCellHeader
 {
 	RDHashKey key;
@@ -146,6 +277,32 @@ typedef struct RDPersistentCacheCellHeader
 	uint32 stamp;
 } RDPersistentCacheCellHeader;
 
+/* Start of a version 2 persistent bitmap cache file. An index of
+   BMPCACHE2_NUM_PSTCELLS entries follows, then the cell payloads. */
+typedef struct RDPersistentCacheFileHeader
+{
+	char magic[8];
+	uint32 version;
+	uint16 bpp;		/* bytes per pixel */
+	uint16 cells;
+	uint32 data_end;	/* offset past the last payload */
+	uint32 reserved;
+} RDPersistentCacheFileHeader;
+
+/* Index entry of a cell in a version 2 file; offset 0 for an empty cell */
+typedef struct RDPersistentCacheIndexEntry
+{
+	RDHashKey key;
+	uint8 width, height;
+	uint8 flags;
+	uint8 reserved;
+	uint16 length;		/* of the bitmap data */
+	uint16 stored;		/* of the payload */
+	uint32 stamp;
+	uint32 offset;
+	uint32 crc;		/* of the payload */
+} RDPersistentCacheIndexEntry;
+
 #define MAX_CBSIZE 256
 
 /* RDPSND */
@@ -253,8 +410,6 @@ typedef struct _RDFileInfo
 struct bmpcache_entry
 {
 	RDBitmapRef bitmap;
-	sint16 previous;
-	sint16 next;
 };
 
 typedef enum _RDConnectionError
@@ -266,6 +421,117 @@ typedef enum _RDConnectionError
 	ConnectionErrorCanceled = 4
 } RDConnectionError;
 
+/* Filled in while a session capture is replayed (capture.c) */
+typedef struct _RDReplayStats
+{
+	uint32 pdus;
+	uint64 bytes;
+	uint64 usec;
+} RDReplayStats;
+
+/* Identifies a decoded bitmap in the process-wide store (bmpstore.c) */
+#define BMPSTORE_PERSISTENT	0	/* digest of the scope and the server's persistent key */
+#define BMPSTORE_RAW		1	/* digest of uncompressed bottom-up rows */
+#define BMPSTORE_COMPRESSED	2	/* digest of interleaved RLE data */
+
+#define BMPSTORE_DIGEST_SIZE	32	/* SHA-256 */
+
+typedef struct _RDBitmapKey
+{
+	uint8 digest[BMPSTORE_DIGEST_SIZE];
+	uint32 length;		/* of the hashed data */
+	uint16 width, height;
+	uint8 bpp;
+	uint8 source;
+} RDBitmapKey;
+
+/* Replacement state of a persistent bitmap cache (cachepolicy.c). Held
+   cells are on one of two lists, each from least to most recently used;
+   the heads of an empty list are not used. */
+#define CACHE_NOT_HELD		0
+#define CACHE_PROBATION		1
+#define CACHE_PROTECTED		2
+#define CACHE_SEGMENTS		3
+
+typedef struct _RDCacheNode
+{
+	sint16 previous, next;
+	uint8 segment;
+	uint8 referenced;
+} RDCacheNode;
+
+typedef struct _RDCacheLists
+{
+	RDCacheNode node[BITMAP_CACHE_ENTRIES];
+	sint16 lru[CACHE_SEGMENTS], mru[CACHE_SEGMENTS];
+	int count[CACHE_SEGMENTS];
+	int protected_cells;	/* most cells kept protected, 0 for the default */
+} RDCacheLists;
+
+typedef struct _RDCachePolicy
+{
+	const char *name;
+	/* take in a cell that is not held; cold cells go first in line for eviction */
+	void (*insert) (RDCacheLists * lists, uint16 idx, RD_BOOL cold);
+	void (*hit) (RDCacheLists * lists, uint16 idx);
+	/* the cell to evict next, left on its list, or NOT_SET */
+	sint16 (*victim) (RDCacheLists * lists);
+} RDCachePolicy;
+
+/* Memory held by the caches of a connection (cachebudget.c) */
+#define CACHE_KIND_BITMAP	0
+#define CACHE_KIND_GLYPH	1
+#define CACHE_KIND_BRUSH	2
+#define CACHE_KIND_CURSOR	3
+#define CACHE_KIND_TEXT		4
+#define CACHE_KINDS		5
+
+typedef struct _RDCacheUsage
+{
+	uint64 bytes[CACHE_KINDS];
+	uint64 shared;			/* of the bitmap bytes, those the store charges to the process */
+	uint32 items[CACHE_KINDS];
+	uint32 freed[CACHE_KINDS];	/* decoded items dropped to stay in budget */
+	uint32 rebuilt[CACHE_KINDS];	/* dropped items decoded again when used */
+	uint64 budget;			/* bytes, 0 for no limit */
+	RD_BOOL warned;
+} RDCacheUsage;
+
+/* Order statistics (orderstats.c), kept while conn->orderStats is set */
+#define RDP_STATS_ORDER_TYPES 32
+#define RDP_STATS_SECONDARY_TYPES 8
+#define RDP_STATS_BUCKETS 16
+
+typedef struct _RDOrderTypeStats
+{
+	uint32 count;
+	uint64 bytes;
+	uint64 parse_nsec, render_nsec;
+	/* orders by total time: bucket 0 under 256ns, then doubling */
+	uint32 histogram[RDP_STATS_BUCKETS];
+} RDOrderTypeStats;
+
+typedef struct _RDCacheStats
+{
+	uint32 hits, misses;
+} RDCacheStats;
+
+typedef struct _RDOrderStats
+{
+	RDOrderTypeStats primary[RDP_STATS_ORDER_TYPES];
+	RDOrderTypeStats secondary[RDP_STATS_SECONDARY_TYPES];
+	RDCacheStats bitmap, glyph, brush, cursor, desktop;
+	uint32 bitmap_disk_loads;	/* bitmap hits served from the persistent cache */
+	uint32 bitmap_shared;		/* cached bitmaps found decoded in the shared store */
+
+	/* in-flight order */
+	uint64 order_start, render_start;
+
+	uint64 since;			/* nanoseconds, when counting started */
+	uint64 next_dump;
+	int dump_interval;		/* seconds between dumps, 0 for none */
+} RDOrderStats;
+
 typedef struct _RDHostLookupInfo
 {
 	int finished;
@@ -282,28 +548,50 @@ struct _RDConnection
 	char hostname[64];
 	
 	// State flags
-	int isConnected, useRdp5, useEncryption, useBitmapCompression, rdp5PerformanceFlags, consoleSession, bitmapCache, bitmapCachePersist, bitmapCachePrecache, desktopSave, polygonEllipseOrders, licenseIssued, notifyStamp, pstcacheEnumerated;
+	int isConnected, useRdp5, useEncryption, useBitmapCompression, rdp5PerformanceFlags, consoleSession, bitmapCache, bitmapCachePersist, bitmapCachePrecache, bitmapCacheCompress, desktopSave, polygonEllipseOrders, licenseIssued, notifyStamp, pstcacheEnumerated;
 	RDP_ORDER_STATE orderState;
 	
 	// Keyboard
 	unsigned int keyboardLayout;
 	int keyboardType, keyboardSubtype, keyboardFunctionkeys;
 	
+	// Input waiting to be sent, by fast path if the server takes it
+	RD_BOOL fastPathInput;
+	RDInputEvent inputBatch[INPUT_BATCH_SIZE];
+	int inputBatchCount;
+	
 	// Connection details
 	int tcpPort, currentStatus, screenWidth, screenHeight, serverBpp, shareID, serverRdpVersion;
 	
 	// Bitmap caches
 	int pstcacheBpp;
 	int pstcacheFd[8];
-	int bmpcacheCount[BITMAP_CACHE_SIZE];
+	uint8 *pstcacheMap[8];
+	uint32 pstcacheSize[8];
+	struct _RDPrecache *pstcachePrecache;
 	unsigned char deskCache[DESKTOP_CACHE_SIZE * 4];
 	RDBitmapRef volatileBc[BITMAP_CACHE_SIZE];
 	RDCursorRef cursorCache[CURSOR_CACHE_SIZE];
 	RDBrushData brushCache[BRUSH_CACHE_ENTRIES][BRUSH_CACHE_SIZE];
+	RDBrushTile brushTiles[BRUSH_TILE_ENTRIES];
+	uint32 brushTileGeneration;
 	RDDataBlob textCache[TEXT_CACHE_SIZE];
 	RDFontGlyph fontCache[FONT_CACHE_SIZE][FONT_CACHE_ENTRIES];
+	RDGlyphAtlas glyphAtlas[FONT_CACHE_SIZE];
+	int glyphAtlasHand;
+	uint8 *glyphMask;
+	int glyphMaskSize;
+	uint32 *ropSource;
+	int ropSourceSize;
+	RDTextGlyph *textRun;
+	int textRunSize;
 	struct bmpcache_entry bmpcache[BITMAP_CACHE_SIZE][BITMAP_CACHE_ENTRIES];
-	int bmpcacheLru[BITMAP_CACHE_SIZE], bmpcacheMru[BITMAP_CACHE_SIZE];
+	RDCacheLists bmpcacheLists[BITMAP_CACHE_SIZE];
+	const RDCachePolicy *bmpcachePolicy;
+	FILE *bmpcacheTrace;
+	uint8 bmpstoreScope[BMPSTORE_DIGEST_SIZE];
+	RD_BOOL bmpstoreAttached;
+	RDCacheUsage cacheUsage;
 	
 	// Device redirection
 	char *rdpdrClientname;
@@ -335,10 +623,11 @@ struct _RDConnection
 	
 	// Network
 	unsigned char *nextPacket;
-	NSInputStream *inputStream; 
- 	NSOutputStream *outputStream;
-	RDStream inStream, outStream;
+	RDTransport transport;
+	RDStream outStream;
 	RDStreamRef rdpStream;
+	struct _RDCapture *capture;
+	RDOrderStats *orderStats;
 	
 	// Secure
 	uint32 rc4KeyLen, secEncryptUseCount, secDecryptUseCount;
@@ -377,3 +666,6 @@ struct _DEVICE_FNS
 
 typedef RD_BOOL(*str_handle_lines_t) (const char *line, void *data);
 
+typedef void (*workpool_fn) (void *ctx, int index);
+typedef struct _RDWorkBatch *RDWorkBatchRef;
+
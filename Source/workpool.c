@@ -0,0 +1,225 @@
+/*
+   rdesktop: A Remote Desktop Protocol client.
+   Worker thread pool for decoding independent pieces of a PDU in parallel
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* One pool is shared by every connection in the process. workpool_run is
+   fork/join: the calling thread queues a batch, works on it alongside the
+   pool threads, and returns once every item is done, so callers can commit
+   results in their original order afterwards. workpool_start queues a
+   batch for the pool threads alone and returns at once; the caller polls
+   it with workpool_finished and collects it with workpool_wait. */
+
+#import "rdesktop.h"
+
+#include <pthread.h>
+
+#define WORKPOOL_MAX_THREADS 32
+
+typedef struct _RDWorkBatch
+{
+	workpool_fn fn;
+	void *ctx;
+	int count;
+	int next;		/* next unclaimed index */
+	int done;		/* finished indices */
+	pthread_cond_t finished;
+	struct _RDWorkBatch *next_batch;
+} RDWorkBatch;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+static RDWorkBatch *pool_queue = NULL;
+static int pool_threads = 0;
+
+/* claim one item, dropping the batch from the queue once all are claimed;
+   called with pool_lock held */
+static int
+workpool_claim(RDWorkBatch * batch)
+{
+	RDWorkBatch **b;
+	int index = batch->next++;
+
+	if (batch->next == batch->count)
+	{
+		for (b = &pool_queue; *b != NULL; b = &(*b)->next_batch)
+		{
+			if (*b == batch)
+			{
+				*b = batch->next_batch;
+				break;
+			}
+		}
+	}
+	return index;
+}
+
+/* run one claimed item; called with pool_lock held, which is dropped meanwhile */
+static void
+workpool_do(RDWorkBatch * batch, int index)
+{
+	pthread_mutex_unlock(&pool_lock);
+	batch->fn(batch->ctx, index);
+	pthread_mutex_lock(&pool_lock);
+
+	if (++batch->done == batch->count)
+		pthread_cond_signal(&batch->finished);
+}
+
+static void *
+workpool_thread(void *arg)
+{
+	RDWorkBatch *batch;
+
+	pthread_mutex_lock(&pool_lock);
+	while (1)
+	{
+		while (pool_queue == NULL)
+			pthread_cond_wait(&pool_work, &pool_lock);
+
+		batch = pool_queue;
+		workpool_do(batch, workpool_claim(batch));
+	}
+	return NULL;
+}
+
+/* Start the shared pool. threads is the total number of decoding threads,
+   including the caller of workpool_run; 0 means one per CPU and 1 keeps
+   all work on the calling thread. Only the first call has any effect. */
+void
+workpool_init(int threads)
+{
+	pthread_t thread;
+	int i;
+
+	if (threads <= 0)
+		threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	threads = MIN(MAX(threads, 1), WORKPOOL_MAX_THREADS);
+
+	pthread_mutex_lock(&pool_lock);
+	if (pool_threads == 0)
+	{
+		for (i = 0; i < threads - 1; i++)
+		{
+			if (pthread_create(&thread, NULL, workpool_thread, NULL) != 0)
+			{
+				warning("workpool: could only start %d threads\n", i);
+				break;
+			}
+			pthread_detach(thread);
+			pool_threads++;
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/* append a batch to the queue and wake the pool; called with pool_lock held */
+static void
+workpool_queue(RDWorkBatch * batch, int count, workpool_fn fn, void *ctx)
+{
+	RDWorkBatch **tail;
+
+	batch->fn = fn;
+	batch->ctx = ctx;
+	batch->count = count;
+	batch->next = 0;
+	batch->done = 0;
+	batch->next_batch = NULL;
+	pthread_cond_init(&batch->finished, NULL);
+
+	for (tail = &pool_queue; *tail != NULL; tail = &(*tail)->next_batch)
+		;
+	*tail = batch;
+	pthread_cond_broadcast(&pool_work);
+}
+
+/* Call fn(ctx, i) for every i in [0, count), spread over the pool, and
+   wait for all of them to finish. fn must be safe to run concurrently
+   with itself. */
+void
+workpool_run(int count, workpool_fn fn, void *ctx)
+{
+	RDWorkBatch batch;
+	int i;
+
+	if ((pool_threads == 0) || (count < 2))
+	{
+		for (i = 0; i < count; i++)
+			fn(ctx, i);
+		return;
+	}
+
+	pthread_mutex_lock(&pool_lock);
+	workpool_queue(&batch, count, fn, ctx);
+
+	while (batch.next < batch.count)
+		workpool_do(&batch, workpool_claim(&batch));
+
+	while (batch.done < batch.count)
+		pthread_cond_wait(&batch.finished, &pool_lock);
+	pthread_mutex_unlock(&pool_lock);
+
+	pthread_cond_destroy(&batch.finished);
+}
+
+/* Like workpool_run, but return at once and leave all of the work to the
+   pool threads. Without pool threads the work is done before returning.
+   Every batch must be collected with workpool_wait. */
+RDWorkBatchRef
+workpool_start(int count, workpool_fn fn, void *ctx)
+{
+	RDWorkBatch *batch = (RDWorkBatch *) xmalloc(sizeof(RDWorkBatch));
+	int i;
+
+	if ((pool_threads == 0) || (count < 1))
+	{
+		for (i = 0; i < count; i++)
+			fn(ctx, i);
+		batch->count = batch->done = count;
+		pthread_cond_init(&batch->finished, NULL);
+		return batch;
+	}
+
+	pthread_mutex_lock(&pool_lock);
+	workpool_queue(batch, count, fn, ctx);
+	pthread_mutex_unlock(&pool_lock);
+	return batch;
+}
+
+RD_BOOL
+workpool_finished(RDWorkBatchRef batch)
+{
+	RD_BOOL finished;
+
+	pthread_mutex_lock(&pool_lock);
+	finished = (batch->done == batch->count);
+	pthread_mutex_unlock(&pool_lock);
+	return finished;
+}
+
+/* Wait for a batch from workpool_start to finish, and free it */
+void
+workpool_wait(RDWorkBatchRef batch)
+{
+	pthread_mutex_lock(&pool_lock);
+	while (batch->done < batch->count)
+		pthread_cond_wait(&batch->finished, &pool_lock);
+	pthread_mutex_unlock(&pool_lock);
+
+	pthread_cond_destroy(&batch->finished);
+	xfree(batch);
+}